@@ -28,12 +28,20 @@ BasicShader *basic_shader_init(BasicShader *self)
 {
     bool rv;
 
+#if USE_TEXTURE_ATLAS
+    if(!shader_init(SHADER(self), SHADER_DIR"/atlas-vertex.gl", SHADER_DIR"/atlas-fragment.gl"))
+#else
     if(!shader_init(SHADER(self), SHADER_DIR"/vertex.gl", SHADER_DIR"/fragment.gl"))
+#endif
         return NULL;
 
     rv = shader_get_attribute_locationp(SHADER(self), "position", &(self->position));
     rv &= shader_get_attribute_locationp(SHADER(self), "texcoord", &(self->texcoords));
     rv &= shader_get_uniform_locationp(SHADER(self), "mvp", &(self->mvp));
+    rv &= shader_get_uniform_locationp(SHADER(self), "position_scale", &(self->position_scale));
+    rv &= shader_get_uniform_locationp(SHADER(self), "position_offset", &(self->position_offset));
+    rv &= shader_get_uniform_locationp(SHADER(self), "texcoord_scale", &(self->texcoord_scale));
+    rv &= shader_get_uniform_locationp(SHADER(self), "texcoord_offset", &(self->texcoord_offset));
 
     if(rv)
         return self;
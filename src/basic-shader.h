@@ -18,6 +18,10 @@ typedef struct{
     GLint texcoords;
     /*Shader uniforms*/
     GLint mvp;
+    GLint position_scale;
+    GLint position_offset;
+    GLint texcoord_scale;
+    GLint texcoord_offset;
 }BasicShader;
 
 
@@ -14,6 +14,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "btg-io.h"
 #include "sg-sphere.h"
@@ -67,260 +76,382 @@ enum sgPropertyTypes {
 };
 
 
-static int read_error = false;
-
-void sgClearReadError() { read_error = false; }
-int sgReadError() { return  read_error ; }
+/*
+ * All the reading state lives in a SGBinReader: the whole (uncompressed)
+ * file is held in memory and read through a cursor. sgRead* functions copy
+ * values out of it, sgReadView returns a pointer into it.
+ */
+void sgClearReadError ( SGBinReader *fd ) { fd->error = false; }
+bool sgReadError ( SGBinReader *fd ) { return fd->error; }
 
-void sgReadChar ( gzFile fd, char *var )
+const char *sgReadView ( SGBinReader *fd, const unsigned int n )
 {
-    if ( gzread ( fd, var, sizeof(char) ) != sizeof(char) ) {
-        read_error = true ;
-    }
-}
-
+    const char *rv;
 
-void sgReadFloat ( gzFile fd, float *var )
-{
-    union { float v; uint32_t u; } buf;
-    if ( gzread ( fd, &buf.u, sizeof(float) ) != sizeof(float) ) {
-        read_error = true ;
+    if ( n > fd->size - fd->offset ) {
+        fd->offset = fd->size;
+        fd->error = true ;
+        return NULL;
     }
-    *var = buf.v;
+    rv = fd->data + fd->offset;
+    fd->offset += n;
+    return rv;
 }
 
-
-void sgReadDouble ( gzFile fd, double *var )
+void sgReadBytes ( SGBinReader *fd, const unsigned int n, void *var )
 {
-    union { double v; uint64_t u; } buf;
-    if ( gzread ( fd, &buf.u, sizeof(double) ) != sizeof(double) ) {
-        read_error = true ;
-    }
-    *var = buf.v;
-}
+    const char *src;
 
+    if ( n == 0) return;
+    src = sgReadView ( fd, n );
+    if ( src )
+        memcpy ( var, src, n );
+}
 
-void sgReadUInt ( gzFile fd, unsigned int *var )
+void sgReadChar ( SGBinReader *fd, char *var )
 {
-    if ( gzread ( fd, var, sizeof(unsigned int) ) != sizeof(unsigned int) ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(char), var );
 }
 
 
-void sgReadInt ( gzFile fd, int *var )
+void sgReadFloat ( SGBinReader *fd, float *var )
 {
-    if ( gzread ( fd, var, sizeof(int) ) != sizeof(int) ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(float), var );
 }
 
 
-void sgReadLong ( gzFile fd, int32_t *var )
+void sgReadDouble ( SGBinReader *fd, double *var )
 {
-    if ( gzread ( fd, var, sizeof(int32_t) ) != sizeof(int32_t) ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(double), var );
 }
 
 
-void sgReadLongLong ( gzFile fd, int64_t *var )
+void sgReadUInt ( SGBinReader *fd, unsigned int *var )
 {
-    if ( gzread ( fd, var, sizeof(int64_t) ) != sizeof(int64_t) ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(unsigned int), var );
 }
 
 
-void sgReadUShort ( gzFile fd, unsigned short *var )
+void sgReadInt ( SGBinReader *fd, int *var )
 {
-    if ( gzread ( fd, var, sizeof(unsigned short) ) != sizeof(unsigned short) ){
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(int), var );
 }
 
 
-void sgReadShort ( gzFile fd, short *var )
+void sgReadLong ( SGBinReader *fd, int32_t *var )
 {
-    if ( gzread ( fd, var, sizeof(short) ) != sizeof(short) ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(int32_t), var );
 }
 
-void sgReadFloats ( gzFile fd, const unsigned int n, float *var )
+
+void sgReadLongLong ( SGBinReader *fd, int64_t *var )
 {
-    if ( gzread ( fd, var, sizeof(float) * n ) != (int)(sizeof(float) * n) ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(int64_t), var );
 }
 
 
-void sgReadDoubles ( gzFile fd, const unsigned int n, double *var )
+void sgReadUShort ( SGBinReader *fd, unsigned short *var )
 {
-    if ( gzread ( fd, var, sizeof(double) * n ) != (int)(sizeof(double) * n) ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(unsigned short), var );
 }
 
 
-void sgReadBytes ( gzFile fd, const unsigned int n, void *var )
+void sgReadShort ( SGBinReader *fd, short *var )
 {
-    if ( n == 0) return;
-    if ( gzread ( fd, var, n ) != (int)n ) {
-        read_error = true ;
-    }
+    sgReadBytes ( fd, sizeof(short), var );
 }
 
+/***/
 
-void sgReadUShorts ( gzFile fd, const unsigned int n, unsigned short *var )
+/*
+ * Values are read out of views with memcpy: views point inside the file
+ * and have no alignment guarantees.
+ */
+static inline uint32_t sg_bin_load_index(const char *buffer, size_t i, bool wide)
 {
-    if ( gzread ( fd, var, sizeof(unsigned short) * n )
-	 != (int)(sizeof(unsigned short) * n) )
-    {
-        read_error = true ;
+    if(wide){
+        uint32_t rv;
+        memcpy(&rv, buffer + i * sizeof(uint32_t), sizeof(uint32_t));
+        return rv;
+    }else{
+        uint16_t rv;
+        memcpy(&rv, buffer + i * sizeof(uint16_t), sizeof(uint16_t));
+        return rv;
     }
 }
 
-
-void sgReadShorts ( gzFile fd, const unsigned int n, short *var )
+static inline SGVec3f sg_bin_load_vec3f(const char *buffer, size_t i)
 {
-    if ( gzread ( fd, var, sizeof(short) * n )
-	 != (int)(sizeof(short) * n) )
-    {
-        read_error = true ;
-    }
+    SGVec3f rv;
+    memcpy(&rv, buffer + i * sizeof(float) * 3, sizeof(float) * 3);
+    return rv;
 }
 
+/****/
 
-void sgReadUInts ( gzFile fd, const unsigned int n, unsigned int *var )
+/*
+ * Makes sure the inflate buffer can hold at least @p size bytes.
+ * Contents are kept.
+ */
+static bool sg_bin_reader_reserve(SGBinReader *self, size_t size)
 {
-    if ( gzread ( fd, var, sizeof(unsigned int) * n )
-	 != (int)(sizeof(unsigned int) * n) )
-    {
-        read_error = true ;
-    }
-}
+    char *tmp;
 
+    if(size <= self->inflated_size)
+        return true;
+    tmp = realloc(self->inflated, size);
+    if(!tmp)
+        return false;
+    self->inflated = tmp;
+    self->inflated_size = size;
+    return true;
+}
 
-void sgReadInts ( gzFile fd, const unsigned int n, int *var )
+/*
+ * Inflates the gzip stream (possibly made of several members) held in
+ * @p src into the reader buffer. The buffer is sized after the gzip trailer
+ * (uncompressed size modulo 2^32 of the last member) and grown if that
+ * turns out to be wrong.
+ */
+static bool sg_bin_reader_inflate(SGBinReader *self, const unsigned char *src, size_t len)
 {
-    if ( gzread ( fd, var, sizeof(int) * n )
-	 != (int)(sizeof(int) * n) )
-    {
-        read_error = true ;
+    z_stream zs = {0};
+    size_t used;
+    uint32_t isize;
+    int zrv;
+
+    memcpy(&isize, src + len - 4, sizeof(uint32_t)); /*little endian in the file*/
+    isize = GUINT32_FROM_LE(isize);
+    if(!sg_bin_reader_reserve(self, (isize > 0) ? isize : len * 4))
+        return false;
+    if(inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        return false;
+    zs.next_in = (unsigned char *)src;
+    zs.avail_in = len;
+    zs.next_out = (unsigned char *)self->inflated;
+    zs.avail_out = self->inflated_size;
+    do{
+        if(zs.avail_out == 0){
+            used = (char *)zs.next_out - self->inflated;
+            if(!sg_bin_reader_reserve(self, self->inflated_size * 2))
+                break;
+            zs.next_out = (unsigned char *)self->inflated + used;
+            zs.avail_out = self->inflated_size - used;
+        }
+        zrv = inflate(&zs, Z_NO_FLUSH);
+        if(zrv == Z_STREAM_END && zs.avail_in > 0){
+            /*Concatenated gzip member*/
+            inflateReset(&zs);
+            zrv = Z_OK;
+        }
+    }while(zrv == Z_OK || (zrv == Z_BUF_ERROR && zs.avail_out == 0));
+    inflateEnd(&zs);
+
+    if(zrv != Z_STREAM_END){
+        printf("Error inflating BTG data: %s\n", zs.msg ? zs.msg : "truncated file");
+        return false;
     }
+    self->data = self->inflated;
+    self->size = (char *)zs.next_out - self->inflated; /*total_out is reset by each member*/
+    return true;
 }
-/***/
-
-typedef struct{
-    GByteArray *buffer;
-    size_t offset;
-} SGSimpleBuffer;
-
-#define G_BYTE_ARRAY(buffer) ((GByteArray *)(buffer))
 
-SGSimpleBuffer *sg_simple_buffer_new(void)
+/*
+ * Fallback for files that can't be mapped.
+ */
+static bool sg_bin_reader_gzread(SGBinReader *self, gzFile fp)
 {
-    SGSimpleBuffer *rv;
+    size_t len = 0;
+    int n;
 
-    rv = g_new0(SGSimpleBuffer, 1);
-    rv->buffer = g_byte_array_new();
+    if(!sg_bin_reader_reserve(self, 1 << 20))
+        return false;
+    do{
+        if(len == self->inflated_size && !sg_bin_reader_reserve(self, len * 2))
+            return false;
+        n = gzread(fp, self->inflated + len, self->inflated_size - len);
+        if(n > 0)
+            len += n;
+    }while(n > 0);
+    if(n < 0)
+        return false;
 
-    return rv;
+    self->data = self->inflated;
+    self->size = len;
+    return true;
 }
 
-SGSimpleBuffer *sg_simple_buffer_sized_new(size_t size)
+static bool sg_bin_reader_open_file(SGBinReader *self, const char *filename)
 {
-    SGSimpleBuffer *rv;
+    struct stat st;
+    unsigned char *map;
+    int fd;
+    bool rv;
 
-    rv = g_new0(SGSimpleBuffer, 1);
-    rv->buffer = g_byte_array_sized_new(size);
+    fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &st) != 0 || st.st_size < 4){
+        close(fd);
+        return false;
+    }
 
-    return rv;
-}
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+        gzFile fp = gzdopen(fd, "rb");
+        if(!fp){
+            close(fd);
+            return false;
+        }
+        rv = sg_bin_reader_gzread(self, fp);
+        gzclose(fp);
+        return rv;
+    }
+    close(fd);
 
-void sg_simple_buffer_free(SGSimpleBuffer *self)
-{
-    g_byte_array_free(self->buffer, TRUE);
-    g_free(self);
+    if(map[0] == 0x1f && map[1] == 0x8b){
+        rv = sg_bin_reader_inflate(self, map, st.st_size);
+        munmap(map, st.st_size);
+        return rv;
+    }
+    /*Uncompressed BTG: read straight from the mapping*/
+    self->mapping = map;
+    self->mapping_size = st.st_size;
+    self->data = (const char *)map;
+    self->size = st.st_size;
+    return true;
 }
 
-void sg_simple_buffer_resize(SGSimpleBuffer *self, size_t size)
+/**
+ * @brief Loads @p filename, or @p filename.gz, in memory.
+ */
+static bool sg_bin_reader_open(SGBinReader *self, const char *filename)
 {
-    g_byte_array_set_size(self->buffer, size);
-}
+    char *with_gz;
+    bool rv;
 
+    self->data = NULL;
+    self->size = self->offset = 0;
+    sgClearReadError(self);
 
-void sg_simple_buffer_reset(SGSimpleBuffer *self)
-{
-    self->offset = 0;
+    rv = sg_bin_reader_open_file(self, filename);
+    if (!rv) {
+        asprintf(&with_gz, "%s.gz", filename);
+        rv = sg_bin_reader_open_file(self, with_gz);
+        free(with_gz);
+    }
+    if (!rv)
+        self->stats.failures++;
+    return rv;
 }
 
-int32_t sg_simple_buffer_readInt(SGSimpleBuffer *self)
+/*
+ * Releases the current file. Scratch buffers are kept for the next one.
+ */
+static void sg_bin_reader_close(SGBinReader *self)
 {
-    unsigned int* p = (unsigned int*)(self->buffer->data + self->offset);
-
-    self->offset += sizeof(unsigned int);
-    return *p;
+    if(self->error)
+        self->stats.failures++;
+    else
+        self->stats.files++;
+    self->stats.bytes += self->offset;
+
+    if(self->mapping)
+        munmap(self->mapping, self->mapping_size);
+    self->mapping = NULL;
+    self->mapping_size = 0;
+    self->data = NULL;
+    self->size = self->offset = 0;
 }
 
-SGVec3d sg_simple_buffer_readVec3d(SGSimpleBuffer *self)
+/**
+ * @brief Creates a new SGBinReader.
+ *
+ * Caller must free the reader using sg_bin_reader_free when done.
+ *
+ * @return a newly allocated SGBinReader or NULL on failure.
+ *
+ * @see sg_bin_reader_free
+ */
+SGBinReader *sg_bin_reader_new(void)
 {
-    double *p = (double*)(self->buffer->data + self->offset);
-
+    SGBinReader *self;
 
-    self->offset += 3 * sizeof(double);
-    return (*(SGVec3d *)p);
+    self = calloc(1, sizeof(SGBinReader));
+    if(self){
+        if(!sg_bin_reader_init(self))
+            return sg_bin_reader_free(self);
+    }
+    return self;
 }
 
-float sg_simple_buffer_readFloat(SGSimpleBuffer *self)
+/**
+ * @brief Inits a SGBinReader.
+ *
+ * A reader can be used to read any number of files, one at a time.
+ * Scratch buffers grow to fit the biggest file read so far and are only
+ * released by sg_bin_reader_dispose.
+ *
+ * Caller must dispose the reader using sg_bin_reader_dispose when done.
+ *
+ * @return @p self on success or NULL on failure.
+ *
+ * @see sg_bin_reader_dispose
+ */
+SGBinReader *sg_bin_reader_init(SGBinReader *self)
 {
-    float* p = (float*)(self->buffer->data + self->offset);
-
-    self->offset += sizeof(float);
-    return *p;
+    *self = (SGBinReader){0};
+    return self;
 }
 
-SGVec2f sg_simple_buffer_readVec2f(SGSimpleBuffer *self)
+SGBinReader *sg_bin_reader_dispose(SGBinReader *self)
 {
-    float* p = (float*)(self->buffer->data + self->offset);
-
-    self->offset += 2 * sizeof(float);
-    return *((SGVec2f *)p);
+    if(self->mapping)
+        munmap(self->mapping, self->mapping_size);
+    if(self->inflated)
+        free(self->inflated);
+    if(self->nodes)
+        free(self->nodes);
+    if(self->texcoords)
+        free(self->texcoords);
+    *self = (SGBinReader){0};
+    return NULL;
 }
 
-SGVec3f sg_simple_buffer_readVec3f(SGSimpleBuffer *self)
+SGBinReader *sg_bin_reader_free(SGBinReader *self)
 {
-    float* p = (float*)(self->buffer->data + self->offset);
-
-    self->offset += 3 * sizeof(float);
-    return *((SGVec3f*)p);
+    sg_bin_reader_dispose(self);
+    free(self);
+    return NULL;
 }
 
-SGVec4f sg_simple_buffer_readVec4f(SGSimpleBuffer *self)
+static void sg_bin_primitives_init(SGBinPrimitives *self)
 {
-    float* p = (float*)(self->buffer->data + self->offset);
-
-    self->offset += 4 * sizeof(float);
-    return *((SGVec4f *)p);
+    guint zero = 0;
+
+    self->offsets = g_array_new(FALSE, TRUE, sizeof(guint));
+    g_array_append_val(self->offsets, zero);
+    self->v = g_array_new(FALSE, TRUE, sizeof(guint32));
+    self->n = g_array_new(FALSE, TRUE, sizeof(guint32));
+    self->c = g_array_new(FALSE, TRUE, sizeof(guint32));
+    for(int i = 0; i < MAX_TC_SETS; i++)
+        self->tcs[i] = g_array_new(FALSE, TRUE, sizeof(guint32));
+    for(int i = 0; i < MAX_VAS; i++)
+        self->vas[i] = g_array_new(FALSE, TRUE, sizeof(guint32));
+    self->runs = g_array_new(FALSE, TRUE, sizeof(SGBinRun));
 }
 
-/****/
-
-
-
-gzFile file_fopen(const char *filename)
+static void sg_bin_primitives_dispose(SGBinPrimitives *self)
 {
-    gzFile rv;
-    char *with_gz;
-
-    rv = gzopen(filename, "rb");
-    if (rv == NULL) {
-        asprintf(&with_gz, "%s.gz", filename);
-        rv = gzopen(with_gz, "rb");
-        free(with_gz);
-    }
-    return rv;
+    g_array_free(self->offsets, TRUE);
+    g_array_free(self->v, TRUE);
+    g_array_free(self->n, TRUE);
+    g_array_free(self->c, TRUE);
+    for(int i = 0; i < MAX_TC_SETS; i++)
+        g_array_free(self->tcs[i], TRUE);
+    for(int i = 0; i < MAX_VAS; i++)
+        g_array_free(self->vas[i], TRUE);
+    g_array_free(self->runs, TRUE);
 }
 
 SGBinObject *sg_bin_object_new(void)
@@ -331,39 +462,18 @@ SGBinObject *sg_bin_object_new(void)
 
     rv->wgs84_nodes = g_array_new(FALSE, TRUE, sizeof(SGVec3d));
     //printf("rv->wgs84_nodes: %p\n",rv->wgs84_nodes);
-    rv->colors = g_array_new(FALSE, TRUE, sizeof(SGVec3d));
+    rv->colors = g_array_new(FALSE, TRUE, sizeof(SGVec4f));
     rv->normals = g_array_new(FALSE, TRUE, sizeof(SGVec3f));
     rv->texcoords = g_array_new(FALSE, TRUE, sizeof(SGVec2f));
     rv->va_flt = g_array_new(FALSE, TRUE, sizeof(float));
     rv->va_int = g_array_new(FALSE, TRUE, sizeof(int));
 
-    rv->pts_v = g_ptr_array_new();
-    rv->pts_n = g_ptr_array_new();
-    rv->pts_c = g_ptr_array_new();
-    rv->pts_tcs = g_ptr_array_new();
-    rv->pts_vas = g_ptr_array_new();
-    rv->pt_materials = g_ptr_array_new();
-
-    rv->tris_v = g_ptr_array_new();
-    rv->tris_n = g_ptr_array_new();
-    rv->tris_c = g_ptr_array_new();
-    rv->tris_tcs = g_ptr_array_new();
-    rv->tris_vas = g_ptr_array_new();
-    rv->tri_materials = g_ptr_array_new();
-
-    rv->strips_v = g_ptr_array_new();
-    rv->strips_n = g_ptr_array_new();
-    rv->strips_c = g_ptr_array_new();
-    rv->strips_tcs = g_ptr_array_new();
-    rv->strips_vas = g_ptr_array_new();
-    rv->strip_materials = g_ptr_array_new();
-
-    rv->fans_v = g_ptr_array_new();
-    rv->fans_n = g_ptr_array_new();
-    rv->fans_c = g_ptr_array_new();
-    rv->fans_tcs = g_ptr_array_new();
-    rv->fans_vas = g_ptr_array_new();
-    rv->fan_materials = g_ptr_array_new();
+    rv->materials = g_ptr_array_new();
+
+    sg_bin_primitives_init(&rv->points);
+    sg_bin_primitives_init(&rv->triangles);
+    sg_bin_primitives_init(&rv->strips);
+    sg_bin_primitives_init(&rv->fans);
 
     return rv;
 }
@@ -378,376 +488,194 @@ void sg_bin_object_free(SGBinObject *self)
     g_array_free(self->va_flt, TRUE);
     g_array_free(self->va_int, TRUE);
 
-    /*Points*/
-    // points vertex index: PtrArray of int GArray
-    for(guint i = 0; i < self->pts_v->len; i++){
-        GArray *a = g_ptr_array_index(self->pts_v, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->pts_v, TRUE);
-
-    // points normal index: PtrArray of int GArray
-    for(guint i = 0; i < self->pts_n->len; i++){
-        GArray *a = g_ptr_array_index(self->pts_n, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->pts_n, TRUE);
-
-    // points color index: PtrArray of int GArray
-    for(guint i = 0; i < self->pts_c->len; i++){
-        GArray *a = g_ptr_array_index(self->pts_c, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->pts_c, TRUE);
-
-    // points texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->pts_tcs->len; i++){
-        GPtrArray *p_tcs = g_ptr_array_index(self->pts_tcs, i);
-        for(guint j = 0; j < p_tcs->len; j++){
-            GArray *a = g_ptr_array_index(p_tcs, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(p_tcs, TRUE);
-    }
-    g_ptr_array_free(self->pts_tcs, TRUE);
-
-    // points vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->pts_vas->len; i++){
-        GPtrArray *p_vas = g_ptr_array_index(self->pts_vas, i);
-        for(guint j = 0; j < p_vas->len; j++){
-            GArray *a = g_ptr_array_index(p_vas, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(p_vas, TRUE);
-    }
-    g_ptr_array_free(self->pts_vas, TRUE);
-
-    // points materials: GPtrArray of char *
-    for(guint i = 0; i < self->pt_materials->len; i++){
-        char *str = g_ptr_array_index(self->pt_materials, i);
+    for(guint i = 0; i < self->materials->len; i++){
+        char *str = g_ptr_array_index(self->materials, i);
         g_free(str);
     }
-    g_ptr_array_free(self->pt_materials, TRUE);
+    g_ptr_array_free(self->materials, TRUE);
 
-    /*Triangles*/
-    // triangles vertex index: PtrArray of int GArray
-    for(guint i = 0; i < self->tris_v->len; i++){
-        GArray *a = g_ptr_array_index(self->tris_v, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->tris_v, TRUE);
+    sg_bin_primitives_dispose(&self->points);
+    sg_bin_primitives_dispose(&self->triangles);
+    sg_bin_primitives_dispose(&self->strips);
+    sg_bin_primitives_dispose(&self->fans);
 
-    // triangles normal index: PtrArray of int GArray
-    for(guint i = 0; i < self->tris_n->len; i++){
-        GArray *a = g_ptr_array_index(self->tris_n, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->tris_n, TRUE);
+    g_free(self);
+}
 
-    // triangles color index: PtrArray of int GArray
-    for(guint i = 0; i < self->tris_c->len; i++){
-        GArray *a = g_ptr_array_index(self->tris_c, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->tris_c, TRUE);
-
-    // triangles texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->tris_tcs->len; i++){
-        GPtrArray *t_tcs = g_ptr_array_index(self->tris_tcs, i);
-        for(guint j = 0; j < t_tcs->len; j++){
-            GArray *a = g_ptr_array_index(t_tcs, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(t_tcs, TRUE);
-    }
-    g_ptr_array_free(self->tris_tcs, TRUE);
-
-    // triangles vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->tris_vas->len; i++){
-        GPtrArray *t_vas = g_ptr_array_index(self->tris_vas, i);
-        for(guint j = 0; j < t_vas->len; j++){
-            GArray *a = g_ptr_array_index(t_vas, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(t_vas, TRUE);
+/**
+ * @brief Returns the index of @p material in the material table,
+ * adding it if needed.
+ */
+static guint sg_bin_object_intern_material(SGBinObject *self, const char *material)
+{
+    for(guint i = 0; i < self->materials->len; i++){
+        if(!strcmp(g_ptr_array_index(self->materials, i), material))
+            return i;
     }
-    g_ptr_array_free(self->tris_vas, TRUE);
+    g_ptr_array_add(self->materials, g_strdup(material));
+    return self->materials->len - 1;
+}
 
-    // triangles materials: GPtrArray of char *
-    for(guint i = 0; i < self->tri_materials->len; i++){
-        char *str = g_ptr_array_index(self->tri_materials, i);
-        g_free(str);
-    }
-    g_ptr_array_free(self->tri_materials, TRUE);
 
-    /*Triangle strips*/
-     // strips vertex index: PtrArray of int GArray
-    for(guint i = 0; i < self->strips_v->len; i++){
-        GArray *a = g_ptr_array_index(self->strips_v, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->strips_v, TRUE);
+void sg_bin_object_read_properties(SGBinReader *fp, int nproperties)
+{
+    uint32_t nbytes;
 
-    // strips normal index: PtrArray of int GArray
-    for(guint i = 0; i < self->strips_n->len; i++){
-        GArray *a = g_ptr_array_index(self->strips_n, i);
-        g_array_free(a, TRUE);
+    // skip properties
+    for ( int j = 0; j < nproperties; ++j ) {
+        char prop_type;
+        sgReadChar( fp, &prop_type );
+        sgReadUInt( fp, &nbytes );
+//        printf("property size = %d\n", nbytes);
+        sgReadView( fp, nbytes );
     }
-    g_ptr_array_free(self->strips_n, TRUE);
+}
 
-    // strips color index: PtrArray of int GArray
-    for(guint i = 0; i < self->strips_c->len; i++){
-        GArray *a = g_ptr_array_index(self->strips_c, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->strips_c, TRUE);
-
-    // strips texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->strips_tcs->len; i++){
-        GPtrArray *s_tcs = g_ptr_array_index(self->strips_tcs, i);
-        for(guint j = 0; j < s_tcs->len; j++){
-            GArray *a = g_ptr_array_index(s_tcs, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(s_tcs, TRUE);
-    }
-    g_ptr_array_free(self->strips_tcs, TRUE);
-
-    // strips vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->strips_vas->len; i++){
-        GPtrArray *s_vas = g_ptr_array_index(self->strips_vas, i);
-        for(guint j = 0; j < s_vas->len; j++){
-            GArray *a = g_ptr_array_index(s_vas, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(s_vas, TRUE);
-    }
-    g_ptr_array_free(self->strips_vas, TRUE);
+/*
+ * Index decoders: split @p count tuples of @p stride indices into @p dst,
+ * one array per tuple member. Tuple members are the indices enabled in
+ * the object index mask followed by the ones enabled in its vertex
+ * attribute mask. The masks only tell which arrays the members go to,
+ * a decoder is therefore specialized on the index width and the stride
+ * and picked once per object.
+ */
+typedef void (*SGBinIndexDecoder)(const char *buffer, size_t count, int stride, guint32 **dst);
 
-    // strips materials: GPtrArray of char *
-    for(guint i = 0; i < self->strip_materials->len; i++){
-        char *str = g_ptr_array_index(self->strip_materials, i);
-        g_free(str);
-    }
-    g_ptr_array_free(self->strip_materials, TRUE);
+static inline __attribute__((always_inline))
+void sg_bin_decode_indices(const char *buffer, size_t count, int stride, bool wide, guint32 **dst)
+{
+    for ( size_t i = 0; i < count; i++ )
+        for ( int k = 0; k < stride; k++ )
+            dst[k][i] = sg_bin_load_index(buffer, i * stride + k, wide);
+}
 
-    /*Triangle fans*/
-     // fans vertex index: PtrArray of int GArray
-    for(guint i = 0; i < self->fans_v->len; i++){
-        GArray *a = g_ptr_array_index(self->fans_v, i);
-        g_array_free(a, TRUE);
+/*
+ * vertex + texcoord tuples, the most common layout: deinterleaved
+ * a vector at a time.
+ */
+static void sg_bin_decode_indices_u16_2(const char *buffer, size_t count, int stride, guint32 **dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i lo = _mm_set1_epi32(0xFFFF);
+    for ( ; i + 4 <= count; i += 4 ) {
+        /*4 tuples, each one is a 32 bits lane*/
+        __m128i t = _mm_loadu_si128((const __m128i *)(buffer + i * 2 * sizeof(uint16_t)));
+        _mm_storeu_si128((__m128i *)(dst[0] + i), _mm_and_si128(t, lo));
+        _mm_storeu_si128((__m128i *)(dst[1] + i), _mm_srli_epi32(t, 16));
     }
-    g_ptr_array_free(self->fans_v, TRUE);
-
-    // fans normal index: PtrArray of int GArray
-    for(guint i = 0; i < self->fans_n->len; i++){
-        GArray *a = g_ptr_array_index(self->fans_n, i);
-        g_array_free(a, TRUE);
+#elif defined(__ARM_NEON)
+    for ( ; i + 8 <= count; i += 8 ) {
+        uint16x8x2_t t = vld2q_u16((const uint16_t *)(buffer + i * 2 * sizeof(uint16_t)));
+        vst1q_u32(dst[0] + i, vmovl_u16(vget_low_u16(t.val[0])));
+        vst1q_u32(dst[0] + i + 4, vmovl_u16(vget_high_u16(t.val[0])));
+        vst1q_u32(dst[1] + i, vmovl_u16(vget_low_u16(t.val[1])));
+        vst1q_u32(dst[1] + i + 4, vmovl_u16(vget_high_u16(t.val[1])));
     }
-    g_ptr_array_free(self->fans_n, TRUE);
+#endif
+    guint32 *tail[2] = {dst[0] + i, dst[1] + i};
+    sg_bin_decode_indices(buffer + i * 2 * sizeof(uint16_t), count - i, 2, false, tail);
+}
 
-    // fans color index: PtrArray of int GArray
-    for(guint i = 0; i < self->fans_c->len; i++){
-        GArray *a = g_ptr_array_index(self->fans_c, i);
-        g_array_free(a, TRUE);
-    }
-    g_ptr_array_free(self->fans_c, TRUE);
-
-    // fans texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->fans_tcs->len; i++){
-        GPtrArray *f_tcs = g_ptr_array_index(self->fans_tcs, i);
-        for(guint j = 0; j < f_tcs->len; j++){
-            GArray *a = g_ptr_array_index(f_tcs, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(f_tcs, TRUE);
-    }
-    g_ptr_array_free(self->fans_tcs, TRUE);
-
-    // fans vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    for(guint i = 0; i < self->fans_vas->len; i++){
-        GPtrArray *f_vas = g_ptr_array_index(self->fans_vas, i);
-        for(guint j = 0; j < f_vas->len; j++){
-            GArray *a = g_ptr_array_index(f_vas, j);
-            g_array_free(a, TRUE);
-        }
-        g_ptr_array_free(f_vas, TRUE);
+static void sg_bin_decode_indices_u32_2(const char *buffer, size_t count, int stride, guint32 **dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for ( ; i + 4 <= count; i += 4 ) {
+        __m128 a = _mm_loadu_ps((const float *)(buffer + i * 2 * sizeof(uint32_t)));
+        __m128 b = _mm_loadu_ps((const float *)(buffer + (i + 2) * 2 * sizeof(uint32_t)));
+        _mm_storeu_ps((float *)(dst[0] + i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps((float *)(dst[1] + i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
     }
-    g_ptr_array_free(self->fans_vas, TRUE);
-
-    // fans materials: GPtrArray of char *
-    for(guint i = 0; i < self->fan_materials->len; i++){
-        char *str = g_ptr_array_index(self->fan_materials, i);
-        g_free(str);
+#elif defined(__ARM_NEON)
+    for ( ; i + 4 <= count; i += 4 ) {
+        uint32x4x2_t t = vld2q_u32((const uint32_t *)(buffer + i * 2 * sizeof(uint32_t)));
+        vst1q_u32(dst[0] + i, t.val[0]);
+        vst1q_u32(dst[1] + i, t.val[1]);
     }
-    g_ptr_array_free(self->fan_materials, TRUE);
-
-    g_free(self);
+#endif
+    guint32 *tail[2] = {dst[0] + i, dst[1] + i};
+    sg_bin_decode_indices(buffer + i * 2 * sizeof(uint32_t), count - i, 2, true, tail);
 }
 
-
-
-void sg_bin_object_read_properties(gzFile fp, int nproperties)
+/* The stride is a constant in these: loops over tuple members are unrolled*/
+#define SG_BIN_INDEX_DECODER(name, stride, wide) \
+static void name(const char *buffer, size_t count, int unused, guint32 **dst) \
+{ \
+    sg_bin_decode_indices(buffer, count, stride, wide, dst); \
+}
+SG_BIN_INDEX_DECODER(sg_bin_decode_indices_u16_1, 1, false)
+SG_BIN_INDEX_DECODER(sg_bin_decode_indices_u32_1, 1, true)
+SG_BIN_INDEX_DECODER(sg_bin_decode_indices_u16_3, 3, false)
+SG_BIN_INDEX_DECODER(sg_bin_decode_indices_u32_3, 3, true)
+SG_BIN_INDEX_DECODER(sg_bin_decode_indices_u16_4, 4, false)
+SG_BIN_INDEX_DECODER(sg_bin_decode_indices_u32_4, 4, true)
+
+static void sg_bin_decode_indices_u16_n(const char *buffer, size_t count, int stride, guint32 **dst)
 {
-    SGSimpleBuffer *buf;
-    uint32_t nbytes;
+    sg_bin_decode_indices(buffer, count, stride, false, dst);
+}
 
-    // read properties
-    buf = sg_simple_buffer_new();
-    for ( int j = 0; j < nproperties; ++j ) {
-        char prop_type;
-        sgReadChar( fp, &prop_type );
-        sgReadUInt( fp, &nbytes );
-//        printf("property size = %d\n", nbytes);
-        if ( nbytes > buf->buffer->len) { sg_simple_buffer_resize(buf, nbytes ); }
-        char *ptr = buf->buffer->data;
-        sgReadBytes( fp, nbytes, ptr );
-    }
-    sg_simple_buffer_free(buf);
+static void sg_bin_decode_indices_u32_n(const char *buffer, size_t count, int stride, guint32 **dst)
+{
+    sg_bin_decode_indices(buffer, count, stride, true, dst);
 }
 
-static void read_indices_uint32(char* buffer,
-                         size_t bytes,
-                         int indexMask,
-                         int vaMask,
-                         GArray *vertices,
-                         GArray *normals,
-                         GArray *colors,
-                         GPtrArray *texCoords,
-                         GPtrArray *vas
-                        )
+static SGBinIndexDecoder sg_bin_index_decoder_get(int stride, bool wide)
 {
-    const int indexSize = sizeof(uint32_t) * __builtin_popcount(indexMask);
-    const int vaSize = sizeof(uint32_t) * __builtin_popcount(vaMask);
-    const int count = bytes / (indexSize + vaSize);
-
-    uint32_t *src = (uint32_t *)(buffer);
-    for (int i=0; i<count; ++i) {
-        if (indexMask & SG_IDX_VERTICES)  g_array_append_val(vertices, *src++);
-        if (indexMask & SG_IDX_NORMALS) g_array_append_val(normals, *src++);
-        if (indexMask & SG_IDX_COLORS) g_array_append_val(colors, *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_0) g_array_append_val(g_ptr_array_index(texCoords, 0), *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_1) g_array_append_val(g_ptr_array_index(texCoords,1), *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_2) g_array_append_val(g_ptr_array_index(texCoords,2), *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_3) g_array_append_val(g_ptr_array_index(texCoords,3), *src++);
-
-        if ( vaMask ) {
-            if (vaMask & SG_VA_INTEGER_0) g_array_append_val(g_ptr_array_index(vas,0), *src++);
-            if (vaMask & SG_VA_INTEGER_1) g_array_append_val(g_ptr_array_index(vas,1), *src++);
-            if (vaMask & SG_VA_INTEGER_2) g_array_append_val(g_ptr_array_index(vas,2), *src++);
-            if (vaMask & SG_VA_INTEGER_3) g_array_append_val(g_ptr_array_index(vas,3), *src++);
-            if (vaMask & SG_VA_FLOAT_0) g_array_append_val(g_ptr_array_index(vas,4), *src++);
-            if (vaMask & SG_VA_FLOAT_1) g_array_append_val(g_ptr_array_index(vas,5), *src++);
-            if (vaMask & SG_VA_FLOAT_2) g_array_append_val(g_ptr_array_index(vas,6), *src++);
-            if (vaMask & SG_VA_FLOAT_3) g_array_append_val(g_ptr_array_index(vas,7), *src++);
-        }
-    } // of elements in the index
-
-    // WS2.0 fix : toss zero area triangles
-    if ( ( count == 3 ) && (indexMask & SG_IDX_VERTICES) ) {
-        if ( (g_array_index(vertices,uint32_t,0) == g_array_index(vertices,uint32_t,1)) ||
-             (g_array_index(vertices,uint32_t,1) == g_array_index(vertices,uint32_t,2)) ||
-             (g_array_index(vertices,uint32_t,2) == g_array_index(vertices,uint32_t,0)) ) {
-            g_array_remove_range(vertices, 0, vertices->len);
-        }
+    switch(stride){
+        case 1: return wide ? sg_bin_decode_indices_u32_1 : sg_bin_decode_indices_u16_1;
+        case 2: return wide ? sg_bin_decode_indices_u32_2 : sg_bin_decode_indices_u16_2;
+        case 3: return wide ? sg_bin_decode_indices_u32_3 : sg_bin_decode_indices_u16_3;
+        case 4: return wide ? sg_bin_decode_indices_u32_4 : sg_bin_decode_indices_u16_4;
+        default: return wide ? sg_bin_decode_indices_u32_n : sg_bin_decode_indices_u16_n;
     }
 }
 
-static void read_indices_uint16(char* buffer,
-                         size_t bytes,
-                         int indexMask,
-                         int vaMask,
-                         GArray *vertices,
-                         GArray *normals,
-                         GArray *colors,
-                         GPtrArray *texCoords,
-                         GPtrArray *vas
-                        )
+/*
+ * Sums the sizes of the @p nelements elements that are next in @p fp,
+ * without consuming them.
+ */
+static size_t sg_bin_reader_peek_elements_size(SGBinReader *fp, int nelements)
 {
+    size_t offset = fp->offset;
+    bool error = fp->error;
+    size_t rv = 0;
+    unsigned int nbytes;
 
-    const int indexSize = sizeof(uint16_t) * __builtin_popcount(indexMask);
-    const int vaSize = sizeof(uint16_t) * __builtin_popcount(vaMask);
-    const int count = bytes / (indexSize + vaSize);
-
-    uint16_t *src = (uint16_t *)(buffer);
-    for (int i=0; i<count; ++i) {
-        if (indexMask & SG_IDX_VERTICES)  g_array_append_val(vertices, *src++);
-        if (indexMask & SG_IDX_NORMALS) g_array_append_val(normals, *src++);
-        if (indexMask & SG_IDX_COLORS) g_array_append_val(colors, *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_0) g_array_append_val(g_ptr_array_index(texCoords,0), *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_1) g_array_append_val(g_ptr_array_index(texCoords,1), *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_2) g_array_append_val(g_ptr_array_index(texCoords,2), *src++);
-        if (indexMask & SG_IDX_TEXCOORDS_3) g_array_append_val(g_ptr_array_index(texCoords,3), *src++);
-
-        if ( vaMask ) {
-            if (vaMask & SG_VA_INTEGER_0) g_array_append_val(g_ptr_array_index(vas,0), *src++);
-            if (vaMask & SG_VA_INTEGER_1) g_array_append_val(g_ptr_array_index(vas,1), *src++);
-            if (vaMask & SG_VA_INTEGER_2) g_array_append_val(g_ptr_array_index(vas,2), *src++);
-            if (vaMask & SG_VA_INTEGER_3) g_array_append_val(g_ptr_array_index(vas,3), *src++);
-            if (vaMask & SG_VA_FLOAT_0) g_array_append_val(g_ptr_array_index(vas,4), *src++);
-            if (vaMask & SG_VA_FLOAT_1) g_array_append_val(g_ptr_array_index(vas,5), *src++);
-            if (vaMask & SG_VA_FLOAT_2) g_array_append_val(g_ptr_array_index(vas,6), *src++);
-            if (vaMask & SG_VA_FLOAT_3) g_array_append_val(g_ptr_array_index(vas,7), *src++);
-        }
-    } // of elements in the index
-
-    // WS2.0 fix : toss zero area triangles
-    if ( ( count == 3 ) && (indexMask & SG_IDX_VERTICES) ) {
-        if ( (g_array_index(vertices,uint16_t,0) == g_array_index(vertices,uint16_t,1)) ||
-             (g_array_index(vertices,uint16_t,1) == g_array_index(vertices,uint16_t,2)) ||
-             (g_array_index(vertices,uint16_t,2) == g_array_index(vertices,uint16_t,0)) ) {
-            g_array_remove_range(vertices, 0, vertices->len);
-        }
+    for ( int j = 0; j < nelements; ++j ) {
+        sgReadUInt( fp, &nbytes );
+        if ( !sgReadView( fp, nbytes ) )
+            break;
+        rv += nbytes;
     }
+    fp->offset = offset;
+    fp->error = error;
+    return rv;
 }
 
 
-// read object properties
-void sg_bin_object_read_object(SGBinObject *self, gzFile fp,
-                         int obj_type,
-                         int nproperties,
-                         int nelements,
-                         GPtrArray *vertices,
-                         GPtrArray *normals,
-                         GPtrArray *colors,
-                         GPtrArray *texCoords,
-                         GPtrArray *vertexAttribs,
-                         GPtrArray *materials)
+// read primitive object properties, masks must hold default values
+static void sg_bin_object_read_object_properties(SGBinReader *fp, int nproperties,
+                                                 unsigned char *idx_mask,
+                                                 unsigned int *vertex_attrib_mask,
+                                                 char material[256])
 {
     unsigned int  nbytes;
-    unsigned char idx_mask;
-    unsigned int  vertex_attrib_mask;
-    int j;
-    GArray *vs;
-    GArray *ns;
-    GArray *cs;
-    GPtrArray *tcs;
-    GPtrArray *vas;
-    char material[256];
-    SGSimpleBuffer *buf;
-
-    buf = sg_simple_buffer_sized_new(32768); //32 kb
-
-    // default values
-    if ( obj_type == SG_POINTS ) {
-        idx_mask = SG_IDX_VERTICES;
-    } else {
-        idx_mask = (char)(SG_IDX_VERTICES | SG_IDX_TEXCOORDS_0);
-    }
-    vertex_attrib_mask = 0;
+    const char *ptr;
 
-    for ( j = 0; j < nproperties; ++j ) {
+    material[0] = '\0';
+    for ( int j = 0; j < nproperties; ++j ) {
         char prop_type;
         sgReadChar( fp, &prop_type );
         sgReadUInt( fp, &nbytes );
 
-        sg_simple_buffer_resize(buf, nbytes);
-        char *ptr = buf->buffer->data;
-
         switch( prop_type )
         {
             case SG_MATERIAL:
-                sgReadBytes( fp, nbytes, ptr );
+                ptr = sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
                 if (nbytes > 255) {
                     nbytes = 255;
                 }
@@ -757,29 +685,55 @@ void sg_bin_object_read_object(SGBinObject *self, gzFile fp,
 
             case SG_INDEX_TYPES:
                 if (nbytes == 1) {
-                    sgReadChar( fp, (char *)&idx_mask );
+                    sgReadChar( fp, (char *)idx_mask );
                 } else {
-                    sgReadBytes( fp, nbytes, ptr );
+                    sgReadView( fp, nbytes );
                 }
                 break;
 
             case SG_VERT_ATTRIBS:
                 if (nbytes == 4) {
-                    sgReadUInt( fp, &vertex_attrib_mask );
+                    sgReadUInt( fp, vertex_attrib_mask );
                 } else {
-                    sgReadBytes( fp, nbytes, ptr );
+                    sgReadView( fp, nbytes );
                 }
                 break;
 
             default:
-                sgReadBytes( fp, nbytes, ptr );
-                printf("Found UNKNOWN property type with nbytes == %d mask is %d\n", nbytes, (int)idx_mask);
+                sgReadView( fp, nbytes );
+                printf("Found UNKNOWN property type with nbytes == %d mask is %d\n", nbytes, (int)*idx_mask);
                 break;
         }
     }
+}
+
+// read object properties
+void sg_bin_object_read_object(SGBinObject *self, SGBinReader *fp,
+                         int obj_type,
+                         int nproperties,
+                         int nelements,
+                         SGBinPrimitives *prims)
+{
+    unsigned int  nbytes;
+    unsigned char idx_mask;
+    unsigned int  vertex_attrib_mask;
+    int j;
+    char material[256];
+    SGBinRun run;
+    guint nprims;
+
+    // default values
+    if ( obj_type == SG_POINTS ) {
+        idx_mask = SG_IDX_VERTICES;
+    } else {
+        idx_mask = (char)(SG_IDX_VERTICES | SG_IDX_TEXCOORDS_0);
+    }
+    vertex_attrib_mask = 0;
 
-    if ( sgReadError() ) {
+    sg_bin_object_read_object_properties(fp, nproperties, &idx_mask, &vertex_attrib_mask, material);
+    if ( sgReadError( fp ) ) {
         printf("Error reading object properties\n");
+        return;
     }
 
     size_t indexCount = __builtin_popcount(idx_mask);
@@ -787,102 +741,107 @@ void sg_bin_object_read_object(SGBinObject *self, gzFile fp,
         printf("object index mask has no bits set\n");
     }
 
-    for ( j = 0; j < nelements; ++j ) {
-        sgReadUInt( fp, &nbytes );
-        if ( sgReadError() ) {
-                printf("Error reading element size");
+    nprims = sg_bin_primitives_count(prims);
+    run = (SGBinRun){
+        .material = sg_bin_object_intern_material(self, material),
+        .start = nprims,
+        .idx_mask = idx_mask,
+        .va_mask = vertex_attrib_mask
+    };
+
+    /* Tuple layout, same order as in the file*/
+    const bool wide = self->version >= 10;
+    const size_t isize = wide ? sizeof(uint32_t) : sizeof(uint16_t);
+    GArray *dest[3 + MAX_TC_SETS + MAX_VAS];
+    guint32 *out[3 + MAX_TC_SETS + MAX_VAS];
+    int stride = 0;
+    if (idx_mask & SG_IDX_VERTICES) dest[stride++] = prims->v;
+    if (idx_mask & SG_IDX_NORMALS) dest[stride++] = prims->n;
+    if (idx_mask & SG_IDX_COLORS) dest[stride++] = prims->c;
+    for ( int i = 0; i < MAX_TC_SETS; i++ )
+        if (idx_mask & (SG_IDX_TEXCOORDS_0 << i)) dest[stride++] = prims->tcs[i];
+    for ( int i = 0; i < 4; i++ )
+        if (vertex_attrib_mask & (SG_VA_INTEGER_0 << i)) dest[stride++] = prims->vas[i];
+    for ( int i = 0; i < 4; i++ )
+        if (vertex_attrib_mask & (SG_VA_FLOAT_0 << i)) dest[stride++] = prims->vas[4 + i];
+    const SGBinIndexDecoder decode = sg_bin_index_decoder_get(stride, wide);
+
+    /* Arrays are sized for the whole object upfront and trimmed once done.
+     * Growing them zero-pads primitives of previous runs that didn't have
+     * the attribute*/
+    guint start, end, noffsets;
+    start = end = sg_bin_primitives_start(prims, nprims);
+    noffsets = prims->offsets->len;
+    if ( stride ) {
+        size_t ntuples = sg_bin_reader_peek_elements_size(fp, nelements) / (isize * stride);
+        for ( int k = 0; k < stride; k++ ) {
+            g_array_set_size(dest[k], start + ntuples);
+            out[k] = &g_array_index(dest[k], guint32, start);
         }
+        g_array_set_size(prims->offsets, noffsets + nelements);
+    }
+    guint *offsets = &g_array_index(prims->offsets, guint, noffsets);
 
-        sg_simple_buffer_resize(buf, nbytes);
-        char *ptr = buf->buffer->data;
-        sgReadBytes( fp, nbytes, ptr );
+    for ( j = 0; j < nelements; ++j ) {
+        sgReadUInt( fp, &nbytes );
+        const char *ptr = sgReadView( fp, nbytes );
 
-        if ( sgReadError() ) {
+        if ( sgReadError( fp ) ) {
             printf("Error reading element bytes");
+            break;
         }
-
-        size_t indices_size;
-        indices_size = (self->version >= 10) ? sizeof(uint32_t) : sizeof(uint16_t);
-        vs = g_array_new(FALSE, TRUE, indices_size);
-        ns = g_array_new(FALSE, TRUE, indices_size);
-        cs = g_array_new(FALSE, TRUE, indices_size);
-        tcs = g_ptr_array_sized_new(MAX_TC_SETS);
-        for(int z = 0; z < MAX_TC_SETS; z++)
-            g_ptr_array_add(tcs, g_array_new(FALSE, TRUE, indices_size));
-        vas = g_ptr_array_sized_new(MAX_VAS);
-        for(int z = 0; z < MAX_VAS; z++)
-            g_ptr_array_add(vas, g_array_new(FALSE, TRUE, indices_size));
-
-        if (self->version >= 10) {
-//            printf("Reading indices as 32-bits ints\n");
-            read_indices_uint32(ptr, nbytes, idx_mask, vertex_attrib_mask, vs, ns, cs, tcs, vas);
-        } else {
-//            printf("Reading indices as 16-bits ints\n");
-            read_indices_uint16(ptr, nbytes, idx_mask, vertex_attrib_mask, vs, ns, cs, tcs, vas);
+        if ( !stride )
+            continue;
+
+        size_t count = nbytes / (isize * stride);
+        // WS2.0 fix : toss zero area triangles
+        if ( count == 3 && (idx_mask & SG_IDX_VERTICES) ) {
+            uint32_t v[3];
+            for ( int i = 0; i < 3; i++ )
+                v[i] = sg_bin_load_index(ptr, i * stride, wide);
+            if ( v[0] == v[1] || v[1] == v[2] || v[2] == v[0] )
+                continue;
         }
 
-        // Fix for WS2.0 - ignore zero area triangles
-        if ( vs->len > 0 ) {
-            g_ptr_array_add(vertices, vs);
-            g_ptr_array_add(normals, ns);
-            g_ptr_array_add(colors, cs);
-            g_ptr_array_add(texCoords, tcs);
-            g_ptr_array_add(vertexAttribs, vas);
-            g_ptr_array_add(materials, g_strdup(material));
-        }else{
-            g_array_free(vs, TRUE);
-            g_array_free(ns, TRUE);
-            g_array_free(cs, TRUE);
-            for(int z = 0; z < MAX_TC_SETS; z++){
-                GArray *a = g_ptr_array_index(tcs, z);
-                g_array_free(a, TRUE);
-            }
-            g_ptr_array_free(tcs, TRUE);
-            for(int z = 0; z < MAX_VAS; z++){
-                GArray *a = g_ptr_array_index(vas, z);
-                g_array_free(a, TRUE);
-            }
-            g_ptr_array_free(vas, TRUE);
-        }
+        decode(ptr, count, stride, out);
+        for ( int k = 0; k < stride; k++ )
+            out[k] += count;
+        end += count;
+        *offsets++ = end;
     } // of element iteration
-    sg_simple_buffer_free(buf);
-}
 
-
-
-void sg_bin_object_load(SGBinObject *self, const char *filename)
-{
-    SGVec3d p;
-    int i, k;
-    size_t j;
-    gzFile fp;
-    unsigned int nbytes;
-    SGSimpleBuffer *buf;
-
-    fp = file_fopen(filename);
-    if(!fp){
-        printf("Error opening for reading (and .gz): %s\n",filename);
-        return;
+    if ( stride ) {
+        for ( int k = 0; k < stride; k++ )
+            g_array_set_size(dest[k], end);
+        g_array_set_size(prims->offsets, offsets - &g_array_index(prims->offsets, guint, 0));
     }
 
-    buf =  sg_simple_buffer_sized_new(32768); //32 kb
+    /* Fix for WS2.0 - zero area triangles have been ignored, the run is
+     * only recorded if something remains. Consecutive objects with the
+     * same properties share a run*/
+    if ( sg_bin_primitives_count(prims) > nprims ) {
+        SGBinRun *last = prims->runs->len ? sg_bin_run_get(prims, prims->runs->len - 1) : NULL;
+        if ( !last || last->material != run.material
+             || last->idx_mask != run.idx_mask || last->va_mask != run.va_mask )
+            g_array_append_val(prims->runs, run);
+    }
+}
 
 
-    sgClearReadError();
 
-    // read headers
+// read file header, returns false on bad magic or read error
+static bool sg_bin_object_read_header(SGBinReader *fp, unsigned short *version, int *nobjects)
+{
     unsigned int header;
     sgReadUInt( fp, &header );
     if ( ((header & 0xFF000000) >> 24) == 'S' &&
          ((header & 0x00FF0000) >> 16) == 'G' ) {
 
         // read file version
-        self->version = (header & 0x0000FFFF);
+        *version = (header & 0x0000FFFF);
     } else {
-        // close the file before we return
-        gzclose(fp);
         printf("Bad BTG magic/version\n");
-        return;
+        return false;
     }
 
     // read creation time
@@ -890,48 +849,104 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
     sgReadUInt( fp, &foo_calendar_time );
 
     // read number of top level objects
-    int nobjects;
-    if ( self->version >= 10) { // version 10 extends everything to be 32-bit
-        sgReadInt( fp, &nobjects );
-    } else if ( self->version >= 7 ) {
+    if ( *version >= 10) { // version 10 extends everything to be 32-bit
+        sgReadInt( fp, nobjects );
+    } else if ( *version >= 7 ) {
         uint16_t v;
         sgReadUShort( fp, &v );
-        nobjects = v;
+        *nobjects = v;
     } else {
         int16_t v;
         sgReadShort( fp, &v );
-        nobjects = v;
+        *nobjects = v;
     }
 
-    //printf("SGBinObject::read_bin Total objects to read = %d\n", nobjects);
-
-    if ( sgReadError() ) {
+    if ( sgReadError( fp ) ) {
         printf("Error reading BTG file header\n");
-        return;
+        return false;
     }
+    return true;
+}
+
+static void sg_bin_object_read_object_header(SGBinReader *fp, unsigned short version,
+                                             char *obj_type,
+                                             uint32_t *nproperties,
+                                             uint32_t *nelements)
+{
+    sgReadChar( fp, obj_type );
+    if ( version >= 10 ) {
+        sgReadUInt( fp, nproperties );
+        sgReadUInt( fp, nelements );
+    } else if ( version >= 7 ) {
+        uint16_t v;
+        sgReadUShort( fp, &v );
+        *nproperties = v;
+        sgReadUShort( fp, &v );
+        *nelements = v;
+    } else {
+        int16_t v;
+        sgReadShort( fp, &v );
+        *nproperties = v;
+        sgReadShort( fp, &v );
+        *nelements = v;
+    }
+}
+
+/**
+ * @brief Loads a BTG file in @p self using a one-shot reader.
+ *
+ * @see sg_bin_object_read
+ */
+void sg_bin_object_load(SGBinObject *self, const char *filename)
+{
+    SGBinReader reader;
+
+    sg_bin_reader_init(&reader);
+    sg_bin_object_read(self, &reader, filename);
+    sg_bin_reader_dispose(&reader);
+}
+
+/**
+ * @brief Loads a BTG file in @p self.
+ *
+ * @param self The SGBinObject to fill
+ * @param fp The reader to use. Readers can't be shared between threads
+ * but can be reused from one file to the next.
+ * @param filename The file to read (.gz is tried if not found)
+ * @return true on success, false if the file couldn't be opened or
+ * was truncated.
+ */
+bool sg_bin_object_read(SGBinObject *self, SGBinReader *fp, const char *filename)
+{
+    int i, k;
+    size_t j;
+    unsigned int nbytes;
+    bool rv;
+
+    if(!sg_bin_reader_open(fp, filename)){
+        printf("Error opening for reading (and .gz): %s\n",filename);
+        return false;
+    }
+
+    // read headers
+    int nobjects;
+    if ( !sg_bin_object_read_header( fp, &self->version, &nobjects ) ) {
+        // close the file before we return
+        fp->error = true;
+        sg_bin_reader_close(fp);
+        return false;
+    }
+
+    //printf("SGBinObject::read_bin Total objects to read = %d\n", nobjects);
 
     // read in objects
     for ( i = 0; i < nobjects; ++i ) {
         // read object header
         char obj_type;
         uint32_t nproperties, nelements;
-        sgReadChar( fp, &obj_type );
-        if ( self->version >= 10 ) {
-            sgReadUInt( fp, &nproperties );
-            sgReadUInt( fp, &nelements );
-        } else if ( self->version >= 7 ) {
-            uint16_t v;
-            sgReadUShort( fp, &v );
-            nproperties = v;
-            sgReadUShort( fp, &v );
-            nelements = v;
-        } else {
-            int16_t v;
-            sgReadShort( fp, &v );
-            nproperties = v;
-            sgReadShort( fp, &v );
-            nelements = v;
-        }
+        sg_bin_object_read_object_header( fp, self->version, &obj_type, &nproperties, &nelements );
+        fp->stats.objects++;
+        fp->stats.elements += nelements;
 
         //printf("SGBinObject::read_bin object #%d = %d props = %d elements = %d\n", i, (int)obj_type, nproperties, nelements);
 
@@ -942,12 +957,13 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             // read bounding sphere elements
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
-                sg_simple_buffer_resize(buf, nbytes);
-                sg_simple_buffer_reset(buf);
-                char *ptr = buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
-                self->gbs_center = sg_simple_buffer_readVec3d(buf);
-                self->gbs_radius = sg_simple_buffer_readFloat(buf);
+                const char *ptr = sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
+                if ( nbytes < sizeof(SGVec3d) + sizeof(float) )
+                    continue;
+                memcpy(&self->gbs_center, ptr, sizeof(SGVec3d));
+                memcpy(&self->gbs_radius, ptr + sizeof(SGVec3d), sizeof(float));
             }
         } else if ( obj_type == SG_VERTEX_LIST ) {
             // read vertex list properties
@@ -956,17 +972,17 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             // read vertex list elements
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
-                sg_simple_buffer_resize(buf, nbytes);
-                sg_simple_buffer_reset(buf);
-                char *ptr = buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
+                const char *ptr = sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
                 int count = nbytes / (sizeof(float) * 3);
-   //             g_array_set_size(self->wgs84_nodes, count);
+                guint first = self->wgs84_nodes->len;
+                g_array_set_size(self->wgs84_nodes, first + count);
+                SGVec3d *dst = &g_array_index(self->wgs84_nodes, SGVec3d, first);
                 for ( k = 0; k < count; ++k ) {
-                    SGVec3f v = sg_simple_buffer_readVec3f(buf);
+                    SGVec3f v = sg_bin_load_vec3f(ptr, k);
                     // extend from float to double, hmmm
-                    SGVec3d tmp = {v.x, v.y, v.z};
-                    g_array_append_val(self->wgs84_nodes, tmp);
+                    dst[k] = (SGVec3d){v.x, v.y, v.z};
                 }
             }
         } else if ( obj_type == SG_COLOR_LIST ) {
@@ -976,16 +992,11 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             // read color list elements
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
-                sg_simple_buffer_resize(buf, nbytes);
-                sg_simple_buffer_reset(buf);
-                char *ptr = buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
+                const char *ptr = sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
                 int count = nbytes / (sizeof(float) * 4);
-//                g_array_set_size(self->colors, count);
-                for ( k = 0; k < count; ++k ) {
-                    SGVec4f tmp = sg_simple_buffer_readVec4f(buf);
-                    g_array_append_val(self->colors, tmp);
-                }
+                g_array_append_vals(self->colors, ptr, count);
             }
         } else if ( obj_type == SG_NORMAL_LIST ) {
             // read normal list properties
@@ -994,10 +1005,9 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             // read normal list elements
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
-                sg_simple_buffer_resize(buf, nbytes);
-                sg_simple_buffer_reset(buf);
-                unsigned char *ptr = (unsigned char *)buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
+                const unsigned char *ptr = (const unsigned char *)sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
                 int count = nbytes / 3;
 //                g_array_set_size(self->normals, count);
                 for ( k = 0; k < count; ++k ) {
@@ -1016,16 +1026,11 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             // read texcoord list elements
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
-                sg_simple_buffer_resize(buf, nbytes);
-                sg_simple_buffer_reset(buf);
-                char *ptr = buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
+                const char *ptr = sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
                 int count = nbytes / (sizeof(float) * 2);
-//                g_array_set_size(self->texcoords, count);
-                for ( k = 0; k < count; ++k ) {
-                    SGVec2f tmp = sg_simple_buffer_readVec2f(buf);
-                    g_array_append_val(self->texcoords, tmp);
-                }
+                g_array_append_vals(self->texcoords, ptr, count);
             }
         } else if ( obj_type == SG_VA_FLOAT_LIST ) {
             // read vertex attribute (float) properties
@@ -1034,16 +1039,11 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             // read vertex attribute list elements
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
-                sg_simple_buffer_resize(buf, nbytes);
-                sg_simple_buffer_reset(buf);
-                char *ptr = buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
+                const char *ptr = sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
                 int count = nbytes / (sizeof(float));
-//                g_array_set_size(self->va_flt, count);
-                for ( k = 0; k < count; ++k ) {
-                    float tmp = sg_simple_buffer_readFloat(buf);
-                    g_array_append_val(self->va_flt, tmp);
-                }
+                g_array_append_vals(self->va_flt, ptr, count);
             }
         } else if ( obj_type == SG_VA_INTEGER_LIST ) {
             // read vertex attribute (integer) properties
@@ -1052,37 +1052,28 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             // read vertex attribute list elements
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
-                sg_simple_buffer_resize(buf, nbytes);
-                sg_simple_buffer_reset(buf);
-                char *ptr = buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
+                const char *ptr = sgReadView( fp, nbytes );
+                if ( !ptr )
+                    break;
                 int count = nbytes / (sizeof(unsigned int));
-//                g_array_set_size(self->va_int, count);
-                for ( k = 0; k < count; ++k ) {
-                    int tmp = sg_simple_buffer_readInt(buf);
-                    g_array_append_val(self->va_int, tmp);
-                }
+                g_array_append_vals(self->va_int, ptr, count);
             }
         } else if ( obj_type == SG_POINTS ) {
             // read point elements
             sg_bin_object_read_object(self, fp, SG_POINTS, nproperties, nelements,
-                         self->pts_v, self->pts_n, self->pts_c, self->pts_tcs,
-                         self->pts_vas, self->pt_materials );
+                         &self->points );
         } else if ( obj_type == SG_TRIANGLE_FACES ) {
             // read triangle face properties
             sg_bin_object_read_object(self, fp, SG_TRIANGLE_FACES, nproperties, nelements,
-                         self->tris_v, self->tris_n, self->tris_c, self->tris_tcs,
-                         self->tris_vas, self->tri_materials );
+                         &self->triangles );
         } else if ( obj_type == SG_TRIANGLE_STRIPS ) {
             // read triangle strip properties
             sg_bin_object_read_object(self, fp, SG_TRIANGLE_STRIPS, nproperties, nelements,
-                         self->strips_v, self->strips_n, self->strips_c, self->strips_tcs,
-                         self->strips_vas, self->strip_materials );
+                         &self->strips );
         } else if ( obj_type == SG_TRIANGLE_FANS ) {
             // read triangle fan properties
             sg_bin_object_read_object(self, fp, SG_TRIANGLE_FANS, nproperties, nelements,
-                         self->fans_v, self->fans_n, self->fans_c, self->fans_tcs,
-                         self->fans_vas, self->fan_materials );
+                         &self->fans );
         } else {
             // unknown object type, just skip
             sg_bin_object_read_properties( fp, nproperties );
@@ -1091,26 +1082,364 @@ void sg_bin_object_load(SGBinObject *self, const char *filename)
             for ( j = 0; j < nelements; ++j ) {
                 sgReadUInt( fp, &nbytes );
                 // cout << "element size = " << nbytes << endl;
-                if ( nbytes > buf->buffer->len ) { sg_simple_buffer_resize(buf, nbytes); }
-                char *ptr = buf->buffer->data;
-                sgReadBytes( fp, nbytes, ptr );
+                sgReadView( fp, nbytes );
             }
         }
 
-        if ( sgReadError() ) {
+        if ( sgReadError( fp ) ) {
             printf("Error while reading object %d\n",i);
         }
     }
 
     // close the file
-    gzclose(fp);
-    sg_simple_buffer_free(buf);
+    rv = !sgReadError( fp );
+    sg_bin_reader_close(fp);
+    return rv;
 }
 
 
+/*
+ * Hands the triangles of one element over. Always inlined with
+ * constant @p wide, @p has_tc and @p indexed so that there is a copy of
+ * the loop per index layout and callback, without per-corner branching.
+ */
+static inline __attribute__((always_inline))
+bool sg_bin_object_stream_element(const char *ptr, size_t count,
+                                  size_t stride, size_t tc_offset,
+                                  const bool wide, const bool has_tc,
+                                  const bool indexed,
+                                  SGVec3d *nodes, size_t n_nodes,
+                                  const SGVec2f *texcoords, size_t n_texcoords,
+                                  SGBinStreamHandlers *handlers,
+                                  void *data)
+{
+    static const SGVec2f no_tcs[1] = {{0.0f, 0.0f}};
+    SGVec2f no_tc = {0.0f, 0.0f};
+
+    for ( size_t k = 2; k < count; k += 3 ) {
+        uint32_t v[3], t[3];
+        for ( int l = 0; l < 3; l++ ) {
+            size_t base = (k - 2 + l) * stride;
+            v[l] = sg_bin_load_index(ptr, base, wide);
+            t[l] = has_tc ? sg_bin_load_index(ptr, base + tc_offset, wide) : 0;
+        }
+
+        // WS2.0 fix : toss zero area triangles
+        if ( count == 3 && (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) )
+            break;
+
+        if ( v[0] >= n_nodes || v[1] >= n_nodes || v[2] >= n_nodes ||
+             (has_tc && (t[0] >= n_texcoords || t[1] >= n_texcoords || t[2] >= n_texcoords)) ) {
+            printf("Triangle index out of range, skipping\n");
+            continue;
+        }
+        if ( indexed ) {
+            if ( !handlers->indexed_triangle(data, nodes, has_tc ? texcoords : no_tcs, v, t) )
+                return false;
+        } else if ( !handlers->triangle(data,
+                     &nodes[v[0]], has_tc ? (SGVec2f *)&texcoords[t[0]] : &no_tc,
+                     &nodes[v[1]], has_tc ? (SGVec2f *)&texcoords[t[1]] : &no_tc,
+                     &nodes[v[2]], has_tc ? (SGVec2f *)&texcoords[t[2]] : &no_tc) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define SG_BIN_STREAM_ELEMENT(wide, has_tc, indexed) \
+    sg_bin_object_stream_element(ptr, nbytes / (isize * stride), stride, tc_offset, \
+        wide, has_tc, indexed, nodes, n_nodes, texcoords, n_texcoords, handlers, data)
+
+// read a SG_TRIANGLE_FACES object and hand its triangles over
+static bool sg_bin_object_stream_triangles(SGBinReader *fp, unsigned short version,
+                                           int nproperties,
+                                           int nelements,
+                                           SGVec3d *nodes, size_t n_nodes,
+                                           const SGVec2f *texcoords, size_t n_texcoords,
+                                           SGBinStreamHandlers *handlers,
+                                           void *data)
+{
+    unsigned int  nbytes;
+    unsigned char idx_mask;
+    unsigned int  vertex_attrib_mask;
+    char material[256];
+    bool rv;
+    int j;
+
+    idx_mask = (char)(SG_IDX_VERTICES | SG_IDX_TEXCOORDS_0);
+    vertex_attrib_mask = 0;
+    sg_bin_object_read_object_properties(fp, nproperties, &idx_mask, &vertex_attrib_mask, material);
+    if ( sgReadError( fp ) ) {
+        printf("Error reading object properties\n");
+        return false;
+    }
+
+    if ( !handlers->begin_triangles(data, material, nelements) )
+        return false;
+
+    /* Indices are stored as tuples: vertex, normal, color, texcoords
+     * then vertex attributes, each one being present if set in the masks*/
+    const bool wide = version >= 10;
+    const bool has_tc = idx_mask & SG_IDX_TEXCOORDS_0;
+    const size_t stride = __builtin_popcount(idx_mask) + __builtin_popcount(vertex_attrib_mask);
+    const size_t tc_offset = __builtin_popcount(idx_mask & (SG_IDX_VERTICES | SG_IDX_NORMALS | SG_IDX_COLORS));
+    const size_t isize = wide ? sizeof(uint32_t) : sizeof(uint16_t);
+    /*Layout is the same for all elements: picked once*/
+    const int layout = (handlers->indexed_triangle ? 4 : 0) | (wide ? 2 : 0) | (has_tc ? 1 : 0);
+
+    if ( !(idx_mask & SG_IDX_VERTICES) )
+        printf("Triangles object has no vertex indices, skipping\n");
+
+    for ( j = 0; j < nelements; ++j ) {
+        sgReadUInt( fp, &nbytes );
+        const char *ptr = sgReadView( fp, nbytes );
+        if ( sgReadError( fp ) ) {
+            printf("Error reading element bytes");
+            return false;
+        }
+        if ( !(idx_mask & SG_IDX_VERTICES) )
+            continue;
+
+        switch ( layout ) {
+            case 0: rv = SG_BIN_STREAM_ELEMENT(false, false, false); break;
+            case 1: rv = SG_BIN_STREAM_ELEMENT(false, true, false); break;
+            case 2: rv = SG_BIN_STREAM_ELEMENT(true, false, false); break;
+            case 3: rv = SG_BIN_STREAM_ELEMENT(true, true, false); break;
+            case 4: rv = SG_BIN_STREAM_ELEMENT(false, false, true); break;
+            case 5: rv = SG_BIN_STREAM_ELEMENT(false, true, true); break;
+            case 6: rv = SG_BIN_STREAM_ELEMENT(true, false, true); break;
+            default: rv = SG_BIN_STREAM_ELEMENT(true, true, true); break;
+        }
+        if ( !rv )
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Grows a scratch array of @p elsize elements to hold at least @p count
+ * of them. Contents are kept.
+ */
+static bool sg_bin_reader_grow(void **array, size_t *size, size_t count, size_t elsize)
+{
+    size_t nsize;
+    void *tmp;
+
+    if(count <= *size)
+        return true;
+    nsize = *size ? *size : 1024;
+    while(nsize < count)
+        nsize *= 2;
+    tmp = realloc(*array, nsize * elsize);
+    if(!tmp)
+        return false;
+    *array = tmp;
+    *size = nsize;
+    return true;
+}
+
+/**
+ * @brief Reads a BTG file in one pass using a one-shot reader.
+ *
+ * @see sg_bin_reader_stream
+ */
+bool sg_bin_object_stream(const char *filename, SGBinStreamHandlers *handlers, void *data)
+{
+    SGBinReader reader;
+    bool rv;
+
+    sg_bin_reader_init(&reader);
+    rv = sg_bin_reader_stream(&reader, filename, handlers, data);
+    sg_bin_reader_dispose(&reader);
+    return rv;
+}
+
+/**
+ * @brief Reads a BTG file in one pass, calling @p handlers as
+ * data becomes available.
+ *
+ * Unlike sg_bin_object_read, nothing besides the vertex and texture
+ * coordinates lists is kept in memory, in @p fp scratch buffers. Triangle
+ * objects are expected to come after these lists, which is the way
+ * FlightGear writes them.
+ *
+ * @param fp The reader to use. Readers can't be shared between threads
+ * but can be reused from one file to the next.
+ * @param filename The file to read (.gz is tried if not found)
+ * @param handlers Callbacks: bounding_sphere, begin_triangles and
+ * either triangle or indexed_triangle must be set
+ * @param data Passed as-is to the callbacks
+ * @return false if the file couldn't be read or a callback failed,
+ * true otherwise.
+ */
+bool sg_bin_reader_stream(SGBinReader *fp, const char *filename, SGBinStreamHandlers *handlers, void *data)
+{
+    unsigned short version;
+    int nobjects;
+    unsigned int nbytes;
+    const SGVec2f *texcoords;
+    size_t n_nodes, n_texcoords;
+    bool rv;
+
+    if(!sg_bin_reader_open(fp, filename)){
+        printf("Error opening for reading (and .gz): %s\n",filename);
+        return false;
+    }
+
+    if ( !sg_bin_object_read_header( fp, &version, &nobjects ) ) {
+        fp->error = true;
+        sg_bin_reader_close(fp);
+        return false;
+    }
+
+    texcoords = NULL;
+    n_nodes = n_texcoords = 0;
+    rv = true;
+    for ( int i = 0; rv && i < nobjects; ++i ) {
+        char obj_type;
+        uint32_t nproperties, nelements;
+        sg_bin_object_read_object_header( fp, version, &obj_type, &nproperties, &nelements );
+        fp->stats.objects++;
+        fp->stats.elements += nelements;
+
+        if ( obj_type == SG_TRIANGLE_FACES ) {
+            rv = sg_bin_object_stream_triangles(fp, version, nproperties, nelements,
+                         fp->nodes, n_nodes, texcoords, n_texcoords,
+                         handlers, data);
+            continue;
+        }
+
+        sg_bin_object_read_properties( fp, nproperties );
+        for ( uint32_t j = 0; j < nelements; ++j ) {
+            sgReadUInt( fp, &nbytes );
+            const char *ptr = sgReadView( fp, nbytes );
+            if ( !ptr )
+                break;
+
+            if ( obj_type == SG_BOUNDING_SPHERE ) {
+                SGVec3d center;
+                float radius;
+                if ( nbytes < sizeof(SGVec3d) + sizeof(float) )
+                    continue;
+                memcpy(&center, ptr, sizeof(SGVec3d));
+                memcpy(&radius, ptr + sizeof(SGVec3d), sizeof(float));
+                handlers->bounding_sphere(data, &center, radius);
+            } else if ( obj_type == SG_VERTEX_LIST ) {
+                // extend from float to double, hmmm: the list has to be copied
+                size_t count = nbytes / (sizeof(float) * 3);
+                if ( !sg_bin_reader_grow((void **)&fp->nodes, &fp->nodes_size,
+                                         n_nodes + count, sizeof(SGVec3d)) ) {
+                    rv = false;
+                    break;
+                }
+                for ( size_t k = 0; k < count; ++k ) {
+                    SGVec3f v = sg_bin_load_vec3f(ptr, k);
+                    fp->nodes[n_nodes++] = (SGVec3d){v.x, v.y, v.z};
+                }
+            } else if ( obj_type == SG_TEXCOORD_LIST ) {
+                size_t count = nbytes / (sizeof(float) * 2);
+                if ( !texcoords && ((uintptr_t)ptr % _Alignof(SGVec2f)) == 0 ) {
+                    /*Usual case: a single, aligned, list used in place*/
+                    texcoords = (const SGVec2f *)ptr;
+                    n_texcoords = count;
+                    continue;
+                }
+                /*The first list was used in place, move it to the scratch buffer*/
+                bool in_place = texcoords && texcoords != fp->texcoords;
+                if ( !sg_bin_reader_grow((void **)&fp->texcoords, &fp->texcoords_size,
+                                         n_texcoords + count, sizeof(SGVec2f)) ) {
+                    rv = false;
+                    break;
+                }
+                if ( in_place )
+                    memcpy(fp->texcoords, texcoords, sizeof(SGVec2f) * n_texcoords);
+                memcpy(fp->texcoords + n_texcoords, ptr, sizeof(SGVec2f) * count);
+                n_texcoords += count;
+                texcoords = fp->texcoords;
+            }
+            // normals, colors, vertex attributes, points, strips
+            // and fans are of no use for rendering: skipped
+        }
+
+        if ( sgReadError( fp ) ) {
+            printf("Error while reading object %d\n",i);
+            rv = false;
+        }
+    }
+
+    sg_bin_reader_close(fp);
+    return rv;
+}
+
+/*
+ * Writes runs of @p prims, merging consecutive runs with the same material
+ * into one group. @p keyword is the OBJ element keyword ("f", "ts", ...).
+ */
+static void sg_bin_object_write_obj_groups(SGBinObject *self, FILE *fp,
+                                           SGBinPrimitives *prims,
+                                           const char *keyword)
+{
+    guint start = 0;
+    guint end = 1;
+    size_t i, j, r;
+    char *material;
+
+    while ( start < prims->runs->len ) {
+        // find next group
+        guint mat_id = sg_bin_run_get(prims, start)->material;
+        material = g_ptr_array_index(self->materials, mat_id);
+        while ( (end < prims->runs->len) &&
+                (sg_bin_run_get(prims, end)->material == mat_id) )
+        {
+            end++;
+        }
+        guint first = sg_bin_run_get(prims, start)->start;
+        guint last = sg_bin_run_end(prims, end - 1);
+        //printf("group = %d to %d\n",first, last-1);
+
+        SGSphered d = (SGSphered){
+            .center = (SGVec3d){0.0, 0.0, 0.0},
+            .radius = -1.0
+        };
+        for ( i = sg_bin_primitives_start(prims, first); i < sg_bin_primitives_start(prims, last); ++i ) {
+            guint32 idx = g_array_index(prims->v, guint32, i);
+            SGVec3d tmp = g_array_index(self->wgs84_nodes, SGVec3d, idx);
+            sg_sphered_expand_by(&d, &tmp);
+        }
+
+        SGVec3d bs_center = d.center;
+        double bs_radius = d.radius;
+
+        // write group headers
+        fprintf(fp, "\n");
+        fprintf(fp, "# usemtl %s\n", material);
+        fprintf(fp, "# bs %.4f %.4f %.4f %.2f\n",
+                bs_center.x, bs_center.y, bs_center.z, bs_radius);
+
+        // write groups
+        for ( r = start; r < end; ++r ) {
+            bool has_tc = sg_bin_run_get(prims, r)->idx_mask & SG_IDX_TEXCOORDS_0;
+            for ( i = sg_bin_run_get(prims, r)->start; i < sg_bin_run_end(prims, r); ++i ) {
+                fprintf(fp, "%s", keyword);
+                for ( j = sg_bin_primitives_start(prims, i); j < sg_bin_primitives_end(prims, i); ++j ) {
+                    guint32 a = g_array_index(prims->v, guint32, j);
+                    if ( has_tc )
+                        fprintf(fp, " %d/%d", a+1, g_array_index(prims->tcs[0], guint32, j)+1);
+                    else
+                        fprintf(fp, " %d", a+1);
+                }
+                fprintf(fp, "\n");
+            }
+        }
+
+        start = end;
+        end = start + 1;
+    }
+}
+
 bool sg_bin_object_write_obj(SGBinObject *self, const char *filename)
 {
-    size_t i, j;
+    size_t i;
     FILE *fp;
 
     fp = fopen( filename, "w" );
@@ -1119,9 +1448,9 @@ bool sg_bin_object_write_obj(SGBinObject *self, const char *filename)
         return false;
     }
 
-    printf("triangles size = %d tri_materials = %d\n", self->tris_v->len, self->tri_materials->len);
-    printf("strips size = %d strip_materials = %d\n", self->strips_v->len, self->strip_materials->len);
-    printf("fan size = %d fan_materials = %d\n", self->fans_v->len, self->fan_materials->len);
+    printf("triangles size = %d materials = %d\n", sg_bin_primitives_count(&self->triangles), self->triangles.runs->len);
+    printf("strips size = %d materials = %d\n", sg_bin_primitives_count(&self->strips), self->strips.runs->len);
+    printf("fan size = %d materials = %d\n", sg_bin_primitives_count(&self->fans), self->fans.runs->len);
 
     printf("points = %d\n",self->wgs84_nodes->len);
     printf("tex coords = %d\n",self->texcoords->len);
@@ -1131,10 +1460,10 @@ bool sg_bin_object_write_obj(SGBinObject *self, const char *filename)
     fprintf(fp, "# Version %s\n", SG_SCENERY_FILE_FORMAT);
 
     time_t calendar_time = time(NULL);
-    struct tm *local_tm;
-    local_tm = localtime( &calendar_time );
+    struct tm local_tm;
+    localtime_r( &calendar_time, &local_tm );
     char time_str[256];
-    strftime( time_str, 256, "%a %b %d %H:%M:%S %Z %Y", local_tm);
+    strftime( time_str, 256, "%a %b %d %H:%M:%S %Z %Y", &local_tm);
     fprintf(fp, "# Created %s\n", time_str );
     fprintf(fp, "\n");
 
@@ -1182,143 +1511,15 @@ bool sg_bin_object_write_obj(SGBinObject *self, const char *filename)
     fprintf(fp, "\n");
 
     // dump individual triangles if they exist
-    if ( self->tris_v->len != 0 ) {
+    if ( sg_bin_primitives_count(&self->triangles) != 0 ) {
         fprintf(fp, "# triangle groups\n");
-
-        guint start = 0;
-        guint end = 1;
-        char *material;
-        while ( start < self->tri_materials->len ) {
-            // find next group
-            material = g_ptr_array_index(self->tri_materials,start);
-           // printf("tri_materials.size: %d\n", self->tri_materials->len);
-            while ( (end < self->tri_materials->len) &&
-                    (!strcmp(material, g_ptr_array_index(self->tri_materials,end))) )
-            {
-                //printf("end = %d\n",end);
-                end++;
-            }
-            //printf("group = %d to %d\n",start, end-1);
-            //
-            SGSphered d = (SGSphered){
-                .center = (SGVec3d){0.0, 0.0, 0.0},
-                .radius = -1.0
-            };
-            for ( i = start; i < end; ++i ) {
-                GArray *a = g_ptr_array_index(self->tris_v, i);
-                for ( j = 0; j < a->len; ++j ) {
-                    int idx;
-                    if(self->version >= 10)
-                        idx = g_array_index(a, int, j);
-                    else
-                        idx = g_array_index(a, uint16_t, j);
-                    SGVec3d tmp = g_array_index(self->wgs84_nodes, SGVec3d, idx);
-                    sg_sphered_expand_by(&d, &tmp);
-                }
-            }
-
-            SGVec3d bs_center = d.center;
-            double bs_radius = d.radius;
-
-            // write group headers
-            fprintf(fp, "\n");
-            fprintf(fp, "# usemtl %s\n", material);
-            fprintf(fp, "# bs %.4f %.4f %.4f %.2f\n",
-                    bs_center.x, bs_center.y, bs_center.z, bs_radius);
-
-            // write groups
-            for ( i = start; i < end; ++i ) {
-                fprintf(fp, "f");
-                GArray *tri_v = g_ptr_array_index(self->tris_v, i);
-                GPtrArray *tri_tcs = g_ptr_array_index(self->tris_tcs,i);
-                for ( j = 0; j < tri_v->len; ++j ) {
-                    int a, b;
-                    GArray *ttcs = g_ptr_array_index(tri_tcs,0);
-                    if(self->version >= 10){
-                        a = g_array_index(tri_v, int, j);
-                        b = g_array_index(ttcs, int, j);
-                    }else{
-                        a = g_array_index(tri_v, uint16_t, j);
-                        b = g_array_index(ttcs, uint16_t, j);
-                    }
-                    fprintf(fp, " %d/%d", a+1, b+1);
-                }
-                fprintf(fp, "\n");
-            }
-
-            start = end;
-            end = start + 1;
-        }
+        sg_bin_object_write_obj_groups(self, fp, &self->triangles, "f");
     }
 
     // dump triangle groups
-    if (self->strips_v->len != 0) {
+    if ( sg_bin_primitives_count(&self->strips) != 0 ) {
         fprintf(fp, "# triangle strips\n");
-
-        guint start = 0;
-        guint end = 1;
-        char *material;
-        while ( start < self->strip_materials->len ) {
-            // find next group
-            material = g_ptr_array_index(self->strip_materials, start);
-            while ( (end < self->strip_materials->len) &&
-                    (!strcmp(material, g_ptr_array_index(self->strip_materials, end))) )
-                {
-                    // cout << "end = " << end << endl;
-                    end++;
-                }
-            // cout << "group = " << start << " to " << end - 1 << endl;
-
-
-            SGSphered d = (SGSphered){
-                .center = (SGVec3d){0.0, 0.0, 0.0},
-                .radius = -1.0
-            };
-            for ( i = start; i < end; ++i ) {
-                GArray *a = g_ptr_array_index(self->tris_v, i);
-                for ( j = 0; j < a->len; ++j ) {
-                    int idx;
-                    if(self->version >= 10)
-                        idx = g_array_index(a, int, j);
-                    else
-                        idx = g_array_index(a, uint16_t, j);
-                    SGVec3d tmp = g_array_index(self->wgs84_nodes, SGVec3d, idx);
-                    sg_sphered_expand_by(&d, &tmp);
-                }
-            }
-
-            SGVec3d bs_center = d.center;
-            double bs_radius = d.radius;
-
-            // write group headers
-            fprintf(fp, "\n");
-            fprintf(fp, "# usemtl %s\n", material);
-            fprintf(fp, "# bs %.4f %.4f %.4f %.2f\n",
-                    bs_center.x, bs_center.y, bs_center.z, bs_radius);
-
-            // write groups
-            for ( i = start; i < end; ++i ) {
-                fprintf(fp, "ts");
-                GArray *strip_v = g_ptr_array_index(self->strips_v, i);
-                GPtrArray *strip_tcs = g_ptr_array_index(self->strips_tcs,i);
-                for ( j = 0; j < strip_v->len; ++j ) {
-                    int a, b;
-                    GArray *stcs = g_ptr_array_index(strip_tcs,0);
-                    if(self->version >= 10){
-                        a = g_array_index(strip_v, int, j);
-                        b = g_array_index(stcs, int, j);
-                    }else{
-                        a = g_array_index(strip_v, uint16_t, j);
-                        b = g_array_index(stcs, uint16_t, j);
-                    }
-                    fprintf(fp, " %d/%d", a+1, b+1);
-                }
-                fprintf(fp, "\n");
-            }
-
-            start = end;
-            end = start + 1;
-        }
+        sg_bin_object_write_obj_groups(self, fp, &self->strips, "ts");
     }
 
     // close the file
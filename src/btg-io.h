@@ -11,6 +11,7 @@
 #ifndef BTG_IO_H
 #define BTG_IO_H
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <glib.h>
 #include <zlib.h>
@@ -21,6 +22,35 @@
 #include "sg-vec.h"
 #include "sg-sphere.h"
 
+/* A run of consecutive primitives sharing the same material and
+ * index/attribute masks*/
+typedef struct {
+    guint material;         // index in SGBinObject materials
+    guint start;            // first primitive of the run
+    unsigned char idx_mask;     // SG_IDX_* index arrays filled for this run
+    unsigned int va_mask;       // SG_VA_* attributes filled for this run
+} SGBinRun;
+
+/* Primitives (points, triangles, strips or fans) stored in a compressed
+ * sparse row layout: indices of all primitives are stored back to back,
+ * primitive i spanning [offsets[i], offsets[i+1]) in each index array.
+ *
+ * An index array is only filled for runs that have the matching bit in
+ * their masks, it stays empty until the first such run and is zero-padded
+ * from there on to stay aligned with offsets.
+ *
+ * Indices are always stored as guint32, whatever the file version.
+ * */
+typedef struct {
+    GArray *offsets;        // guint, number of primitives + 1
+    GArray *v;              // vertex indices
+    GArray *n;              // normal indices
+    GArray *c;              // color indices
+    GArray *tcs[MAX_TC_SETS];   // texture coordinates indices ( up to 4 sets )
+    GArray *vas[MAX_VAS];       // vertex attributes indices ( up to 8 sets )
+    GArray *runs;           // SGBinRun
+} SGBinPrimitives;
+
 typedef struct {
     unsigned short version;
 
@@ -28,55 +58,91 @@ typedef struct {
     float gbs_radius;
 
     GArray *wgs84_nodes;   // vertex list: GArray of SGVec3d
-    GArray *colors;        // color list: GArray of SGVec3d
+    GArray *colors;        // color list: GArray of SGVec4f
     GArray *normals;       // normal list: GArray of SGVec3f
     GArray *texcoords;     // texture coordinate list: GArray of SGVec2f
     GArray *va_flt;        // vertex attribute list (floats): GArray of float
     GArray *va_int;        // vertex attribute list (ints): GArray of int
 
-/*
-typedef std::vector < int > int_list;
-typedef std::vector < int_list > group_list;
-
-typedef std::vector < tci_list > group_tci_list;
-typedef boost::array<int_list, MAX_TC_SETS> tci_list;
-
-typedef boost::array<int_list, MAX_VAS>     vai_list;
-typedef std::vector < vai_list > group_vai_list;
-*/
-    GPtrArray *pts_v;   // points vertex index: PtrArray of int GArray
-    GPtrArray *pts_n;   // points normal index: PtrArray of int GArray
-    GPtrArray *pts_c;   // points color index: PtrArray of int GArray
-    GPtrArray *pts_tcs; // points texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *pts_vas; // points vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *pt_materials; // points materials: GPtrArray of char *
-
-    GPtrArray *tris_v;              	// triangles vertex index: PtrArray of int GArray
-    GPtrArray *tris_n;              	// triangles normal index: PtrArray of int GArray
-    GPtrArray *tris_c;              	// triangles color index: PtrArray of int GArray
-    GPtrArray *tris_tcs;            // triangles texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *tris_vas;            // triangles vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *tri_materials;          // triangles materials: GPtrArray of char *
-
-    GPtrArray *strips_v;            	// tristrips vertex index: PtrArray of int GArray
-    GPtrArray *strips_n;            	// tristrips normal index: PtrArray of int GArray
-    GPtrArray *strips_c;            	// tristrips color index: PtrArray of int GArray
-    GPtrArray *strips_tcs;          // tristrips texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *strips_vas;          // tristrips vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *strip_materials;        // tristrips materials: GPtrArray of char *
-
-    GPtrArray *fans_v;              	// fans vertex index: PtrArray of int GArray
-    GPtrArray *fans_n;              	// fans normal index: PtrArray of int GArray
-    GPtrArray *fans_c;              	// fans color index: PtrArray of int GArray
-    GPtrArray *fans_tcs;            // fanss texture coordinates ( up to 4 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *fans_vas;            // fans vertex attributes ( up to 8 sets ): PtrArray of sized PtrArray of int GArray
-    GPtrArray *fan_materials;	        // fans materials: GPtrArray of char *
+    GPtrArray *materials;  // interned material names: GPtrArray of char *
+
+    SGBinPrimitives points;
+    SGBinPrimitives triangles;
+    SGBinPrimitives strips;
+    SGBinPrimitives fans;
 } SGBinObject;
 
+#define sg_bin_primitives_count(p) ((p)->offsets->len - 1)
+#define sg_bin_primitives_start(p, i) (g_array_index((p)->offsets, guint, (i)))
+#define sg_bin_primitives_end(p, i) (g_array_index((p)->offsets, guint, (i)+1))
+#define sg_bin_run_get(p, r) (&g_array_index((p)->runs, SGBinRun, (r)))
+/*First primitive past the end of run r*/
+#define sg_bin_run_end(p, r) (((r)+1 < (p)->runs->len) ? sg_bin_run_get((p), (r)+1)->start : sg_bin_primitives_count(p))
+
+
+/* Reading context. Holds the file being read, the error state and
+ * buffers that are kept from one file to the next. Readers share
+ * nothing: threads can load files concurrently as long as each one
+ * uses its own reader.
+ * */
+typedef struct{
+    size_t files;           // files read successfully
+    size_t failures;        // files that couldn't be opened or parsed
+    size_t bytes;           // uncompressed bytes parsed
+    size_t objects;         // top level objects read
+    size_t elements;        // object elements read
+}SGBinReaderStats;
+
+typedef struct{
+    /*File being read*/
+    const char *data;
+    size_t size;
+    size_t offset;          // read cursor
+    void *mapping;          // data points into this mapping, to be unmapped
+    size_t mapping_size;
+    bool error;
+
+    /*Scratch buffers, reused across files*/
+    char *inflated;         // data has been inflated here
+    size_t inflated_size;
+    SGVec3d *nodes;         // stream mode: vertices extended to double
+    size_t nodes_size;
+    SGVec2f *texcoords;     // stream mode: texcoords that can't be used in place
+    size_t texcoords_size;
+
+    SGBinReaderStats stats;
+}SGBinReader;
+
+/* Streaming interface: the file is decoded in one pass and triangles are
+ * handed over as soon as they are read, resolved against the vertex and
+ * texture coordinate lists. Normals, colors, vertex attributes, points,
+ * strips and fans are skipped.
+ * */
+typedef struct{
+    void (*bounding_sphere)(void *data, SGVec3d *center, float radius);
+    /*Called before the triangles of each SG_TRIANGLE_FACES object*/
+    bool (*begin_triangles)(void *data, const char *material, unsigned int nelements);
+    bool (*triangle)(void *data, SGVec3d *v1, SGVec2f *t1, SGVec3d *v2, SGVec2f *t2, SGVec3d *v3, SGVec2f *t3);
+    /* Optional, called instead of triangle if set. Corners are given as
+     * indices into the vertex and texture coordinates lists. Objects without
+     * texture coordinates get a list of one (0,0) element*/
+    bool (*indexed_triangle)(void *data, const SGVec3d *nodes, const SGVec2f *texcoords,
+                             const uint32_t v[3], const uint32_t t[3]);
+}SGBinStreamHandlers;
 
 SGBinObject *sg_bin_object_new(void);
 void sg_bin_object_free(SGBinObject *self);
 bool sg_bin_object_write_obj(SGBinObject *self, const char *filename);
 void sg_bin_object_load(SGBinObject *self, const char *filename);
 
+bool sg_bin_object_stream(const char *filename, SGBinStreamHandlers *handlers, void *data);
+
+SGBinReader *sg_bin_reader_new(void);
+SGBinReader *sg_bin_reader_init(SGBinReader *self);
+SGBinReader *sg_bin_reader_dispose(SGBinReader *self);
+SGBinReader *sg_bin_reader_free(SGBinReader *self);
+
+bool sg_bin_object_read(SGBinObject *self, SGBinReader *reader, const char *filename);
+bool sg_bin_reader_stream(SGBinReader *self, const char *filename, SGBinStreamHandlers *handlers, void *data);
+
 #endif
@@ -17,6 +17,7 @@
 #include "misc.h"
 
 #include "fg-scenery.h"
+#include "tile-loader.h"
 
 // return the horizontal tile span factor based on latitude
 static double sg_bucket_span( double l ) {
@@ -309,26 +310,26 @@ void sg_bucket_sibling_set(SGBucket *self, SGBucket *dest, int dx, int dy)
 
 
 
+/**
+ * @brief Returns the bucket's mesh if it has been loaded.
+ *
+ * This function never blocks: if the mesh is not there yet, its loading is
+ * queued on the TileLoader and NULL is returned until the TileManager hands
+ * the result over.
+ *
+ * @param self The bucket to work on
+ * @return The mesh, or NULL if not (yet) available.
+ *
+ * @see tile_manager_collect
+ */
 Mesh *sg_bucket_get_mesh(SGBucket *self)
 {
-    Uint32 start,end;
-    char *filename;
-
-//    printf("Getting mesh for tile %p\n", self);
-    if(!self->mesh){
-        /*TODO: better memory management, avoid malloc/free each call*/
-        filename = fg_scenery_get_file(sg_bucket_getfilename(self));
-        if(!filename)
-            return NULL;
-        printf("Bucket %p lat:%d lon:%d x:%d y:%d: Will load next bucket: path=%s\n",
-            self, self->lat, self->lon, self->x, self->y,
-            filename
-        );
-        start = SDL_GetTicks();
-        self->mesh = mesh_new_from_file(filename);
-        end = SDL_GetTicks();
-        printf("Mesh loaded from disk in %d ms\n",end-start);
-        free(filename);
+    TileLoader *loader;
+
+    if(!self->mesh && !self->loading){
+        loader = tile_loader_get_instance();
+        if(loader)
+            self->loading = tile_loader_request(loader, self, TILE_LOADER_PRIORITY_NOW);
     }
     return self->mesh;
 }
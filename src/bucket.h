@@ -31,6 +31,8 @@ typedef struct{
     unsigned char y;          // y subdivision (0 to 7)
 
     Mesh *mesh;
+    bool loading; /*mesh has been requested from the TileLoader*/
+    size_t size; /*Bytes of the mesh chain in RAM, set once loaded*/
     Uint32 last_used;
 }SGBucket;
 
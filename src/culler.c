@@ -0,0 +1,759 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "culler.h"
+#include "mesh-lod.h"
+
+/**
+ * Culler: frustum culling of all resident groups in one pass.
+ *
+ * The bounds of the cells and groups of every mesh handed to the culler
+ * are kept in contiguous arrays, away from the VGroups. Cells are tested
+ * first, then the groups of the visible cells. Tests are done on float
+ * centers relative to an origin that follows the camera, several
+ * spheres at a time when SSE, AVX or NEON are available.
+ *
+ * Cells in the frustum are then tested against the horizon: with space
+ * scaled so that the (lowered) ellipsoid becomes the unit sphere, a
+ * cell is hidden when its sphere is both beyond the plane of the
+ * horizon circle and inside the cone going from the camera to that
+ * circle. Scaling turns spheres into ellipsoids: their radius is scaled
+ * by the largest factor, that of the polar axis, so that the sphere
+ * used holds the whole ellipsoid and culling stays conservative.
+ *
+ * When enabled, the terrain of the remaining cells is drawn in an
+ * OcclusionBuffer, at the coarsest level of detail that stays under
+ * half an occlusion buffer pixel, and cells then groups hidden by it
+ * are dropped.
+ */
+
+#define CULLER_ALIGN 32
+
+/*WGS84, as in sg_geod.c*/
+#define CULLER_EQURAD 6378137.0
+#define CULLER_SQUASH 0.9966471893352525192801545
+
+typedef struct{
+    double scale[3]; /*World to unit ellipsoid*/
+    double radius_scale; /*Conservative, the largest of scale*/
+    double eye[3]; /*Scaled camera position*/
+    double axis[3]; /*Unit vector from the center to the camera*/
+    double plane; /*Distance from the center to the horizon circle plane*/
+    double cone; /*Half angle of the cone from the camera to the horizon*/
+}CullerHorizon;
+
+static bool culler_spheres_grow(CullerSpheres *self, size_t size);
+static bool culler_add_cells(Culler *self, Mesh *head, Mesh *mesh);
+static bool culler_horizon_init(CullerHorizon *self, SGVec3d *eye);
+static bool culler_horizon_hides(CullerHorizon *self, SGVec3d *center, double radius);
+static void culler_add_occluders(Culler *self, SGVec3d *eye);
+
+Culler *culler_new(void)
+{
+    Culler *rv;
+
+    rv = calloc(1, sizeof(Culler));
+    if(rv){
+        if(!culler_init(rv))
+            return culler_free(rv);
+    }
+    return rv;
+}
+
+Culler *culler_init(Culler *self)
+{
+    /*calloc'ed*/
+    return self;
+}
+
+Culler *culler_dispose(Culler *self)
+{
+    culler_spheres_dispose(&self->cell_bounds);
+    culler_spheres_dispose(&self->group_bounds);
+    if(self->meshes)
+        free(self->meshes);
+    if(self->cells)
+        free(self->cells);
+    if(self->items)
+        free(self->items);
+    if(self->visible_cells)
+        free(self->visible_cells);
+    if(self->visible)
+        free(self->visible);
+    if(self->distances)
+        free(self->distances);
+    if(self->occlusion)
+        occlusion_buffer_free(self->occlusion);
+    return self;
+}
+
+Culler *culler_free(Culler *self)
+{
+    culler_dispose(self);
+    free(self);
+    return NULL;
+}
+
+/**
+ * @brief Starts tracking the groups of @p mesh and of its accessories.
+ *
+ * @param self a Culler
+ * @param mesh The head of a Mesh chain, finished
+ * @return true on success, false on failure
+ */
+bool culler_add_mesh(Culler *self, Mesh *mesh)
+{
+    size_t n_cells, n_groups;
+
+    if(self->n_meshes == self->allocated_meshes){
+        size_t nsize = self->allocated_meshes ? self->allocated_meshes * 2 : 8;
+        CullerMesh *tmp = realloc(self->meshes, nsize * sizeof(CullerMesh));
+        if(!tmp)
+            return false;
+        self->meshes = tmp;
+        self->allocated_meshes = nsize;
+    }
+
+    n_cells = self->cell_bounds.n;
+    n_groups = self->group_bounds.n;
+    for(Mesh *iter = mesh; iter != NULL; iter = iter->next){
+        if(!culler_add_cells(self, mesh, iter)){
+            /*Roll back*/
+            self->cell_bounds.n = n_cells;
+            self->group_bounds.n = n_groups;
+            return false;
+        }
+    }
+    self->meshes[self->n_meshes++] = (CullerMesh){
+        .mesh = mesh,
+        .serial = mesh->serial
+    };
+    return true;
+}
+
+/*
+ * Adds the cells and groups of a single mesh. Meshes without
+ * cells get one that holds all their groups.
+ */
+static bool culler_add_cells(Culler *self, Mesh *head, Mesh *mesh)
+{
+    size_t n_cells;
+    size_t first_item;
+    MeshCell all = {
+        .bs = mesh->bs,
+        .first_group = 0,
+        .n_groups = mesh->n_groups
+    };
+    MeshCell *cells;
+
+    cells = mesh->n_cells ? mesh->cells : &all;
+    n_cells = mesh->n_cells ? mesh->n_cells : 1;
+
+    if(!culler_spheres_grow(&self->cell_bounds, self->cell_bounds.n + n_cells)
+       || !culler_spheres_grow(&self->group_bounds, self->group_bounds.n + mesh->n_groups))
+        return false;
+    /*Parallel arrays follow their spheres*/
+    CullerCell *tcells = realloc(self->cells, self->cell_bounds.allocated * sizeof(CullerCell));
+    if(!tcells)
+        return false;
+    self->cells = tcells;
+    uint32_t *tvcells = realloc(self->visible_cells, self->cell_bounds.allocated * sizeof(uint32_t));
+    if(!tvcells)
+        return false;
+    self->visible_cells = tvcells;
+    CullerItem *titems = realloc(self->items, self->group_bounds.allocated * sizeof(CullerItem));
+    if(!titems)
+        return false;
+    self->items = titems;
+    uint32_t *tvisible = realloc(self->visible, self->group_bounds.allocated * sizeof(uint32_t));
+    if(!tvisible)
+        return false;
+    self->visible = tvisible;
+    float *tdistances = realloc(self->distances, self->group_bounds.allocated * sizeof(float));
+    if(!tdistances)
+        return false;
+    self->distances = tdistances;
+
+    for(size_t i = 0; i < n_cells; i++){
+        first_item = self->group_bounds.n;
+        for(size_t j = 0; j < cells[i].n_groups; j++){
+            VGroup *group = &mesh->groups[cells[i].first_group + j];
+
+            self->items[self->group_bounds.n] = (CullerItem){
+                .head = head,
+                .mesh = mesh,
+                .group = group
+            };
+            culler_spheres_add(&self->group_bounds, &group->bs, &self->origin);
+        }
+        self->cells[self->cell_bounds.n] = (CullerCell){
+            .first_item = first_item,
+            .n_items = cells[i].n_groups
+        };
+        culler_spheres_add(&self->cell_bounds, &cells[i].bs, &self->origin);
+    }
+    return true;
+}
+
+/**
+ * @brief Stops tracking the groups of a Mesh chain.
+ *
+ * Only pointers are compared: @p mesh needs not be valid anymore.
+ * Remaining groups keep their order.
+ *
+ * @param self a Culler
+ * @param mesh The head of a chain given to culler_add_mesh
+ */
+void culler_remove_mesh(Culler *self, Mesh *mesh)
+{
+    CullerSpheres *cb, *gb;
+    size_t nc, ng;
+    size_t i;
+
+    for(i = 0; i < self->n_meshes; i++){
+        if(self->meshes[i].mesh == mesh)
+            break;
+    }
+    if(i == self->n_meshes)
+        return;
+    memmove(&self->meshes[i], &self->meshes[i+1], (self->n_meshes - i - 1) * sizeof(CullerMesh));
+    self->n_meshes--;
+
+    /*Keep the cells, and their items, that belong to other chains*/
+    cb = &self->cell_bounds;
+    gb = &self->group_bounds;
+    nc = ng = 0;
+    for(size_t c = 0; c < cb->n; c++){
+        CullerCell *cell = &self->cells[c];
+
+        /*Empty cells can't be told apart, dropping them is harmless*/
+        if(!cell->n_items || self->items[cell->first_item].head == mesh)
+            continue;
+
+        for(size_t j = 0; j < cell->n_items; j++){
+            size_t src = cell->first_item + j;
+            gb->x[ng] = gb->x[src];
+            gb->y[ng] = gb->y[src];
+            gb->z[ng] = gb->z[src];
+            gb->r[ng] = gb->r[src];
+            gb->centers[ng] = gb->centers[src];
+            self->items[ng] = self->items[src];
+            ng++;
+        }
+        cb->x[nc] = cb->x[c];
+        cb->y[nc] = cb->y[c];
+        cb->z[nc] = cb->z[c];
+        cb->r[nc] = cb->r[c];
+        cb->centers[nc] = cb->centers[c];
+        self->cells[nc] = (CullerCell){
+            .first_item = ng - cell->n_items,
+            .n_items = cell->n_items
+        };
+        nc++;
+    }
+    cb->n = nc;
+    gb->n = ng;
+    self->n_visible = self->n_visible_cells = 0;
+}
+
+/**
+ * @brief Makes the culler track exactly the @p n meshes of @p meshes.
+ *
+ * Meshes that are not in @p meshes anymore are removed, new ones
+ * are added. Tracked meshes can have been freed since the last call.
+ *
+ * @param self a Culler
+ * @param meshes Heads of Mesh chains
+ * @param n Number of meshes in @p meshes
+ * @return true on success, false if a mesh couldn't be added
+ */
+bool culler_set_meshes(Culler *self, Mesh **meshes, size_t n)
+{
+    bool found;
+    bool rv;
+
+    for(size_t i = 0; i < self->n_meshes; i++){
+        found = false;
+        /*Only dereference meshes that are known to be alive*/
+        for(size_t j = 0; j < n && !found; j++)
+            found = meshes[j] == self->meshes[i].mesh && meshes[j]->serial == self->meshes[i].serial;
+        if(!found){
+            culler_remove_mesh(self, self->meshes[i].mesh);
+            i--;
+        }
+    }
+
+    rv = true;
+    for(size_t j = 0; j < n; j++){
+        found = false;
+        for(size_t i = 0; i < self->n_meshes && !found; i++)
+            found = meshes[j] == self->meshes[i].mesh;
+        if(!found)
+            rv = culler_add_mesh(self, meshes[j]) && rv;
+    }
+    return rv;
+}
+
+/**
+ * @brief Turns occlusion culling by the terrain on or off.
+ *
+ * @param self a Culler
+ * @param enabled true to enable occlusion culling
+ * @param fovy Vertical field of view (radians) of the camera
+ * @return true on success, false if the occlusion buffer couldn't be
+ * created (occlusion culling is then off)
+ */
+bool culler_set_occlusion(Culler *self, bool enabled, float fovy)
+{
+    if(!enabled){
+        if(self->occlusion)
+            self->occlusion = occlusion_buffer_free(self->occlusion);
+        return true;
+    }
+    if(!self->occlusion){
+        self->occlusion = occlusion_buffer_new(OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+        if(!self->occlusion)
+            return false;
+    }
+    self->occlusion_scale = self->occlusion->height / (2.0 * tan(fovy / 2.0));
+    return true;
+}
+
+/*Distance from @p eye to the sphere of cell @p c, 0 when inside*/
+static float culler_cell_distance(Culler *self, uint32_t c, SGVec3d *eye)
+{
+    CullerSpheres *cb = &self->cell_bounds;
+    float dx, dy, dz, d;
+
+    dx = cb->x[c] - (eye->x - self->origin.x);
+    dy = cb->y[c] - (eye->y - self->origin.y);
+    dz = cb->z[c] - (eye->z - self->origin.z);
+    d = sqrtf(dx*dx + dy*dy + dz*dz) - cb->r[c];
+    return d > 0.0f ? d : 0.0f;
+}
+
+/**
+ * @brief Computes the visible groups.
+ *
+ * Results are stored in self->visible (indices in self->items), in
+ * the order groups have been added. Groups of a same mesh are
+ * therefore consecutive. self->distances holds the distance from
+ * the camera to the cell of each visible group, 0 when inside.
+ *
+ * @param self a Culler
+ * @param vp The View-Projection matrix
+ * @param eye The camera position, in world coordinates
+ * @return The number of visible groups
+ */
+size_t culler_cull(Culler *self, mat4d vp, SGVec3d *eye)
+{
+    float planes[6][4];
+    CullerHorizon horizon;
+    CullerCell *cell;
+    CullerSpheres *cb, *gb;
+    size_t first, n;
+    float d;
+
+    if(sg_vect3d_distSqr(eye, &self->origin) > CULLER_REBASE_DISTANCE*CULLER_REBASE_DISTANCE){
+        self->origin = *eye;
+        culler_spheres_rebase(&self->cell_bounds, &self->origin);
+        culler_spheres_rebase(&self->group_bounds, &self->origin);
+    }
+    culler_get_planes(vp, &self->origin, planes);
+    cb = &self->cell_bounds;
+    gb = &self->group_bounds;
+
+    self->n_visible_cells = culler_spheres_test(cb, planes,
+        0, cb->n, self->visible_cells
+    );
+
+    self->n_horizon_cells = 0;
+    if(culler_horizon_init(&horizon, eye)){
+        n = 0;
+        for(size_t i = 0; i < self->n_visible_cells; i++){
+            uint32_t c = self->visible_cells[i];
+            if(culler_horizon_hides(&horizon, &cb->centers[c], cb->r[c]))
+                self->n_horizon_cells++;
+            else
+                self->visible_cells[n++] = c;
+        }
+        self->n_visible_cells = n;
+    }
+
+    self->n_occluded_cells = 0;
+    if(self->occlusion){
+        occlusion_buffer_clear(self->occlusion, vp);
+        culler_add_occluders(self, eye);
+        n = 0;
+        for(size_t i = 0; i < self->n_visible_cells; i++){
+            uint32_t c = self->visible_cells[i];
+            SGSphered bs = {.center = cb->centers[c], .radius = cb->r[c]};
+
+            if(occlusion_buffer_is_occluded(self->occlusion, &bs))
+                self->n_occluded_cells++;
+            else
+                self->visible_cells[n++] = c;
+        }
+        self->n_visible_cells = n;
+    }
+
+    self->n_visible = 0;
+    self->n_occluded = 0;
+    for(size_t i = 0; i < self->n_visible_cells; i++){
+        uint32_t c = self->visible_cells[i];
+        cell = &self->cells[c];
+        first = self->n_visible;
+        self->n_visible += culler_spheres_test(gb, planes,
+            cell->first_item, cell->n_items, self->visible + self->n_visible
+        );
+        if(self->occlusion){
+            n = first;
+            for(size_t j = first; j < self->n_visible; j++){
+                uint32_t g = self->visible[j];
+                SGSphered bs = {.center = gb->centers[g], .radius = gb->r[g]};
+
+                if(occlusion_buffer_is_occluded(self->occlusion, &bs))
+                    self->n_occluded++;
+                else
+                    self->visible[n++] = g;
+            }
+            self->n_visible = n;
+        }
+        d = culler_cell_distance(self, c, eye);
+        for(size_t j = first; j < self->n_visible; j++)
+            self->distances[j] = d;
+    }
+    return self->n_visible;
+}
+
+/*
+ * Draws the terrain of the visible cells in the occlusion buffer.
+ * Accessories (e.g buildings) are too small to be worth it.
+ */
+static void culler_add_occluders(Culler *self, SGVec3d *eye)
+{
+    CullerItem *item;
+    indice_t *indices;
+    size_t n_indices;
+    float d, bias;
+    int lod;
+
+    for(size_t i = 0; i < self->n_visible_cells; i++){
+        uint32_t c = self->visible_cells[i];
+        CullerCell *cell = &self->cells[c];
+
+        d = culler_cell_distance(self, c, eye);
+        for(size_t j = 0; j < cell->n_items; j++){
+            item = &self->items[cell->first_item + j];
+            if(item->mesh != item->head)
+                continue;
+            lod = vgroup_select_lod(item->group, d, self->occlusion_scale, CULLER_OCCLUDER_ERROR);
+            indices = vgroup_get_lod_indices(item->group, lod, &n_indices);
+            bias = CULLER_OCCLUDER_BIAS + (lod ? item->group->lods[lod - 1].error : 0.0f);
+            occlusion_buffer_add_triangles(self->occlusion, item->mesh->transformation,
+                item->group->positions, indices, n_indices, bias
+            );
+        }
+    }
+}
+
+/*
+ * Sets up the horizon seen from @p eye. Returns false when the camera
+ * is below the horizon ellipsoid, which then hides nothing.
+ */
+static bool culler_horizon_init(CullerHorizon *self, SGVec3d *eye)
+{
+    double a = CULLER_EQURAD - CULLER_HORIZON_MARGIN;
+    double b = CULLER_EQURAD * CULLER_SQUASH - CULLER_HORIZON_MARGIN;
+    double len;
+
+    self->scale[0] = self->scale[1] = 1.0 / a;
+    self->scale[2] = self->radius_scale = 1.0 / b;
+    self->eye[0] = eye->x * self->scale[0];
+    self->eye[1] = eye->y * self->scale[1];
+    self->eye[2] = eye->z * self->scale[2];
+    len = sqrt(self->eye[0]*self->eye[0] + self->eye[1]*self->eye[1] + self->eye[2]*self->eye[2]);
+    if(len <= 1.0)
+        return false;
+    for(int i = 0; i < 3; i++)
+        self->axis[i] = self->eye[i] / len;
+    self->plane = 1.0 / len;
+    self->cone = asin(1.0 / len);
+    return true;
+}
+
+/*Tells whether the sphere @p center, @p radius is below the horizon*/
+static bool culler_horizon_hides(CullerHorizon *self, SGVec3d *center, double radius)
+{
+    double c[3], dc[3];
+    double r, dist, cosa;
+
+    r = radius * self->radius_scale;
+    c[0] = center->x * self->scale[0];
+    c[1] = center->y * self->scale[1];
+    c[2] = center->z * self->scale[2];
+    if(c[0]*self->axis[0] + c[1]*self->axis[1] + c[2]*self->axis[2] + r > self->plane)
+        return false;
+
+    for(int i = 0; i < 3; i++)
+        dc[i] = c[i] - self->eye[i];
+    dist = sqrt(dc[0]*dc[0] + dc[1]*dc[1] + dc[2]*dc[2]);
+    if(dist <= r)
+        return false;
+    /*Angle between the cone axis and the direction of the sphere*/
+    cosa = -(dc[0]*self->axis[0] + dc[1]*self->axis[1] + dc[2]*self->axis[2]) / dist;
+    if(cosa > 1.0) cosa = 1.0;
+    if(cosa < -1.0) cosa = -1.0;
+    return acos(cosa) + asin(r / dist) <= self->cone;
+}
+
+/**
+ * @brief Extracts the frustum planes of @p vp, relative to @p origin.
+ *
+ * Planes are in the same order as glm_frustum_planes: left, right,
+ * bottom, top, near, far. Normals point inwards. Extraction is done in
+ * double precision, before moving to @p origin.
+ */
+void culler_get_planes(mat4d vp, SGVec3d *origin, float planes[6][4])
+{
+    double p[4];
+    double len;
+
+    for(int i = 0; i < 6; i++){
+        int row = i / 2;
+        double sign = (i % 2) ? -1.0 : 1.0;
+
+        for(int j = 0; j < 4; j++)
+            p[j] = vp[j][3] + sign * vp[j][row];
+        len = sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+        for(int j = 0; j < 4; j++)
+            p[j] /= len;
+        p[3] += p[0]*origin->x + p[1]*origin->y + p[2]*origin->z;
+        for(int j = 0; j < 4; j++)
+            planes[i][j] = p[j];
+    }
+}
+
+/**
+ * @brief Tests the spheres first to first+n-1 against @p planes.
+ *
+ * @param self The spheres
+ * @param planes Frustum planes, relative to the spheres origin
+ * @param first First sphere to test
+ * @param n Number of spheres to test
+ * @param visible Where to store the indices of the visible spheres,
+ * must have room for @p n indices
+ * @return The number of visible spheres
+ */
+size_t culler_spheres_test(CullerSpheres *self, float planes[6][4], size_t first, size_t n, uint32_t *visible)
+{
+    size_t end = first + n;
+    size_t rv = 0;
+    size_t i = first;
+    unsigned int mask;
+
+#if defined(__AVX__)
+    for(; i < end; i += 8){
+        __m256 x = _mm256_loadu_ps(self->x + i);
+        __m256 y = _mm256_loadu_ps(self->y + i);
+        __m256 z = _mm256_loadu_ps(self->z + i);
+        __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(self->r + i));
+        __m256 in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for(int p = 0; p < 6; p++){
+            __m256 d = _mm256_add_ps(
+                _mm256_add_ps(
+                    _mm256_mul_ps(x, _mm256_set1_ps(planes[p][0])),
+                    _mm256_mul_ps(y, _mm256_set1_ps(planes[p][1]))
+                ),
+                _mm256_add_ps(
+                    _mm256_mul_ps(z, _mm256_set1_ps(planes[p][2])),
+                    _mm256_set1_ps(planes[p][3])
+                )
+            );
+            in = _mm256_and_ps(in, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+        }
+        mask = _mm256_movemask_ps(in);
+        if(end - i < 8)
+            mask &= (1u << (end - i)) - 1;
+        while(mask){
+            visible[rv++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    for(; i < end; i += 4){
+        __m128 x = _mm_loadu_ps(self->x + i);
+        __m128 y = _mm_loadu_ps(self->y + i);
+        __m128 z = _mm_loadu_ps(self->z + i);
+        __m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(self->r + i));
+        __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for(int p = 0; p < 6; p++){
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(x, _mm_set1_ps(planes[p][0])),
+                    _mm_mul_ps(y, _mm_set1_ps(planes[p][1]))
+                ),
+                _mm_add_ps(
+                    _mm_mul_ps(z, _mm_set1_ps(planes[p][2])),
+                    _mm_set1_ps(planes[p][3])
+                )
+            );
+            in = _mm_and_ps(in, _mm_cmpge_ps(d, nr));
+        }
+        mask = _mm_movemask_ps(in);
+        if(end - i < 4)
+            mask &= (1u << (end - i)) - 1;
+        while(mask){
+            visible[rv++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    for(; i < end; i += 4){
+        float32x4_t x = vld1q_f32(self->x + i);
+        float32x4_t y = vld1q_f32(self->y + i);
+        float32x4_t z = vld1q_f32(self->z + i);
+        float32x4_t nr = vnegq_f32(vld1q_f32(self->r + i));
+        uint32x4_t in = vdupq_n_u32(0xffffffff);
+
+        for(int p = 0; p < 6; p++){
+            float32x4_t d = vdupq_n_f32(planes[p][3]);
+            d = vmlaq_n_f32(d, x, planes[p][0]);
+            d = vmlaq_n_f32(d, y, planes[p][1]);
+            d = vmlaq_n_f32(d, z, planes[p][2]);
+            in = vandq_u32(in, vcgeq_f32(d, nr));
+        }
+        mask = (vgetq_lane_u32(in, 0) & 1)
+             | (vgetq_lane_u32(in, 1) & 2)
+             | (vgetq_lane_u32(in, 2) & 4)
+             | (vgetq_lane_u32(in, 3) & 8);
+        if(end - i < 4)
+            mask &= (1u << (end - i)) - 1;
+        while(mask){
+            visible[rv++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#else
+    for(; i < end; i++){
+        bool in = true;
+
+        for(int p = 0; p < 6 && in; p++){
+            float d = self->x[i]*planes[p][0] + self->y[i]*planes[p][1]
+                    + self->z[i]*planes[p][2] + planes[p][3];
+            in = d >= -self->r[i];
+        }
+        if(in)
+            visible[rv++] = i;
+    }
+#endif
+    return rv;
+}
+
+/**
+ * @brief Appends a sphere.
+ *
+ * @param self The spheres
+ * @param bs The sphere, in world coordinates
+ * @param origin Current origin of the float centers
+ * @return true on success, false on failure
+ */
+bool culler_spheres_add(CullerSpheres *self, SGSphered *bs, SGVec3d *origin)
+{
+    size_t i;
+
+    if(!culler_spheres_grow(self, self->n + 1))
+        return false;
+    i = self->n++;
+    self->centers[i] = bs->center;
+    self->x[i] = bs->center.x - origin->x;
+    self->y[i] = bs->center.y - origin->y;
+    self->z[i] = bs->center.z - origin->z;
+    self->r[i] = bs->radius;
+    return true;
+}
+
+/**
+ * @brief Recomputes float centers relative to a new origin.
+ */
+void culler_spheres_rebase(CullerSpheres *self, SGVec3d *origin)
+{
+    for(size_t i = 0; i < self->n; i++){
+        self->x[i] = self->centers[i].x - origin->x;
+        self->y[i] = self->centers[i].y - origin->y;
+        self->z[i] = self->centers[i].z - origin->z;
+    }
+}
+
+void culler_spheres_dispose(CullerSpheres *self)
+{
+    if(self->x) free(self->x);
+    if(self->y) free(self->y);
+    if(self->z) free(self->z);
+    if(self->r) free(self->r);
+    if(self->centers) free(self->centers);
+    memset(self, 0, sizeof(CullerSpheres));
+}
+
+/*
+ * Makes room for @p size spheres, plus CULLER_PADDING. Float arrays
+ * are CULLER_ALIGN-aligned.
+ */
+static bool culler_spheres_grow(CullerSpheres *self, size_t size)
+{
+    size_t nsize;
+    float **arrays[4] = {&self->x, &self->y, &self->z, &self->r};
+    float *tmp[4];
+    SGVec3d *centers;
+
+    if(size + CULLER_PADDING <= self->allocated)
+        return true;
+
+    nsize = self->allocated ? self->allocated * 2 : 64;
+    while(nsize < size + CULLER_PADDING)
+        nsize *= 2;
+
+    centers = realloc(self->centers, nsize * sizeof(SGVec3d));
+    if(!centers)
+        return false;
+    self->centers = centers;
+
+    for(int i = 0; i < 4; i++){
+        tmp[i] = aligned_alloc(CULLER_ALIGN, nsize * sizeof(float));
+        if(!tmp[i]){
+            for(int j = 0; j < i; j++)
+                free(tmp[j]);
+            return false;
+        }
+    }
+    for(int i = 0; i < 4; i++){
+        if(*arrays[i]){
+            memcpy(tmp[i], *arrays[i], self->allocated * sizeof(float));
+            free(*arrays[i]);
+        }
+        /*Padding is read by vector loads, keep it defined*/
+        memset(tmp[i] + self->allocated, 0, (nsize - self->allocated) * sizeof(float));
+        *arrays[i] = tmp[i];
+    }
+    self->allocated = nsize;
+    return true;
+}
@@ -0,0 +1,109 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef CULLER_H
+#define CULLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <cglm/cglm.h>
+
+#include "mesh.h"
+#include "occlusion-buffer.h"
+#include "sg-sphere.h"
+
+/*Float centers are rebased once the camera is this far (meters) from their origin*/
+#define CULLER_REBASE_DISTANCE 1000.0
+/*Arrays are padded so that vector loads never go past their end*/
+#define CULLER_PADDING 8
+/* The horizon is the one of the WGS84 ellipsoid lowered by this much
+ * (meters), which keeps it below the geoid and the lowest lands*/
+#define CULLER_HORIZON_MARGIN 500.0
+/*Error (occlusion buffer pixels) of the levels of detail used as occluders*/
+#define CULLER_OCCLUDER_ERROR 0.5
+/*Distance (meters) added to occluders, on top of their level of detail error*/
+#define CULLER_OCCLUDER_BIAS 2.0
+
+/* Bounding spheres as a structure of arrays. Centers are floats
+ * relative to an origin close to the camera, the double world centers
+ * are kept to rebase them.*/
+typedef struct{
+    float *x;
+    float *y;
+    float *z;
+    float *r;
+    SGVec3d *centers;
+    size_t n;
+    size_t allocated;
+}CullerSpheres;
+
+typedef struct{
+    Mesh *head; /*Chain the group belongs to*/
+    Mesh *mesh; /*Mesh the group belongs to*/
+    VGroup *group;
+}CullerItem;
+
+/*A range of items, the groups of a MeshCell*/
+typedef struct{
+    size_t first_item;
+    size_t n_items;
+}CullerCell;
+
+typedef struct{
+    Mesh *mesh; /*Any mesh of a chain*/
+    unsigned long serial; /*Tells apart meshes allocated at the same address*/
+}CullerMesh;
+
+typedef struct{
+    CullerMesh *meshes;
+    size_t n_meshes;
+    size_t allocated_meshes;
+
+    /*Cells of all meshes, in mesh order*/
+    CullerSpheres cell_bounds;
+    CullerCell *cells; /*n is cell_bounds.n*/
+
+    /*Groups of all meshes, in cell order*/
+    CullerSpheres group_bounds;
+    CullerItem *items; /*n is group_bounds.n*/
+
+    SGVec3d origin;
+
+    /*NULL when occlusion culling is off, see culler_set_occlusion*/
+    OcclusionBuffer *occlusion;
+    float occlusion_scale; /*Occlusion buffer pixels per meter at 1 m*/
+
+    /*Results of the last culler_cull call*/
+    uint32_t *visible_cells;
+    size_t n_visible_cells;
+    uint32_t *visible; /*Indices in items*/
+    float *distances; /*Camera to the item cell distance (meters), parallel to visible*/
+    size_t n_visible;
+    /*Cells in the frustum but below the horizon, or hidden by terrain*/
+    size_t n_horizon_cells;
+    size_t n_occluded_cells;
+    size_t n_occluded; /*Groups of visible cells hidden by terrain*/
+}Culler;
+
+Culler *culler_new(void);
+Culler *culler_init(Culler *self);
+Culler *culler_dispose(Culler *self);
+Culler *culler_free(Culler *self);
+
+bool culler_add_mesh(Culler *self, Mesh *mesh);
+void culler_remove_mesh(Culler *self, Mesh *mesh);
+bool culler_set_meshes(Culler *self, Mesh **meshes, size_t n);
+bool culler_set_occlusion(Culler *self, bool enabled, float fovy);
+size_t culler_cull(Culler *self, mat4d vp, SGVec3d *eye);
+
+bool culler_spheres_add(CullerSpheres *self, SGSphered *bs, SGVec3d *origin);
+void culler_spheres_rebase(CullerSpheres *self, SGVec3d *origin);
+void culler_spheres_dispose(CullerSpheres *self);
+void culler_get_planes(mat4d vp, SGVec3d *origin, float planes[6][4]);
+size_t culler_spheres_test(CullerSpheres *self, float planes[6][4], size_t first, size_t n, uint32_t *visible);
+#endif /* CULLER_H */
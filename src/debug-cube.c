@@ -19,6 +19,7 @@
 
 #include "debug-cube-shader.h"
 #include "debug-cube.h"
+#include "gl-state.h"
 
 // Our vertices. Three consecutive floats give a 3D vertex; Three consecutive vertices give a triangle.
 // A cube has 6 faces with 2 triangles each, so this makes 6*2=12 triangles, and 12*3 vertices
@@ -122,11 +123,11 @@ DebugCube *debug_cube_init(DebugCube *self)
     glm_mat4_mul(self->projection, self->view, self->mvp);
 
     glGenBuffers(1, &self->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, self->vbo);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, &self->colors);
-    glBindBuffer(GL_ARRAY_BUFFER, self->colors);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->colors);
     glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
 
     return self;
@@ -150,7 +151,7 @@ void debug_cube_render(DebugCube *self)
     static float deg = 0;
 
     glDisable(GL_DEPTH_TEST);   // skybox should be drawn behind anything else
-    glUseProgram(SHADER(self->shader)->program_id);
+    gl_state_use_program(SHADER(self->shader)->program_id);
 
     glm_rotate_x(rot, glm_rad(deg), rot);
     deg += 1.0;
@@ -162,8 +163,8 @@ void debug_cube_render(DebugCube *self)
 //    glUniformMatrix4fv(self->shader->mvp, 1, GL_FALSE, self->mvp[0]);
 
     // 1rst attribute buffer : vertices
-    glEnableVertexAttribArray(self->shader->position);
-    glBindBuffer(GL_ARRAY_BUFFER, self->vbo);
+    gl_state_enable_attrib(self->shader->position);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->vbo);
     glVertexAttribPointer(
        self->shader->position,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
        3,                  // size
@@ -173,8 +174,8 @@ void debug_cube_render(DebugCube *self)
        (void*)0            // array buffer offset
     );
 
-    glEnableVertexAttribArray(self->shader->color);
-    glBindBuffer(GL_ARRAY_BUFFER, self->colors);
+    gl_state_enable_attrib(self->shader->color);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->colors);
     glVertexAttribPointer(
         self->shader->color,                                // attribute. No particular reason for 1, but must match the layout in the shader.
         3,                                // size
@@ -186,8 +187,8 @@ void debug_cube_render(DebugCube *self)
 
     // Draw the triangle !
     glDrawArrays(GL_TRIANGLES, 0, 12*3); // 12*3 indices starting at 0 -> 12 triangles -> 6 squares
-    glDisableVertexAttribArray(self->vbo);
-    glDisableVertexAttribArray(self->colors);
+    gl_state_disable_attrib(self->vbo);
+    gl_state_disable_attrib(self->colors);
 
-    glUseProgram(0);
+    gl_state_use_program(0);
 }
@@ -20,6 +20,7 @@
 
 #include "debug-triangle-shader.h"
 #include "debug-triangle.h"
+#include "gl-state.h"
 
 // An array of 3 vectors which represents 3 vertices
 static const GLfloat g_vertex_buffer_data[] = {
@@ -45,7 +46,7 @@ DebugTriangle *debug_triangle_init(DebugTriangle *self)
     self->shader = debug_triangle_shader_new();
 
     glGenBuffers(1, &self->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, self->vbo);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
 
     return self;
@@ -64,14 +65,14 @@ void *debug_triangle_free(DebugTriangle *self)
 
 void debug_triangle_render(DebugTriangle *self)
 {
-    glUseProgram(SHADER(self->shader)->program_id);
+    gl_state_use_program(SHADER(self->shader)->program_id);
 
     glUniformMatrix4fv(self->shader->mvp, 1, GL_FALSE, GLM_MAT4_IDENTITY[0]);
 
 
     // 1rst attribute buffer : vertices
-    glEnableVertexAttribArray(self->shader->position);
-    glBindBuffer(GL_ARRAY_BUFFER, self->vbo);
+    gl_state_enable_attrib(self->shader->position);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->vbo);
     glVertexAttribPointer(
        self->vbo,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
        3,                  // size
@@ -82,7 +83,7 @@ void debug_triangle_render(DebugTriangle *self)
     );
     // Draw the triangle !
     glDrawArrays(GL_TRIANGLES, 0, 3); // Starting from vertex 0; 3 vertices total -> 1 triangle
-    glDisableVertexAttribArray(self->vbo);
+    gl_state_disable_attrib(self->vbo);
 
-    glUseProgram(0);
+    gl_state_use_program(0);
 }
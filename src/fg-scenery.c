@@ -73,7 +73,6 @@ char *fg_scenery_get_file(const char *filename)
             asprintf(&url, "%s/%s", FG_MIRROR_URL, filename);
         if(!http_download_file(url, rv)){
             printf("Failure to download %s\n", url);
-            exit(0);
             free(rv);
             rv = NULL;
         }
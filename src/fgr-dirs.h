@@ -28,6 +28,10 @@
 #define TERRAIN_DIR FGR_HOME"/resources/fg-scenery/Terrain"
 #endif
 
+#ifndef CACHE_DIR
+#define CACHE_DIR FGR_HOME"/resources/cache"
+#endif
+
 #ifndef TEX_DIR
 #if USE_TINY_TEXTURES
 #define TEX_DIR FGR_HOME"/resources/fg-scenery/textures/small"
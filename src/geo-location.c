@@ -9,8 +9,6 @@
 #include <stdio.h>
 #include "geo-location.h"
 
-#define EARTH_RADIUS_M 6371009
-
 #define MIN_LAT -90.0
 #define MAX_LAT 90.0
 #define MIN_LON -180.0
@@ -228,6 +226,33 @@ double geo_location_bearing(GeoLocation *self, GeoLocation *dest)
     return rv;
 }
 
+/**
+ * @brief Computes the location reached when going @p distance meters
+ * from @p self along the great circle of initial @p bearing.
+ *
+ * @param self The starting GeoLocation
+ * @param bearing Initial bearing, in degrees
+ * @param distance Distance to go, in meters
+ * @param dest Where to store the reached location. Can be @p self.
+ *
+ * @return true on success, false on failure
+ */
+bool geo_location_destination(GeoLocation *self, double bearing, double distance, GeoLocation *dest)
+{
+    double slat = deg2rad(self->latitude);
+    double slon = deg2rad(self->longitude);
+    double brg = deg2rad(bearing);
+    double ad = distance / EARTH_RADIUS_M; /*angular distance*/
+    double dlat, dlon;
+
+    dlat = asin(sin(slat)*cos(ad) + cos(slat)*sin(ad)*cos(brg));
+    dlon = slon + atan2(sin(brg)*sin(ad)*cos(slat), cos(ad) - sin(slat)*sin(dlat));
+    /*Back to [-180,180]*/
+    dlon = fmod(dlon + 3.0*M_PI, 2.0*M_PI) - M_PI;
+
+    return geo_location_set_rad(dest, dlat, dlon);
+}
+
 static inline bool valid_latitude(double value)
 {
     return value >= MIN_LAT && value <= MAX_LAT;
@@ -17,6 +17,9 @@ typedef struct{
     double longitude;
 }GeoLocation;
 
+/*Mean radius, used for all distances*/
+#define EARTH_RADIUS_M 6371009
+
 #define deg2rad(deg) ((deg) * M_PI/180.0)
 #define rad2deg(rad) ((rad) * 180.0/M_PI)
 
@@ -30,6 +33,7 @@ char *geo_location_latitude_to_dms(double latitude, char *obuf);
 char *geo_location_longitude_to_dms(double longitude, char *obuf);
 
 double geo_location_bearing(GeoLocation *self, GeoLocation *dest);
+bool geo_location_destination(GeoLocation *self, double bearing, double distance, GeoLocation *dest);
 
 static inline bool geo_location_set_rad(GeoLocation *self, double latitude, double longitude)
 {
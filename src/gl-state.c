@@ -0,0 +1,383 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#define GL_GLEXT_PROTOTYPES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if USE_GLES
+#include <SDL2/SDL_opengles2.h>
+#include <SDL_opengles2_gl2ext.h>
+#else
+#include <SDL2/SDL_opengl.h>
+#include <SDL2/SDL_opengl_glext.h>
+#endif
+
+#include <SDL2/SDL.h>
+
+#include "gl-state.h"
+
+/**
+ * GLState: a cache of the GL bindings the renderer changes the most,
+ * that drops calls setting what is already set.
+ *
+ * There is a single GL context, so a single cache. Every bind of the
+ * program, textures, buffers and vertex arrays, and every change of the
+ * enabled attributes, must go through it. Code that doesn't must call
+ * gl_state_invalidate afterwards.
+ *
+ * Enabled attributes and the element array buffer belong to the bound
+ * vertex array object: they are only cached for the default one.
+ *
+ * The cache also counts GL calls. Calls that don't go through it can be
+ * added with gl_state_count, to get the number of calls per frame.
+ */
+
+typedef void (*GenVertexArraysFunc)(GLsizei n, GLuint *arrays);
+typedef void (*BindVertexArrayFunc)(GLuint array);
+typedef void (*DeleteVertexArraysFunc)(GLsizei n, const GLuint *arrays);
+
+/*Texture targets that are cached*/
+typedef enum{
+    GL_STATE_TEXTURE_2D,
+    GL_STATE_TEXTURE_CUBE_MAP,
+    GL_STATE_TEXTURE_2D_ARRAY,
+    GL_STATE_N_TARGETS
+}GLStateTarget;
+
+typedef struct{
+    bool ready; /*Cached values have been set to GL_STATE_UNKNOWN*/
+
+    GLuint program;
+    GLenum active_texture; /*0 based*/
+    GLuint textures[GL_STATE_MAX_TEXTURE_UNITS][GL_STATE_N_TARGETS];
+    GLuint array_buffer;
+    GLuint element_buffer; /*Of the default vertex array*/
+    uint32_t attribs; /*Enabled attributes of the default vertex array*/
+    uint32_t known_attribs;
+    GLuint vertex_array;
+
+    /*NULL when vertex array objects aren't available*/
+    GenVertexArraysFunc gen_vertex_arrays;
+    BindVertexArrayFunc bind_vertex_array;
+    DeleteVertexArraysFunc delete_vertex_arrays;
+
+    GLStateStats stats;
+}GLState;
+
+static GLState gl_state = {0};
+
+static inline void gl_state_check(void)
+{
+    if(!gl_state.ready)
+        gl_state_invalidate();
+}
+
+static int gl_state_target_index(GLenum target)
+{
+    switch(target){
+        case GL_TEXTURE_2D:
+            return GL_STATE_TEXTURE_2D;
+        case GL_TEXTURE_CUBE_MAP:
+            return GL_STATE_TEXTURE_CUBE_MAP;
+#ifdef GL_TEXTURE_2D_ARRAY
+        case GL_TEXTURE_2D_ARRAY:
+            return GL_STATE_TEXTURE_2D_ARRAY;
+#endif
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Looks up what the current context supports and forgets all
+ * cached state.
+ *
+ * Must be called once the GL context has been created. Without it
+ * the cache works, but vertex array objects are never used.
+ *
+ * @return true if vertex array objects are available
+ */
+bool gl_state_init(void)
+{
+    const char *version;
+    bool available;
+
+    memset(&gl_state.stats, 0, sizeof(GLStateStats));
+
+#if USE_GLES
+    available = SDL_GL_ExtensionSupported("GL_OES_vertex_array_object");
+    if(available){
+        gl_state.gen_vertex_arrays = (GenVertexArraysFunc)SDL_GL_GetProcAddress("glGenVertexArraysOES");
+        gl_state.bind_vertex_array = (BindVertexArrayFunc)SDL_GL_GetProcAddress("glBindVertexArrayOES");
+        gl_state.delete_vertex_arrays = (DeleteVertexArraysFunc)SDL_GL_GetProcAddress("glDeleteVertexArraysOES");
+    }
+#else
+    /*Core in GL 3.0, "3" is also the first char of "3.0 Mesa ..."*/
+    version = (const char *)glGetString(GL_VERSION);
+    available = (version && version[0] >= '3' && version[0] <= '9')
+             || SDL_GL_ExtensionSupported("GL_ARB_vertex_array_object");
+    if(available){
+        gl_state.gen_vertex_arrays = (GenVertexArraysFunc)SDL_GL_GetProcAddress("glGenVertexArrays");
+        gl_state.bind_vertex_array = (BindVertexArrayFunc)SDL_GL_GetProcAddress("glBindVertexArray");
+        gl_state.delete_vertex_arrays = (DeleteVertexArraysFunc)SDL_GL_GetProcAddress("glDeleteVertexArrays");
+    }
+#endif
+    (void)version;
+    if(!gl_state.gen_vertex_arrays || !gl_state.bind_vertex_array || !gl_state.delete_vertex_arrays){
+        gl_state.gen_vertex_arrays = NULL;
+        gl_state.bind_vertex_array = NULL;
+        gl_state.delete_vertex_arrays = NULL;
+    }
+    gl_state_invalidate();
+    return gl_state_has_vertex_arrays();
+}
+
+/**
+ * @brief Forgets all cached state: the next calls will all reach
+ * the GL.
+ *
+ * To be called after GL code that doesn't go through the cache.
+ */
+void gl_state_invalidate(void)
+{
+    gl_state.program = GL_STATE_UNKNOWN;
+    gl_state.active_texture = GL_STATE_UNKNOWN;
+    for(int i = 0; i < GL_STATE_MAX_TEXTURE_UNITS; i++){
+        for(int j = 0; j < GL_STATE_N_TARGETS; j++)
+            gl_state.textures[i][j] = GL_STATE_UNKNOWN;
+    }
+    gl_state.array_buffer = GL_STATE_UNKNOWN;
+    gl_state.element_buffer = GL_STATE_UNKNOWN;
+    gl_state.attribs = 0;
+    gl_state.known_attribs = 0;
+    /*Without VAOs, the default vertex array is always the one bound*/
+    gl_state.vertex_array = gl_state.bind_vertex_array ? GL_STATE_UNKNOWN : 0;
+    gl_state.ready = true;
+}
+
+void gl_state_use_program(GLuint program)
+{
+    gl_state_check();
+    if(gl_state.program == program){
+        gl_state.stats.skipped++;
+        return;
+    }
+    glUseProgram(program);
+    gl_state.program = program;
+    gl_state.stats.calls++;
+}
+
+/**
+ * @brief Selects the texture unit the next texture binds go to.
+ *
+ * @param unit GL_TEXTURE0 + n
+ */
+void gl_state_active_texture(GLenum unit)
+{
+    gl_state_check();
+    if(gl_state.active_texture == unit - GL_TEXTURE0){
+        gl_state.stats.skipped++;
+        return;
+    }
+    glActiveTexture(unit);
+    gl_state.active_texture = unit - GL_TEXTURE0;
+    gl_state.stats.calls++;
+}
+
+void gl_state_bind_texture(GLenum target, GLuint texture)
+{
+    GLuint *bound = NULL;
+    int t;
+
+    gl_state_check();
+    t = gl_state_target_index(target);
+    if(t >= 0 && gl_state.active_texture < GL_STATE_MAX_TEXTURE_UNITS)
+        bound = &gl_state.textures[gl_state.active_texture][t];
+    if(bound && *bound == texture){
+        gl_state.stats.skipped++;
+        return;
+    }
+    glBindTexture(target, texture);
+    if(bound)
+        *bound = texture;
+    gl_state.stats.calls++;
+}
+
+/**
+ * @brief Deletes a texture. Units it was bound to get 0 bound instead.
+ */
+void gl_state_delete_texture(GLuint texture)
+{
+    gl_state_check();
+    glDeleteTextures(1, &texture);
+    for(int i = 0; i < GL_STATE_MAX_TEXTURE_UNITS; i++){
+        for(int j = 0; j < GL_STATE_N_TARGETS; j++){
+            if(gl_state.textures[i][j] == texture)
+                gl_state.textures[i][j] = 0;
+        }
+    }
+    gl_state.stats.calls++;
+}
+
+/**
+ * @brief Binds a buffer to GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER.
+ *
+ * The element array buffer binding is part of the bound vertex array.
+ */
+void gl_state_bind_buffer(GLenum target, GLuint buffer)
+{
+    GLuint *bound = NULL;
+
+    gl_state_check();
+    if(target == GL_ARRAY_BUFFER)
+        bound = &gl_state.array_buffer;
+    else if(target == GL_ELEMENT_ARRAY_BUFFER && gl_state.vertex_array == 0)
+        bound = &gl_state.element_buffer;
+    if(bound && *bound == buffer){
+        gl_state.stats.skipped++;
+        return;
+    }
+    glBindBuffer(target, buffer);
+    if(bound)
+        *bound = buffer;
+    gl_state.stats.calls++;
+}
+
+/**
+ * @brief Deletes a buffer. Bindings it had are reset to 0.
+ */
+void gl_state_delete_buffer(GLuint buffer)
+{
+    gl_state_check();
+    glDeleteBuffers(1, &buffer);
+    if(gl_state.array_buffer == buffer)
+        gl_state.array_buffer = 0;
+    if(gl_state.element_buffer == buffer)
+        gl_state.element_buffer = 0;
+    gl_state.stats.calls++;
+}
+
+void gl_state_enable_attrib(GLuint index)
+{
+    uint32_t bit;
+
+    gl_state_check();
+    bit = index < GL_STATE_MAX_ATTRIBS ? 1u << index : 0;
+    if(gl_state.vertex_array == 0 && (gl_state.known_attribs & gl_state.attribs & bit)){
+        gl_state.stats.skipped++;
+        return;
+    }
+    glEnableVertexAttribArray(index);
+    if(gl_state.vertex_array == 0){
+        gl_state.attribs |= bit;
+        gl_state.known_attribs |= bit;
+    }
+    gl_state.stats.calls++;
+}
+
+void gl_state_disable_attrib(GLuint index)
+{
+    uint32_t bit;
+
+    gl_state_check();
+    bit = index < GL_STATE_MAX_ATTRIBS ? 1u << index : 0;
+    if(gl_state.vertex_array == 0 && (gl_state.known_attribs & ~gl_state.attribs & bit)){
+        gl_state.stats.skipped++;
+        return;
+    }
+    glDisableVertexAttribArray(index);
+    if(gl_state.vertex_array == 0){
+        gl_state.attribs &= ~bit;
+        gl_state.known_attribs |= bit;
+    }
+    gl_state.stats.calls++;
+}
+
+/**
+ * @brief Tells whether vertex array objects can be used.
+ */
+bool gl_state_has_vertex_arrays(void)
+{
+    return gl_state.gen_vertex_arrays != NULL;
+}
+
+/**
+ * @brief Creates a vertex array object.
+ *
+ * @return The vertex array name, 0 when unavailable
+ */
+GLuint gl_state_gen_vertex_array(void)
+{
+    GLuint rv = 0;
+
+    if(!gl_state.gen_vertex_arrays)
+        return 0;
+    gl_state.gen_vertex_arrays(1, &rv);
+    gl_state.stats.calls++;
+    return rv;
+}
+
+/**
+ * @brief Binds a vertex array object, 0 being the default one.
+ *
+ * The enabled attributes and element array buffer then are the ones
+ * of @p vao.
+ */
+void gl_state_bind_vertex_array(GLuint vao)
+{
+    gl_state_check();
+    if(!gl_state.bind_vertex_array)
+        return;
+    if(gl_state.vertex_array == vao){
+        gl_state.stats.skipped++;
+        return;
+    }
+    /*The cache of the default vertex array is kept while others are bound*/
+    if(gl_state.vertex_array == GL_STATE_UNKNOWN){
+        gl_state.element_buffer = GL_STATE_UNKNOWN;
+        gl_state.known_attribs = 0;
+    }
+    gl_state.bind_vertex_array(vao);
+    gl_state.vertex_array = vao;
+    gl_state.stats.calls++;
+}
+
+/**
+ * @brief Deletes a vertex array object. The default one gets bound if
+ * @p vao was.
+ */
+void gl_state_delete_vertex_array(GLuint vao)
+{
+    gl_state_check();
+    if(!gl_state.delete_vertex_arrays || !vao)
+        return;
+    gl_state.delete_vertex_arrays(1, &vao);
+    if(gl_state.vertex_array == vao)
+        gl_state.vertex_array = 0;
+    gl_state.stats.calls++;
+}
+
+/**
+ * @brief Adds @p n GL calls that didn't go through the cache (draws,
+ * uniforms, etc.) to the counters.
+ */
+void gl_state_count(size_t n)
+{
+    gl_state.stats.calls += n;
+}
+
+void gl_state_get_stats(GLStateStats *stats)
+{
+    *stats = gl_state.stats;
+}
+
+void gl_state_reset_stats(void)
+{
+    memset(&gl_state.stats, 0, sizeof(GLStateStats));
+}
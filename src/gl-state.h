@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef GL_STATE_H
+#define GL_STATE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if USE_GLES
+#include <SDL2/SDL_opengles2.h>
+#else
+#include <SDL2/SDL_opengl.h>
+#endif
+
+/*Value of the cached bindings that aren't known*/
+#define GL_STATE_UNKNOWN ((GLuint)-1)
+/*Attributes and texture units tracked, others always go to the GL*/
+#define GL_STATE_MAX_ATTRIBS 16
+#define GL_STATE_MAX_TEXTURE_UNITS 8
+
+typedef struct{
+    size_t calls; /*Made to the GL, see gl_state_count*/
+    size_t skipped; /*Redundant, dropped by the cache*/
+}GLStateStats;
+
+bool gl_state_init(void);
+void gl_state_invalidate(void);
+
+void gl_state_use_program(GLuint program);
+void gl_state_active_texture(GLenum unit);
+void gl_state_bind_texture(GLenum target, GLuint texture);
+void gl_state_delete_texture(GLuint texture);
+void gl_state_bind_buffer(GLenum target, GLuint buffer);
+void gl_state_delete_buffer(GLuint buffer);
+void gl_state_enable_attrib(GLuint index);
+void gl_state_disable_attrib(GLuint index);
+
+bool gl_state_has_vertex_arrays(void);
+GLuint gl_state_gen_vertex_array(void);
+void gl_state_bind_vertex_array(GLuint vao);
+void gl_state_delete_vertex_array(GLuint vao);
+
+void gl_state_count(size_t n);
+void gl_state_get_stats(GLStateStats *stats);
+void gl_state_reset_stats(void);
+#endif /* GL_STATE_H */
@@ -5,33 +5,82 @@
  *
  * SPDX-License-Identifier: GPL-2.0-only
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <sys/stat.h>
 
 #include <curl/curl.h>
 
 #include "misc.h"
 
 #ifndef HAVE_HTTP_DOWNLOAD_FILE
+/**
+ * @brief Sets up libcurl.
+ *
+ * Must be called once, before any thread downloads: curl's own setup
+ * isn't thread-safe.
+ *
+ * @return true on success, false otherwise
+ */
+bool http_download_init(void)
+{
+    static bool done = false;
+
+    if(!done)
+        done = curl_global_init(CURL_GLOBAL_DEFAULT) == CURLE_OK;
+    return done;
+}
+
+/**
+ * @brief Downloads @p url to @p output.
+ *
+ * The file is written aside and renamed once complete: other threads
+ * never see a partial file, and can download the same one at once.
+ *
+ * @param url What to download
+ * @param output Where to put it, missing directories are created
+ * @return true on success, false otherwise
+ */
 bool http_download_file(char *url, char *output)
 {
     CURL *curl;
     FILE *fp;
     CURLcode res;
     bool ret;
+    char *tmpname;
+    int fd;
 
     ret = create_path(output);
     if(!ret) return false;
 
+    if(asprintf(&tmpname, "%s.XXXXXX", output) < 0)
+        return false;
+    fd = mkstemp(tmpname);
+    if(fd >= 0)
+        fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH); /*mkstemp makes it private*/
+    fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if(!fp){
+        printf("Couldn't open %s for writting\n",tmpname);
+        if(fd >= 0){
+            close(fd);
+            unlink(tmpname);
+        }
+        free(tmpname);
+        return false;
+    }
+
 //  printf("Query: %s\n",url);
     curl = curl_easy_init();
-    if(!curl) return false;
-
-    fp = fopen(output,"wb");
-    if(!fp){
-        printf("Couldn't open %s for writting\n",output);
+    if(!curl){
+        fclose(fp);
+        unlink(tmpname);
+        free(tmpname);
         return false;
     }
     curl_easy_setopt(curl, CURLOPT_URL, url);
@@ -48,15 +97,20 @@ bool http_download_file(char *url, char *output)
     res = curl_easy_perform(curl);
     /* always cleanup */
     curl_easy_cleanup(curl);
-    fclose(fp);
-    if(res == CURLE_HTTP_RETURNED_ERROR){
-        unlink(output);
+    if(fclose(fp) != 0 && res == CURLE_OK)
+        res = CURLE_WRITE_ERROR;
+    if(res == CURLE_OK && rename(tmpname, output) != 0)
+        res = CURLE_WRITE_ERROR;
+    if(res != CURLE_OK){
+        unlink(tmpname);
+        free(tmpname);
         printf("[ %sFAILED%s ]\n",
             "\033[0;31m", /*red*/
             "\033[0m" /*Reset*/
         );
         return false;
     }
+    free(tmpname);
 
     printf("[ %sOK%s ]\n",
         "\033[0;32m", /*red*/
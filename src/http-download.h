@@ -9,6 +9,7 @@
 #define HTTP_DOWNLOAD_H
 #include <stdbool.h>
 
+bool http_download_init(void);
 bool http_download_file(char *url, char *output);
 
 #endif /* HTTP_DOWNLOAD_H */
@@ -0,0 +1,218 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+
+/**
+ * LZ: a byte-oriented LZ77 codec, fast rather than tight.
+ *
+ * The output follows the LZ4 block format: sequences of a token (4 bits
+ * of literal length, 4 bits of match length), the literals, then a 16
+ * bits little endian offset back into the output and the rest of the
+ * match length. Lengths of 15 or more go on in the following bytes,
+ * 255 at a time. The block ends with literals only: the last 5 bytes
+ * are always literals and no match starts in the last 12 bytes.
+ *
+ * The compressor is greedy and only remembers the last position of
+ * each hashed 4 bytes sequence. Decompression is mostly memcpy.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t rv;
+
+    memcpy(&rv, p, sizeof(uint32_t));
+    return rv;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+/*Writes the rest of a length that didn't fit in the token*/
+static inline uint8_t *lz_put_length(uint8_t *op, uint8_t *oend, size_t len)
+{
+    for(; len >= 255; len -= 255){
+        if(op == oend)
+            return NULL;
+        *op++ = 255;
+    }
+    if(op == oend)
+        return NULL;
+    *op++ = len;
+    return op;
+}
+
+/*Literals from @p anchor, then a match of @p len at @p offset (none if 0)*/
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *anchor, size_t nliterals, size_t offset, size_t len)
+{
+    uint8_t *token;
+
+    if(op == oend)
+        return NULL;
+    token = op++;
+    *token = (nliterals >= 15 ? 15 : nliterals) << 4;
+    if(nliterals >= 15 && !(op = lz_put_length(op, oend, nliterals - 15)))
+        return NULL;
+    if((size_t)(oend - op) < nliterals)
+        return NULL;
+    memcpy(op, anchor, nliterals);
+    op += nliterals;
+    if(!offset)
+        return op;
+
+    if(oend - op < 2)
+        return NULL;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    len -= LZ_MIN_MATCH;
+    *token |= len >= 15 ? 15 : len;
+    if(len >= 15)
+        op = lz_put_length(op, oend, len - 15);
+    return op;
+}
+
+/**
+ * @brief Compresses a buffer.
+ *
+ * @param src The data to compress
+ * @param n Size of @p src, in bytes
+ * @param dst Where to put the compressed data
+ * @param capacity Size of @p dst. lz_compress_bound(n) is always enough.
+ * @return The size of the compressed data, 0 if it didn't fit in @p
+ * capacity.
+ */
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity)
+{
+    uint32_t table[1 << LZ_HASH_LOG];
+    const uint8_t *ip, *ref, *anchor;
+    const uint8_t *limit, *match_limit;
+    uint8_t *op, *oend;
+    uint32_t h;
+    size_t len;
+
+    op = dst;
+    oend = dst + capacity;
+    ip = anchor = src;
+    if(n > LZ_MF_LIMIT){
+        memset(table, 0, sizeof(table));
+        limit = src + n - LZ_MF_LIMIT;
+        match_limit = src + n - LZ_LAST_LITERALS;
+        while(ip < limit){
+            h = lz_hash(lz_read32(ip));
+            ref = src + table[h];
+            table[h] = ip - src;
+            if(ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != lz_read32(ip)){
+                ip++;
+                continue;
+            }
+            while(ip > anchor && ref > src && ip[-1] == ref[-1]){
+                ip--;
+                ref--;
+            }
+            for(len = LZ_MIN_MATCH; ip + len < match_limit && ip[len] == ref[len]; len++)
+                ;
+            op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, len);
+            if(!op)
+                return 0;
+            ip += len;
+            anchor = ip;
+            /*Where the match ends is likely to start the next one*/
+            if(ip < limit)
+                table[lz_hash(lz_read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+    op = lz_put_sequence(op, oend, anchor, src + n - anchor, 0, 0);
+    return op ? op - dst : 0;
+}
+
+/*Reads the rest of a length that didn't fit in the token*/
+static inline bool lz_get_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+
+    do{
+        if(*ip == iend)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    }while(b == 255);
+    return true;
+}
+
+/**
+ * @brief Decompresses a buffer made by lz_compress.
+ *
+ * Corrupted input is detected: nothing is ever read or written out of
+ * the buffers.
+ *
+ * @param src The compressed data
+ * @param n Size of @p src, in bytes
+ * @param dst Where to put the data
+ * @param size Size of the data once decompressed
+ * @return true on success, false if @p src is corrupted or doesn't
+ * decompress to exactly @p size bytes.
+ */
+bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size)
+{
+    const uint8_t *ip, *iend;
+    uint8_t *op, *oend, *ref;
+    size_t len, offset;
+    uint8_t token;
+
+    ip = src;
+    iend = src + n;
+    op = dst;
+    oend = dst + size;
+    while(ip < iend){
+        token = *ip++;
+        len = token >> 4;
+        if(len == 15 && !lz_get_length(&ip, iend, &len))
+            return false;
+        if(len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+            return false;
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+        if(ip == iend)
+            break; /*Last sequence, literals only*/
+
+        if(iend - ip < 2)
+            return false;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(!offset || offset > (size_t)(op - dst))
+            return false;
+        len = token & 15;
+        if(len == 15 && !lz_get_length(&ip, iend, &len))
+            return false;
+        len += LZ_MIN_MATCH;
+        if(len > (size_t)(oend - op))
+            return false;
+
+        ref = op - offset;
+        if(offset >= len){
+            memcpy(op, ref, len);
+            op += len;
+        }else{
+            /*Overlapping: repeats the last offset bytes*/
+            for(size_t i = 0; i < len; i++)
+                *op++ = *ref++;
+        }
+    }
+    return op == oend;
+}
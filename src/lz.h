@@ -0,0 +1,22 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef LZ_H
+#define LZ_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*Positions remembered by the compressor: 2^LZ_HASH_LOG*/
+#define LZ_HASH_LOG 14
+
+/*Size of the output buffer that always holds the compression of @p n bytes*/
+#define lz_compress_bound(n) ((n) + (n) / 255 + 16)
+
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity);
+bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size);
+#endif /* LZ_H */
@@ -0,0 +1,501 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mesh-cache.h"
+#include "mesh-optimizer.h"
+#include "fg-scenery.h"
+#include "fgr-dirs.h"
+#include "misc.h"
+
+/**
+ * Mesh cache: render-ready tiles.
+ *
+ * A cache file holds a whole STG chain (base mesh and accessories) as
+ * it is after mesh_finish(): flattened positions, texcoords and indices
+ * for each group, and the spatial cells groups are sorted in. The file is mmap'ed and the arrays are used in place,
+ * loading a tile from cache doesn't go through btg-io nor the VertexSet.
+ */
+
+static Mesh *mesh_cache_parse(uint8_t *base, size_t size, const char *name);
+static bool mesh_cache_count(Mesh *self, MeshCacheHeader *hdr);
+static bool mesh_cache_write(Mesh *self, FILE *fp, MeshCacheHeader *hdr);
+static bool mesh_cache_pad(FILE *fp, uint64_t *offset, size_t align);
+
+/**
+ * @brief Computes the cache filename for a given STG file.
+ *
+ * Cache files mirror the Terrain directory layout under CACHE_DIR.
+ *
+ * @param stg_filename Path to the STG file
+ * @return The cache filename, to be freed by the caller.
+ */
+char *mesh_cache_get_filename(const char *stg_filename)
+{
+    char *rv;
+    const char *rel;
+    const char *ext;
+    int len;
+
+    rel = stg_filename + fg_scenery_base_start(stg_filename);
+    while(*rel == '/')
+        rel++;
+    ext = strrchr(rel, '.');
+    len = ext ? ext - rel : (int)strlen(rel);
+
+    if(asprintf(&rv, CACHE_DIR"/%.*s.fgrc", len, rel) < 0)
+        return NULL;
+    return rv;
+}
+
+/**
+ * @brief Tells whether @p cache_filename exists and is at least as recent
+ * as @p stg_filename.
+ */
+bool mesh_cache_is_fresh(const char *cache_filename, const char *stg_filename)
+{
+    struct stat cst, sst;
+
+    if(stat(cache_filename, &cst) != 0)
+        return false;
+    if(stat(stg_filename, &sst) != 0)
+        return true; /*No source to compare with, cache is all we have*/
+    return cst.st_mtime >= sst.st_mtime;
+}
+
+/**
+ * @brief Loads a Mesh chain from a cache file.
+ *
+ * The file is mapped in memory and the vertex arrays of the
+ * groups point into the mapping. The mapping is released by
+ * mesh_free().
+ *
+ * @param filename The cache file
+ * @return A newly created Mesh, with its accessories, NULL on failure.
+ */
+Mesh *mesh_cache_load(const char *filename)
+{
+    int fd;
+    struct stat st;
+    uint8_t *base;
+    Mesh *rv;
+
+    fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(MeshCacheHeader)){
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return NULL;
+
+    rv = mesh_cache_parse(base, st.st_size, filename);
+    if(!rv){
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    rv->mapping = base;
+    rv->mapping_size = st.st_size;
+    return rv;
+}
+
+/**
+ * @brief Loads a Mesh chain from an image of a cache file in memory,
+ * see mesh_cache_pack.
+ *
+ * Like with mesh_cache_load, the groups point into @p buffer, which is
+ * freed by mesh_free().
+ *
+ * @param buffer The image, allocated with malloc. Taken over, even on
+ * failure.
+ * @param size Size of @p buffer, in bytes
+ * @return A newly created Mesh, with its accessories, NULL on failure.
+ */
+Mesh *mesh_cache_unpack(void *buffer, size_t size)
+{
+    Mesh *rv;
+
+    rv = size >= sizeof(MeshCacheHeader) ? mesh_cache_parse(buffer, size, "Packed mesh") : NULL;
+    if(!rv){
+        free(buffer);
+        return NULL;
+    }
+    rv->mapping = buffer;
+    rv->mapping_size = size;
+    rv->mapping_allocated = true;
+    return rv;
+}
+
+/*Builds the chain held by the cache image @p base, groups point into it*/
+static Mesh *mesh_cache_parse(uint8_t *base, size_t size, const char *name)
+{
+    MeshCacheHeader *hdr;
+    MeshCacheMesh *cmeshes;
+    MeshCacheGroup *cgroups;
+    MeshCacheCell *ccells;
+    Mesh *rv, *mesh;
+    size_t tables_size;
+
+    hdr = (MeshCacheHeader *)base;
+    if(hdr->magic != MESH_CACHE_MAGIC
+       || hdr->version != MESH_CACHE_VERSION
+       || hdr->indice_size != sizeof(indice_t)
+       || hdr->file_size != size
+       || hdr->n_meshes == 0
+       || (mesh_optimizer_get_flags() & ~hdr->optimizations)){
+        printf("%s: Stale or invalid mesh cache, ignoring\n", name);
+        return NULL;
+    }
+    tables_size = sizeof(MeshCacheHeader)
+                + hdr->n_meshes * sizeof(MeshCacheMesh)
+                + hdr->n_groups * sizeof(MeshCacheGroup)
+                + hdr->n_cells * sizeof(MeshCacheCell);
+    if(tables_size > size)
+        return NULL;
+    cmeshes = (MeshCacheMesh *)(base + sizeof(MeshCacheHeader));
+    cgroups = (MeshCacheGroup *)(cmeshes + hdr->n_meshes);
+    ccells = (MeshCacheCell *)(cgroups + hdr->n_groups);
+
+    rv = NULL;
+    for(uint32_t i = 0; i < hdr->n_meshes; i++){
+        MeshCacheMesh *cm = &cmeshes[i];
+
+        if(cm->first_group + cm->n_groups > hdr->n_groups
+           || cm->first_cell + cm->n_cells > hdr->n_cells)
+            goto bail;
+        mesh = mesh_new(cm->n_groups);
+        if(!mesh)
+            goto bail;
+        if(rv)
+            mesh_add_accessory(rv, mesh);
+        else
+            rv = mesh;
+        memcpy(mesh->transformation, cm->transformation, sizeof(cm->transformation));
+        mesh->bs = cm->bs;
+        mesh->optimizations = hdr->optimizations;
+
+        for(uint32_t j = 0; j < cm->n_groups; j++){
+            MeshCacheGroup *cg = &cgroups[cm->first_group + j];
+            VGroup *group = &mesh->groups[j];
+
+            if(cg->material >= size
+               || cg->positions + cg->n_vertices * sizeof(SGVec3f) > size
+               || cg->texcoords + cg->n_vertices * sizeof(SGVec2f) > size
+               || cg->indices + cg->n_indices * sizeof(indice_t) > size
+               || cg->lod_indices + cg->n_lod_indices * sizeof(indice_t) > size
+               || cg->n_lods > VGROUP_LOD_LEVELS - 1)
+                goto bail;
+
+            group->mapped = true;
+            group->material = strndup((char *)base + cg->material, size - cg->material);
+            group->positions = (SGVec3f *)(base + cg->positions);
+            group->texcoords = (SGVec2f *)(base + cg->texcoords);
+            group->indices = (indice_t *)(base + cg->indices);
+            group->n_vertices = cg->n_vertices;
+            group->n_indices = cg->n_indices;
+            group->allocated_indices = cg->n_indices;
+            group->bs = cg->bs;
+            group->lod_indices = (indice_t *)(base + cg->lod_indices);
+            group->n_lod_indices = cg->n_lod_indices;
+            group->n_lods = cg->n_lods;
+            for(uint32_t k = 0; k < cg->n_lods; k++){
+                if(cg->lods[k].offset + cg->lods[k].n_indices > cg->n_lod_indices)
+                    goto bail;
+                group->lods[k] = (VGroupLod){
+                    .offset = cg->lods[k].offset,
+                    .n_indices = cg->lods[k].n_indices,
+                    .error = cg->lods[k].error
+                };
+            }
+        }
+
+        if(cm->n_cells){
+            mesh->cells = malloc(cm->n_cells * sizeof(MeshCell));
+            if(!mesh->cells)
+                goto bail;
+            mesh->n_cells = cm->n_cells;
+        }
+        for(uint32_t j = 0; j < cm->n_cells; j++){
+            MeshCacheCell *cc = &ccells[cm->first_cell + j];
+
+            if(cc->first_group + cc->n_groups > cm->n_groups)
+                goto bail;
+            mesh->cells[j] = (MeshCell){
+                .bs = cc->bs,
+                .first_group = cc->first_group,
+                .n_groups = cc->n_groups
+            };
+        }
+    }
+    return rv;
+
+bail:
+    printf("%s: Corrupted mesh cache, ignoring\n", name);
+    if(rv)
+        mesh_free(rv);
+    return NULL;
+}
+
+/**
+ * @brief Writes a finished Mesh chain (base mesh and its accessories)
+ * to a cache file.
+ *
+ * The file is written under a temporary name and renamed once complete
+ * so that concurrent loaders never see a partial file.
+ *
+ * @param self The head of the chain. All groups must have been finished.
+ * @param filename The cache file to (over)write
+ * @return true on success, false otherwise
+ */
+bool mesh_cache_save(Mesh *self, const char *filename)
+{
+    MeshCacheHeader hdr;
+    char *tmpname;
+    FILE *fp;
+    int fd;
+    bool rv;
+
+    if(!mesh_cache_count(self, &hdr))
+        return false;
+
+    if(!create_path(filename))
+        return false;
+    if(asprintf(&tmpname, "%s.XXXXXX", filename) < 0)
+        return false;
+    fd = mkstemp(tmpname);
+    if(fd < 0 || !(fp = fdopen(fd, "wb"))){
+        printf("Couldn't create mesh cache %s\n", tmpname);
+        if(fd >= 0){
+            close(fd);
+            unlink(tmpname);
+        }
+        free(tmpname);
+        return false;
+    }
+
+    rv = mesh_cache_write(self, fp, &hdr);
+    if(rv){
+        rewind(fp);
+        rv = fwrite(&hdr, sizeof(MeshCacheHeader), 1, fp) == 1;
+    }
+    rv = (fclose(fp) == 0) && rv;
+
+    if(rv)
+        rv = rename(tmpname, filename) == 0;
+    if(!rv){
+        printf("Failed to write mesh cache %s\n", filename);
+        unlink(tmpname);
+    }
+    free(tmpname);
+    return rv;
+}
+
+/**
+ * @brief Makes in memory the image of the cache file of a finished Mesh
+ * chain.
+ *
+ * @param self The head of the chain. All groups must have been finished.
+ * @param size Where to store the size of the image, in bytes
+ * @return The image, to be freed by the caller or handed to
+ * mesh_cache_unpack. NULL on failure.
+ */
+void *mesh_cache_pack(Mesh *self, size_t *size)
+{
+    MeshCacheHeader hdr;
+    char *rv;
+    FILE *fp;
+    bool written;
+
+    if(!mesh_cache_count(self, &hdr))
+        return NULL;
+
+    rv = NULL;
+    fp = open_memstream(&rv, size);
+    if(!fp)
+        return NULL;
+    written = mesh_cache_write(self, fp, &hdr);
+    if(fclose(fp) != 0 || !written || *size != hdr.file_size){
+        free(rv);
+        return NULL;
+    }
+    /*Header is rewritten once the size is known*/
+    memcpy(rv, &hdr, sizeof(MeshCacheHeader));
+    return rv;
+}
+
+/*Fills @p hdr with the counts of @p self, false if it's not finished*/
+static bool mesh_cache_count(Mesh *self, MeshCacheHeader *hdr)
+{
+    Mesh *iter;
+
+    memset(hdr, 0, sizeof(MeshCacheHeader));
+    hdr->magic = MESH_CACHE_MAGIC;
+    hdr->version = MESH_CACHE_VERSION;
+    hdr->indice_size = sizeof(indice_t);
+    hdr->optimizations = MESH_OPTIMIZE_ALL;
+    for(iter = self; iter != NULL; iter = iter->next){
+        hdr->n_meshes++;
+        hdr->optimizations &= iter->optimizations;
+        hdr->n_cells += iter->n_cells;
+        for(size_t i = 0; i < iter->n_groups; i++){
+            if(!iter->groups[i].positions) /*not finished*/
+                return false;
+            hdr->n_groups++;
+        }
+    }
+    return true;
+}
+
+/* Writes @p self, with @p hdr as counted by mesh_cache_count, whose
+ * file_size is then set. The header written first is incomplete and
+ * must be written again.*/
+static bool mesh_cache_write(Mesh *self, FILE *fp, MeshCacheHeader *hdr)
+{
+    MeshCacheMesh cm;
+    MeshCacheGroup cg;
+    MeshCacheCell cc;
+    Mesh *iter;
+    uint64_t offset, str_offset, data_offset;
+    bool rv;
+
+    /*Compute where strings and data will land*/
+    str_offset = sizeof(MeshCacheHeader)
+               + hdr->n_meshes * sizeof(MeshCacheMesh)
+               + hdr->n_groups * sizeof(MeshCacheGroup)
+               + hdr->n_cells * sizeof(MeshCacheCell);
+    data_offset = str_offset;
+    for(iter = self; iter != NULL; iter = iter->next){
+        for(size_t i = 0; i < iter->n_groups; i++)
+            data_offset += strlen(iter->groups[i].material) + 1;
+    }
+    data_offset += MESH_CACHE_ALIGN - 1;
+    data_offset -= data_offset % MESH_CACHE_ALIGN;
+
+    /*Header is rewritten once the size is known*/
+    rv = fwrite(hdr, sizeof(MeshCacheHeader), 1, fp) == 1;
+
+    uint32_t first_group = 0;
+    uint32_t first_cell = 0;
+    for(iter = self; rv && iter != NULL; iter = iter->next){
+        memset(&cm, 0, sizeof(MeshCacheMesh));
+        memcpy(cm.transformation, iter->transformation, sizeof(cm.transformation));
+        cm.bs = iter->bs;
+        cm.first_group = first_group;
+        cm.n_groups = iter->n_groups;
+        cm.first_cell = first_cell;
+        cm.n_cells = iter->n_cells;
+        first_group += iter->n_groups;
+        first_cell += iter->n_cells;
+        rv = fwrite(&cm, sizeof(MeshCacheMesh), 1, fp) == 1;
+    }
+
+    offset = data_offset;
+    for(iter = self; rv && iter != NULL; iter = iter->next){
+        for(size_t i = 0; rv && i < iter->n_groups; i++){
+            VGroup *group = &iter->groups[i];
+
+            memset(&cg, 0, sizeof(MeshCacheGroup));
+            cg.bs = group->bs;
+            cg.material = str_offset;
+            str_offset += strlen(group->material) + 1;
+
+            cg.n_vertices = group->n_vertices;
+            cg.n_indices = group->n_indices;
+            cg.positions = offset;
+            offset += group->n_vertices * sizeof(SGVec3f);
+            offset += (MESH_CACHE_ALIGN - offset % MESH_CACHE_ALIGN) % MESH_CACHE_ALIGN;
+            cg.texcoords = offset;
+            offset += group->n_vertices * sizeof(SGVec2f);
+            offset += (MESH_CACHE_ALIGN - offset % MESH_CACHE_ALIGN) % MESH_CACHE_ALIGN;
+            cg.indices = offset;
+            offset += group->n_indices * sizeof(indice_t);
+            offset += (MESH_CACHE_ALIGN - offset % MESH_CACHE_ALIGN) % MESH_CACHE_ALIGN;
+            cg.n_lods = group->n_lods;
+            cg.n_lod_indices = group->n_lod_indices;
+            cg.lod_indices = offset;
+            offset += group->n_lod_indices * sizeof(indice_t);
+            offset += (MESH_CACHE_ALIGN - offset % MESH_CACHE_ALIGN) % MESH_CACHE_ALIGN;
+            for(size_t k = 0; k < group->n_lods; k++){
+                cg.lods[k] = (MeshCacheLod){
+                    .offset = group->lods[k].offset,
+                    .n_indices = group->lods[k].n_indices,
+                    .error = group->lods[k].error
+                };
+            }
+
+            rv = fwrite(&cg, sizeof(MeshCacheGroup), 1, fp) == 1;
+        }
+    }
+    hdr->file_size = offset;
+
+    for(iter = self; rv && iter != NULL; iter = iter->next){
+        for(size_t i = 0; rv && i < iter->n_cells; i++){
+            memset(&cc, 0, sizeof(MeshCacheCell));
+            cc.bs = iter->cells[i].bs;
+            cc.first_group = iter->cells[i].first_group;
+            cc.n_groups = iter->cells[i].n_groups;
+            rv = fwrite(&cc, sizeof(MeshCacheCell), 1, fp) == 1;
+        }
+    }
+
+    for(iter = self; rv && iter != NULL; iter = iter->next){
+        for(size_t i = 0; rv && i < iter->n_groups; i++){
+            const char *material = iter->groups[i].material;
+            rv = fwrite(material, strlen(material) + 1, 1, fp) == 1;
+        }
+    }
+
+    offset = ftell(fp);
+    rv = rv && mesh_cache_pad(fp, &offset, MESH_CACHE_ALIGN);
+    for(iter = self; rv && iter != NULL; iter = iter->next){
+        for(size_t i = 0; rv && i < iter->n_groups; i++){
+            VGroup *group = &iter->groups[i];
+
+            rv = fwrite(group->positions, sizeof(SGVec3f), group->n_vertices, fp) == group->n_vertices;
+            offset += group->n_vertices * sizeof(SGVec3f);
+            rv = rv && mesh_cache_pad(fp, &offset, MESH_CACHE_ALIGN);
+
+            rv = rv && fwrite(group->texcoords, sizeof(SGVec2f), group->n_vertices, fp) == group->n_vertices;
+            offset += group->n_vertices * sizeof(SGVec2f);
+            rv = rv && mesh_cache_pad(fp, &offset, MESH_CACHE_ALIGN);
+
+            rv = rv && fwrite(group->indices, sizeof(indice_t), group->n_indices, fp) == group->n_indices;
+            offset += group->n_indices * sizeof(indice_t);
+            rv = rv && mesh_cache_pad(fp, &offset, MESH_CACHE_ALIGN);
+
+            rv = rv && fwrite(group->lod_indices, sizeof(indice_t), group->n_lod_indices, fp) == group->n_lod_indices;
+            offset += group->n_lod_indices * sizeof(indice_t);
+            rv = rv && mesh_cache_pad(fp, &offset, MESH_CACHE_ALIGN);
+        }
+    }
+    rv = rv && (offset == hdr->file_size);
+
+    return rv;
+}
+
+static bool mesh_cache_pad(FILE *fp, uint64_t *offset, size_t align)
+{
+    static const uint8_t zeros[MESH_CACHE_ALIGN] = {0};
+    size_t npad;
+
+    npad = (align - *offset % align) % align;
+    if(npad && fwrite(zeros, 1, npad, fp) != npad)
+        return false;
+    *offset += npad;
+    return true;
+}
@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mesh.h"
+
+#define MESH_CACHE_MAGIC 0x43524746 /*"FGRC", reads backwards on the other endianness*/
+#define MESH_CACHE_VERSION 3
+/*Alignment of each vertex/index array in the file*/
+#define MESH_CACHE_ALIGN 16
+
+/* On-disk layout, all offsets are from the start of the file:
+ *
+ * MeshCacheHeader
+ * MeshCacheMesh[n_meshes]   base mesh first, then accessories
+ * MeshCacheGroup[n_groups]  groups of all meshes, in chain order
+ * MeshCacheCell[n_cells]    cells of all meshes, in chain order
+ * material names            NUL-terminated
+ * positions, texcoords, indices and LOD indices arrays, MESH_CACHE_ALIGN-aligned
+ */
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t indice_size; /*sizeof(indice_t) used when writing*/
+    uint8_t optimizations; /*MeshOptimizeFlags applied to all meshes*/
+    uint32_t n_meshes;
+    uint32_t n_groups;
+    uint64_t file_size;
+    uint32_t n_cells;
+    uint32_t reserved2;
+}MeshCacheHeader;
+
+typedef struct{
+    double transformation[16];
+    SGSphered bs;
+    uint32_t first_group;
+    uint32_t n_groups;
+    uint32_t first_cell;
+    uint32_t n_cells;
+}MeshCacheMesh;
+
+typedef struct{
+    uint64_t offset; /*In the group LOD indices*/
+    uint64_t n_indices;
+    float error;
+    uint32_t reserved;
+}MeshCacheLod;
+
+typedef struct{
+    SGSphered bs;
+    uint64_t material; /*offset*/
+    uint64_t positions; /*offset*/
+    uint64_t texcoords; /*offset*/
+    uint64_t indices; /*offset*/
+    uint64_t n_indices;
+    uint32_t n_vertices;
+    uint32_t n_lods;
+    uint64_t lod_indices; /*offset*/
+    uint64_t n_lod_indices;
+    MeshCacheLod lods[VGROUP_LOD_LEVELS - 1];
+}MeshCacheGroup;
+
+typedef struct{
+    SGSphered bs;
+    uint32_t first_group; /*within the mesh*/
+    uint32_t n_groups;
+}MeshCacheCell;
+
+char *mesh_cache_get_filename(const char *stg_filename);
+bool mesh_cache_is_fresh(const char *cache_filename, const char *stg_filename);
+
+Mesh *mesh_cache_load(const char *filename);
+bool mesh_cache_save(Mesh *self, const char *filename);
+void *mesh_cache_pack(Mesh *self, size_t *size);
+Mesh *mesh_cache_unpack(void *buffer, size_t size);
+#endif /* MESH_CACHE_H */
@@ -0,0 +1,848 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "mesh-lod.h"
+#include "mesh-optimizer.h"
+
+/**
+ * MeshLod: Simplified versions of VGroups, drawn instead of the full
+ * resolution ones when their error projects to less than a pixel or so.
+ *
+ * The groups of a cell are simplified together, their vertices welded
+ * by position, by collapsing edges onto one of their vertices, cheapest
+ * first. The cost is the quadric error of Garland and Heckbert: the
+ * area weighted mean of the squared distances of the kept vertex to the
+ * planes of the triangles that have been merged into it. Levels reuse
+ * the group vertices and only add indices, each level starting from the
+ * previous one.
+ *
+ * Vertices of the cell borders, which include the tile borders, never
+ * move, so cells drawn at different levels don't crack. Vertices of
+ * the borders between two materials only slide along them, onto their
+ * next vertex, for both groups at once. Their quadrics get planes
+ * standing along the border so that it keeps its shape. Vertices
+ * shared by more than two groups or on a texture seam never move.
+ *
+ * All groups of a cell get the same levels, with the same error: the
+ * square root of the worst collapse cost so far, i.e the RMS distance
+ * to the merged planes of the worst vertex.
+ */
+
+/*Collapses bending a triangle normal more than this (cosine) are rejected*/
+#define MESH_LOD_MIN_NORMAL_DOT 0.5
+/*Weight of the planes keeping material borders in place*/
+#define MESH_LOD_BORDER_WEIGHT 10.0
+
+/* Max error (meters) of each level, with 1 pixel error at 60° fov and
+ * 600 pixels high: 500 m, 2 km and 8 km away*/
+static const float lod_max_errors[VGROUP_LOD_LEVELS - 1] = {1.0f, 4.0f, 16.0f};
+
+typedef enum{
+    LOD_VERTEX_INTERIOR, /*Used by a single group*/
+    LOD_VERTEX_BORDER, /*Between two groups, slides along the border*/
+    LOD_VERTEX_LOCKED
+}LodVertexKind;
+
+/*Symmetric 4x4 matrix of a weighted sum of squared distances to planes*/
+typedef struct{
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double w;
+}LodQuadric;
+
+typedef struct{
+    float cost;
+    uint32_t src; /*Vertex that goes away*/
+    uint32_t dst; /*Vertex it gets merged into*/
+}LodCollapse;
+
+/*A group vertex at the position of a welded vertex*/
+typedef struct{
+    uint32_t group;
+    uint32_t vertex;
+}LodEntry;
+
+typedef struct{
+    float x, y, z;
+    uint32_t id; /*Group vertex*/
+}LodSortVertex;
+
+typedef struct{
+    uint64_t edge;
+    uint32_t corner;
+}LodEdge;
+
+typedef struct{
+    VGroup *groups;
+    size_t n_groups;
+
+    /*Group vertices are numbered from vertex_base[group]*/
+    uint32_t *vertex_base;
+    size_t n_group_vertices;
+    uint32_t *welded; /*Welded vertex of each group vertex*/
+
+    /*Group vertices welded by position*/
+    SGVec3f *positions;
+    size_t n_vertices;
+    uint32_t *first_entry; /*n_vertices + 1*/
+    LodEntry *entries;
+    uint8_t *kinds;
+    bool *seams; /*Several vertices of a same group (texture seam)*/
+    LodQuadric *quadrics;
+
+    /*Triangles of all groups, in welded and group vertices*/
+    uint32_t *corners;
+    uint32_t *group_corners;
+    uint32_t *triangle_groups;
+    size_t n_indices;
+
+    /*Rebuilt at each pass: triangles using each vertex*/
+    uint32_t *first_triangle; /*n_vertices + 1*/
+    uint32_t *triangles;
+
+    LodCollapse *collapses;
+    uint32_t *remap;
+    uint32_t *group_remap;
+    uint32_t *stamps;
+    uint32_t stamp;
+    bool *touched;
+
+    float error; /*Worst collapse so far*/
+}LodBuilder;
+
+static void lod_quadric_add_plane(LodQuadric *self, double n[3], double d, double w)
+{
+    self->a00 += w*n[0]*n[0]; self->a01 += w*n[0]*n[1]; self->a02 += w*n[0]*n[2];
+    self->a11 += w*n[1]*n[1]; self->a12 += w*n[1]*n[2];
+    self->a22 += w*n[2]*n[2];
+    self->b0 += w*n[0]*d; self->b1 += w*n[1]*d; self->b2 += w*n[2]*d;
+    self->c += w*d*d;
+    self->w += w;
+}
+
+static void lod_quadric_add(LodQuadric *self, const LodQuadric *other)
+{
+    self->a00 += other->a00; self->a01 += other->a01; self->a02 += other->a02;
+    self->a11 += other->a11; self->a12 += other->a12;
+    self->a22 += other->a22;
+    self->b0 += other->b0; self->b1 += other->b1; self->b2 += other->b2;
+    self->c += other->c;
+    self->w += other->w;
+}
+
+/*(Qa + Qb)(p): weighted mean of the squared distances of p to the planes*/
+static double lod_quadric_eval(const LodQuadric *qa, const LodQuadric *qb, const SGVec3f *p)
+{
+    LodQuadric q = *qa;
+    double x, y, z, rv;
+
+    lod_quadric_add(&q, qb);
+    if(q.w <= 0.0)
+        return 0.0;
+    x = p->x; y = p->y; z = p->z;
+    rv = q.a00*x*x + q.a11*y*y + q.a22*z*z
+       + 2.0 * (q.a01*x*y + q.a02*x*z + q.a12*y*z)
+       + 2.0 * (q.b0*x + q.b1*y + q.b2*z)
+       + q.c;
+    return rv > 0.0 ? rv / q.w : 0.0;
+}
+
+/*Unnormalized normal of (a, b, c)*/
+static void lod_normal(const SGVec3f *a, const SGVec3f *b, const SGVec3f *c, double n[3])
+{
+    double u[3] = {b->x - a->x, b->y - a->y, b->z - a->z};
+    double v[3] = {c->x - a->x, c->y - a->y, c->z - a->z};
+
+    n[0] = u[1]*v[2] - u[2]*v[1];
+    n[1] = u[2]*v[0] - u[0]*v[2];
+    n[2] = u[0]*v[1] - u[1]*v[0];
+}
+
+static inline size_t lod_next_corner(size_t i)
+{
+    return i % 3 == 2 ? i - 2 : i + 1;
+}
+
+static int lod_collapse_cmp(const void *a, const void *b)
+{
+    float ca = ((const LodCollapse *)a)->cost;
+    float cb = ((const LodCollapse *)b)->cost;
+
+    return (ca > cb) - (ca < cb);
+}
+
+static int lod_sort_vertex_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, 3 * sizeof(float));
+}
+
+static int lod_edge_cmp(const void *a, const void *b)
+{
+    uint64_t ea = ((const LodEdge *)a)->edge;
+    uint64_t eb = ((const LodEdge *)b)->edge;
+
+    return (ea > eb) - (ea < eb);
+}
+
+/*Welded vertices of group vertices, by exact position*/
+static bool lod_builder_weld(LodBuilder *self)
+{
+    LodSortVertex *sorted;
+    VGroup *group;
+    uint32_t n;
+
+    sorted = malloc(sizeof(LodSortVertex) * self->n_group_vertices);
+    if(!sorted)
+        return false;
+    for(size_t g = 0; g < self->n_groups; g++){
+        group = &self->groups[g];
+        for(size_t i = 0; i < group->n_vertices; i++){
+            sorted[self->vertex_base[g] + i] = (LodSortVertex){
+                .x = group->positions[i].x,
+                .y = group->positions[i].y,
+                .z = group->positions[i].z,
+                .id = self->vertex_base[g] + i
+            };
+        }
+    }
+    qsort(sorted, self->n_group_vertices, sizeof(LodSortVertex), lod_sort_vertex_cmp);
+
+    n = 0;
+    for(size_t i = 0; i < self->n_group_vertices; i++){
+        if(i > 0 && lod_sort_vertex_cmp(&sorted[i], &sorted[i-1]))
+            n++;
+        self->welded[sorted[i].id] = n;
+        self->positions[n] = (SGVec3f){sorted[i].x, sorted[i].y, sorted[i].z};
+    }
+    self->n_vertices = self->n_group_vertices ? n + 1 : 0;
+    free(sorted);
+
+    /*Group vertices of each welded vertex*/
+    memset(self->first_entry, 0, sizeof(uint32_t) * (self->n_vertices + 1));
+    for(size_t i = 0; i < self->n_group_vertices; i++)
+        self->first_entry[self->welded[i] + 1]++;
+    for(size_t i = 0; i < self->n_vertices; i++)
+        self->first_entry[i + 1] += self->first_entry[i];
+    memcpy(self->remap, self->first_entry, sizeof(uint32_t) * self->n_vertices);
+    for(size_t g = 0; g < self->n_groups; g++){
+        for(size_t i = 0; i < self->groups[g].n_vertices; i++){
+            uint32_t w = self->welded[self->vertex_base[g] + i];
+            self->entries[self->remap[w]++] = (LodEntry){g, i};
+        }
+    }
+    return true;
+}
+
+/*Vertex of @p group at the position of welded vertex @p v, UINT32_MAX if none*/
+static uint32_t lod_builder_get_group_vertex(LodBuilder *self, uint32_t v, uint32_t group)
+{
+    for(uint32_t e = self->first_entry[v]; e < self->first_entry[v + 1]; e++){
+        if(self->entries[e].group == group)
+            return self->entries[e].vertex;
+    }
+    return UINT32_MAX;
+}
+
+static void lod_builder_init_quadrics(LodBuilder *self)
+{
+    const SGVec3f *p = self->positions;
+    const uint32_t *t;
+    double n[3], l, d;
+
+    for(size_t i = 0; i < self->n_indices; i += 3){
+        t = &self->corners[i];
+        lod_normal(&p[t[0]], &p[t[1]], &p[t[2]], n);
+        l = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if(l == 0.0)
+            continue;
+        n[0] /= l; n[1] /= l; n[2] /= l;
+        d = -(n[0]*p[t[0]].x + n[1]*p[t[0]].y + n[2]*p[t[0]].z);
+        for(int k = 0; k < 3; k++)
+            lod_quadric_add_plane(&self->quadrics[t[k]], n, d, l * 0.5);
+    }
+}
+
+/* Plane standing along the edge @p corner -> next corner, orthogonal
+ * to its triangle, added to both ends*/
+static void lod_builder_add_border_plane(LodBuilder *self, size_t corner)
+{
+    const SGVec3f *p = self->positions;
+    const uint32_t *t = &self->corners[corner - corner % 3];
+    uint32_t a, b;
+    double e[3], tn[3], n[3], l, el, d;
+
+    a = self->corners[corner];
+    b = self->corners[lod_next_corner(corner)];
+    lod_normal(&p[t[0]], &p[t[1]], &p[t[2]], tn);
+    e[0] = p[b].x - p[a].x; e[1] = p[b].y - p[a].y; e[2] = p[b].z - p[a].z;
+    n[0] = e[1]*tn[2] - e[2]*tn[1];
+    n[1] = e[2]*tn[0] - e[0]*tn[2];
+    n[2] = e[0]*tn[1] - e[1]*tn[0];
+    l = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    if(l == 0.0)
+        return;
+    n[0] /= l; n[1] /= l; n[2] /= l;
+    d = -(n[0]*p[a].x + n[1]*p[a].y + n[2]*p[a].z);
+    el = e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
+    lod_quadric_add_plane(&self->quadrics[a], n, d, el * MESH_LOD_BORDER_WEIGHT);
+    lod_quadric_add_plane(&self->quadrics[b], n, d, el * MESH_LOD_BORDER_WEIGHT);
+}
+
+/* Tells what each welded vertex may do: edges that aren't shared by
+ * exactly two triangles are cell borders, edges shared by triangles of
+ * two groups are material borders.*/
+static bool lod_builder_classify(LodBuilder *self)
+{
+    LodEdge *edges;
+    uint8_t *n_borders;
+    bool *locked;
+    size_t i, j, n_groups;
+    uint32_t last_group;
+
+    edges = malloc(sizeof(LodEdge) * self->n_indices);
+    n_borders = calloc(self->n_vertices, sizeof(uint8_t));
+    locked = calloc(self->n_vertices, sizeof(bool));
+    if(!edges || !n_borders || !locked){
+        free(edges);
+        free(n_borders);
+        free(locked);
+        return false;
+    }
+
+    for(i = 0; i < self->n_indices; i++){
+        uint64_t a = self->corners[i];
+        uint64_t b = self->corners[lod_next_corner(i)];
+        edges[i] = (LodEdge){
+            .edge = a < b ? (a << 32) | b : (b << 32) | a,
+            .corner = i
+        };
+    }
+    qsort(edges, self->n_indices, sizeof(LodEdge), lod_edge_cmp);
+    for(i = 0; i < self->n_indices; i = j){
+        uint32_t a = edges[i].edge >> 32;
+        uint32_t b = edges[i].edge & 0xffffffff;
+        for(j = i + 1; j < self->n_indices && edges[j].edge == edges[i].edge; j++)
+            ;
+        if(j - i != 2){
+            locked[a] = locked[b] = true;
+        }else if(self->triangle_groups[edges[i].corner / 3] != self->triangle_groups[edges[i+1].corner / 3]){
+            if(n_borders[a] < UINT8_MAX) n_borders[a]++;
+            if(n_borders[b] < UINT8_MAX) n_borders[b]++;
+            lod_builder_add_border_plane(self, edges[i].corner);
+            lod_builder_add_border_plane(self, edges[i+1].corner);
+        }
+    }
+
+    for(uint32_t v = 0; v < self->n_vertices; v++){
+        n_groups = 0;
+        last_group = UINT32_MAX;
+        self->seams[v] = false;
+        /*Entries are sorted by group*/
+        for(uint32_t e = self->first_entry[v]; e < self->first_entry[v + 1]; e++){
+            if(self->entries[e].group == last_group)
+                self->seams[v] = true;
+            else
+                n_groups++;
+            last_group = self->entries[e].group;
+        }
+        if(locked[v] || self->seams[v] || n_groups > 2)
+            self->kinds[v] = LOD_VERTEX_LOCKED;
+        else if(n_groups == 2)
+            self->kinds[v] = n_borders[v] == 2 ? LOD_VERTEX_BORDER : LOD_VERTEX_LOCKED;
+        else
+            self->kinds[v] = LOD_VERTEX_INTERIOR;
+    }
+    free(edges);
+    free(n_borders);
+    free(locked);
+    return true;
+}
+
+static void lod_builder_build_adjacency(LodBuilder *self)
+{
+    memset(self->first_triangle, 0, sizeof(uint32_t) * (self->n_vertices + 1));
+    for(size_t i = 0; i < self->n_indices; i++)
+        self->first_triangle[self->corners[i] + 1]++;
+    for(size_t i = 0; i < self->n_vertices; i++)
+        self->first_triangle[i + 1] += self->first_triangle[i];
+    /*remap is free until the collapses get picked*/
+    memcpy(self->remap, self->first_triangle, sizeof(uint32_t) * self->n_vertices);
+    for(size_t i = 0; i < self->n_indices; i++)
+        self->triangles[self->remap[self->corners[i]]++] = i / 3;
+}
+
+static bool lod_triangle_has(const uint32_t *t, uint32_t v)
+{
+    return t[0] == v || t[1] == v || t[2] == v;
+}
+
+/* Tells whether @p src -> @p dst, an edge of triangle @p triangle,
+ * is a border between two groups*/
+static bool lod_builder_is_border(LodBuilder *self, uint32_t src, uint32_t dst, uint32_t triangle)
+{
+    for(uint32_t t = self->first_triangle[src]; t < self->first_triangle[src + 1]; t++){
+        uint32_t other = self->triangles[t];
+        if(other != triangle && lod_triangle_has(&self->corners[other * 3], dst))
+            return self->triangle_groups[other] != self->triangle_groups[triangle];
+    }
+    return false;
+}
+
+/* Tells whether collapsing src onto dst keeps the surface manifold:
+ * the vertices both are connected to must be those of the triangles
+ * they share. Returns the number of shared triangles, 0 when the
+ * collapse must not happen.*/
+static size_t lod_builder_check_link(LodBuilder *self, uint32_t src, uint32_t dst)
+{
+    uint32_t mark, seen, v;
+    size_t n_shared, n_common;
+
+    mark = ++self->stamp;
+    n_shared = 0;
+    for(uint32_t t = self->first_triangle[src]; t < self->first_triangle[src + 1]; t++){
+        const uint32_t *tri = &self->corners[self->triangles[t] * 3];
+        if(lod_triangle_has(tri, dst))
+            n_shared++;
+        for(int k = 0; k < 3; k++){
+            if(tri[k] != src)
+                self->stamps[tri[k]] = mark;
+        }
+    }
+
+    seen = ++self->stamp;
+    n_common = 0;
+    for(uint32_t t = self->first_triangle[dst]; t < self->first_triangle[dst + 1]; t++){
+        const uint32_t *tri = &self->corners[self->triangles[t] * 3];
+        for(int k = 0; k < 3; k++){
+            v = tri[k];
+            if(v != dst && v != src && self->stamps[v] == mark){
+                self->stamps[v] = seen;
+                n_common++;
+            }
+        }
+    }
+    return n_common == n_shared ? n_shared : 0;
+}
+
+/*Tells whether moving src onto dst flips or squashes any triangle*/
+static bool lod_builder_check_flip(LodBuilder *self, uint32_t src, uint32_t dst)
+{
+    const SGVec3f *p = self->positions;
+    const SGVec3f *moved[3];
+    double n0[3], n1[3], l0, l1;
+
+    for(uint32_t t = self->first_triangle[src]; t < self->first_triangle[src + 1]; t++){
+        const uint32_t *tri = &self->corners[self->triangles[t] * 3];
+        if(lod_triangle_has(tri, dst))
+            continue; /*Goes away*/
+        for(int k = 0; k < 3; k++)
+            moved[k] = tri[k] == src ? &p[dst] : &p[tri[k]];
+        lod_normal(&p[tri[0]], &p[tri[1]], &p[tri[2]], n0);
+        lod_normal(moved[0], moved[1], moved[2], n1);
+        l0 = sqrt(n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2]);
+        l1 = sqrt(n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2]);
+        if(l0 == 0.0)
+            continue;
+        if(l1 == 0.0)
+            return false;
+        if((n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2]) < MESH_LOD_MIN_NORMAL_DOT * l0 * l1)
+            return false;
+    }
+    return true;
+}
+
+/*Tells whether all groups using src also have dst*/
+static bool lod_builder_check_groups(LodBuilder *self, uint32_t src, uint32_t dst)
+{
+    for(uint32_t e = self->first_entry[src]; e < self->first_entry[src + 1]; e++){
+        if(lod_builder_get_group_vertex(self, dst, self->entries[e].group) == UINT32_MAX)
+            return false;
+    }
+    return true;
+}
+
+/* One pass of collapses over the current triangles. Each vertex
+ * can only be part of one collapse per pass so that the adjacency
+ * stays valid. Returns the number of collapses done.*/
+static size_t lod_builder_pass(LodBuilder *self, float max_cost)
+{
+    size_t n_collapses, n_done, j;
+    const SGVec3f *p = self->positions;
+    LodCollapse *c;
+
+    lod_builder_build_adjacency(self);
+
+    n_collapses = 0;
+    for(size_t i = 0; i < self->n_indices; i++){
+        uint32_t src = self->corners[i];
+        uint32_t dst = self->corners[lod_next_corner(i)];
+        if(self->kinds[src] == LOD_VERTEX_LOCKED || self->seams[dst])
+            continue;
+        if(self->kinds[src] == LOD_VERTEX_BORDER && !lod_builder_is_border(self, src, dst, i / 3))
+            continue;
+        self->collapses[n_collapses++] = (LodCollapse){
+            .cost = lod_quadric_eval(&self->quadrics[src], &self->quadrics[dst], &p[dst]),
+            .src = src,
+            .dst = dst
+        };
+    }
+    qsort(self->collapses, n_collapses, sizeof(LodCollapse), lod_collapse_cmp);
+
+    for(size_t i = 0; i < self->n_vertices; i++)
+        self->remap[i] = i;
+    for(size_t i = 0; i < self->n_group_vertices; i++)
+        self->group_remap[i] = i;
+    memset(self->touched, 0, sizeof(bool) * self->n_vertices);
+
+    n_done = 0;
+    for(size_t i = 0; i < n_collapses && self->collapses[i].cost <= max_cost; i++){
+        c = &self->collapses[i];
+        if(self->touched[c->src] || self->touched[c->dst])
+            continue;
+        if(!lod_builder_check_link(self, c->src, c->dst)
+           || !lod_builder_check_flip(self, c->src, c->dst)
+           || !lod_builder_check_groups(self, c->src, c->dst))
+            continue;
+
+        self->remap[c->src] = c->dst;
+        for(uint32_t e = self->first_entry[c->src]; e < self->first_entry[c->src + 1]; e++){
+            LodEntry *entry = &self->entries[e];
+            self->group_remap[self->vertex_base[entry->group] + entry->vertex] =
+                self->vertex_base[entry->group]
+                + lod_builder_get_group_vertex(self, c->dst, entry->group);
+        }
+        lod_quadric_add(&self->quadrics[c->dst], &self->quadrics[c->src]);
+        if(sqrtf(c->cost) > self->error)
+            self->error = sqrtf(c->cost);
+        for(uint32_t t = self->first_triangle[c->src]; t < self->first_triangle[c->src + 1]; t++){
+            const uint32_t *tri = &self->corners[self->triangles[t] * 3];
+            for(int k = 0; k < 3; k++)
+                self->touched[tri[k]] = true;
+        }
+        n_done++;
+    }
+    if(!n_done)
+        return 0;
+
+    j = 0;
+    for(size_t i = 0; i < self->n_indices; i += 3){
+        uint32_t a = self->remap[self->corners[i]];
+        uint32_t b = self->remap[self->corners[i+1]];
+        uint32_t c = self->remap[self->corners[i+2]];
+        if(a == b || b == c || a == c)
+            continue;
+        self->triangle_groups[j / 3] = self->triangle_groups[i / 3];
+        for(int k = 0; k < 3; k++){
+            self->group_corners[j + k] = self->group_remap[self->group_corners[i + k]];
+            self->corners[j + k] = self->remap[self->corners[i + k]];
+        }
+        j += 3;
+    }
+    self->n_indices = j;
+    return n_done;
+}
+
+/*Appends the current triangles of each group as a new level*/
+static bool lod_builder_add_level(LodBuilder *self, uint32_t *first, uint32_t *counts, indice_t *scratch)
+{
+    VGroup *group;
+    VGroupLod *lod;
+    indice_t *tmp;
+    size_t n;
+
+    memset(counts, 0, sizeof(uint32_t) * self->n_groups);
+    for(size_t i = 0; i < self->n_indices; i += 3)
+        counts[self->triangle_groups[i / 3]] += 3;
+    first[0] = 0;
+    for(size_t g = 1; g < self->n_groups; g++)
+        first[g] = first[g - 1] + counts[g - 1];
+    for(size_t i = 0; i < self->n_indices; i += 3){
+        uint32_t g = self->triangle_groups[i / 3];
+        for(int k = 0; k < 3; k++)
+            scratch[first[g]++] = self->group_corners[i + k] - self->vertex_base[g];
+    }
+
+    for(size_t g = 0; g < self->n_groups; g++){
+        group = &self->groups[g];
+        lod = &group->lods[group->n_lods];
+        first[g] -= counts[g];
+        n = group->n_lods ? group->lods[group->n_lods - 1].n_indices : group->n_indices;
+        if(group->n_lods && counts[g] == n){
+            /*Untouched since the previous level*/
+            *lod = group->lods[group->n_lods - 1];
+        }else{
+            tmp = realloc(group->lod_indices, sizeof(indice_t) * (group->n_lod_indices + counts[g]));
+            if(!tmp && counts[g])
+                return false;
+            group->lod_indices = tmp;
+            memcpy(group->lod_indices + group->n_lod_indices, scratch + first[g], sizeof(indice_t) * counts[g]);
+            if(counts[g] != group->n_indices)
+                mesh_optimizer_reorder_triangles(group->lod_indices + group->n_lod_indices, counts[g], group->n_vertices);
+            lod->offset = group->n_lod_indices;
+            lod->n_indices = counts[g];
+            group->n_lod_indices += counts[g];
+        }
+        lod->error = self->error;
+        group->n_lods++;
+    }
+    return true;
+}
+
+static void lod_builder_dispose(LodBuilder *self)
+{
+    free(self->vertex_base);
+    free(self->welded);
+    free(self->positions);
+    free(self->first_entry);
+    free(self->entries);
+    free(self->kinds);
+    free(self->seams);
+    free(self->quadrics);
+    free(self->corners);
+    free(self->group_corners);
+    free(self->triangle_groups);
+    free(self->first_triangle);
+    free(self->triangles);
+    free(self->collapses);
+    free(self->remap);
+    free(self->group_remap);
+    free(self->stamps);
+    free(self->touched);
+}
+
+/**
+ * @brief Builds the levels of detail of a range of groups simplified
+ * together.
+ *
+ * @param groups The groups, none of them mapped
+ * @param n_groups Number of groups
+ * @return true on success, false on failure
+ */
+static bool lod_build_groups(VGroup *groups, size_t n_groups)
+{
+    LodBuilder builder = {0};
+    uint32_t *first, *counts;
+    indice_t *scratch;
+    size_t n_indices, n_previous;
+    bool rv;
+
+    builder.groups = groups;
+    builder.n_groups = n_groups;
+    n_indices = 0;
+    builder.vertex_base = malloc(sizeof(uint32_t) * n_groups);
+    if(!builder.vertex_base)
+        return false;
+    for(size_t g = 0; g < n_groups; g++){
+        builder.vertex_base[g] = builder.n_group_vertices;
+        builder.n_group_vertices += groups[g].n_vertices;
+        n_indices += groups[g].n_indices;
+    }
+    if(n_indices / 3 < MESH_LOD_MIN_TRIANGLES){
+        free(builder.vertex_base);
+        return true;
+    }
+
+    rv = false;
+    builder.welded = malloc(sizeof(uint32_t) * builder.n_group_vertices);
+    builder.positions = malloc(sizeof(SGVec3f) * builder.n_group_vertices);
+    builder.first_entry = malloc(sizeof(uint32_t) * (builder.n_group_vertices + 1));
+    builder.entries = malloc(sizeof(LodEntry) * builder.n_group_vertices);
+    builder.kinds = malloc(sizeof(uint8_t) * builder.n_group_vertices);
+    builder.seams = malloc(sizeof(bool) * builder.n_group_vertices);
+    builder.quadrics = calloc(builder.n_group_vertices, sizeof(LodQuadric));
+    builder.corners = malloc(sizeof(uint32_t) * n_indices);
+    builder.group_corners = malloc(sizeof(uint32_t) * n_indices);
+    builder.triangle_groups = malloc(sizeof(uint32_t) * (n_indices / 3));
+    builder.first_triangle = malloc(sizeof(uint32_t) * (builder.n_group_vertices + 1));
+    builder.triangles = malloc(sizeof(uint32_t) * n_indices);
+    builder.collapses = malloc(sizeof(LodCollapse) * n_indices);
+    builder.remap = malloc(sizeof(uint32_t) * builder.n_group_vertices);
+    builder.group_remap = malloc(sizeof(uint32_t) * builder.n_group_vertices);
+    builder.stamps = calloc(builder.n_group_vertices, sizeof(uint32_t));
+    builder.touched = malloc(sizeof(bool) * builder.n_group_vertices);
+    first = malloc(sizeof(uint32_t) * n_groups);
+    counts = malloc(sizeof(uint32_t) * n_groups);
+    scratch = malloc(sizeof(indice_t) * n_indices);
+    if(!builder.welded || !builder.positions || !builder.first_entry
+       || !builder.entries || !builder.kinds || !builder.seams
+       || !builder.quadrics || !builder.corners || !builder.group_corners
+       || !builder.triangle_groups || !builder.first_triangle
+       || !builder.triangles || !builder.collapses || !builder.remap
+       || !builder.group_remap || !builder.stamps || !builder.touched
+       || !first || !counts || !scratch)
+        goto out;
+
+    if(!lod_builder_weld(&builder))
+        goto out;
+    for(size_t g = 0; g < n_groups; g++){
+        for(size_t i = 0; i < groups[g].n_indices; i += 3){
+            uint32_t *corners = &builder.corners[builder.n_indices];
+            for(int k = 0; k < 3; k++){
+                uint32_t v = builder.vertex_base[g] + groups[g].indices[i + k];
+                builder.group_corners[builder.n_indices + k] = v;
+                corners[k] = builder.welded[v];
+            }
+            /*Two vertices at the same place, nothing to draw*/
+            if(corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2])
+                continue;
+            builder.triangle_groups[builder.n_indices / 3] = g;
+            builder.n_indices += 3;
+        }
+    }
+    lod_builder_init_quadrics(&builder);
+    if(!lod_builder_classify(&builder))
+        goto out;
+
+    rv = true;
+    n_previous = builder.n_indices / 3;
+    for(int level = 0; level < VGROUP_LOD_LEVELS - 1; level++){
+        if(n_previous < MESH_LOD_MIN_TRIANGLES)
+            break;
+        while(lod_builder_pass(&builder, lod_max_errors[level] * lod_max_errors[level]))
+            ;
+        /*Not worth it, the next level will start from there*/
+        if(builder.n_indices / 3 > n_previous * MESH_LOD_MIN_REDUCTION)
+            continue;
+        n_previous = builder.n_indices / 3;
+        if(!lod_builder_add_level(&builder, first, counts, scratch)){
+            rv = false;
+            break;
+        }
+    }
+
+out:
+    free(first);
+    free(counts);
+    free(scratch);
+    lod_builder_dispose(&builder);
+    return rv;
+}
+
+/**
+ * @brief Builds up to VGROUP_LOD_LEVELS - 1 simplified versions of the
+ * groups of a finished mesh, cell by cell, stored in their lod_indices.
+ *
+ * Level l collapses whatever costs less than lod_max_errors[l - 1].
+ * Levels that keep more than MESH_LOD_MIN_REDUCTION times the triangles
+ * of the previous one are skipped, and cells under MESH_LOD_MIN_TRIANGLES
+ * aren't simplified any further.
+ *
+ * @param self The Mesh to work on, its groups must not be mapped
+ * @return true on success, false on failure (groups have no levels)
+ */
+bool mesh_build_lods(Mesh *self)
+{
+    VGroup *group;
+    bool rv;
+
+    for(size_t i = 0; i < self->n_groups; i++){
+        group = &self->groups[i];
+        if(group->mapped || !group->indices)
+            return false;
+        if(group->lod_indices)
+            free(group->lod_indices);
+        group->lod_indices = NULL;
+        group->n_lod_indices = 0;
+        group->n_lods = 0;
+    }
+
+    rv = true;
+    if(self->n_cells){
+        for(size_t c = 0; c < self->n_cells && rv; c++)
+            rv = lod_build_groups(&self->groups[self->cells[c].first_group], self->cells[c].n_groups);
+    }else{
+        rv = lod_build_groups(self->groups, self->n_groups);
+    }
+
+    if(!rv){
+        for(size_t i = 0; i < self->n_groups; i++){
+            group = &self->groups[i];
+            if(group->lod_indices)
+                free(group->lod_indices);
+            group->lod_indices = NULL;
+            group->n_lod_indices = 0;
+            group->n_lods = 0;
+        }
+    }
+    return rv;
+}
+
+/**
+ * @brief Picks the coarsest level of detail whose error, seen from
+ * @p distance, stays under @p max_error pixels.
+ *
+ * @param self a VGroup
+ * @param distance Distance (meters) from the camera to the group
+ * @param pixel_scale Pixels covered by one meter one meter away from the
+ * camera: viewport height / (2 * tan(fovy / 2))
+ * @param max_error Max acceptable error, in pixels
+ * @return The level to draw, 0 being full resolution
+ */
+int vgroup_select_lod(VGroup *self, float distance, float pixel_scale, float max_error)
+{
+    for(int i = self->n_lods; i > 0; i--){
+        if(self->lods[i - 1].error * pixel_scale <= max_error * distance)
+            return i;
+    }
+    return 0;
+}
+
+/**
+ * @brief Gets where the indices of a level of detail are in the group
+ * index buffer.
+ *
+ * The mesh chain of the group must have been prepared.
+ *
+ * @param self a VGroup
+ * @param level The level, 0 being full resolution. Levels the group
+ * doesn't have fall back to the coarsest it has.
+ * @param first_index Offset (bytes) of the level indices in the group ibo
+ * @param n_indices Number of indices of the level
+ */
+void vgroup_get_lod_range(VGroup *self, int level, size_t *first_index, size_t *n_indices)
+{
+    if(level > (int)self->n_lods)
+        level = self->n_lods;
+    if(level <= 0){
+        *first_index = self->first_index;
+        *n_indices = self->n_indices;
+        return;
+    }
+    *first_index = self->lods[level - 1].first_index;
+    *n_indices = self->lods[level - 1].n_indices;
+}
+
+/**
+ * @brief Gets the indices of a level of detail, in RAM.
+ *
+ * Unlike vgroup_get_lod_range, works on groups that have not been
+ * prepared. Indices are relative to the group vertices.
+ *
+ * @param self a VGroup
+ * @param level The level, 0 being full resolution. Levels the group
+ * doesn't have fall back to the coarsest it has.
+ * @param n_indices Number of indices of the level
+ * @return The indices of the level
+ */
+indice_t *vgroup_get_lod_indices(VGroup *self, int level, size_t *n_indices)
+{
+    if(level > (int)self->n_lods)
+        level = self->n_lods;
+    if(level <= 0){
+        *n_indices = self->n_indices;
+        return self->indices;
+    }
+    *n_indices = self->lods[level - 1].n_indices;
+    return self->lod_indices + self->lods[level - 1].offset;
+}
@@ -0,0 +1,23 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+#include <stdbool.h>
+
+#include "mesh.h"
+
+/*Levels that keep more than this fraction of the previous one are skipped*/
+#define MESH_LOD_MIN_REDUCTION 0.8
+/*Cells with fewer triangles than this aren't simplified any further*/
+#define MESH_LOD_MIN_TRIANGLES 64
+
+bool mesh_build_lods(Mesh *self);
+int vgroup_select_lod(VGroup *self, float distance, float pixel_scale, float max_error);
+void vgroup_get_lod_range(VGroup *self, int level, size_t *first_index, size_t *n_indices);
+indice_t *vgroup_get_lod_indices(VGroup *self, int level, size_t *n_indices);
+#endif /* MESH_LOD_H */
@@ -0,0 +1,359 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "mesh-optimizer.h"
+#include "mesh-lod.h"
+
+/**
+ * MeshOptimizer: Reorders the triangles and vertices of finished
+ * VGroups so that the GPU transforms each vertex as few times as
+ * possible and fetches vertices in memory order.
+ *
+ * Triangles are reordered with Tom Forsyth's "Linear-Speed Vertex Cache
+ * Optimisation": vertices are scored on their position in a modeled LRU
+ * cache and on how many triangles still use them, and the next triangle
+ * is the one with the best score among those using cached vertices.
+ *
+ * Optimizations are applied when tiles are built, before they get
+ * written to the mesh cache, which records them.
+ */
+
+/*Forsyth's scoring parameters*/
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+typedef struct{
+    float score;
+    int cache_pos; /*-1 when not in the modeled cache*/
+    uint32_t first_triangle; /*In the adjacency array*/
+    uint32_t n_triangles; /*Not yet emitted triangles using the vertex*/
+}OptimizerVertex;
+
+static MeshOptimizeFlags default_flags = MESH_OPTIMIZE;
+
+/**
+ * @brief Sets the optimizations mesh_new_from_file applies to tiles it
+ * builds.
+ *
+ * Cached tiles that lack any of @p flags are rebuilt.
+ *
+ * @param flags MeshOptimizeFlags
+ */
+void mesh_optimizer_set_flags(MeshOptimizeFlags flags)
+{
+    default_flags = flags;
+}
+
+MeshOptimizeFlags mesh_optimizer_get_flags(void)
+{
+    return default_flags;
+}
+
+/**
+ * @brief Applies optimizations to all groups of a mesh. Accessories
+ * are left alone.
+ *
+ * Groups must have been finished and must not point into a cache
+ * mapping.
+ *
+ * @param self The Mesh to work on
+ * @param flags Optimizations to apply
+ * @return true on success, false otherwise
+ *
+ * @see mesh_finish
+ */
+bool mesh_optimize(Mesh *self, MeshOptimizeFlags flags)
+{
+    VGroup *group;
+    bool rv;
+
+    rv = true;
+    for(size_t i = 0; i < self->n_groups; i++){
+        group = &self->groups[i];
+        if(group->mapped || !group->indices)
+            return false;
+        if(flags & MESH_OPTIMIZE_VERTEX_CACHE)
+            rv = vgroup_optimize_vertex_cache(group) && rv;
+        if(flags & MESH_OPTIMIZE_VERTEX_FETCH)
+            rv = vgroup_optimize_vertex_fetch(group) && rv;
+    }
+    /*Groups of a cell are simplified together*/
+    if(flags & MESH_OPTIMIZE_LOD)
+        rv = mesh_build_lods(self) && rv;
+    if(rv)
+        self->optimizations |= flags;
+    return rv;
+}
+
+static float optimizer_vertex_score(OptimizerVertex *v)
+{
+    float rv;
+
+    if(v->n_triangles == 0)
+        return -1.0f; /*No triangle left to pull*/
+
+    rv = 0.0f;
+    if(v->cache_pos >= 0){
+        if(v->cache_pos < 3){
+            /* Vertices of the last triangle get a fixed score so that
+             * its direct neighbours don't always win*/
+            rv = LAST_TRIANGLE_SCORE;
+        }else{
+            rv = 1.0f - (v->cache_pos - 3) * (1.0f / (MESH_OPTIMIZER_CACHE_SIZE - 3));
+            rv = powf(rv, CACHE_DECAY_POWER);
+        }
+    }
+    /*Helps finishing off vertices with few triangles left*/
+    rv += VALENCE_BOOST_SCALE * powf(v->n_triangles, -VALENCE_BOOST_POWER);
+    return rv;
+}
+
+/**
+ * @brief Reorders the triangles of a finished VGroup for post-transform
+ * cache reuse.
+ *
+ * @param self The VGroup to work on
+ * @return true on success, false on failure (the group is left as is)
+ */
+bool vgroup_optimize_vertex_cache(VGroup *self)
+{
+    return mesh_optimizer_reorder_triangles(self->indices, self->n_indices, self->n_vertices);
+}
+
+/**
+ * @brief Reorders triangles for post-transform cache reuse.
+ *
+ * @param src The triangles, reordered in place
+ * @param n_indices Number of indices
+ * @param n_vertices Number of vertices @p src refers to
+ * @return true on success, false on failure (@p src is left as is)
+ */
+bool mesh_optimizer_reorder_triangles(indice_t *src, size_t n_indices, size_t n_vertices)
+{
+    OptimizerVertex *vertices;
+    uint32_t *adjacency;
+    float *scores;
+    bool *emitted;
+    indice_t *indices;
+    int cache[MESH_OPTIMIZER_CACHE_SIZE + 3];
+    int new_cache[MESH_OPTIMIZER_CACHE_SIZE + 3];
+    size_t n_triangles, n_cache, n_new_cache;
+    long best;
+    float best_score;
+    bool rv;
+
+    n_triangles = n_indices / 3;
+    if(n_triangles < 2)
+        return true;
+
+    rv = false;
+    vertices = calloc(n_vertices, sizeof(OptimizerVertex));
+    adjacency = malloc(sizeof(uint32_t) * n_triangles * 3);
+    scores = malloc(sizeof(float) * n_triangles);
+    emitted = calloc(n_triangles, sizeof(bool));
+    indices = malloc(sizeof(indice_t) * n_triangles * 3);
+    if(!vertices || !adjacency || !scores || !emitted || !indices)
+        goto out;
+
+    /*Triangles using each vertex*/
+    for(size_t i = 0; i < n_triangles * 3; i++)
+        vertices[src[i]].n_triangles++;
+    for(size_t i = 0, offset = 0; i < n_vertices; i++){
+        vertices[i].first_triangle = offset;
+        offset += vertices[i].n_triangles;
+        vertices[i].n_triangles = 0;
+        vertices[i].cache_pos = -1;
+    }
+    for(size_t i = 0; i < n_triangles * 3; i++){
+        OptimizerVertex *v = &vertices[src[i]];
+        adjacency[v->first_triangle + v->n_triangles++] = i / 3;
+    }
+
+    for(size_t i = 0; i < n_vertices; i++)
+        vertices[i].score = optimizer_vertex_score(&vertices[i]);
+    for(size_t i = 0; i < n_triangles; i++){
+        scores[i] = vertices[src[i*3]].score
+                  + vertices[src[i*3+1]].score
+                  + vertices[src[i*3+2]].score;
+    }
+
+    n_cache = 0;
+    best = -1;
+    for(size_t n = 0; n < n_triangles; n++){
+        if(best < 0){
+            /*Nothing left around the cache, start over from the best triangle*/
+            best_score = -INFINITY;
+            for(size_t i = 0; i < n_triangles; i++){
+                if(!emitted[i] && scores[i] > best_score){
+                    best_score = scores[i];
+                    best = i;
+                }
+            }
+        }
+
+        emitted[best] = true;
+        n_new_cache = 0;
+        for(int i = 0; i < 3; i++){
+            indice_t idx = src[best*3 + i];
+            OptimizerVertex *v = &vertices[idx];
+
+            indices[n*3 + i] = idx;
+            /*Removes the triangle from the ones using the vertex*/
+            for(uint32_t j = v->first_triangle; j < v->first_triangle + v->n_triangles; j++){
+                if(adjacency[j] == best){
+                    adjacency[j] = adjacency[v->first_triangle + v->n_triangles - 1];
+                    v->n_triangles--;
+                    break;
+                }
+            }
+            /*Degenerate triangles use a vertex more than once*/
+            bool seen = false;
+            for(size_t j = 0; j < n_new_cache; j++)
+                seen = seen || new_cache[j] == idx;
+            if(!seen)
+                new_cache[n_new_cache++] = idx;
+        }
+        /*LRU: the triangle vertices go first, others are pushed back*/
+        for(size_t i = 0; i < n_cache; i++){
+            bool in_triangle = false;
+            for(int j = 0; j < 3; j++)
+                in_triangle = in_triangle || cache[i] == indices[n*3 + j];
+            if(!in_triangle)
+                new_cache[n_new_cache++] = cache[i];
+        }
+        for(size_t i = 0; i < n_new_cache; i++){
+            vertices[new_cache[i]].cache_pos = i < MESH_OPTIMIZER_CACHE_SIZE ? i : -1;
+            vertices[new_cache[i]].score = optimizer_vertex_score(&vertices[new_cache[i]]);
+        }
+        n_cache = n_new_cache < MESH_OPTIMIZER_CACHE_SIZE ? n_new_cache : MESH_OPTIMIZER_CACHE_SIZE;
+        memcpy(cache, new_cache, n_cache * sizeof(int));
+
+        /*Only triangles using cached vertices have had their score changed*/
+        best = -1;
+        best_score = -INFINITY;
+        for(size_t i = 0; i < n_new_cache; i++){
+            OptimizerVertex *v = &vertices[new_cache[i]];
+            for(uint32_t j = v->first_triangle; j < v->first_triangle + v->n_triangles; j++){
+                uint32_t t = adjacency[j];
+                scores[t] = vertices[src[t*3]].score
+                          + vertices[src[t*3+1]].score
+                          + vertices[src[t*3+2]].score;
+                if(scores[t] > best_score){
+                    best_score = scores[t];
+                    best = t;
+                }
+            }
+        }
+    }
+
+    memcpy(src, indices, sizeof(indice_t) * n_triangles * 3);
+    rv = true;
+out:
+    free(vertices);
+    free(adjacency);
+    free(scores);
+    free(emitted);
+    free(indices);
+    return rv;
+}
+
+/**
+ * @brief Reorders the vertices of a finished VGroup in the order its
+ * triangles use them, so that vertex fetches go forward in memory.
+ *
+ * Vertices that no triangle uses are dropped.
+ *
+ * @param self The VGroup to work on
+ * @return true on success, false on failure (the group is left as is)
+ */
+bool vgroup_optimize_vertex_fetch(VGroup *self)
+{
+    long *remap;
+    SGVec3f *positions;
+    SGVec2f *texcoords;
+    indice_t n_vertices;
+
+    remap = malloc(sizeof(long) * (self->n_vertices ? self->n_vertices : 1));
+    positions = malloc(sizeof(SGVec3f) * (self->n_vertices ? self->n_vertices : 1));
+    texcoords = malloc(sizeof(SGVec2f) * (self->n_vertices ? self->n_vertices : 1));
+    if(!remap || !positions || !texcoords){
+        free(remap);
+        free(positions);
+        free(texcoords);
+        return false;
+    }
+
+    for(size_t i = 0; i < self->n_vertices; i++)
+        remap[i] = -1;
+    n_vertices = 0;
+    for(size_t i = 0; i < self->n_indices; i++){
+        indice_t idx = self->indices[i];
+        if(remap[idx] < 0){
+            remap[idx] = n_vertices;
+            positions[n_vertices] = self->positions[idx];
+            texcoords[n_vertices] = self->texcoords[idx];
+            n_vertices++;
+        }
+        self->indices[i] = remap[idx];
+    }
+    /*Levels of detail only use vertices of the full resolution group*/
+    for(size_t i = 0; i < self->n_lod_indices; i++)
+        self->lod_indices[i] = remap[self->lod_indices[i]];
+
+    free(remap);
+    free(self->positions);
+    free(self->texcoords);
+    self->positions = positions;
+    self->texcoords = texcoords;
+    self->n_vertices = n_vertices;
+    return true;
+}
+
+/**
+ * @brief Computes how many times the vertices of @p self would be
+ * transformed by a GPU with a FIFO post-transform cache of @p cache_size
+ * entries.
+ *
+ * @param self The VGroup to work on
+ * @param cache_size Cache entries, e.g 16 or 32
+ * @param stats Filled with the results
+ */
+void vgroup_get_cache_stats(VGroup *self, size_t cache_size, VGroupCacheStats *stats)
+{
+    size_t *inserted;
+
+    memset(stats, 0, sizeof(VGroupCacheStats));
+    stats->triangles = self->n_indices / 3;
+    stats->vertices = self->n_vertices;
+    if(!stats->triangles || !stats->vertices)
+        return;
+
+    /* Vertices are in the cache if no more than cache_size vertices have
+     * been transformed since their own transform*/
+    inserted = calloc(self->n_vertices, sizeof(size_t));
+    if(!inserted)
+        return;
+    for(size_t i = 0; i < stats->triangles * 3; i++){
+        indice_t idx = self->indices[i];
+        if(!inserted[idx] || stats->transforms - inserted[idx] >= cache_size){
+            stats->transforms++;
+            inserted[idx] = stats->transforms; /*0 is never inserted*/
+        }
+    }
+    free(inserted);
+
+    stats->acmr = stats->transforms / (float)stats->triangles;
+    stats->atvr = stats->transforms / (float)stats->vertices;
+}
@@ -0,0 +1,50 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+#include <stdbool.h>
+
+#include "mesh.h"
+
+/*Size of the post-transform cache modeled when reordering triangles*/
+#define MESH_OPTIMIZER_CACHE_SIZE 32
+
+typedef enum{
+    MESH_OPTIMIZE_NONE = 0,
+    /*Reorders triangles for post-transform vertex cache reuse*/
+    MESH_OPTIMIZE_VERTEX_CACHE = 1 << 0,
+    /*Reorders vertices in the order triangles first use them*/
+    MESH_OPTIMIZE_VERTEX_FETCH = 1 << 1,
+    /*Builds simplified versions of groups, see mesh-lod.c*/
+    MESH_OPTIMIZE_LOD = 1 << 2,
+    MESH_OPTIMIZE_ALL = MESH_OPTIMIZE_VERTEX_CACHE | MESH_OPTIMIZE_VERTEX_FETCH | MESH_OPTIMIZE_LOD
+}MeshOptimizeFlags;
+
+/*Optimizations applied to tiles when they are built, see mesh_new_from_file*/
+#ifndef MESH_OPTIMIZE
+#define MESH_OPTIMIZE MESH_OPTIMIZE_NONE
+#endif
+
+/*How a VGroup fares with a FIFO post-transform cache*/
+typedef struct{
+    size_t triangles;
+    size_t vertices;
+    size_t transforms; /*Vertex shader invocations*/
+    float acmr; /*Average cache miss ratio: transforms per triangle, 0.5 at best*/
+    float atvr; /*Average transform to vertex ratio, 1.0 at best*/
+}VGroupCacheStats;
+
+void mesh_optimizer_set_flags(MeshOptimizeFlags flags);
+MeshOptimizeFlags mesh_optimizer_get_flags(void);
+
+bool mesh_optimize(Mesh *self, MeshOptimizeFlags flags);
+bool mesh_optimizer_reorder_triangles(indice_t *src, size_t n_indices, size_t n_vertices);
+bool vgroup_optimize_vertex_cache(VGroup *self);
+bool vgroup_optimize_vertex_fetch(VGroup *self);
+void vgroup_get_cache_stats(VGroup *self, size_t cache_size, VGroupCacheStats *stats);
+#endif /* MESH_OPTIMIZER_H */
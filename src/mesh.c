@@ -12,6 +12,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <sys/mman.h>
 
 #if USE_GLES
 #include <SDL2/SDL_opengles2.h>
@@ -22,8 +25,10 @@
 #endif
 
 #include "mesh.h"
+#include "mesh-optimizer.h"
 #include "btg-io.h"
 #include "texture.h"
+#include "gl-state.h"
 #include "misc.h"
 
 #include "geodesy.h"
@@ -33,6 +38,7 @@
 
 #include "stg-object.h"
 #include "fg-scenery.h"
+#include "mesh-cache.h"
 /**
  * @brief Inits a VGroup to make it able to hold as much as @p n_triangles
  * triangles. Will fail (return NULL) if the group as already been inited
@@ -46,7 +52,7 @@
 VGroup *vgroup_init(VGroup *self, const char *material, size_t n_triangles)
 {
     /*Non-inited vgroups are memset'ed to 0 by the parent Mesh*/
-    if(self->indices)
+    if(self->indices || self->wide_indices)
         return NULL;
 
     self->material = strdup(material);
@@ -54,14 +60,14 @@ VGroup *vgroup_init(VGroup *self, const char *material, size_t n_triangles)
 
     /*Triangles are described by a set of 3 indices each*/
     self->allocated_indices = n_triangles * 3;
-    self->indices = calloc(self->allocated_indices, sizeof(indice_t));
+    self->wide_indices = calloc(self->allocated_indices, sizeof(uint32_t));
 
     /* We have the number of indices, but we don't know yet how many different
      * vertices (unique set of positions/texcoords/normals/etc) these indices will
-     * index into. Start off with 30% less vertices than indices (optimistic) and let
-     * the VertexSet handle it.
+     * index into. Terrain meshes have about as many vertices as triangles, start
+     * off with that and let the VertexSet grow if needed.
      */
-    self->vset = vertex_set_new(self->allocated_indices * 0.7);
+    self->vset = vertex_set_new(n_triangles);
     if(!self->vset)
         return NULL;
     self->bs.radius = -1.0;
@@ -81,17 +87,22 @@ void vgroup_dispose(VGroup *self)
 {
     if(self->vset)
         vertex_set_free(self->vset);
-    if(self->indices)
-        free(self->indices);
     if(self->material)
         free(self->material);
     /*TODO: Interwine the coordinates and propertires to deal with all of the
      * at once*/
-    if(self->positions)
-        free(self->positions);
-    if(self->texcoords)
-        free(self->texcoords);
-    glDeleteBuffers(NBuffers, self->buffers);
+    if(self->wide_indices)
+        free(self->wide_indices);
+    if(!self->mapped){
+        if(self->indices)
+            free(self->indices);
+        if(self->lod_indices)
+            free(self->lod_indices);
+        if(self->positions)
+            free(self->positions);
+        if(self->texcoords)
+            free(self->texcoords);
+    }
     /*TODO: Release texture*/
 }
 
@@ -114,15 +125,39 @@ void vgroup_dispose(VGroup *self)
  */
 long vgroup_add_vertex(VGroup *self, SGVec3d *v, SGVec2f *tex)
 {
-    long rv = 0;
-    IndexedVertex *iv;
+    size_t nelements = self->vset->nelements;
+    long rv;
 
-    iv = vertex_set_add_vertex(self->vset, v, tex);
-    if(iv){
+    rv = vertex_set_add_vertex(self->vset, v, tex);
+    if(rv >= 0 && self->vset->nelements > nelements)
         sg_sphered_expand_by(&self->bs, v);
-        return iv->index;
+    return rv;
+}
+
+/*
+ * Appends the indices of a triangle whose vertices have been
+ * added to the group.
+ */
+static bool vgroup_push_triangle(VGroup *self, long idx[3])
+{
+    if(idx[0] < 0 || idx[1] < 0 || idx[2] < 0)
+        return false;
+
+    if(self->n_indices + 3 > self->allocated_indices){
+        size_t nsize = self->allocated_indices ? self->allocated_indices * 2 : 3;
+        uint32_t *tmp = realloc(self->wide_indices, nsize * sizeof(uint32_t));
+        if(!tmp)
+            return false;
+        self->wide_indices = tmp;
+        self->allocated_indices = nsize;
     }
-    return -1;
+
+    self->wide_indices[self->n_indices] = idx[0];
+    self->wide_indices[self->n_indices+1] = idx[1];
+    self->wide_indices[self->n_indices+2] = idx[2];
+    self->n_indices += 3;
+
+    return true;
 }
 
 /**
@@ -139,33 +174,44 @@ long vgroup_add_vertex(VGroup *self, SGVec3d *v, SGVec2f *tex)
  */
 bool vgroup_add_triangle(VGroup *self, SGVec3d *v1, SGVec2f *t1, SGVec3d *v2, SGVec2f *t2, SGVec3d *v3, SGVec2f *t3)
 {
-    size_t idx[3];
+    long idx[3];
 
-    /*TODO: Handle failure*/
     idx[0] = vgroup_add_vertex(self, v1, t1);
     idx[1] = vgroup_add_vertex(self, v2, t2);
     idx[2] = vgroup_add_vertex(self, v3, t3);
 
-    /* TODO: Auto-split the current group into another group if we reach the maximum number
-     * of indices allowed by the storage type (USHORT is the most likely to have the problem)*/
+    return vgroup_push_triangle(self, idx);
+}
+
+/**
+ * @brief Add a triangle given as indices into BTG vertex and texture
+ * coordinates lists to the VGroup.
+ *
+ * Vertices are told apart by their indices only. All triangles
+ * of a VGroup must be added either with this function or with
+ * vgroup_add_triangle, not both.
+ *
+ * @param self The VGroup to work on
+ * @param nodes The BTG vertex list
+ * @param texcoords The BTG texture coordinates list
+ * @param v Indices in @p nodes of the triangle vertices
+ * @param t Indices in @p texcoords of the triangle vertices
+ * @return true on success, false on failure
+ */
+bool vgroup_add_indexed_triangle(VGroup *self, const SGVec3d *nodes, const SGVec2f *texcoords,
+                                 const uint32_t v[3], const uint32_t t[3])
+{
+    long idx[3];
+    size_t nelements;
+
     for(int i = 0; i < 3; i++){
-        if(idx[i] < 0)
-            return false;
-        if(idx[i] > INDICE_MAX){
-            printf(
-                "WARNING: Terrain %s Group %p has indice value %zu greather than "
-                "what can be stored with current sizeof(indice_t)(%zu), Undefined behavior from now\n",
-                "CURRENT FILE", self, idx[i], sizeof(indice_t)
-            );
-        }
+        nelements = self->vset->nelements;
+        idx[i] = vertex_set_add_indexed(self->vset, v[i], t[i], nodes, texcoords);
+        if(idx[i] >= 0 && self->vset->nelements > nelements)
+            sg_sphered_expand_by(&self->bs, (SGVec3d *)&nodes[v[i]]);
     }
 
-    self->indices[self->n_indices] = idx[0];
-    self->indices[self->n_indices+1] = idx[1];
-    self->indices[self->n_indices+2] = idx[2];
-    self->n_indices += 3;
-
-    return true;
+    return vgroup_push_triangle(self, idx);
 }
 
 /**
@@ -185,10 +231,12 @@ size_t vgroup_get_size(VGroup *self, bool data_only)
         rv += sizeof(SGVec3f) * self->n_vertices;
         rv += sizeof(SGVec2f) * self->n_vertices;
         rv += sizeof(indice_t) * self->n_indices;
+        rv += sizeof(indice_t) * self->n_lod_indices;
     }else{
         rv += sizeof(SGVec3f) * self->n_vertices;
         rv += sizeof(SGVec2f) * self->n_vertices;
         rv += sizeof(indice_t) * self->allocated_indices;
+        rv += sizeof(indice_t) * self->n_lod_indices;
         rv += sizeof(VGroup);
     }
     return rv;
@@ -196,73 +244,52 @@ size_t vgroup_get_size(VGroup *self, bool data_only)
 
 bool vgroup_finish(VGroup *self, SGSphered *gbs)
 {
-    if(!self->positions){
-        bool rv;
-        rv = vertex_set_flatten(self->vset, &self->n_vertices, &self->positions, &self->texcoords);
+    bool rv;
+
+    if(!self->wide_indices)
+        return false; /*Already finished*/
+
+    rv = true;
+    if(self->vset){
+        if(self->vset->nelements > INDICE_MAX){
+            printf(
+                "WARNING: Group %s has %zu vertices, more than what can be indexed "
+                "with current sizeof(indice_t)(%zu), mesh_split_groups() has not "
+                "been called. Undefined behavior from now\n",
+                self->material, self->vset->nelements, sizeof(indice_t)
+            );
+        }
+        rv = vertex_set_release_arrays(self->vset, &self->n_vertices, &self->positions, &self->texcoords);
         if(!rv)
             printf("Flattening failed, problems ahead !!\n");
         self->vset = vertex_set_free(self->vset);
-        self->bs.center.x += gbs->center.x;
-        self->bs.center.y += gbs->center.y;
-        self->bs.center.z += gbs->center.z;
-#if 0
-        printf("VGroup %p bs: %.4f %.4f %.4f %.2f\n",self,
-            self->bs.center.x,
-            self->bs.center.y,
-            self->bs.center.z,
-            self->bs.radius
-        );
-#endif
-        return rv;
     }
-    return false;
-}
-
-/**
- * @brief Allocate various OpenGL resources for rendering. Just need to be
- * called once.
- *
- * @param self The VGroup to work on.
- * @return true when the VGroup has been successfully prepared.
- */
-bool vgroup_prepare(VGroup *self)
-{
-    if(self->prepared) return true;
-
-    self->texture = texture_get_by_name(self->material);
-
-    glGenBuffers(NBuffers, self->buffers);
 
-    glBindBuffer(GL_ARRAY_BUFFER, self->buffers[PositionBuffer]);
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        self->n_vertices*sizeof(SGVec3f),
-        self->positions,
-        GL_STATIC_DRAW
-    );
-
-    glBindBuffer(GL_ARRAY_BUFFER, self->buffers[TexCoordBuffer]);
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        self->n_vertices*sizeof(SGVec2f),
-        self->texcoords,
-        GL_STATIC_DRAW
-    );
+    self->indices = malloc(sizeof(indice_t) * (self->n_indices ? self->n_indices : 1));
+    if(self->indices){
+        for(size_t i = 0; i < self->n_indices; i++)
+            self->indices[i] = self->wide_indices[i];
+        self->allocated_indices = self->n_indices;
+    }else{
+        rv = false;
+    }
+    free(self->wide_indices);
+    self->wide_indices = NULL;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, self->buffers[ElementBuffer]);
-    glBufferData(
-        GL_ELEMENT_ARRAY_BUFFER,
-        self->n_indices*sizeof(indice_t),
-        self->indices,
-        GL_STATIC_DRAW
+    self->bs.center.x += gbs->center.x;
+    self->bs.center.y += gbs->center.y;
+    self->bs.center.z += gbs->center.z;
+#if 0
+    printf("VGroup %p bs: %.4f %.4f %.4f %.2f\n",self,
+        self->bs.center.x,
+        self->bs.center.y,
+        self->bs.center.z,
+        self->bs.radius
     );
-
-    self->prepared = true;
-    return true;
+#endif
+    return rv;
 }
 
-
-
 /**
  * @brief Creates a new mesh with @p size groups.
  *
@@ -295,10 +322,13 @@ Mesh *mesh_new(size_t size)
  */
 Mesh *mesh_new_empty(void)
 {
+    static unsigned long serial = 0;
     Mesh *rv;
     rv = calloc(1, sizeof(Mesh));
     if(rv){
         glm_mat4d_identity(rv->transformation);
+        /*Meshes are created by the loader threads*/
+        rv->serial = __atomic_add_fetch(&serial, 1, __ATOMIC_RELAXED);
     }
     return rv;
 }
@@ -315,6 +345,10 @@ void mesh_add_accessory(Mesh *self, Mesh *accessory)
 /**
  * Creates and prepares a new mesh from a STG file
  *
+ * The render-ready mesh cache is looked up first. When there is
+ * no up-to-date cache file, the mesh is built from the BTG files
+ * and the cache is (re)written.
+ *
  * @param filename The filename to read from
  * @return a newly created and prepared Mesh
  */
@@ -326,9 +360,24 @@ Mesh *mesh_new_from_file(const char *filename)
     size_t n;
     bool found;
     size_t str_offset;
+    char *cache_fname;
+    bool complete;
+
+    cache_fname = mesh_cache_get_filename(filename);
+    if(cache_fname && mesh_cache_is_fresh(cache_fname, filename)){
+        rv = mesh_cache_load(cache_fname);
+        if(rv){
+            free(cache_fname);
+            return rv;
+        }
+    }
 
-    if(!stg_object_init(&stg, filename))
+    rv = NULL;
+    if(!stg_object_init(&stg, filename)){
+        if(cache_fname)
+            free(cache_fname);
         return NULL;
+    }
 
     str_offset = fg_scenery_base_start(filename);
 
@@ -347,11 +396,11 @@ Mesh *mesh_new_from_file(const char *filename)
     }
     if(!rv)
         goto bail;
-    for(size_t i = 0; i < rv->n_groups; i++){
-        vgroup_finish(&(rv->groups[i]), &rv->bs);
-    }
+    mesh_finish(rv);
+    mesh_optimize(rv, mesh_optimizer_get_flags());
 
     /*Load tile accessories e.g airports*/
+    complete = true;
     fseek(stg.fp,  0L, SEEK_SET);
     while((found = stg_object_get_value(&stg, "OBJECT", true, &obj_fname, &n))){
         Mesh *acc = NULL;
@@ -362,15 +411,21 @@ Mesh *mesh_new_from_file(const char *filename)
         }
         if(!acc){
             printf("%s loading failed, skipping\n",obj_fname);
+            complete = false;
             continue;
         }
-        for(size_t i = 0; i < acc->n_groups; i++){
-            vgroup_finish(&(acc->groups[i]), &acc->bs);
-        }
+        mesh_finish(acc);
+        mesh_optimize(acc, mesh_optimizer_get_flags());
         mesh_add_accessory(rv, acc);
     }
+    /* The cache is only checked against the STG's mtime: a tile missing
+     * an accessory would stay incomplete for good*/
+    if(cache_fname && complete)
+        mesh_cache_save(rv, cache_fname);
 
 bail:
+    if(cache_fname)
+        free(cache_fname);
     if(obj_fname)
         free(obj_fname);
     stg_object_dispose(&stg);
@@ -378,6 +433,37 @@ bail:
 }
 
 
+/**
+ * @brief Deletes the GL buffers and vertex arrays of @p self.
+ *
+ * The mesh keeps its arrays and will be uploaded again if drawn. Once
+ * released, it can be freed from any thread. Must be called from the GL
+ * thread.
+ *
+ * @param self The head of a Mesh chain
+ */
+void mesh_release_gl(Mesh *self)
+{
+    if(self->vbo)
+        gl_state_delete_buffer(self->vbo);
+    if(self->ibo)
+        gl_state_delete_buffer(self->ibo);
+    if(self->batches){
+        for(size_t i = 0; i < self->n_batches; i++)
+            gl_state_delete_vertex_array(self->batches[i].vao);
+        free(self->batches);
+    }
+    self->vbo = self->ibo = 0;
+    self->batches = NULL;
+    self->n_batches = 0;
+    self->gpu_size = 0;
+    for(Mesh *iter = self; iter; iter = iter->next){
+        for(size_t i = 0; i < iter->n_groups; i++)
+            iter->groups[i].vbo = iter->groups[i].ibo = 0;
+        iter->prepared = false;
+    }
+}
+
 /**
  * @brief Release memory hold by the mesh
  *
@@ -387,6 +473,18 @@ void mesh_free(Mesh *self)
 {
     Mesh *iter, *next;
     VGroup *group;
+    void *mapping;
+    size_t mapping_size;
+    bool mapping_allocated;
+
+    if(!self)
+        return;
+    /*Groups of all meshes in the chain can point into the mapping*/
+    mapping = self->mapping;
+    mapping_size = self->mapping_size;
+    mapping_allocated = self->mapping_allocated;
+    /*As well as into the head GL buffers*/
+    mesh_release_gl(self);
 
     iter = self;
     while(iter){
@@ -398,10 +496,16 @@ void mesh_free(Mesh *self)
         }
         if(iter->groups)
             free(iter->groups);
+        if(iter->cells)
+            free(iter->cells);
         free(iter);
 
         iter = next;
     }
+    if(mapping && mapping_allocated)
+        free(mapping);
+    else if(mapping)
+        munmap(mapping, mapping_size);
 }
 
 bool mesh_set_size(Mesh *self, size_t size)
@@ -413,12 +517,425 @@ bool mesh_set_size(Mesh *self, size_t size)
     groups = realloc(self->groups, sizeof(VGroup) * size);
     if(groups){
         self->groups = groups;
-        memset(self->groups+(old_size*sizeof(VGroup)), 0, (size-old_size)*sizeof(VGroup));
+        if(size > old_size)
+            memset(self->groups + old_size, 0, (size-old_size)*sizeof(VGroup));
         self->n_groups = size;
     }
     return groups != NULL;
 }
 
+typedef struct{
+    float key;
+    uint32_t tri;
+}MeshSplitKey;
+
+/* Grid laid over a tile in its local east/north frame. Vertex
+ * positions are relative to the tile center, so are the axes*/
+typedef struct{
+    SGVec3d east;
+    SGVec3d north;
+    double min_e, min_n;
+    double cell_e, cell_n; /*Cell dimensions, in meters*/
+    int ne, nn; /*Number of cells along each axis*/
+}MeshGrid;
+
+typedef struct{
+    const VertexSet *vset;
+    const uint32_t *indices;
+    SGVec3f *centroids; /*one per triangle*/
+
+    /* Vertices seen in the chunk being looked at have their stamp set
+     * to the current one, which avoids clearing between chunks*/
+    uint32_t *stamps;
+    uint32_t stamp;
+    uint32_t *remap;
+
+    const char *material;
+    int cell; /*Cell of the chunks being emitted*/
+
+    /*Chunks of all groups of the mesh, and their cells*/
+    VGroup *chunks;
+    int *chunk_cells;
+    size_t n_chunks;
+    size_t allocated_chunks;
+}MeshSplitter;
+
+static int mesh_split_key_cmp(const void *a, const void *b)
+{
+    float ka = ((const MeshSplitKey *)a)->key;
+    float kb = ((const MeshSplitKey *)b)->key;
+
+    return (ka > kb) - (ka < kb);
+}
+
+static int mesh_grid_axis_cells(double extent)
+{
+    int rv;
+
+    rv = ceil(extent / MESH_CELL_SIZE);
+    if(rv < 1)
+        return 1;
+    return rv > MESH_MAX_CELLS ? MESH_MAX_CELLS : rv;
+}
+
+static void mesh_grid_init(MeshGrid *self, Mesh *mesh)
+{
+    SGVec3d *c;
+    SGVec3f *p;
+    double lat, lon, e, n;
+    double max_e, max_n;
+
+    c = &mesh->bs.center;
+    lon = atan2(c->y, c->x);
+    lat = atan2(c->z, sqrt(c->x*c->x + c->y*c->y));
+    self->east = (SGVec3d){-sin(lon), cos(lon), 0.0};
+    self->north = (SGVec3d){-sin(lat)*cos(lon), -sin(lat)*sin(lon), cos(lat)};
+
+    self->min_e = self->min_n = INFINITY;
+    max_e = max_n = -INFINITY;
+    for(size_t i = 0; i < mesh->n_groups; i++){
+        VertexSet *vset = mesh->groups[i].vset;
+        for(size_t j = 0; j < vset->nelements; j++){
+            p = &vset->positions[j];
+            e = p->x*self->east.x + p->y*self->east.y + p->z*self->east.z;
+            n = p->x*self->north.x + p->y*self->north.y + p->z*self->north.z;
+            self->min_e = e < self->min_e ? e : self->min_e;
+            self->min_n = n < self->min_n ? n : self->min_n;
+            max_e = e > max_e ? e : max_e;
+            max_n = n > max_n ? n : max_n;
+        }
+    }
+    if(self->min_e > max_e){ /*No vertices at all*/
+        self->min_e = self->min_n = max_e = max_n = 0.0;
+    }
+
+    self->ne = mesh_grid_axis_cells(max_e - self->min_e);
+    self->nn = mesh_grid_axis_cells(max_n - self->min_n);
+    self->cell_e = (max_e - self->min_e) / self->ne;
+    self->cell_n = (max_n - self->min_n) / self->nn;
+}
+
+static int mesh_grid_get_cell(MeshGrid *self, SGVec3f *p)
+{
+    double e, n;
+    int ce, cn;
+
+    e = p->x*self->east.x + p->y*self->east.y + p->z*self->east.z;
+    n = p->x*self->north.x + p->y*self->north.y + p->z*self->north.z;
+    ce = self->cell_e > 0 ? (e - self->min_e) / self->cell_e : 0;
+    cn = self->cell_n > 0 ? (n - self->min_n) / self->cell_n : 0;
+    ce = ce < 0 ? 0 : (ce >= self->ne ? self->ne - 1 : ce);
+    cn = cn < 0 ? 0 : (cn >= self->nn ? self->nn - 1 : cn);
+
+    return cn * self->ne + ce;
+}
+
+static size_t mesh_splitter_count_vertices(MeshSplitter *self, MeshSplitKey *tris, size_t n)
+{
+    const uint32_t *idx;
+    size_t rv;
+
+    rv = 0;
+    self->stamp++;
+    for(size_t i = 0; i < n; i++){
+        idx = &self->indices[tris[i].tri * 3];
+        for(int j = 0; j < 3; j++){
+            if(self->stamps[idx[j]] != self->stamp){
+                self->stamps[idx[j]] = self->stamp;
+                rv++;
+            }
+        }
+    }
+    return rv;
+}
+
+/*
+ * Makes a flattened, not yet finished, VGroup out of the @p n
+ * triangles of @p tris that reference at most @p nvertices vertices.
+ */
+static bool mesh_splitter_emit(MeshSplitter *self, MeshSplitKey *tris, size_t n, size_t nvertices)
+{
+    VGroup *chunk;
+    const uint32_t *idx;
+    uint32_t v;
+    SGVec3d p;
+
+    if(self->n_chunks == self->allocated_chunks){
+        size_t nsize = self->allocated_chunks ? self->allocated_chunks * 2 : 16;
+        VGroup *tmp = realloc(self->chunks, nsize * sizeof(VGroup));
+        if(!tmp)
+            return false;
+        self->chunks = tmp;
+        int *tmp_cells = realloc(self->chunk_cells, nsize * sizeof(int));
+        if(!tmp_cells)
+            return false;
+        self->chunk_cells = tmp_cells;
+        self->allocated_chunks = nsize;
+    }
+    chunk = &self->chunks[self->n_chunks];
+    memset(chunk, 0, sizeof(VGroup));
+
+    chunk->material = strdup(self->material);
+    chunk->positions = malloc(nvertices * sizeof(SGVec3f));
+    chunk->texcoords = malloc(nvertices * sizeof(SGVec2f));
+    chunk->wide_indices = malloc(n * 3 * sizeof(uint32_t));
+    if(!chunk->material || !chunk->positions || !chunk->texcoords || !chunk->wide_indices){
+        vgroup_dispose(chunk);
+        return false;
+    }
+    chunk->allocated_indices = n * 3;
+    chunk->bs.radius = -1.0;
+
+    self->stamp++;
+    for(size_t i = 0; i < n; i++){
+        idx = &self->indices[tris[i].tri * 3];
+        for(int j = 0; j < 3; j++){
+            v = idx[j];
+            if(self->stamps[v] != self->stamp){
+                self->stamps[v] = self->stamp;
+                self->remap[v] = chunk->n_vertices;
+                chunk->positions[chunk->n_vertices] = self->vset->positions[v];
+                chunk->texcoords[chunk->n_vertices] = self->vset->texcoords[v];
+                chunk->n_vertices++;
+
+                p = (SGVec3d){
+                    self->vset->positions[v].x,
+                    self->vset->positions[v].y,
+                    self->vset->positions[v].z
+                };
+                sg_sphered_expand_by(&chunk->bs, &p);
+            }
+            chunk->wide_indices[chunk->n_indices++] = self->remap[v];
+        }
+    }
+    self->chunk_cells[self->n_chunks] = self->cell;
+    self->n_chunks++;
+    return true;
+}
+
+/*
+ * Splits @p tris in two halves at the median of the triangle
+ * centroids along the longest axis of their bounding box until
+ * each half references few enough vertices to be indexed
+ * with indice_t.
+ */
+static bool mesh_splitter_split(MeshSplitter *self, MeshSplitKey *tris, size_t n)
+{
+    SGVec3f min, max, *c;
+    size_t nvertices;
+    int axis;
+
+    nvertices = mesh_splitter_count_vertices(self, tris, n);
+    if(nvertices <= INDICE_MAX)
+        return mesh_splitter_emit(self, tris, n, nvertices);
+
+    min = max = self->centroids[tris[0].tri];
+    for(size_t i = 1; i < n; i++){
+        c = &self->centroids[tris[i].tri];
+        min.x = c->x < min.x ? c->x : min.x;
+        min.y = c->y < min.y ? c->y : min.y;
+        min.z = c->z < min.z ? c->z : min.z;
+        max.x = c->x > max.x ? c->x : max.x;
+        max.y = c->y > max.y ? c->y : max.y;
+        max.z = c->z > max.z ? c->z : max.z;
+    }
+    axis = 0;
+    if(max.y - min.y > max.x - min.x)
+        axis = 1;
+    if(max.z - min.z > (axis ? max.y - min.y : max.x - min.x))
+        axis = 2;
+
+    for(size_t i = 0; i < n; i++){
+        c = &self->centroids[tris[i].tri];
+        tris[i].key = axis == 0 ? c->x : (axis == 1 ? c->y : c->z);
+    }
+    qsort(tris, n, sizeof(MeshSplitKey), mesh_split_key_cmp);
+
+    return mesh_splitter_split(self, tris, n/2)
+        && mesh_splitter_split(self, tris + n/2, n - n/2);
+}
+
+/*
+ * Bins the triangles of @p group into the cells of @p grid, then cuts
+ * the part of each cell that has too many vertices to be indexed with
+ * indice_t. Chunks are appended to @p self.
+ */
+static bool mesh_splitter_run(MeshSplitter *self, MeshGrid *grid, VGroup *group)
+{
+    const SGVec3f *p[3];
+    MeshSplitKey *tris;
+    int *tri_cells;
+    size_t first[MESH_MAX_CELLS * MESH_MAX_CELLS + 1] = {0};
+    size_t ntris, ncells;
+    bool rv;
+
+    self->vset = group->vset;
+    self->indices = group->wide_indices;
+    self->material = group->material;
+    ntris = group->n_indices / 3;
+    ncells = grid->ne * grid->nn;
+
+    tris = malloc(ntris * sizeof(MeshSplitKey));
+    tri_cells = malloc(ntris * sizeof(int));
+    self->centroids = malloc(ntris * sizeof(SGVec3f));
+    self->stamps = calloc(group->vset->nelements, sizeof(uint32_t));
+    self->remap = malloc(group->vset->nelements * sizeof(uint32_t));
+    self->stamp = 0;
+    rv = tris && tri_cells && self->centroids && self->stamps && self->remap;
+    if(rv){
+        for(size_t i = 0; i < ntris; i++){
+            for(int j = 0; j < 3; j++)
+                p[j] = &group->vset->positions[self->indices[i*3+j]];
+            self->centroids[i] = (SGVec3f){
+                (p[0]->x + p[1]->x + p[2]->x) / 3.0f,
+                (p[0]->y + p[1]->y + p[2]->y) / 3.0f,
+                (p[0]->z + p[1]->z + p[2]->z) / 3.0f
+            };
+            tri_cells[i] = mesh_grid_get_cell(grid, &self->centroids[i]);
+            first[tri_cells[i] + 1]++;
+        }
+        /*Counting sort, triangles keep their order within a cell*/
+        for(size_t i = 1; i <= ncells; i++)
+            first[i] += first[i-1];
+        for(size_t i = 0; i < ntris; i++)
+            tris[first[tri_cells[i]]++].tri = i;
+        /*first[c] is now the end of cell c*/
+        for(size_t c = 0; rv && c < ncells; c++){
+            size_t start = c ? first[c-1] : 0;
+            if(first[c] == start)
+                continue;
+            self->cell = c;
+            rv = mesh_splitter_split(self, tris + start, first[c] - start);
+        }
+    }
+
+    free(tris);
+    free(tri_cells);
+    free(self->centroids);
+    free(self->stamps);
+    free(self->remap);
+    return rv;
+}
+
+/**
+ * @brief Cuts the groups of a Mesh into spatial cells and splits
+ * groups that have more vertices than what can be indexed with
+ * indice_t.
+ *
+ * The tile is divided in a grid of cells of about MESH_CELL_SIZE
+ * meters in its local east/north frame. Each cell holds a range
+ * of groups, one per material, or more if the part of a material
+ * that falls in the cell has too many vertices. In that case it is
+ * cut in spatially coherent chunks. Each group has its own bounding
+ * sphere, cell bounding spheres are computed by mesh_finish().
+ *
+ * Must be called before the groups are finished. Meshes that have
+ * finished groups are left untouched.
+ *
+ * @param self The Mesh to work on
+ * @return true on success, false on failure
+ */
+bool mesh_split_groups(Mesh *self)
+{
+    MeshSplitter splitter = {0};
+    MeshGrid grid;
+    VGroup *groups;
+    MeshCell *cells;
+    size_t ncells, n;
+
+    if(self->n_cells || !self->n_groups)
+        return true;
+    for(size_t i = 0; i < self->n_groups; i++){
+        if(!self->groups[i].vset)
+            return true;
+    }
+
+    mesh_grid_init(&grid, self);
+    for(size_t i = 0; i < self->n_groups; i++){
+        if(!mesh_splitter_run(&splitter, &grid, &self->groups[i]))
+            goto bail;
+    }
+
+    /*Sort chunks by cell, materials keep their order within a cell*/
+    ncells = grid.ne * grid.nn;
+    groups = malloc(splitter.n_chunks * sizeof(VGroup));
+    cells = calloc(ncells, sizeof(MeshCell));
+    if(!groups || !cells){
+        free(groups);
+        free(cells);
+        goto bail;
+    }
+    for(size_t i = 0; i < splitter.n_chunks; i++)
+        cells[splitter.chunk_cells[i]].n_groups++;
+    for(size_t c = 1; c < ncells; c++)
+        cells[c].first_group = cells[c-1].first_group + cells[c-1].n_groups;
+    for(size_t c = 0; c < ncells; c++)
+        cells[c].n_groups = 0;
+    for(size_t i = 0; i < splitter.n_chunks; i++){
+        MeshCell *cell = &cells[splitter.chunk_cells[i]];
+        groups[cell->first_group + cell->n_groups++] = splitter.chunks[i];
+    }
+    /*Drop empty cells*/
+    n = 0;
+    for(size_t c = 0; c < ncells; c++){
+        if(cells[c].n_groups){
+            cells[n] = cells[c];
+            cells[n].bs.radius = -1.0;
+            n++;
+        }
+    }
+
+    /*No GL resources yet, and this can run on a loader thread*/
+    for(size_t i = 0; i < self->n_groups; i++){
+        vertex_set_free(self->groups[i].vset);
+        free(self->groups[i].wide_indices);
+        free(self->groups[i].material);
+    }
+    free(self->groups);
+    self->groups = groups;
+    self->n_groups = splitter.n_chunks;
+    self->cells = cells;
+    self->n_cells = n;
+
+    free(splitter.chunks);
+    free(splitter.chunk_cells);
+    return true;
+
+bail:
+    for(size_t j = 0; j < splitter.n_chunks; j++)
+        vgroup_dispose(&splitter.chunks[j]);
+    free(splitter.chunks);
+    free(splitter.chunk_cells);
+    return false;
+}
+
+/**
+ * @brief Finishes all the groups of a Mesh and computes the bounding
+ * spheres of its cells.
+ *
+ * @param self The Mesh to work on
+ * @return true on success, false if any group couldn't be finished
+ *
+ * @see vgroup_finish
+ */
+bool mesh_finish(Mesh *self)
+{
+    MeshCell *cell;
+    bool rv;
+
+    rv = true;
+    for(size_t i = 0; i < self->n_groups; i++)
+        rv = vgroup_finish(&(self->groups[i]), &self->bs) && rv;
+
+    for(size_t i = 0; i < self->n_cells; i++){
+        cell = &self->cells[i];
+        cell->bs.radius = -1.0;
+        for(size_t j = 0; j < cell->n_groups; j++)
+            sg_sphered_expand_by_sphere(&cell->bs, &self->groups[cell->first_group + j].bs);
+    }
+    return rv;
+}
+
 /**
  * @brief Adds a new vgroup in @p self that can hold up to @p n_triangles
  * triangles.
@@ -436,222 +953,559 @@ VGroup *mesh_add_vgroup(Mesh *self, const char *material, size_t n_triangles)
 {
     for(int i = 0; i < self->n_groups; i++){
         /*First available group will have all it's pointers set to NULL*/
-        if(!self->groups[i].indices){
+        if(!self->groups[i].indices && !self->groups[i].wide_indices){
             return vgroup_init(&(self->groups[i]), material, n_triangles);
         }
     }
     return NULL;
 }
 
+#if USE_QUANTIZED_VERTICES
+/* Steps are powers of two, and boxes start on a multiple of their step:
+ * a vertex shared by boxes with the same step is dequantized to the same
+ * value in both, which keeps cells and tiles watertight.*/
+static void mesh_quantization_box(float min, float max, float *scale, float *offset)
+{
+    int exp;
+
+    /*One step is kept for the alignment of offset*/
+    frexp(fmax(max - min, 1e-6) / (MESH_VERTEX_QUANTIZATION_STEPS - 1.0), &exp);
+    *scale = ldexp(1.0, exp);
+    *offset = floor(min / *scale) * *scale;
+}
+
+/*Quantizes @p v within [offset, offset + scale * MESH_VERTEX_QUANTIZATION_STEPS]*/
+static inline MeshVertexComponent mesh_quantize(double v, double offset, double scale)
+{
+    double q;
+
+    q = floor((v - offset) / scale + 0.5);
+    return q < 0.0 ? 0 : (q > MESH_VERTEX_QUANTIZATION_STEPS ? MESH_VERTEX_QUANTIZATION_STEPS : q);
+}
+#endif
+
 /**
- * @brief Allocate various OpenGL resources for rendering. Just need to be
- * called once.
+ * @brief Lays out the groups of a mesh chain as they will be uploaded
+ * to the GL.
  *
- * @param self The mesh to work on.
+ * All vertices of the chain (i.e the tile and its accessories) go to a
+ * single interleaved array, and all indices to a single index array.
+ * Groups are laid out in order, in batches of groups that together have
+ * no more vertices than what indice_t can address: indices are rebased
+ * on the first vertex of their batch so that groups of a same batch can
+ * be drawn without changing vertex pointers.
+ *
+ * When vertices are quantized, batches don't span more than a cell and
+ * vertices are quantized within the bounding box of their batch.
+ *
+ * Fills self->batches and the batch and first_index of all groups and
+ * of their levels of detail, whose indices follow the group ones. The
+ * texture of groups must have been looked up when using an atlas.
+ *
+ * @param self The chain head
+ * @param vertices Set to the vertices, to be freed by the caller
+ * @param n_vertices Set to the number of vertices
+ * @param indices Set to the indices, to be freed by the caller
+ * @param n_indices Set to the number of indices
+ * @return true on success, false on failure
  */
-Mesh *mesh_prepare(Mesh *self)
+bool mesh_pack(Mesh *self, MeshVertex **vertices, size_t *n_vertices, indice_t **indices, size_t *n_indices)
 {
-    for(size_t i = 0; i < self->n_groups; i++){
-        vgroup_prepare(&(self->groups[i]));
+    MeshVertex *vertex;
+    indice_t *index;
+    size_t n_groups, batch_size, vertex_offset;
+    MeshBatch *batch;
+    VGroup *group;
+    SGVec3f pmin, pmax;
+    SGVec2f tmin, tmax;
+    MeshCell *cells;
+    size_t n_cells;
+
+    *n_vertices = 0;
+    *n_indices = 0;
+    n_groups = 0;
+    for(Mesh *iter = self; iter; iter = iter->next){
+        for(size_t i = 0; i < iter->n_groups; i++){
+            *n_vertices += iter->groups[i].n_vertices;
+            *n_indices += iter->groups[i].n_indices + iter->groups[i].n_lod_indices;
+        }
+        n_groups += iter->n_groups;
     }
-    return self;
+
+    /*Each group starts at most one batch*/
+    if(self->batches)
+        free(self->batches);
+    self->n_batches = 0;
+    self->batches = malloc((n_groups ? n_groups : 1) * sizeof(MeshBatch));
+    *vertices = malloc(*n_vertices * sizeof(MeshVertex));
+    *indices = malloc(*n_indices * sizeof(indice_t));
+    if(!self->batches || (*n_vertices && !*vertices) || (*n_indices && !*indices)){
+        free(*vertices);
+        free(*indices);
+        return false;
+    }
+
+    /*Group to batch assignment, and indices*/
+    index = *indices;
+    batch = NULL;
+    batch_size = 0;
+    vertex_offset = 0;
+    for(Mesh *iter = self; iter; iter = iter->next){
+        /*Meshes without cells are handled as a single cell*/
+        MeshCell all = {
+            .bs = iter->bs,
+            .first_group = 0,
+            .n_groups = iter->n_groups
+        };
+        cells = iter->n_cells ? iter->cells : &all;
+        n_cells = iter->n_cells ? iter->n_cells : 1;
+
+        for(size_t c = 0; c < n_cells; c++){
+#if USE_QUANTIZED_VERTICES
+            /*Keeps quantization boxes small*/
+            batch = NULL;
+#endif
+            for(size_t i = cells[c].first_group; i < cells[c].first_group + cells[c].n_groups; i++){
+                group = &iter->groups[i];
+                if(!batch || batch_size + group->n_vertices > INDICE_MAX + 1){
+                    batch = &self->batches[self->n_batches++];
+                    batch->base_vertex = vertex_offset * sizeof(MeshVertex);
+                    batch->vao = batch->vao_program = 0;
+                    batch_size = 0;
+                }
+                group->batch = batch;
+                group->first_index = (index - *indices) * sizeof(indice_t);
+                for(size_t j = 0; j < group->n_indices; j++)
+                    *index++ = group->indices[j] + batch_size;
+                /* Coarser levels use the same vertices. Levels that are
+                 * the same as the previous one share its indices*/
+                for(size_t l = 0; l < group->n_lods; l++){
+                    if(l > 0 && group->lods[l].offset == group->lods[l - 1].offset){
+                        group->lods[l].first_index = group->lods[l - 1].first_index;
+                        continue;
+                    }
+                    group->lods[l].first_index = (index - *indices) * sizeof(indice_t);
+                    for(size_t j = 0; j < group->lods[l].n_indices; j++)
+                        *index++ = group->lod_indices[group->lods[l].offset + j] + batch_size;
+                }
+                batch_size += group->n_vertices;
+                vertex_offset += group->n_vertices;
+            }
+        }
+    }
+
+    /*Quantization boxes*/
+    for(size_t b = 0; b < self->n_batches; b++){
+        batch = &self->batches[b];
+#if USE_QUANTIZED_VERTICES
+        pmin = (SGVec3f){INFINITY, INFINITY, INFINITY};
+        pmax = (SGVec3f){-INFINITY, -INFINITY, -INFINITY};
+        tmin = (SGVec2f){INFINITY, INFINITY};
+        tmax = (SGVec2f){-INFINITY, -INFINITY};
+        for(Mesh *iter = self; iter; iter = iter->next){
+            for(size_t i = 0; i < iter->n_groups; i++){
+                group = &iter->groups[i];
+                if(group->batch != batch)
+                    continue;
+                for(size_t j = 0; j < group->n_vertices; j++){
+                    pmin.x = fminf(pmin.x, group->positions[j].x);
+                    pmin.y = fminf(pmin.y, group->positions[j].y);
+                    pmin.z = fminf(pmin.z, group->positions[j].z);
+                    pmax.x = fmaxf(pmax.x, group->positions[j].x);
+                    pmax.y = fmaxf(pmax.y, group->positions[j].y);
+                    pmax.z = fmaxf(pmax.z, group->positions[j].z);
+                    tmin.x = fminf(tmin.x, group->texcoords[j].x);
+                    tmin.y = fminf(tmin.y, group->texcoords[j].y);
+                    tmax.x = fmaxf(tmax.x, group->texcoords[j].x);
+                    tmax.y = fmaxf(tmax.y, group->texcoords[j].y);
+                }
+            }
+        }
+        mesh_quantization_box(pmin.x, pmax.x, &batch->position_scale.x, &batch->position_offset.x);
+        mesh_quantization_box(pmin.y, pmax.y, &batch->position_scale.y, &batch->position_offset.y);
+        mesh_quantization_box(pmin.z, pmax.z, &batch->position_scale.z, &batch->position_offset.z);
+        mesh_quantization_box(tmin.x, tmax.x, &batch->texcoord_scale.x, &batch->texcoord_offset.x);
+        mesh_quantization_box(tmin.y, tmax.y, &batch->texcoord_scale.y, &batch->texcoord_offset.y);
+#else
+        batch->position_offset = (SGVec3f){0.0f, 0.0f, 0.0f};
+        batch->position_scale = (SGVec3f){1.0f, 1.0f, 1.0f};
+        batch->texcoord_offset = (SGVec2f){0.0f, 0.0f};
+        batch->texcoord_scale = (SGVec2f){1.0f, 1.0f};
+#endif
+    }
+
+    /*Vertices. Cells are contiguous group ranges, so groups are laid out in order*/
+    vertex = *vertices;
+    for(Mesh *iter = self; iter; iter = iter->next){
+        for(size_t i = 0; i < iter->n_groups; i++){
+            group = &iter->groups[i];
+            batch = group->batch;
+            for(size_t j = 0; j < group->n_vertices; j++){
+#if USE_QUANTIZED_VERTICES
+                vertex->position[0] = mesh_quantize(group->positions[j].x, batch->position_offset.x, batch->position_scale.x);
+                vertex->position[1] = mesh_quantize(group->positions[j].y, batch->position_offset.y, batch->position_scale.y);
+                vertex->position[2] = mesh_quantize(group->positions[j].z, batch->position_offset.z, batch->position_scale.z);
+                vertex->texcoord[0] = mesh_quantize(group->texcoords[j].x, batch->texcoord_offset.x, batch->texcoord_scale.x);
+                vertex->texcoord[1] = mesh_quantize(group->texcoords[j].y, batch->texcoord_offset.y, batch->texcoord_scale.y);
+#else
+                vertex->position[0] = group->positions[j].x;
+                vertex->position[1] = group->positions[j].y;
+                vertex->position[2] = group->positions[j].z;
+                vertex->texcoord[0] = group->texcoords[j].x;
+                vertex->texcoord[1] = group->texcoords[j].y;
+#endif
+#if USE_TEXTURE_ATLAS
+                /*Not quantized*/
+                vertex->texcoord[2] = group->texture ? group->texture->layer : 0;
+#endif
+                vertex++;
+            }
+        }
+    }
+    return true;
 }
 
 /**
- * @brief Does the actual rendering of a prepared mesh.
+ * @brief Uploads the groups of a mesh chain to the GL. Just needs to be
+ * called once, on the chain head.
  *
- * @param Mesh The Mesh to be worked on
- * @param position Handle to "position" attribute of the shader
- * @param texcoords Handle to "texcoords" attribute of the shader
- * @param u_mvp Handle to the Model-View-Projection uniform matrix on the shader
- * @param vp The current View-Projection matrix.
+ * The whole chain goes to a single vertex buffer and a single index
+ * buffer.
+ *
+ * @param self The chain head
+ * @param stats If not NULL, incremented with what has been uploaded
+ * @return true on success, false on failure
+ *
+ * @see mesh_pack
  */
-void mesh_render_buffer(Mesh *self, BasicShader *shader, mat4d vp, vec4 frustum[6], vec4 frustrum_bs)
+bool mesh_prepare(Mesh *self, MeshRenderStats *stats)
 {
-    /* TODO: Maybe get the mv out of here (rendermaanger that applies the matrix
-     * before calling mesh_render_buffer?).
-     * */
+    MeshVertex *vertices;
+    indice_t *indices;
+    size_t n_vertices, n_indices;
 
-    VGroup *group;
+    if(self->prepared) return true;
+
+    for(Mesh *iter = self; iter; iter = iter->next){
+        for(size_t i = 0; i < iter->n_groups; i++)
+            iter->groups[i].texture = texture_get_by_name(iter->groups[i].material);
+    }
+
+    if(!mesh_pack(self, &vertices, &n_vertices, &indices, &n_indices))
+        return false;
+
+    /*The element array buffer binding belongs to the vertex array*/
+    gl_state_bind_vertex_array(0);
+    glGenBuffers(1, &self->vbo);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->vbo);
+    glBufferData(GL_ARRAY_BUFFER, n_vertices * sizeof(MeshVertex), vertices, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &self->ibo);
+    gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, self->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, n_indices * sizeof(indice_t), indices, GL_STATIC_DRAW);
+    gl_state_count(4);
+
+    free(vertices);
+    free(indices);
+    self->gpu_size = n_vertices * sizeof(MeshVertex) + n_indices * sizeof(indice_t);
+    if(stats){
+        stats->upload_bytes += self->gpu_size;
+        stats->upload_calls += 6;
+    }
+
+    for(Mesh *iter = self; iter; iter = iter->next){
+        for(size_t i = 0; i < iter->n_groups; i++){
+            iter->groups[i].vbo = self->vbo;
+            iter->groups[i].ibo = self->ibo;
+        }
+        iter->prepared = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Sets the Model-View-Projection matrix of @p self on @p shader.
+ *
+ * Must be called before rendering the groups of @p self with
+ * vgroup_render.
+ *
+ * @param self The mesh to be worked on
+ * @param shader The shader in use
+ * @param vp The current View-Projection matrix.
+ */
+void mesh_bind(Mesh *self, BasicShader *shader, mat4d vp)
+{
     mat4d mvp;
     mat4 mvpf;
-    vec4 mbs = {self->bs.center.x,self->bs.center.y,self->bs.center.z,self->bs.radius};
-
-    if(!glm_sphere_sphere(frustrum_bs, mbs)){/*printf("sphere-culled mesh %p\n",self);*/ return;}
-    if(!glm_frustum_cgsphered(frustum, &self->bs)) return;
 
     glm_mat4d_mul(vp, self->transformation, mvp);
     glm_mat4d_ucopyf(mvp, mvpf);
     glUniformMatrix4fv(shader->mvp, 1, GL_FALSE, mvpf[0]);
+    gl_state_count(1);
+}
 
-    for(GLuint i = 0; i < self->n_groups; i++){
-        group = &(self->groups[i]);
-        vec4 gbs = {group->bs.center.x,group->bs.center.y,group->bs.center.z,group->bs.radius};
-
-        if(!glm_sphere_sphere(frustrum_bs, gbs)){continue;}
-        if(!glm_frustum_cgsphered(frustum, &group->bs)) {continue;}
-
-        /*TODO: static_branch on preparation*/
-        if(!group->prepared)
-            vgroup_prepare(group);
-
-        glActiveTexture(GL_TEXTURE0 );
-        glBindTexture(GL_TEXTURE_2D, group->texture ? group->texture->id : 0); /*TODO: static_branch on tex loading*/
-
-        glEnableVertexAttribArray(shader->position);
-        glBindBuffer(GL_ARRAY_BUFFER, group->buffers[PositionBuffer]);
-        glVertexAttribPointer(
-            shader->position,
-            3,
-            GL_FLOAT,
-            GL_FALSE,
-            sizeof(SGVec3f), /*If we don't specify the stride, apitrace doesn't detect the values correctly*/
-            (void*)0
-        );
+/*Points the shader attributes to the vertices of a batch, vbo being bound*/
+static void mesh_batch_set_pointers(MeshBatch *self, BasicShader *shader)
+{
+    glVertexAttribPointer(
+        shader->position,
+        3,
+        MESH_VERTEX_COMPONENT_TYPE,
+        GL_FALSE,
+        sizeof(MeshVertex), /*If we don't specify the stride, apitrace doesn't detect the values correctly*/
+        (void*)(self->base_vertex + offsetof(MeshVertex, position))
+    );
+    glVertexAttribPointer(
+        shader->texcoords,
+        VGROUP_TEXCOORD_COMPONENTS,
+        MESH_VERTEX_COMPONENT_TYPE,
+        GL_FALSE,
+        sizeof(MeshVertex),
+        (void*)(self->base_vertex + offsetof(MeshVertex, texcoord))
+    );
+    gl_state_count(2);
+}
 
-        glEnableVertexAttribArray(shader->texcoords);
-        glBindBuffer(GL_ARRAY_BUFFER, group->buffers[TexCoordBuffer]);
-        glVertexAttribPointer(
-            shader->texcoords,
-            2,
-            GL_FLOAT,
-            GL_FALSE,
-            sizeof(SGVec2f), /*As above*/
-            (void*)0
-        );
+/**
+ * @brief Sets up the vertices of a batch for drawing, and how to
+ * dequantize them.
+ *
+ * When vertex array objects are available, the first call creates one
+ * holding the buffers, the enabled attributes and their pointers. Later
+ * calls only bind it. Otherwise, the buffers are bound and the
+ * attributes pointed to the batch vertices: the attributes must have
+ * been enabled.
+ *
+ * @param self The MeshBatch
+ * @param shader The shader in use
+ * @param vbo The vertex buffer of the chain the batch belongs to
+ * @param ibo The index buffer of the chain the batch belongs to
+ */
+void mesh_batch_bind(MeshBatch *self, BasicShader *shader, GLuint vbo, GLuint ibo)
+{
+    GLuint program = SHADER(shader)->program_id;
+
+    if(gl_state_has_vertex_arrays()){
+        if(self->vao && self->vao_program == program){
+            gl_state_bind_vertex_array(self->vao);
+        }else{
+            if(!self->vao)
+                self->vao = gl_state_gen_vertex_array();
+            gl_state_bind_vertex_array(self->vao);
+            gl_state_bind_buffer(GL_ARRAY_BUFFER, vbo);
+            gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+            gl_state_enable_attrib(shader->position);
+            gl_state_enable_attrib(shader->texcoords);
+            mesh_batch_set_pointers(self, shader);
+            self->vao_program = program;
+        }
+    }else{
+        gl_state_bind_buffer(GL_ARRAY_BUFFER, vbo);
+        gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        mesh_batch_set_pointers(self, shader);
+    }
+    glUniform3f(shader->position_scale, self->position_scale.x, self->position_scale.y, self->position_scale.z);
+    glUniform3f(shader->position_offset, self->position_offset.x, self->position_offset.y, self->position_offset.z);
+    glUniform2f(shader->texcoord_scale, self->texcoord_scale.x, self->texcoord_scale.y);
+    glUniform2f(shader->texcoord_offset, self->texcoord_offset.x, self->texcoord_offset.y);
+    gl_state_count(4);
+}
+
+/**
+ * @brief Submits a prepared VGroup geometry.
+ *
+ * The shader program, its attributes arrays and the group texture
+ * must already be set up.
+ *
+ * @param self The VGroup to draw
+ * @param shader The shader in use
+ *
+ * @see vgroup_render
+ * @see RenderQueue
+ */
+void vgroup_draw(VGroup *self, BasicShader *shader)
+{
+    mesh_batch_bind(self->batch, shader, self->vbo, self->ibo);
+    glDrawElements(GL_TRIANGLES, self->n_indices, INDICE_TYPE, (void*)self->first_index);
+    gl_state_count(1);
+}
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, group->buffers[ElementBuffer]);
-        glDrawElements(GL_TRIANGLES, group->n_indices, INDICE_TYPE, 0);
+/**
+ * @brief Draws a VGroup of a prepared mesh.
+ *
+ * @param self The VGroup to draw
+ * @param shader The shader in use
+ *
+ * @see mesh_bind
+ * @see mesh_prepare
+ */
+void vgroup_render(VGroup *self, BasicShader *shader)
+{
+    gl_state_active_texture(GL_TEXTURE0);
+    gl_state_bind_texture(TEXTURE_TARGET, self->texture ? self->texture->id : 0); /*TODO: static_branch on tex loading*/
 
-        glDisableVertexAttribArray(shader->position);
-        glDisableVertexAttribArray(shader->texcoords);
+    if(!gl_state_has_vertex_arrays()){
+        gl_state_enable_attrib(shader->position);
+        gl_state_enable_attrib(shader->texcoords);
     }
+    vgroup_draw(self, shader);
 }
 
-Mesh *mesh_new_from_btg(const char *filename)
+/**
+ * @brief Does the actual rendering of a prepared mesh.
+ *
+ * Culling is hierarchical: the whole mesh, then its cells, then
+ * the groups of the cells that are (partly) visible.
+ *
+ * @param Mesh The Mesh to be worked on
+ * @param shader The shader in use
+ * @param vp The current View-Projection matrix.
+ * @param frustum The frustum planes, in world coordinates
+ * @param frustrum_bs The frustum bounding sphere, in world coordinates
+ * @param stats If not NULL, incremented with what has been submitted
+ *
+ * @see Culler for culling all resident meshes at once
+ */
+void mesh_render_buffer(Mesh *self, BasicShader *shader, mat4d vp, vec4 frustum[6], vec4 frustrum_bs, MeshRenderStats *stats)
 {
-    Mesh *rv = NULL;
-    SGBinObject *terrain;
+    VGroup *group;
+    MeshCell *cells;
+    size_t n_cells;
+    vec4 mbs = {self->bs.center.x,self->bs.center.y,self->bs.center.z,self->bs.radius};
 
-    printf("Loading btg: %s\n",filename);
-    terrain = sg_bin_object_new();
-    sg_bin_object_load(terrain, filename);
-
-    if(terrain->tris_v->len == 0)
-        goto out;
-
-    /*Do a first pass to read the total number of triangle groups*/
-    guint start = 0;
-    guint end = 1;
-    char *material;
-    size_t ngroups = 0;
-
-    while ( start < terrain->tri_materials->len ) {
-        // find next group
-        material = g_ptr_array_index(terrain->tri_materials,start);
-        while ( (end < terrain->tri_materials->len) &&
-                (!strcmp(material, g_ptr_array_index(terrain->tri_materials,end))) )
-        {
-            end++;
+    if(!glm_sphere_sphere(frustrum_bs, mbs)){/*printf("sphere-culled mesh %p\n",self);*/ return;}
+    if(!glm_frustum_cgsphered(frustum, &self->bs)) return;
+
+    /*TODO: static_branch on preparation*/
+    if(!self->prepared && !mesh_prepare(self, stats))
+        return;
+    mesh_bind(self, shader, vp);
+    if(stats)
+        stats->meshes++;
+
+    /*Meshes without cells are handled as a single cell*/
+    MeshCell all = {
+        .bs = self->bs,
+        .first_group = 0,
+        .n_groups = self->n_groups
+    };
+    cells = self->n_cells ? self->cells : &all;
+    n_cells = self->n_cells ? self->n_cells : 1;
+
+    for(size_t c = 0; c < n_cells; c++){
+        MeshCell *cell = &cells[c];
+        vec4 cbs = {cell->bs.center.x,cell->bs.center.y,cell->bs.center.z,cell->bs.radius};
+
+        if(!glm_sphere_sphere(frustrum_bs, cbs)){continue;}
+        if(!glm_frustum_cgsphered(frustum, &cell->bs)) {continue;}
+        if(stats)
+            stats->cells++;
+
+        for(size_t i = cell->first_group; i < cell->first_group + cell->n_groups; i++){
+            group = &(self->groups[i]);
+            vec4 gbs = {group->bs.center.x,group->bs.center.y,group->bs.center.z,group->bs.radius};
+
+            if(!glm_sphere_sphere(frustrum_bs, gbs)){continue;}
+            if(!glm_frustum_cgsphered(frustum, &group->bs)) {continue;}
+
+            vgroup_render(group, shader);
+            if(stats){
+                stats->groups++;
+                stats->draw_calls++;
+                stats->texture_binds++;
+                stats->buffer_binds += 2;
+                stats->triangles += group->n_indices / 3;
+            }
         }
-        ngroups++;
-        start = end;
-        end = start + 1;
     }
+}
 
-    rv = mesh_new(ngroups);
-    glm_translated(rv->transformation,
-        (vec3d){terrain->gbs_center.x,
-                terrain->gbs_center.y,
-                terrain->gbs_center.z
-        }
+typedef struct{
+    Mesh *mesh;
+    VGroup *group; /*Group being filled*/
+    /*The current triangle object doesn't go in the current group*/
+    bool new_group;
+    const char *material;
+    unsigned int nelements;
+}MeshBuilder;
+
+static void mesh_builder_bounding_sphere(void *data, SGVec3d *center, float radius)
+{
+    MeshBuilder *self = (MeshBuilder *)data;
+
+    glm_translated(self->mesh->transformation,
+        (vec3d){center->x, center->y, center->z}
     );
-    rv->bs = (SGSphered){
-        .center = terrain->gbs_center,
-        .radius = terrain->gbs_radius
+    self->mesh->bs = (SGSphered){
+        .center = *center,
+        .radius = radius
     };
+}
 
-    /*Second pass, actually read the data*/
-    start = 0;
-    end = 1;
-    VGroup *group;
-    while ( start < terrain->tri_materials->len ) {
-        // find next group
-        material = g_ptr_array_index(terrain->tri_materials,start);
-        while ( (end < terrain->tri_materials->len) &&
-                (!strcmp(material, g_ptr_array_index(terrain->tri_materials,end))) )
-        {
-            end++;
-        }
-        /*Current group spans from tris_v[start] to tris_v[end-1]*/
+static bool mesh_builder_begin_triangles(void *data, const char *material, unsigned int nelements)
+{
+    MeshBuilder *self = (MeshBuilder *)data;
+
+    /* Consecutive objects sharing the same material end up in the same
+     * group. The group is only created once the first triangle is known
+     * to survive, objects made of degenerated triangles only don't
+     * split groups.*/
+    self->new_group = !self->group || strcmp(self->group->material, material);
+    self->material = material;
+    self->nelements = nelements;
+    return true;
+}
 
-        group = mesh_add_vgroup(rv, material, (end-start)*3);
-        if(!group){
-            printf("Couldn't get group for %s size %d\n",material,  (end-start)*3);
-            exit(-1);
+static bool mesh_builder_indexed_triangle(void *data, const SGVec3d *nodes, const SGVec2f *texcoords,
+                                  const uint32_t v[3], const uint32_t t[3])
+{
+    MeshBuilder *self = (MeshBuilder *)data;
+    size_t n;
 
-        }
-        for (guint  i = start; i < end; ++i ) {
-            GArray *tri_v = g_ptr_array_index(terrain->tris_v, i);
-            GArray *tri_c = g_ptr_array_index(terrain->tris_c, i);
-            GPtrArray *tri_tcs = g_ptr_array_index(terrain->tris_tcs,i);
-            GArray *ttcs = g_ptr_array_index(tri_tcs,0);
-
-            for (guint j = 2; j < tri_v->len; j += 3) { //Edges of the triangle
-                /* Here we have take the same approach as Simgear that is
-                 * starting on the last edge(vertex) of the triangle tri_v[2]
-                 * and going backwards(tri_v[2-1], tri_v[2-2]), reading one
-                 * triangle per operation while eliminating tests on i-1,i-2.
-                 * SimGear seems to consider that more than one triangle could
-                 * be in tri_v and goes by increments of 3. That has been
-                 * reproduced here.
-                 * */
-                int a3, b3;
-                if(terrain->version >= 10){
-                    a3 = g_array_index(tri_v, int, j);
-                    b3 = g_array_index(ttcs, int, j);
-                }else{
-                    a3 = g_array_index(tri_v, uint16_t, j);
-                    b3 = g_array_index(ttcs, uint16_t, j);
-                }
-                SGVec3d vert3 = g_array_index(terrain->wgs84_nodes, SGVec3d, a3);
-                SGVec2f tex3 = g_array_index(terrain->texcoords, SGVec2f, b3);
-
-                int a2, b2;
-                if(terrain->version >= 10){
-                    a2 = g_array_index(tri_v, int, j - 1);
-                    b2 = g_array_index(ttcs, int, j - 1);
-                }else{
-                    a2 = g_array_index(tri_v, uint16_t, j - 1);
-                    b2 = g_array_index(ttcs, uint16_t, j - 1);
-                }
-                SGVec3d vert2 = g_array_index(terrain->wgs84_nodes, SGVec3d, a2);
-                SGVec2f tex2 = g_array_index(terrain->texcoords, SGVec2f, b2);
-
-                int a1, b1;
-                if(terrain->version >= 10){
-                    a1 = g_array_index(tri_v, int, j - 2);
-                    b1 = g_array_index(ttcs, int, j - 2);
-                }else{
-                    a1 = g_array_index(tri_v, uint16_t, j - 2);
-                    b1 = g_array_index(ttcs, uint16_t, j - 2);
-                }
-                SGVec3d vert1 = g_array_index(terrain->wgs84_nodes, SGVec3d, a1);
-                SGVec2f tex1 = g_array_index(terrain->texcoords, SGVec2f, b1);
-
-                vgroup_add_triangle(group,
-                    &vert1, &tex1,
-                    &vert2, &tex2,
-                    &vert3, &tex3
-                );
-            }
-        }
-        start = end;
-        end = start + 1;
+    if(self->new_group){
+        n = self->mesh->n_groups;
+        if(!mesh_set_size(self->mesh, n + 1))
+            return false;
+        /*Each element usually holds one triangle*/
+        self->group = vgroup_init(&self->mesh->groups[n], self->material, self->nelements);
+        if(!self->group)
+            return false;
+        self->new_group = false;
     }
-out:
-    sg_bin_object_free(terrain);
-    return rv;
+    return vgroup_add_indexed_triangle(self->group, nodes, texcoords, v, t);
+}
+
+/**
+ * @brief Creates a new mesh from a BTG file.
+ *
+ * The file is streamed: triangles go straight into per-material
+ * vgroups without building an intermediate SGBinObject.
+ *
+ * @param filename The BTG file to read from
+ * @return a newly created Mesh whose groups still need to be
+ * finished, NULL on failure or if the file has no triangles.
+ */
+Mesh *mesh_new_from_btg(const char *filename)
+{
+    MeshBuilder builder = {0};
+    SGBinStreamHandlers handlers = {
+        .bounding_sphere = mesh_builder_bounding_sphere,
+        .begin_triangles = mesh_builder_begin_triangles,
+        .indexed_triangle = mesh_builder_indexed_triangle
+    };
+
+    printf("Loading btg: %s\n",filename);
+    builder.mesh = mesh_new_empty();
+    if(!builder.mesh)
+        return NULL;
+
+    if(!sg_bin_object_stream(filename, &handlers, &builder)
+       || builder.mesh->n_groups == 0
+       || !mesh_split_groups(builder.mesh)){
+        mesh_free(builder.mesh);
+        return NULL;
+    }
+    return builder.mesh;
 }
 
 /**
@@ -16,52 +16,166 @@
 #include "indice.h"
 #include "sg-sphere.h"
 
-typedef enum{
-    PositionBuffer,
-    TexCoordBuffer,
-    ElementBuffer,
-    NBuffers
-}VGroupBuffer;
+#if USE_TEXTURE_ATLAS
+/*Texture coordinates also hold the atlas layer*/
+#define VGROUP_TEXCOORD_COMPONENTS 3
+#else
+#define VGROUP_TEXCOORD_COMPONENTS 2
+#endif
+
+#if USE_QUANTIZED_VERTICES
+/*Vertex attributes are quantized on 16 bits, see MeshBatch*/
+typedef GLushort MeshVertexComponent;
+#define MESH_VERTEX_COMPONENT_TYPE GL_UNSIGNED_SHORT
+#define MESH_VERTEX_QUANTIZATION_STEPS 65535.0
+#else
+typedef GLfloat MeshVertexComponent;
+#define MESH_VERTEX_COMPONENT_TYPE GL_FLOAT
+#endif
 
+/*A vertex, as uploaded to the GL*/
 typedef struct{
-    bool prepared;
+    MeshVertexComponent position[3];
+    MeshVertexComponent texcoord[VGROUP_TEXCOORD_COMPONENTS];
+}MeshVertex;
+
+/* Consecutive groups of a chain that are drawn with the same vertex
+ * pointers: their indices are relative to the same base vertex. When
+ * vertices are quantized, they also share the same quantization box.*/
+typedef struct{
+    size_t base_vertex; /*Offset (bytes) of the first vertex in the chain vbo*/
+    /*Attributes are dequantized as component * scale + offset*/
+    SGVec3f position_scale;
+    SGVec3f position_offset;
+    SGVec2f texcoord_scale;
+    SGVec2f texcoord_offset;
+    /* Vertex array object holding the batch buffers and pointers, 0
+     * until first drawn or when unavailable. Attribute locations are
+     * the ones of vao_program*/
+    GLuint vao;
+    GLuint vao_program;
+}MeshBatch;
+
+/*Levels of detail of a VGroup, including the full resolution one*/
+#define VGROUP_LOD_LEVELS 4
+
+/*A simplified version of a VGroup, using a subset of its vertices*/
+typedef struct{
+    size_t offset; /*First index of the level in lod_indices*/
+    size_t n_indices;
+    size_t first_index; /*Offset (bytes) of the level indices in ibo*/
+    float error; /*Meters, worst RMS distance to the merged triangles planes*/
+}VGroupLod;
+
+typedef struct{
+    /* positions, texcoords and indices point into the Mesh
+     * cache mapping and must not be freed*/
+    bool mapped;
 
     char *material;
     /*Texture associated with this mesh*/
     Texture *texture;
 
-    /*Vertices, in a specialized hash*/
+    /*Vertices, deduplicated in a specialized hash*/
     VertexSet *vset;
 
-    /*Vertex attributes, flattened from above hash*/
+    /*Vertex attributes, handed over by the above set*/
     SGVec3f *positions; /*Vertex coordinates*/
     SGVec2f *texcoords; /*Texture coordinates*/
     indice_t n_vertices; /*Actual vertices in the arrays (vertices, texs)*/
 
     /*Indices into the above data, to be passed to OpenGL in drawElements*/
     indice_t *indices;
+    /* While building, indices are kept here and only narrowed to
+     * indice_t by vgroup_finish, once groups that have too many
+     * vertices have been split*/
+    uint32_t *wide_indices;
     size_t n_indices; /*Actual number of valid indices*/
     size_t allocated_indices; /*We have room to store allocated_indices indices*/
 
+    /* Coarser levels of detail, lods[0] being level 1. Their indices
+     * follow each other in lod_indices, a level that is the same as
+     * the previous one shares its indices. See mesh-lod.c*/
+    VGroupLod lods[VGROUP_LOD_LEVELS - 1];
+    size_t n_lods;
+    indice_t *lod_indices;
+    size_t n_lod_indices;
+
     /*In world coordinates, i.e already transformed
      * during prepare stage*/
     SGSphered bs; /*bounding sphere*/
 
-    /*Buffers: OpenGL handles*/
-    GLuint buffers[NBuffers];
+    /*Buffers: OpenGL handles, shared by all groups of a chain*/
+    GLuint vbo;
+    GLuint ibo;
+    MeshBatch *batch; /*Indices are relative to the batch base vertex*/
+    size_t first_index; /*Offset (bytes) of the group indices in ibo*/
 }VGroup;
 
 
+/*Side of the square cells tiles are cut into, in meters*/
+#define MESH_CELL_SIZE 4000.0
+/*At most MESH_MAX_CELLS x MESH_MAX_CELLS cells per mesh*/
+#define MESH_MAX_CELLS 8
+
+/* A spatial cell of a Mesh: a range of consecutive groups, one or
+ * more per material, whose triangles fall in the same cell of the grid
+ * laid over the tile in its local east/north frame.*/
+typedef struct{
+    /*Encloses the bounding spheres of the cell groups*/
+    SGSphered bs;
+    size_t first_group;
+    size_t n_groups;
+}MeshCell;
+
+typedef struct{
+    size_t meshes; /*Transformations set (one per visible mesh when not queued)*/
+    size_t cells;
+    size_t groups;
+    size_t triangles;
+    size_t draw_calls;
+    size_t texture_binds;
+    size_t buffer_binds;
+    size_t upload_bytes; /*Sent to the GL by mesh_prepare*/
+    size_t upload_calls; /*GL calls made by mesh_prepare*/
+    size_t gl_calls; /*All GL calls of the frame, see GLState*/
+    size_t gl_skipped; /*Redundant calls dropped by GLState*/
+}MeshRenderStats;
+
 typedef struct _Mesh{
     VGroup *groups;
     size_t n_groups;
 
+    /*Groups are sorted by cell. Meshes without cells have their
+     * groups culled one by one*/
+    MeshCell *cells;
+    size_t n_cells;
+
     mat4d transformation;
 
     /*In world coordinates, i.e already transformed
      * during prepare stage*/
     SGSphered bs;
 
+    /*Unique among all meshes created by the process*/
+    unsigned long serial;
+    /*MeshOptimizeFlags applied to the groups, see mesh_optimize*/
+    unsigned int optimizations;
+
+    /* Set on all meshes of a chain by mesh_prepare. The head owns the
+     * buffers holding the vertices and indices of the whole chain*/
+    bool prepared;
+    GLuint vbo;
+    GLuint ibo;
+    size_t gpu_size; /*Bytes of vbo and ibo*/
+    MeshBatch *batches;
+    size_t n_batches;
+
+    /*Set on the head of a chain loaded from a cache file*/
+    void *mapping;
+    size_t mapping_size;
+    bool mapping_allocated; /*malloc'ed image instead, see mesh_cache_unpack*/
+
     struct _Mesh *next;
 }Mesh;
 
@@ -69,20 +183,31 @@ VGroup *vgroup_init(VGroup *self, const char *material, size_t n_triangles);
 void vgroup_dispose(VGroup *self);
 long vgroup_add_vertex(VGroup *self, SGVec3d *v, SGVec2f *tex);
 bool vgroup_add_triangle(VGroup *self, SGVec3d *v1, SGVec2f *t1, SGVec3d *v2, SGVec2f *t2, SGVec3d *v3, SGVec2f *t3);
+bool vgroup_add_indexed_triangle(VGroup *self, const SGVec3d *nodes, const SGVec2f *texcoords,
+                                 const uint32_t v[3], const uint32_t t[3]);
 bool vgroup_finish(VGroup *self, SGSphered *gbs);
 size_t vgroup_get_size(VGroup *self, bool data_only);
-bool vgroup_prepare(VGroup *self);
 
 Mesh *mesh_new_from_file(const char *filename);
 Mesh *mesh_new_from_btg(const char *filename);
 Mesh *mesh_new(size_t size);
 Mesh *mesh_new_empty(void);
 void mesh_free(Mesh *self);
+void mesh_release_gl(Mesh *self);
+void mesh_add_accessory(Mesh *self, Mesh *accessory);
 bool mesh_set_size(Mesh *self, size_t size);
+bool mesh_split_groups(Mesh *self);
+bool mesh_finish(Mesh *self);
 VGroup *mesh_add_vgroup(Mesh *self, const char *material, size_t n_triangles);
-
-Mesh *mesh_prepare(Mesh *self);
-void mesh_render_buffer(Mesh *self, BasicShader *shader, mat4d vp, vec4 frustum[6], vec4 frustrum_bs);
+size_t mesh_get_size(Mesh *self, bool data_only);
+
+bool mesh_pack(Mesh *self, MeshVertex **vertices, size_t *n_vertices, indice_t **indices, size_t *n_indices);
+bool mesh_prepare(Mesh *self, MeshRenderStats *stats);
+void mesh_bind(Mesh *self, BasicShader *shader, mat4d vp);
+void mesh_batch_bind(MeshBatch *self, BasicShader *shader, GLuint vbo, GLuint ibo);
+void vgroup_draw(VGroup *self, BasicShader *shader);
+void vgroup_render(VGroup *self, BasicShader *shader);
+void mesh_render_buffer(Mesh *self, BasicShader *shader, mat4d vp, vec4 frustum[6], vec4 frustrum_bs, MeshRenderStats *stats);
 
 void mesh_dump(Mesh *self);
 
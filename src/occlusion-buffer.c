@@ -0,0 +1,260 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "occlusion-buffer.h"
+
+/**
+ * OcclusionBuffer: coarse software depth buffer used to cull what is
+ * hidden behind terrain.
+ *
+ * Occluders are rasterized at a low resolution, keeping at each pixel
+ * center the distance of the nearest one along the camera axis. A
+ * sphere is occluded when every pixel of its screen rectangle, grown
+ * by one pixel, holds an occluder nearer than the nearest point of the
+ * sphere. Growing the rectangle accounts for pixels only partly
+ * covered by the occluders.
+ *
+ * Triangles crossing the near plane are not clipped but skipped: that
+ * only makes the buffer see less occluders. Occluders drawn with a
+ * simplified mesh must be given a bias at least as large as its error.
+ */
+
+OcclusionBuffer *occlusion_buffer_new(size_t width, size_t height)
+{
+    OcclusionBuffer *rv;
+
+    rv = calloc(1, sizeof(OcclusionBuffer));
+    if(rv){
+        if(!occlusion_buffer_init(rv, width, height))
+            return occlusion_buffer_free(rv);
+    }
+    return rv;
+}
+
+OcclusionBuffer *occlusion_buffer_init(OcclusionBuffer *self, size_t width, size_t height)
+{
+    self->width = width;
+    self->height = height;
+    self->depth = malloc(width * height * sizeof(float));
+    if(!self->depth)
+        return NULL;
+    glm_mat4d_identity(self->vp);
+    occlusion_buffer_clear(self, self->vp);
+    return self;
+}
+
+OcclusionBuffer *occlusion_buffer_dispose(OcclusionBuffer *self)
+{
+    if(self->depth)
+        free(self->depth);
+    return self;
+}
+
+OcclusionBuffer *occlusion_buffer_free(OcclusionBuffer *self)
+{
+    occlusion_buffer_dispose(self);
+    free(self);
+    return NULL;
+}
+
+/**
+ * @brief Removes all occluders and sets the camera of the next ones.
+ *
+ * @param self an OcclusionBuffer
+ * @param vp The View-Projection matrix of the frame
+ */
+void occlusion_buffer_clear(OcclusionBuffer *self, mat4d vp)
+{
+    size_t n = self->width * self->height;
+
+    for(size_t i = 0; i < n; i++)
+        self->depth[i] = FLT_MAX;
+    memcpy(self->vp, vp, sizeof(mat4d));
+    self->n_triangles = 0;
+}
+
+/*
+ * Rasterizes a triangle given in pixels, with 1/w at each vertex. 1/w
+ * is linear in screen space, as are the barycentric coordinates.
+ */
+static void occlusion_buffer_fill(OcclusionBuffer *self, float sx[3], float sy[3], float iw[3], float bias)
+{
+    float area;
+    float a[3], b[3], c[3]; /*Barycentric coordinates: a*x + b*y + c*/
+    float wa, wb, wc; /*1/w, same*/
+    int x0, x1, y0, y1;
+
+    area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+    if(fabsf(area) < 1e-6f)
+        return;
+
+    x0 = floorf(fminf(sx[0], fminf(sx[1], sx[2])));
+    x1 = ceilf(fmaxf(sx[0], fmaxf(sx[1], sx[2])));
+    y0 = floorf(fminf(sy[0], fminf(sy[1], sy[2])));
+    y1 = ceilf(fmaxf(sy[0], fmaxf(sy[1], sy[2])));
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > (int)self->width - 1) x1 = self->width - 1;
+    if(y1 > (int)self->height - 1) y1 = self->height - 1;
+    if(x0 > x1 || y0 > y1)
+        return;
+
+    /*Weight of vertex k: edge function of the opposite edge over the area*/
+    for(int k = 0; k < 3; k++){
+        int i = (k + 1) % 3;
+        int j = (k + 2) % 3;
+
+        a[k] = -(sy[j] - sy[i]) / area;
+        b[k] = (sx[j] - sx[i]) / area;
+        c[k] = ((sy[j] - sy[i]) * sx[i] - (sx[j] - sx[i]) * sy[i]) / area;
+    }
+    wa = a[0]*iw[0] + a[1]*iw[1] + a[2]*iw[2];
+    wb = b[0]*iw[0] + b[1]*iw[1] + b[2]*iw[2];
+    wc = c[0]*iw[0] + c[1]*iw[1] + c[2]*iw[2];
+
+    for(int y = y0; y <= y1; y++){
+        float py = y + 0.5f;
+        float *row = self->depth + y * self->width;
+
+        for(int x = x0; x <= x1; x++){
+            float px = x + 0.5f;
+            float d;
+
+            if(a[0]*px + b[0]*py + c[0] < 0.0f
+               || a[1]*px + b[1]*py + c[1] < 0.0f
+               || a[2]*px + b[2]*py + c[2] < 0.0f)
+                continue;
+            d = 1.0f / (wa*px + wb*py + wc) + bias;
+            if(d < row[x])
+                row[x] = d;
+        }
+    }
+}
+
+/**
+ * @brief Rasterizes occluding triangles.
+ *
+ * @param self an OcclusionBuffer
+ * @param model Transformation of the mesh the triangles belong to
+ * @param positions Vertices, in mesh coordinates
+ * @param indices Triangles, 3 indices each
+ * @param n_indices Number of indices in @p indices
+ * @param bias Distance (meters) pushing the triangles away from the camera
+ */
+void occlusion_buffer_add_triangles(OcclusionBuffer *self, mat4d model, SGVec3f *positions, indice_t *indices, size_t n_indices, float bias)
+{
+    mat4d mvpd;
+    float m[4][4];
+    float sx[3], sy[3], iw[3];
+    bool skip;
+
+    /*Tile coordinates are only relative to the camera once in doubles*/
+    glm_mat4d_mul(self->vp, model, mvpd);
+    for(int i = 0; i < 4; i++){
+        for(int j = 0; j < 4; j++)
+            m[i][j] = mvpd[i][j];
+    }
+
+    for(size_t i = 0; i + 2 < n_indices; i += 3){
+        skip = false;
+        for(int k = 0; k < 3 && !skip; k++){
+            SGVec3f *p = &positions[indices[i + k]];
+            float x = m[0][0]*p->x + m[1][0]*p->y + m[2][0]*p->z + m[3][0];
+            float y = m[0][1]*p->x + m[1][1]*p->y + m[2][1]*p->z + m[3][1];
+            float w = m[0][3]*p->x + m[1][3]*p->y + m[2][3]*p->z + m[3][3];
+
+            skip = w < OCCLUSION_BUFFER_NEAR;
+            iw[k] = 1.0f / w;
+            sx[k] = (x * iw[k] * 0.5f + 0.5f) * self->width;
+            sy[k] = (y * iw[k] * 0.5f + 0.5f) * self->height;
+        }
+        if(skip)
+            continue;
+        occlusion_buffer_fill(self, sx, sy, iw, bias);
+        self->n_triangles++;
+    }
+}
+
+/**
+ * @brief Tells whether a sphere is entirely hidden by the occluders.
+ *
+ * @param self an OcclusionBuffer
+ * @param bs The sphere, in world coordinates
+ * @return true if the sphere is hidden, false if it could be visible
+ */
+bool occlusion_buffer_is_occluded(OcclusionBuffer *self, SGSphered *bs)
+{
+    double clip[3]; /*x, y, w of the center*/
+    double axes[3][3]; /*x, y, w of the world axes scaled by the radius*/
+    double minx, maxx, miny, maxy;
+    double nearest;
+    int x0, x1, y0, y1;
+    mat4d *vp = &self->vp;
+    const int rows[3] = {0, 1, 3};
+
+    for(int k = 0; k < 3; k++){
+        int r = rows[k];
+
+        clip[k] = (*vp)[0][r]*bs->center.x + (*vp)[1][r]*bs->center.y
+                + (*vp)[2][r]*bs->center.z + (*vp)[3][r];
+        for(int a = 0; a < 3; a++)
+            axes[a][k] = (*vp)[a][r] * bs->radius;
+    }
+    nearest = clip[2] - bs->radius;
+    if(nearest <= OCCLUSION_BUFFER_NEAR)
+        return false;
+
+    /*Screen rectangle of the cube around the sphere*/
+    minx = miny = DBL_MAX;
+    maxx = maxy = -DBL_MAX;
+    for(int corner = 0; corner < 8; corner++){
+        double c[3];
+
+        for(int k = 0; k < 3; k++){
+            c[k] = clip[k];
+            for(int a = 0; a < 3; a++)
+                c[k] += (corner & (1 << a)) ? axes[a][k] : -axes[a][k];
+        }
+        if(c[2] <= OCCLUSION_BUFFER_NEAR)
+            return false;
+        minx = fmin(minx, c[0] / c[2]);
+        maxx = fmax(maxx, c[0] / c[2]);
+        miny = fmin(miny, c[1] / c[2]);
+        maxy = fmax(maxy, c[1] / c[2]);
+    }
+    /*Keeps conversions to int in range*/
+    minx = fmin(fmax(minx, -2.0), 2.0);
+    maxx = fmin(fmax(maxx, -2.0), 2.0);
+    miny = fmin(fmax(miny, -2.0), 2.0);
+    maxy = fmin(fmax(maxy, -2.0), 2.0);
+    x0 = floor((minx * 0.5 + 0.5) * self->width) - 1;
+    x1 = floor((maxx * 0.5 + 0.5) * self->width) + 1;
+    y0 = floor((miny * 0.5 + 0.5) * self->height) - 1;
+    y1 = floor((maxy * 0.5 + 0.5) * self->height) + 1;
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > (int)self->width - 1) x1 = self->width - 1;
+    if(y1 > (int)self->height - 1) y1 = self->height - 1;
+    if(x0 > x1 || y0 > y1)
+        return false; /*Off screen, left to frustum culling*/
+
+    for(int y = y0; y <= y1; y++){
+        float *row = self->depth + y * self->width;
+
+        for(int x = x0; x <= x1; x++){
+            if(row[x] >= nearest)
+                return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef OCCLUSION_BUFFER_H
+#define OCCLUSION_BUFFER_H
+
+#include <stdbool.h>
+
+#include <cglm/cglm.h>
+
+#include "mesh.h"
+#include "sg-sphere.h"
+
+/*Default size, a fifth of the 800x600 viewport*/
+#define OCCLUSION_BUFFER_WIDTH 160
+#define OCCLUSION_BUFFER_HEIGHT 120
+/*Occluders and spheres closer than this (meters) to the camera are ignored*/
+#define OCCLUSION_BUFFER_NEAR 1.0
+
+typedef struct{
+    /* Distance along the camera axis (clip w) of the nearest occluder
+     * at each pixel center, FLT_MAX when there is none*/
+    float *depth;
+    size_t width;
+    size_t height;
+
+    mat4d vp; /*View-Projection of the current frame*/
+    size_t n_triangles; /*Rasterized since the last clear*/
+}OcclusionBuffer;
+
+OcclusionBuffer *occlusion_buffer_new(size_t width, size_t height);
+OcclusionBuffer *occlusion_buffer_init(OcclusionBuffer *self, size_t width, size_t height);
+OcclusionBuffer *occlusion_buffer_dispose(OcclusionBuffer *self);
+OcclusionBuffer *occlusion_buffer_free(OcclusionBuffer *self);
+
+void occlusion_buffer_clear(OcclusionBuffer *self, mat4d vp);
+void occlusion_buffer_add_triangles(OcclusionBuffer *self, mat4d model, SGVec3f *positions, indice_t *indices, size_t n_indices, float bias);
+bool occlusion_buffer_is_occluded(OcclusionBuffer *self, SGSphered *bs);
+#endif /* OCCLUSION_BUFFER_H */
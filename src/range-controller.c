@@ -0,0 +1,162 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "range-controller.h"
+
+/**
+ * RangeController: how far terrain is drawn, and how detailed.
+ *
+ * The height above ground sets a base range: low over the ground, the
+ * far tiles are hidden by the near ones anyway; high up, they make the
+ * picture. The time frames take then picks a level on a ladder that
+ * first coarsens the levels of detail, then shortens the range.
+ *
+ * Both have hysteresis so that the range doesn't go back and forth,
+ * which would load and evict the same tiles:
+ * - The height only moves the base range by whole steps.
+ * - Frame times are averaged. The quality only goes down after
+ * RANGE_CONTROLLER_DOWN_FRAMES frames over budget, and up after
+ * RANGE_CONTROLLER_UP_FRAMES frames well under it. The frames following
+ * a change are not taken into account.
+ *
+ * Each change is printed, which tells what a board can sustain.
+ */
+
+static const RangeControllerLevel levels[] = {
+    {1.0f, 1.0f},
+    {1.0f, 2.0f},
+    {0.8f, 2.0f},
+    {0.8f, 4.0f},
+    {0.6f, 4.0f},
+    {0.5f, 8.0f}
+};
+#define NLEVELS ((int)(sizeof(levels) / sizeof(levels[0])))
+
+RangeController *range_controller_new(void)
+{
+    RangeController *rv;
+
+    rv = calloc(1, sizeof(RangeController));
+    if(rv){
+        if(!range_controller_init(rv))
+            return range_controller_free(rv);
+    }
+    return rv;
+}
+
+RangeController *range_controller_init(RangeController *self)
+{
+    memset(self, 0, sizeof(RangeController));
+    self->budget = RANGE_CONTROLLER_BUDGET;
+    self->frame_time = -1.0;
+    self->base_range = RANGE_CONTROLLER_MIN_RANGE;
+    self->range = RANGE_CONTROLLER_MIN_RANGE;
+    self->far_plane = RANGE_CONTROLLER_MIN_RANGE;
+    self->lod_error = RANGE_CONTROLLER_LOD_ERROR;
+    return self;
+}
+
+RangeController *range_controller_free(RangeController *self)
+{
+    free(self);
+    return NULL;
+}
+
+/**
+ * @brief Tells how long the last frame took.
+ *
+ * @param self a RangeController
+ * @param ms Time spent drawing the frame, the buffer swap (and its wait
+ * for vsync) excluded
+ */
+void range_controller_add_frame(RangeController *self, float ms)
+{
+    if(self->frame_time < 0.0)
+        self->frame_time = ms;
+    else
+        self->frame_time += (ms - self->frame_time) * RANGE_CONTROLLER_SMOOTHING;
+    self->nframes++;
+}
+
+/*Level to switch to, or the current one*/
+static int range_controller_next_level(RangeController *self)
+{
+    if(self->frame_time < 0.0 || self->nframes < RANGE_CONTROLLER_SETTLE_FRAMES)
+        return self->level;
+
+    if(self->frame_time > self->budget * RANGE_CONTROLLER_HIGH){
+        self->out_frames = self->out_frames > 0 ? self->out_frames + 1 : 1;
+        if(self->out_frames >= RANGE_CONTROLLER_DOWN_FRAMES && self->level < NLEVELS - 1)
+            return self->level + 1;
+    }else if(self->frame_time < self->budget * RANGE_CONTROLLER_LOW){
+        self->out_frames = self->out_frames < 0 ? self->out_frames - 1 : -1;
+        if(-self->out_frames >= RANGE_CONTROLLER_UP_FRAMES && self->level > 0)
+            return self->level - 1;
+    }else{
+        self->out_frames = 0;
+    }
+    return self->level;
+}
+
+/**
+ * @brief Works out the range, far plane and LOD error to use.
+ *
+ * To be called once per frame, after range_controller_add_frame.
+ *
+ * @param self a RangeController
+ * @param agl Height above ground (m), NAN when unknown, which keeps the
+ * current base range.
+ * @return true if any output has changed, false otherwise
+ */
+bool range_controller_update(RangeController *self, double agl)
+{
+    double target, range;
+    float lod_error;
+    int level;
+    const char *reason;
+
+    reason = NULL;
+    level = range_controller_next_level(self);
+    if(level != self->level){
+        reason = level > self->level ? "over budget" : "under budget";
+        self->level = level;
+        self->nframes = 0;
+        self->out_frames = 0;
+    }
+
+    if(!isnan(agl)){
+        target = RANGE_CONTROLLER_MIN_RANGE + fmax(agl, 0.0) * RANGE_CONTROLLER_PER_AGL;
+        target = fmin(target, RANGE_CONTROLLER_MAX_RANGE);
+        if(fabs(target - self->base_range) >= RANGE_CONTROLLER_STEP){
+            self->base_range = round(target / RANGE_CONTROLLER_STEP) * RANGE_CONTROLLER_STEP;
+            reason = reason ? reason : "height";
+        }
+    }
+    if(!reason)
+        return false;
+
+    range = round(self->base_range * levels[self->level].range / RANGE_CONTROLLER_STEP);
+    range = fmax(range, 1.0) * RANGE_CONTROLLER_STEP;
+    lod_error = RANGE_CONTROLLER_LOD_ERROR * levels[self->level].lod_error;
+    if(range == self->range && lod_error == self->lod_error)
+        return false;
+    self->range = range;
+    self->far_plane = range;
+    self->lod_error = lod_error;
+
+    printf("RangeController: %s (%.1f ms/frame for %.1f, %.0f m AGL): "
+        "level %d, range %.0f m, far plane %.0f m, LOD error %.1f px\n",
+        reason, self->frame_time, self->budget, agl,
+        self->level, self->range, self->far_plane, self->lod_error
+    );
+    return true;
+}
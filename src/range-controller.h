@@ -0,0 +1,64 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef RANGE_CONTROLLER_H
+#define RANGE_CONTROLLER_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/*Time (ms) a frame should take, board dependent*/
+#ifndef RANGE_CONTROLLER_BUDGET
+#define RANGE_CONTROLLER_BUDGET 20.0
+#endif
+/*Frames slower than budget*HIGH lower the quality, faster than budget*LOW raise it*/
+#define RANGE_CONTROLLER_HIGH 1.0
+#define RANGE_CONTROLLER_LOW 0.7
+/*Weight of each new frame time in the average*/
+#define RANGE_CONTROLLER_SMOOTHING 0.1
+/*Frames the average must stay out of the band before a change*/
+#define RANGE_CONTROLLER_DOWN_FRAMES 15
+#define RANGE_CONTROLLER_UP_FRAMES 100
+/*Frames after a change during which the average settles, ignored*/
+#define RANGE_CONTROLLER_SETTLE_FRAMES 25
+
+/*Range (m) from height above ground: MIN + agl * PER_AGL, at most MAX*/
+#define RANGE_CONTROLLER_MIN_RANGE 6000.0
+#define RANGE_CONTROLLER_MAX_RANGE 30000.0
+#define RANGE_CONTROLLER_PER_AGL 10.0
+/*Ranges are multiples of that, and only follow the height by whole steps*/
+#define RANGE_CONTROLLER_STEP 1000.0
+
+/*Max screen-space error (pixels) of the levels of detail, at full quality*/
+#define RANGE_CONTROLLER_LOD_ERROR 1.0
+
+typedef struct{
+    float range; /*Factor applied to the range*/
+    float lod_error; /*Factor applied to RANGE_CONTROLLER_LOD_ERROR*/
+}RangeControllerLevel;
+
+typedef struct{
+    float budget; /*ms*/
+    double frame_time; /*ms, smoothed*/
+    size_t nframes; /*Seen since the last change*/
+    int out_frames; /*Frames in a row over (>0) or well under (<0) budget*/
+    int level; /*0 is full quality*/
+
+    double base_range; /*Given by the height, m*/
+
+    /*Outputs*/
+    double range; /*Tiles are loaded up to that distance, m*/
+    double far_plane; /*m*/
+    float lod_error; /*pixels*/
+}RangeController;
+
+RangeController *range_controller_new(void);
+RangeController *range_controller_init(RangeController *self);
+RangeController *range_controller_free(RangeController *self);
+
+void range_controller_add_frame(RangeController *self, float ms);
+bool range_controller_update(RangeController *self, double agl);
+#endif /* RANGE_CONTROLLER_H */
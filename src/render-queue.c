@@ -0,0 +1,268 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#define GL_GLEXT_PROTOTYPES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if USE_GLES
+#include <SDL2/SDL_opengles2.h>
+#include <SDL_opengles2_gl2ext.h>
+#else
+#include <SDL2/SDL_opengl.h>
+#include <SDL2/SDL_opengl_glext.h>
+#endif
+
+#include <SDL2/SDL.h>
+
+#include "render-queue.h"
+#include "mesh-lod.h"
+#include "gl-state.h"
+
+/**
+ * RenderQueue: draws groups of all resident meshes sorted by state.
+ *
+ * Groups are pushed in any order during a frame, and drawn by
+ * render_queue_flush() sorted by shader, texture and mesh (i.e
+ * transformation). GL state is only changed when it differs from
+ * the one of the previous group, and consecutive groups that only
+ * differ by their indices go in a single glMultiDrawElements call.
+ * When vertex array objects are available, switching to the vertices
+ * of another batch is a single bind.
+ */
+
+RenderQueue *render_queue_new(void)
+{
+    RenderQueue *rv;
+
+    rv = calloc(1, sizeof(RenderQueue));
+    if(rv){
+        if(!render_queue_init(rv))
+            return render_queue_free(rv);
+    }
+    return rv;
+}
+
+RenderQueue *render_queue_init(RenderQueue *self)
+{
+    self->allocated = 256;
+    self->items = malloc(self->allocated * sizeof(RenderItem));
+    self->counts = malloc(self->allocated * sizeof(GLsizei));
+    self->offsets = malloc(self->allocated * sizeof(void*));
+    if(!self->items || !self->counts || !self->offsets)
+        return NULL;
+
+#if USE_GLES
+    if(SDL_GL_ExtensionSupported("GL_EXT_multi_draw_arrays"))
+        self->multi_draw = (MultiDrawElementsFunc)SDL_GL_GetProcAddress("glMultiDrawElementsEXT");
+#else
+    self->multi_draw = (MultiDrawElementsFunc)glMultiDrawElements; /*GL 1.4*/
+#endif
+    return self;
+}
+
+RenderQueue *render_queue_dispose(RenderQueue *self)
+{
+    if(self->items)
+        free(self->items);
+    if(self->counts)
+        free(self->counts);
+    if(self->offsets)
+        free(self->offsets);
+    return self;
+}
+
+RenderQueue *render_queue_free(RenderQueue *self)
+{
+    render_queue_dispose(self);
+    free(self);
+    return NULL;
+}
+
+/**
+ * @brief Empties the queue, keeping its storage.
+ */
+void render_queue_clear(RenderQueue *self)
+{
+    self->n_items = 0;
+}
+
+/**
+ * @brief Queues @p group for drawing with @p shader.
+ *
+ * The mesh chain of the group must have been prepared.
+ *
+ * @param self a RenderQueue
+ * @param shader The shader to draw the group with
+ * @param mesh The mesh the group belongs to
+ * @param group The group to draw
+ * @param lod The level of detail to draw the group at, 0 being full
+ * resolution
+ * @return true on success, false on failure
+ */
+bool render_queue_push(RenderQueue *self, BasicShader *shader, Mesh *mesh, VGroup *group, int lod)
+{
+    GLuint texture;
+
+    if(self->n_items == self->allocated){
+        size_t nsize = self->allocated * 2;
+        RenderItem *items = realloc(self->items, nsize * sizeof(RenderItem));
+        if(items)
+            self->items = items;
+        GLsizei *counts = realloc(self->counts, nsize * sizeof(GLsizei));
+        if(counts)
+            self->counts = counts;
+        const void **offsets = realloc(self->offsets, nsize * sizeof(void*));
+        if(offsets)
+            self->offsets = offsets;
+        if(!items || !counts || !offsets)
+            return false;
+        self->allocated = nsize;
+    }
+
+    texture = group->texture ? group->texture->id : 0;
+
+    self->items[self->n_items++] = (RenderItem){
+        .key = ((uint64_t)(SHADER(shader)->program_id & 0xff) << 56)
+             | ((uint64_t)(texture & 0xffffff) << 32)
+             | (mesh->serial & 0xffffffff),
+        .shader = shader,
+        .mesh = mesh,
+        .group = group,
+        .lod = lod
+    };
+    return true;
+}
+
+static int render_item_cmp(const void *a, const void *b)
+{
+    const RenderItem *ia = a;
+    const RenderItem *ib = b;
+
+    if(ia->key != ib->key)
+        return ia->key < ib->key ? -1 : 1;
+    /*Groups of a same mesh in buffer order, to keep batches together*/
+    return (ia->group > ib->group) - (ia->group < ib->group);
+}
+
+/*Draws the groups accumulated in counts/offsets*/
+static void render_queue_submit(RenderQueue *self, size_t n, MeshRenderStats *stats)
+{
+    if(!n)
+        return;
+    if(self->multi_draw && n > 1){
+        self->multi_draw(GL_TRIANGLES, self->counts, INDICE_TYPE, self->offsets, n);
+        gl_state_count(1);
+        if(stats)
+            stats->draw_calls++;
+        return;
+    }
+    for(size_t i = 0; i < n; i++)
+        glDrawElements(GL_TRIANGLES, self->counts[i], INDICE_TYPE, self->offsets[i]);
+    gl_state_count(n);
+    if(stats)
+        stats->draw_calls += n;
+}
+
+/**
+ * @brief Draws all queued groups and empties the queue.
+ *
+ * @param self a RenderQueue
+ * @param vp The current View-Projection matrix
+ * @param stats If not NULL, incremented with what has been submitted
+ */
+void render_queue_flush(RenderQueue *self, mat4d vp, MeshRenderStats *stats)
+{
+    BasicShader *shader;
+    Mesh *mesh;
+    GLuint texture, id, vbo;
+    MeshBatch *batch;
+    size_t n, first_index, n_indices;
+    RenderItem *item;
+    VGroup *group;
+
+    qsort(self->items, self->n_items, sizeof(RenderItem), render_item_cmp);
+
+    shader = NULL;
+    mesh = NULL;
+    texture = 0;
+    vbo = 0;
+    batch = NULL;
+    n = 0;
+    gl_state_active_texture(GL_TEXTURE0);
+    for(size_t i = 0; i < self->n_items; i++){
+        item = &self->items[i];
+        group = item->group;
+        id = group->texture ? group->texture->id : 0;
+
+        /*Anything but indices changing ends the current run*/
+        if(item->shader != shader || id != texture || i == 0
+           || item->mesh != mesh || group->batch != batch){
+            render_queue_submit(self, n, stats);
+            n = 0;
+        }
+
+        if(item->shader != shader){
+            if(shader && !gl_state_has_vertex_arrays()){
+                gl_state_disable_attrib(shader->position);
+                gl_state_disable_attrib(shader->texcoords);
+            }
+            shader = item->shader;
+            gl_state_use_program(SHADER(shader)->program_id);
+            /*Vertex arrays hold their enabled attributes*/
+            if(!gl_state_has_vertex_arrays()){
+                gl_state_enable_attrib(shader->position);
+                gl_state_enable_attrib(shader->texcoords);
+            }
+            /*Uniforms and pointers are per program*/
+            mesh = NULL;
+            batch = NULL;
+        }
+
+        if(id != texture || i == 0){
+            gl_state_bind_texture(TEXTURE_TARGET, id);
+            texture = id;
+            if(stats)
+                stats->texture_binds++;
+        }
+
+        if(item->mesh != mesh){
+            mesh_bind(item->mesh, shader, vp);
+            mesh = item->mesh;
+            if(stats)
+                stats->meshes++;
+        }
+
+        if(group->batch != batch){
+            mesh_batch_bind(group->batch, shader, group->vbo, group->ibo);
+            batch = group->batch;
+            if(stats && group->vbo != vbo)
+                stats->buffer_binds += gl_state_has_vertex_arrays() ? 1 : 2;
+            vbo = group->vbo;
+        }
+
+        vgroup_get_lod_range(group, item->lod, &first_index, &n_indices);
+        self->counts[n] = n_indices;
+        self->offsets[n] = (void*)first_index;
+        n++;
+        if(stats){
+            stats->groups++;
+            stats->triangles += n_indices / 3;
+        }
+    }
+    render_queue_submit(self, n, stats);
+
+    /* Leave the default vertex array, with no attribute enabled, to
+     * others. The program stays, GLState knows about it*/
+    gl_state_bind_vertex_array(0);
+    if(shader && !gl_state_has_vertex_arrays()){
+        gl_state_disable_attrib(shader->position);
+        gl_state_disable_attrib(shader->texcoords);
+    }
+    self->n_items = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <cglm/cglm.h>
+
+#include "basic-shader.h"
+#include "mesh.h"
+
+typedef struct{
+    /*Sort key: shader, then texture, then mesh*/
+    uint64_t key;
+    BasicShader *shader;
+    Mesh *mesh;
+    VGroup *group;
+    int lod; /*Level of detail to draw the group at, see vgroup_select_lod*/
+}RenderItem;
+
+typedef void (*MultiDrawElementsFunc)(GLenum mode, const GLsizei *count, GLenum type, const void *const *indices, GLsizei drawcount);
+
+typedef struct{
+    RenderItem *items;
+    size_t n_items;
+    size_t allocated;
+
+    /*Groups that are drawn in a single call*/
+    GLsizei *counts;
+    const void **offsets;
+    /*NULL when unavailable, groups are then drawn one by one*/
+    MultiDrawElementsFunc multi_draw;
+}RenderQueue;
+
+RenderQueue *render_queue_new(void);
+RenderQueue *render_queue_init(RenderQueue *self);
+RenderQueue *render_queue_dispose(RenderQueue *self);
+RenderQueue *render_queue_free(RenderQueue *self);
+
+void render_queue_clear(RenderQueue *self);
+bool render_queue_push(RenderQueue *self, BasicShader *shader, Mesh *mesh, VGroup *group, int lod);
+void render_queue_flush(RenderQueue *self, mat4d vp, MeshRenderStats *stats);
+#endif /* RENDER_QUEUE_H */
@@ -37,3 +37,37 @@ void sg_sphered_expand_by(SGSphered *self, SGVec3d *v)
     };
     self->radius = newRadius;
 }
+
+void sg_sphered_expand_by_sphere(SGSphered *self, SGSphered *s)
+{
+    if (sg_sphered_empty(s))
+      return;
+
+    if (sg_sphered_empty(self)) {
+      *self = *s;
+      return;
+    }
+
+    double dist = sqrt(sg_vect3d_distSqr(&(self->center), &(s->center)));
+    if (dist == 0) {
+      self->radius = s->radius > self->radius ? s->radius : self->radius;
+      return;
+    }
+    /*s is already inside*/
+    if (dist + s->radius <= self->radius)
+      return;
+    /*self is inside s*/
+    if (dist + self->radius <= s->radius) {
+      *self = *s;
+      return;
+    }
+
+    double newRadius = (double)(0.5)*(self->radius + dist + s->radius);
+    double factor = (newRadius - self->radius)/dist;
+    self->center = (SGVec3d){
+        .x = self->center.x + factor * (s->center.x - self->center.x),
+        .y = self->center.y + factor * (s->center.y - self->center.y),
+        .z = self->center.z + factor * (s->center.z - self->center.z),
+    };
+    self->radius = newRadius;
+}
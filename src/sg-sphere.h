@@ -29,4 +29,5 @@ static inline bool sg_sphered_empty(SGSphered *self)
 
 
 void sg_sphered_expand_by(SGSphered *self, SGVec3d *v);
+void sg_sphered_expand_by_sphere(SGSphered *self, SGSphered *s);
 #endif /* SG_SPHERE_H */
@@ -25,6 +25,7 @@
 
 #include "skybox.h"
 #include "fgr-dirs.h"
+#include "gl-state.h"
 
 #define SIZE 1.0f
 
@@ -133,8 +134,8 @@ Skybox *skybox_init(Skybox *self, mat4d projection)
 
 Skybox *skybox_dispose(Skybox *self)
 {
-    glDeleteTextures(1, &self->tex_id);
-    glDeleteBuffers(1, &self->vertex_buffer);
+    gl_state_delete_texture(self->tex_id);
+    gl_state_delete_buffer(self->vertex_buffer);
 #if 0 /*Currently unused*/
     glDeleteBuffers(1, &indices_buffer);
 #endif
@@ -155,9 +156,11 @@ void skybox_set_projection(Skybox *self, mat4d projection)
     mat4 projf;
     glm_mat4d_ucopyf(projection, projf);
 
-    glUseProgram(SHADER(self->shader)->program_id);
+    gl_state_use_program(SHADER(self->shader)->program_id);
     glUniformMatrix4fv(self->shader->projection_matrix, 1, GL_FALSE, projf[0]);
-    glUseProgram(0);
+    /*Uniforms stay with the program, no need to set this one each frame*/
+    glUniform1i(self->shader->texunit, 0);
+    gl_state_count(2);
 }
 
 void skybox_render(Skybox *self)
@@ -165,16 +168,17 @@ void skybox_render(Skybox *self)
     glDepthFunc(GL_LEQUAL);
 
     glEnable(GL_TEXTURE_CUBE_MAP);
-    glUseProgram(SHADER(self->shader)->program_id);
+    gl_state_use_program(SHADER(self->shader)->program_id);
 
     glUniformMatrix4fv(self->shader->view_matrix, 1, GL_FALSE, self->view[0]);
-    glUniform1i(self->shader->texunit, 0);
-
 
-    glBindTexture(GL_TEXTURE_CUBE_MAP, self->tex_id);
+    gl_state_active_texture(GL_TEXTURE0);
+    gl_state_bind_texture(GL_TEXTURE_CUBE_MAP, self->tex_id);
 
-    glEnableVertexAttribArray(self->shader->position);
-    glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer);
+    /*Not a vertex array object of a mesh*/
+    gl_state_bind_vertex_array(0);
+    gl_state_enable_attrib(self->shader->position);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->vertex_buffer);
     glVertexAttribPointer(
         self->shader->position,
         3,
@@ -193,8 +197,8 @@ void skybox_render(Skybox *self)
     glDrawArrays(GL_TRIANGLES, 0, 6*6);
 #endif
 //    glDisableVertexAttribArray(self->pos_attr);
-    glUseProgram(0);
     glDepthFunc(GL_LESS);
+    gl_state_count(6);
 }
 
 bool skybox_load_textures(Skybox *self)
@@ -204,7 +208,7 @@ bool skybox_load_textures(Skybox *self)
     GLenum internal_format;
 
     glGenTextures(1, &(self->tex_id));
-    glBindTexture(GL_TEXTURE_CUBE_MAP, self->tex_id);
+    gl_state_bind_texture(GL_TEXTURE_CUBE_MAP, self->tex_id);
 
     for(int i = 0; i < 6; i++){
         img = IMG_Load(faces[i]);
@@ -255,7 +259,7 @@ bail:
 
         SDL_FreeSurface(img);
     }
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    gl_state_bind_texture(GL_TEXTURE_CUBE_MAP, 0);
     return true;
 }
 
@@ -263,7 +267,7 @@ void skybox_prepare_vbo(Skybox *self)
 {
 
     glGenBuffers(1, &(self->vertex_buffer));
-    glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, self->vertex_buffer);
     glBufferData(
         GL_ARRAY_BUFFER,
         sizeof(vertices),
@@ -9,6 +9,7 @@
 #define GL_GLEXT_PROTOTYPES
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <cglm/cglm.h>
 #if USE_GLES
@@ -25,6 +26,10 @@
 #include "cglm/mat4d.h"
 #include "mesh.h"
 #include "frustum-ext.h"
+#include "culler.h"
+#include "gl-state.h"
+#include "render-queue.h"
+#include "mesh-lod.h"
 
 #if ENABLE_DEBUG_TRIANGLE
 #include "debug-triangle.h"
@@ -53,18 +58,47 @@ TerrainViewer *terrain_viewer_init(TerrainViewer *self, float obliqueness)
     if(!self->plane)
         return NULL;
 
+    if(!gl_state_init())
+        printf("Vertex array objects unavailable, binding buffers for each batch\n");
+
     self->shader = basic_shader_new();
     if(!self->shader){
         printf("Couldn't create mandatory BasicShader, bailing out\n");
         return NULL;
     }
 
+    self->culler = culler_new();
+    if(!self->culler)
+        return NULL;
+
+    self->queue = render_queue_new();
+    if(!self->queue)
+        return NULL;
+
+    self->range_controller = range_controller_new();
+    if(!self->range_controller)
+        return NULL;
+
+#if USE_TILE_PREFETCH
+    self->prefetcher = tile_prefetcher_new();
+    if(!self->prefetcher)
+        return NULL;
+#endif
+
     /*TODO: Pack that up into camera/plane class*/
     /*FG seems to be using fov:55° and far:15km*/
     self->fov_rad = glm_rad(60.0);
     self->near_plane= 1.0;
+    self->obliqueness = obliqueness;
     glm_mat4d_identity(self->projection);
-    glm_perspectived(self->fov_rad, 800.0/600.0, self->near_plane, 10000.0, self->projection);
+    glm_perspectived(self->fov_rad, 800.0/600.0, self->near_plane,
+        self->range_controller->far_plane, self->projection
+    );
+    self->lod_scale = 600.0 / (2.0 * tan(self->fov_rad / 2.0));
+#if USE_OCCLUSION_CULLING
+    if(!culler_set_occlusion(self->culler, true, self->fov_rad))
+        printf("Couldn't enable occlusion culling, going on without\n");
+#endif
 
     self->skybox = skybox_new(self->projection);
     /* Make the horizon higher than the default half screen
@@ -91,6 +125,18 @@ TerrainViewer *terrain_viewer_dispose(TerrainViewer *self)
         skybox_free(self->skybox);
     if(self->shader)
         basic_shader_free(self->shader);
+    if(self->culler)
+        culler_free(self->culler);
+    if(self->queue)
+        render_queue_free(self->queue);
+    if(self->range_controller)
+        range_controller_free(self->range_controller);
+    if(self->meshes)
+        free(self->meshes);
+#if USE_TILE_PREFETCH
+    if(self->prefetcher)
+        tile_prefetcher_free(self->prefetcher);
+#endif
     if(self->plane)
         plane_free(self->plane);
 #if ENABLE_DEBUG_TRIANGLE
@@ -120,9 +166,55 @@ void terrain_viewer_update_plane(TerrainViewer *self, double lat, double lon, do
     self->dirty = true;
 }
 
+/*The skybox is drawn at the far plane whatever its distance, it's left as is*/
+static void terrain_viewer_set_far_plane(TerrainViewer *self, double far_plane)
+{
+    glm_mat4d_identity(self->projection);
+    glm_perspectived(self->fov_rad, 800.0/600.0, self->near_plane, far_plane, self->projection);
+    self->projection[2][1] = self->obliqueness;
+    self->dirty = true;
+}
+
+/* Height of the aircraft above the ground under it, NAN until a tile
+ * is there. The ground is taken at the center of the closest cell,
+ * which is within its relief: enough to tell a low pass from a cruise.
+ * Centers are close enough for the Earth radius to be the same.*/
+static double terrain_viewer_get_agl(TerrainViewer *self)
+{
+    CullerSpheres *cells;
+    SGVec3d *c;
+    double dx, dy, dz, d, best;
+    size_t closest;
+
+    cells = &self->culler->cell_bounds;
+    best = INFINITY;
+    closest = 0;
+    for(size_t i = 0; i < cells->n; i++){
+        c = &cells->centers[i];
+        dx = c->x - self->plane->X;
+        dy = c->y - self->plane->Y;
+        dz = c->z - self->plane->Z;
+        d = dx*dx + dy*dy + dz*dz;
+        if(d < best){
+            best = d;
+            closest = i;
+        }
+    }
+    if(!cells->n)
+        return NAN;
+
+    c = &cells->centers[closest];
+    return sqrt(self->plane->X * self->plane->X + self->plane->Y * self->plane->Y + self->plane->Z * self->plane->Z)
+         - sqrt(c->x * c->x + c->y * c->y + c->z * c->z);
+}
+
 void terrain_viewer_frame(TerrainViewer *self)
 {
     SGBucket **buckets;
+    Mesh **meshes;
+    size_t n;
+    CullerItem *item;
+    GLStateStats gl_stats;
 
 #if ENABLE_DEBUG_TRIANGLE
     debug_triangle_render(self->triangle);
@@ -142,6 +234,9 @@ void terrain_viewer_frame(TerrainViewer *self)
 //        glm_rotate_x(self->skybox->view, glm_rad(self->plane->pitch), self->skybox->view);
     }
 
+    if(range_controller_update(self->range_controller, terrain_viewer_get_agl(self)))
+        terrain_viewer_set_far_plane(self, self->range_controller->far_plane);
+
     /* TODO: refactor this to be relying on plane/camera dirtyness?
      * this double self+plane dirty flags are confusing
      * */
@@ -163,17 +258,59 @@ void terrain_viewer_frame(TerrainViewer *self)
     glEnable(GL_DEPTH_TEST);   // skybox should be drawn behind anything else
 
 
-    buckets = tile_manager_get_tiles(tile_manager_get_instance(), &(self->plane->geopos), 10000); /*10 km*/
-    glUseProgram(SHADER(self->shader)->program_id);
+    buckets = tile_manager_get_tiles(tile_manager_get_instance(), &(self->plane->geopos),
+        self->range_controller->range
+    );
+#if USE_TILE_PREFETCH
+    /*Fills the slots left by the current tiles with the next ones*/
+    tile_prefetcher_add_fix(self->prefetcher, &(self->plane->geopos),
+        self->plane->heading, SDL_GetTicks() / 1000.0
+    );
+    tile_prefetcher_predict(self->prefetcher, self->range_controller->range);
+    tile_manager_prefetch(tile_manager_get_instance(), self->prefetcher);
+#endif
+    memset(&self->stats, 0, sizeof(MeshRenderStats));
+    gl_state_reset_stats();
+    for(n = 0; buckets[n] != NULL; n++)
+        ;
+    if(n > self->a_meshes){
+        meshes = realloc(self->meshes, sizeof(Mesh*) * n);
+        if(!meshes)
+            return;
+        self->meshes = meshes;
+        self->a_meshes = n;
+    }
+    meshes = self->meshes;
+    n = 0;
     for(int i = 0; buckets[i] != NULL; i++){
-        Mesh *iter;
-        for(iter = sg_bucket_get_mesh(buckets[i]); iter != NULL; iter = iter->next){
-            mesh_render_buffer(iter, self->shader, self->projection_view, self->fplanes, self->frustrum_bs);
-        }
+        meshes[n] = sg_bucket_get_mesh(buckets[i]);
+        /*Tiles are uploaded the first time they are seen*/
+        if(meshes[n] && mesh_prepare(meshes[n], &self->stats))
+            n++;
+    }
+    culler_set_meshes(self->culler, meshes, n);
+    culler_cull(self->culler, self->projection_view,
+        &(SGVec3d){self->plane->X, self->plane->Y, self->plane->Z}
+    );
 
+    self->stats.cells = self->culler->n_visible_cells;
+    /* Groups of all tiles and their accessories are drawn together,
+     * sorted by state, instead of mesh after mesh*/
+    render_queue_clear(self->queue);
+    for(size_t i = 0; i < self->culler->n_visible; i++){
+        item = &self->culler->items[self->culler->visible[i]];
+        render_queue_push(self->queue, self->shader, item->mesh, item->group,
+            vgroup_select_lod(item->group, self->culler->distances[i],
+                self->lod_scale, self->range_controller->lod_error
+            )
+        );
     }
-    glUseProgram(0);
+    render_queue_flush(self->queue, self->projection_view, &self->stats);
 
     skybox_render(self->skybox);
+
+    gl_state_get_stats(&gl_stats);
+    self->stats.gl_calls = gl_stats.calls;
+    self->stats.gl_skipped = gl_stats.skipped;
 }
 
@@ -14,6 +14,12 @@
 #include "mesh.h"
 #include "plane.h"
 #include "skybox.h"
+#include "culler.h"
+#include "render-queue.h"
+#include "range-controller.h"
+#if USE_TILE_PREFETCH
+#include "tile-prefetcher.h"
+#endif
 
 #if ENABLE_DEBUG_TRIANGLE
 #include "debug-triangle.h"
@@ -21,17 +27,27 @@
 #include "debug-cube.h"
 #endif
 
-
 typedef struct{
     BasicShader *shader;
     Plane *plane; /*This is more a camera*/
 
     Skybox *skybox; /*Might get rid of it*/
+    Culler *culler;
+    RenderQueue *queue;
+    /*Range, far plane and levels of detail, see range_controller_add_frame*/
+    RangeController *range_controller;
+    Mesh **meshes; /*Of the current tiles, handed to the culler*/
+    size_t a_meshes;
+#if USE_TILE_PREFETCH
+    TilePrefetcher *prefetcher;
+#endif
 
     bool dirty;
     /*TODO: Put that in  plane/camera class?*/
     float fov_rad;
     float near_plane;
+    float obliqueness;
+    float lod_scale; /*Pixels per meter at 1 m from the camera*/
     /*Matrices*/
     mat4d projection;
     mat4d projection_view;
@@ -40,6 +56,8 @@ typedef struct{
     vec4 fplanes[6]; /*frustrum planes*/
     vec4 frustrum_bs; /*frustrum bounding sphere*/
 
+    MeshRenderStats stats; /*What the last frame has submitted*/
+
 #if ENABLE_DEBUG_TRIANGLE
     DebugTriangle *triangle;
 #elif ENABLE_DEBUG_CUBE
@@ -0,0 +1,257 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#define GL_GLEXT_PROTOTYPES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#if USE_GLES
+#include <SDL2/SDL_opengles2.h>
+#include <SDL_opengles2_gl2ext.h>
+#else
+#include <SDL2/SDL_opengl.h>
+#include <SDL2/SDL_opengl_glext.h>
+#endif
+
+#include "texture-atlas.h"
+#include "gl-state.h"
+
+/**
+ * TextureAtlas: all terrain material textures in a single GL texture.
+ *
+ * Each image is resampled to TEXTURE_ATLAS_TILE_SIZE texels and put in
+ * its own layer: a layer of a GL_TEXTURE_2D_ARRAY on desktop GL, a slot
+ * of a plain texture on GLES2. Groups using the atlas carry the layer as
+ * a third texture coordinate, and can all be drawn without binding
+ * another texture.
+ */
+
+/*Rows of slots needed to hold TEXTURE_ATLAS_MAX_LAYERS*/
+#define TEXTURE_ATLAS_ROWS ((TEXTURE_ATLAS_MAX_LAYERS + TEXTURE_ATLAS_SLOTS_PER_ROW - 1) / TEXTURE_ATLAS_SLOTS_PER_ROW)
+
+TextureAtlas *texture_atlas_new(void)
+{
+    TextureAtlas *rv;
+
+    rv = calloc(1, sizeof(TextureAtlas));
+    if(rv){
+        if(!texture_atlas_init(rv))
+            return texture_atlas_free(rv);
+    }
+    return rv;
+}
+
+/*Desktop GL may have less array layers than needed: at least 64 with
+ * EXT_texture_array, 256 with GL 3.0*/
+static size_t texture_atlas_get_max_layers(void)
+{
+#if !USE_GLES
+    GLint max;
+
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max);
+    if(max > 0 && max < TEXTURE_ATLAS_MAX_LAYERS){
+        printf("%s: GL only has %d layers, some textures will be missing\n", __FUNCTION__, max);
+        return max;
+    }
+#endif
+    return TEXTURE_ATLAS_MAX_LAYERS;
+}
+
+TextureAtlas *texture_atlas_init(TextureAtlas *self)
+{
+    self->max_layers = texture_atlas_get_max_layers();
+    glGenTextures(1, &(self->id));
+    gl_state_bind_texture(TEXTURE_ATLAS_TARGET, self->id);
+#if USE_GLES
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+        TEXTURE_ATLAS_SLOT_SIZE * TEXTURE_ATLAS_SLOTS_PER_ROW,
+        TEXTURE_ATLAS_SLOT_SIZE * TEXTURE_ATLAS_ROWS,
+        0, GL_RGBA, GL_UNSIGNED_BYTE, NULL
+    );
+    /*Wrapping is done in the shader, within slots*/
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+#else
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA,
+        TEXTURE_ATLAS_SLOT_SIZE, TEXTURE_ATLAS_SLOT_SIZE, self->max_layers,
+        0, GL_RGBA, GL_UNSIGNED_BYTE, NULL
+    );
+#endif
+    /*Same as standalone textures*/
+    glTexParameteri(TEXTURE_ATLAS_TARGET, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(TEXTURE_ATLAS_TARGET, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl_state_bind_texture(TEXTURE_ATLAS_TARGET, 0);
+
+    if(glGetError() != GL_NO_ERROR){
+        printf("%s: Couldn't allocate atlas storage\n", __FUNCTION__);
+        return NULL;
+    }
+    return self;
+}
+
+TextureAtlas *texture_atlas_dispose(TextureAtlas *self)
+{
+    for(int i = 0; i < self->n_layers; i++)
+        free(self->files[i]);
+    if(self->id)
+        gl_state_delete_texture(self->id);
+    return self;
+}
+
+TextureAtlas *texture_atlas_free(TextureAtlas *self)
+{
+    texture_atlas_dispose(self);
+    free(self);
+    return NULL;
+}
+
+/**
+ * @brief Gets the layer holding the image @p filename, loading it in
+ * the next free layer if needed.
+ *
+ * @param self a TextureAtlas
+ * @param filename The image to look for
+ * @return The layer, -1 if the image couldn't be loaded or the
+ * atlas is full.
+ */
+int texture_atlas_get_layer(TextureAtlas *self, const char *filename)
+{
+    SDL_Surface *img, *rgba;
+    bool rv;
+
+    for(int i = 0; i < self->n_layers; i++){
+        if(!strcmp(self->files[i], filename))
+            return i;
+    }
+
+    if(self->n_layers == self->max_layers){
+        printf("%s: Texture atlas full, can't load %s\n", __FUNCTION__, filename);
+        return -1;
+    }
+
+    img = IMG_Load(filename);
+    if(!img){
+        printf("SDL_Image couldn't load %s: %s\n",filename,SDL_GetError());
+        return -1;
+    }
+    rgba = SDL_ConvertSurfaceFormat(img, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(img);
+    if(!rgba){
+        printf("Couldn't convert %s to RGBA: %s\n",filename,SDL_GetError());
+        return -1;
+    }
+
+    rv = texture_atlas_set_layer(self, self->n_layers, rgba->pixels, rgba->w, rgba->h, rgba->pitch);
+    SDL_FreeSurface(rgba);
+    if(!rv)
+        return -1;
+
+    self->files[self->n_layers] = strdup(filename);
+    return self->n_layers++;
+}
+
+static inline int wrap(int v, int n)
+{
+    v %= n;
+    return v < 0 ? v + n : v;
+}
+
+/* Samples @p src at (@p x, @p y) texel coordinates, bilinearly,
+ * wrapping around edges*/
+static void sample(const uint8_t *src, int w, int h, int pitch, float x, float y, float *texel)
+{
+    int x0, y0;
+    float fx, fy;
+    const uint8_t *t00, *t10, *t01, *t11;
+
+    x0 = floorf(x);
+    y0 = floorf(y);
+    fx = x - x0;
+    fy = y - y0;
+
+    t00 = src + wrap(y0, h) * pitch + wrap(x0, w) * 4;
+    t10 = src + wrap(y0, h) * pitch + wrap(x0 + 1, w) * 4;
+    t01 = src + wrap(y0 + 1, h) * pitch + wrap(x0, w) * 4;
+    t11 = src + wrap(y0 + 1, h) * pitch + wrap(x0 + 1, w) * 4;
+    for(int c = 0; c < 4; c++){
+        texel[c] += (t00[c] * (1.0f - fx) + t10[c] * fx) * (1.0f - fy)
+                  + (t01[c] * (1.0f - fx) + t11[c] * fx) * fy;
+    }
+}
+
+/**
+ * @brief Resamples a RGBA image into a layer.
+ *
+ * The image is scaled to TEXTURE_ATLAS_TILE_SIZE texels. Padding
+ * texels, if any, repeat the image as GL_REPEAT would.
+ *
+ * @param self a TextureAtlas
+ * @param layer The layer to fill
+ * @param rgba Pixels, 4 bytes each
+ * @param w Image width
+ * @param h Image height
+ * @param pitch Bytes per image row
+ * @return true on success, false on failure
+ */
+bool texture_atlas_set_layer(TextureAtlas *self, int layer, const uint8_t *rgba, int w, int h, int pitch)
+{
+    uint8_t *pixels, *dst;
+    float sx, sy, texel[4];
+    int nx, ny;
+
+    pixels = malloc(TEXTURE_ATLAS_SLOT_SIZE * TEXTURE_ATLAS_SLOT_SIZE * 4);
+    if(!pixels)
+        return false;
+
+    sx = w / (float)TEXTURE_ATLAS_TILE_SIZE;
+    sy = h / (float)TEXTURE_ATLAS_TILE_SIZE;
+    /*When shrinking, average over the area covered by the texel*/
+    nx = ceilf(sx);
+    ny = ceilf(sy);
+
+    dst = pixels;
+    for(int y = 0; y < TEXTURE_ATLAS_SLOT_SIZE; y++){
+        for(int x = 0; x < TEXTURE_ATLAS_SLOT_SIZE; x++){
+            texel[0] = texel[1] = texel[2] = texel[3] = 0.0f;
+            for(int j = 0; j < ny; j++){
+                for(int i = 0; i < nx; i++){
+                    sample(rgba, w, h, pitch,
+                        (x - TEXTURE_ATLAS_PADDING + (i + 0.5f) / nx) * sx - 0.5f,
+                        (y - TEXTURE_ATLAS_PADDING + (j + 0.5f) / ny) * sy - 0.5f,
+                        texel
+                    );
+                }
+            }
+            for(int c = 0; c < 4; c++)
+                *dst++ = texel[c] / (nx * ny) + 0.5f;
+        }
+    }
+
+    gl_state_bind_texture(TEXTURE_ATLAS_TARGET, self->id);
+#if USE_GLES
+    glTexSubImage2D(GL_TEXTURE_2D, 0,
+        (layer % TEXTURE_ATLAS_SLOTS_PER_ROW) * TEXTURE_ATLAS_SLOT_SIZE,
+        (layer / TEXTURE_ATLAS_SLOTS_PER_ROW) * TEXTURE_ATLAS_SLOT_SIZE,
+        TEXTURE_ATLAS_SLOT_SIZE, TEXTURE_ATLAS_SLOT_SIZE,
+        GL_RGBA, GL_UNSIGNED_BYTE, pixels
+    );
+#else
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
+        0, 0, layer,
+        TEXTURE_ATLAS_SLOT_SIZE, TEXTURE_ATLAS_SLOT_SIZE, 1,
+        GL_RGBA, GL_UNSIGNED_BYTE, pixels
+    );
+#endif
+    gl_state_bind_texture(TEXTURE_ATLAS_TARGET, 0);
+
+    free(pixels);
+    return true;
+}
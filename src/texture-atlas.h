@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+#include <stdbool.h>
+#include <stdint.h>
+#if USE_GLES
+#include <SDL2/SDL_opengles2.h>
+#else
+#include <SDL2/SDL_opengl.h>
+#endif
+
+#if USE_GLES
+/* GLES2 has no texture arrays: layers are slots of a single 2048x2048
+ * texture, 16x16 of them. Slots are padded with texels wrapped from the
+ * opposite edge so that linear filtering doesn't bleed from neighbours.
+ * These values are hardcoded in shaders/gles/atlas-fragment.gl*/
+#define TEXTURE_ATLAS_TILE_SIZE 112
+#define TEXTURE_ATLAS_PADDING 8
+#define TEXTURE_ATLAS_SLOTS_PER_ROW 16
+#define TEXTURE_ATLAS_MAX_LAYERS (TEXTURE_ATLAS_SLOTS_PER_ROW * TEXTURE_ATLAS_SLOTS_PER_ROW)
+#define TEXTURE_ATLAS_TARGET GL_TEXTURE_2D
+#else
+#define TEXTURE_ATLAS_TILE_SIZE 256
+#define TEXTURE_ATLAS_PADDING 0
+/*Enough for all the images of texture.c, see N_UNIQUE_FILES*/
+#define TEXTURE_ATLAS_MAX_LAYERS 176
+#define TEXTURE_ATLAS_TARGET GL_TEXTURE_2D_ARRAY
+#endif
+#define TEXTURE_ATLAS_SLOT_SIZE (TEXTURE_ATLAS_TILE_SIZE + 2*TEXTURE_ATLAS_PADDING)
+
+typedef struct{
+    GLuint id;
+    char *files[TEXTURE_ATLAS_MAX_LAYERS]; /*Image loaded in each layer*/
+    size_t n_layers;
+    size_t max_layers; /*TEXTURE_ATLAS_MAX_LAYERS, unless the GL can't*/
+}TextureAtlas;
+
+TextureAtlas *texture_atlas_new(void);
+TextureAtlas *texture_atlas_init(TextureAtlas *self);
+TextureAtlas *texture_atlas_dispose(TextureAtlas *self);
+TextureAtlas *texture_atlas_free(TextureAtlas *self);
+
+int texture_atlas_get_layer(TextureAtlas *self, const char *filename);
+bool texture_atlas_set_layer(TextureAtlas *self, int layer, const uint8_t *rgba, int w, int h, int pitch);
+#endif /* TEXTURE_ATLAS_H */
@@ -15,12 +15,20 @@
 
 #include "texture.h"
 #include "fgr-dirs.h"
+#include "gl-state.h"
 
 #define N_NAMES 260
 #define N_UNIQUE_FILES 169
 
+#if USE_TEXTURE_ATLAS && TEXTURE_ATLAS_MAX_LAYERS < N_UNIQUE_FILES
+#error "The texture atlas can't hold all the images"
+#endif
+
 static Texture *_store[256]; /*TODO: Array->Hash or embed in meshes*/
 static unsigned char _ntextures = 0;
+#if USE_TEXTURE_ATLAS
+static TextureAtlas *_atlas = NULL; /*Holds the images of all textures*/
+#endif
 
 static char *files[] = {
     TEX_DIR"/Terrain/asphalt.png",TEX_DIR"/Terrain/gravel.png",TEX_DIR"/Terrain/water-lake.png",
@@ -207,6 +215,10 @@ void texture_store_shutdown(void)
 {
     for(int i = 0; i < _ntextures; i++)
         texture_free(_store[i]);
+#if USE_TEXTURE_ATLAS
+    if(_atlas)
+        _atlas = texture_atlas_free(_atlas);
+#endif
 }
 
 Texture *texture_new(const char *filename, const char *name)
@@ -238,7 +250,9 @@ void texture_free(Texture *self)
         free(self->filename);
     if(self->name)
         free(self->name);
-    glDeleteTextures(1, &self->id);
+#if !USE_TEXTURE_ATLAS
+    gl_state_delete_texture(self->id);
+#endif
     free(self);
 }
 
@@ -248,6 +262,20 @@ bool texture_load(Texture *self)
     GLenum internal_format;
     GLenum format;
 
+#if USE_TEXTURE_ATLAS
+    /*Textures sharing the same image share the same layer*/
+    if(!_atlas){
+        _atlas = texture_atlas_new();
+        if(!_atlas)
+            return false;
+    }
+    self->layer = texture_atlas_get_layer(_atlas, self->filename);
+    if(self->layer < 0)
+        return false;
+    self->id = _atlas->id;
+    return true;
+#endif
+
     img = IMG_Load(self->filename);
     if(!img){
         printf("SDL_Image couldn't load %s: %s\n",self->filename,SDL_GetError());
@@ -255,7 +283,7 @@ bool texture_load(Texture *self)
     }
 
     glGenTextures(1, &(self->id));
-    glBindTexture(GL_TEXTURE_2D, self->id);
+    gl_state_bind_texture(GL_TEXTURE_2D, self->id);
 
     if(img->format->BytesPerPixel == 3){
         internal_format = GL_RGB;
@@ -288,7 +316,7 @@ bail:
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    gl_state_bind_texture(GL_TEXTURE_2D, 0);
 
     SDL_FreeSurface(img);
     return true;
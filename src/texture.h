@@ -14,8 +14,17 @@
 #include <SDL2/SDL_opengl.h>
 #endif
 
+#if USE_TEXTURE_ATLAS
+#include "texture-atlas.h"
+/*What textures must be bound to*/
+#define TEXTURE_TARGET TEXTURE_ATLAS_TARGET
+#else
+#define TEXTURE_TARGET GL_TEXTURE_2D
+#endif
+
 typedef struct{
     GLuint id;
+    int layer; /*Layer in the atlas, 0 when not using one*/
     char *name;
     char *filename;
 }Texture;
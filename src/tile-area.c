@@ -0,0 +1,297 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tile-area.h"
+
+/**
+ * TileArea: the buckets within range of the aircraft, and what changes
+ * when it moves.
+ *
+ * Buckets are rows of SG_BUCKET_SPAN degrees of latitude, cut in
+ * columns whose width grows with the latitude (see sg_bucket_span).
+ * For each row crossing the area, the widest longitude extent of the
+ * area within the row gives the columns to take. That makes the
+ * enumeration exact whatever the range, including near the poles.
+ *
+ * The set is computed for the whole bucket under the aircraft (all the
+ * buckets within range of any point of it), so that it only has to be
+ * recomputed when the aircraft goes into another bucket, or when the
+ * range changes. Each update tells which buckets came in and went out.
+ */
+
+TileArea *tile_area_new(void)
+{
+    TileArea *rv;
+
+    rv = calloc(1, sizeof(TileArea));
+    if(rv){
+        if(!tile_area_init(rv))
+            return tile_area_free(rv);
+    }
+    return rv;
+}
+
+TileArea *tile_area_init(TileArea *self)
+{
+    memset(self, 0, sizeof(TileArea));
+    return self;
+}
+
+TileArea *tile_area_dispose(TileArea *self)
+{
+    tile_list_dispose(&self->current);
+    tile_list_dispose(&self->added);
+    tile_list_dispose(&self->removed);
+    tile_list_dispose(&self->next);
+    return self;
+}
+
+TileArea *tile_area_free(TileArea *self)
+{
+    tile_area_dispose(self);
+    free(self);
+    return NULL;
+}
+
+void tile_list_dispose(TileList *self)
+{
+    if(self->buckets)
+        free(self->buckets);
+    memset(self, 0, sizeof(TileList));
+}
+
+static bool tile_list_append(TileList *self, SGBucket *bucket)
+{
+    SGBucket *tmp;
+    size_t allocated;
+
+    if(self->n == self->allocated){
+        allocated = self->allocated ? self->allocated * 2 : 16;
+        tmp = realloc(self->buckets, sizeof(SGBucket) * allocated);
+        if(!tmp)
+            return false;
+        self->buckets = tmp;
+        self->allocated = allocated;
+    }
+    self->buckets[self->n++] = *bucket;
+    return true;
+}
+
+/* Half the longitude extent (radians), at latitude @p lat, of the
+ * circle of angular radius @p radius around a point at latitude @p
+ * clat*/
+static double tile_area_lon_extent(double clat, double lat, double radius)
+{
+    double den, x;
+
+    den = cos(clat) * cos(lat);
+    if(den < 1e-12)
+        return M_PI; /*Around a pole*/
+    x = (cos(radius) - sin(clat) * sin(lat)) / den;
+    if(x <= -1.0)
+        return M_PI;
+    if(x >= 1.0)
+        return 0.0;
+    return acos(x);
+}
+
+/* Latitude, within [@p min, @p max], where the circle of angular radius
+ * @p radius around a point at latitude @p clat is the widest.*/
+static double tile_area_widest_lat(double clat, double radius, double min, double max)
+{
+    double s;
+
+    s = cos(radius) > 1e-12 ? sin(clat) / cos(radius) : copysign(1.0, clat);
+    s = asin(fmax(-1.0, fmin(s, 1.0)));
+    return fmax(min, fmin(s, max));
+}
+
+/* Appends to @p list the buckets within @p radius (radians) of the
+ * area [@p lat0, @p lat1]x[@p lon0, @p lon1] (radians).*/
+static bool tile_area_enumerate(double lat0, double lat1, double lon0, double lon1, double radius, TileList *list)
+{
+    SGBucket bucket;
+    double min_lat, max_lat;
+    double lo, hi, extent, span;
+    double west, east, lat;
+    int first_row, last_row;
+    int first_col, last_col, ncols;
+
+    list->n = 0;
+    min_lat = rad2deg(lat0 - radius);
+    max_lat = rad2deg(lat1 + radius);
+    first_row = (int)floor(fmax(min_lat, -90.0) / SG_BUCKET_SPAN);
+    last_row = (int)ceil(fmin(max_lat, 90.0) / SG_BUCKET_SPAN) - 1;
+    first_row = first_row < -720 ? -720 : first_row;
+    last_row = last_row > 719 ? 719 : last_row;
+
+    for(int row = first_row; row <= last_row; row++){
+        lo = fmax(deg2rad(row * SG_BUCKET_SPAN), lat0 - radius);
+        hi = fmin(deg2rad((row + 1) * SG_BUCKET_SPAN), lat1 + radius);
+        if(lo > hi)
+            continue;
+        /* The extent only grows toward the widest latitude of each
+         * circle: the widest over the row and the centers is on an edge
+         * of one or the other*/
+        extent = 0.0;
+        for(int i = 0; i < 2; i++){
+            lat = i ? lat1 : lat0;
+            extent = fmax(extent, tile_area_lon_extent(lat,
+                tile_area_widest_lat(lat, radius, lo, hi), radius
+            ));
+            lat = i ? hi : lo;
+            extent = fmax(extent, tile_area_lon_extent(
+                tile_area_widest_lat(lat, radius, lat0, lat1), lat, radius
+            ));
+        }
+
+        lat = (row + 0.5) * SG_BUCKET_SPAN;
+        sg_bucket_set(&bucket, 0.0, lat);
+        span = sg_bucket_get_width(&bucket);
+        ncols = (int)round(360.0 / span);
+        west = rad2deg(lon0 - extent);
+        east = rad2deg(lon1 + extent);
+        first_col = (int)floor((west + 180.0) / span);
+        last_col = (int)floor((east + 180.0) / span);
+        if(extent >= M_PI || last_col - first_col + 1 >= ncols){
+            first_col = 0;
+            last_col = ncols - 1;
+        }
+        for(int col = first_col; col <= last_col; col++){
+            sg_bucket_set(&bucket, -180.0 + ((col % ncols + ncols) % ncols + 0.5) * span, lat);
+            if(!tile_list_append(list, &bucket))
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Lists every bucket crossing a circle on the ground.
+ *
+ * @param center Center of the circle
+ * @param radius Radius of the circle, in meters
+ * @param list Where to put the buckets, replacing its content
+ * @return true on success, false on failure (out of memory)
+ */
+bool tile_area_circle(GeoLocation *center, double radius, TileList *list)
+{
+    double lat, lon;
+
+    lat = deg2rad(center->latitude);
+    lon = deg2rad(center->longitude);
+    return tile_area_enumerate(lat, lat, lon, lon, radius / EARTH_RADIUS_M, list);
+}
+
+/**
+ * @brief Lists every bucket within @p range of any point of @p bucket,
+ * including @p bucket itself.
+ *
+ * This is what tile_area_circle would give for any location within
+ * @p bucket, put together.
+ *
+ * @param bucket The bucket in the middle
+ * @param range Distance, in meters
+ * @param list Where to put the buckets, replacing its content
+ * @return true on success, false on failure (out of memory)
+ */
+bool tile_area_around(SGBucket *bucket, double range, TileList *list)
+{
+    double lat, lon, width;
+
+    lat = bucket->lat + bucket->y * SG_BUCKET_SPAN;
+    lon = sg_bucket_get_center_lon(bucket);
+    width = sg_bucket_get_width(bucket);
+    return tile_area_enumerate(
+        deg2rad(lat), deg2rad(lat + SG_BUCKET_SPAN),
+        deg2rad(lon - width / 2.0), deg2rad(lon + width / 2.0),
+        range / EARTH_RADIUS_M, list
+    );
+}
+
+static int tile_area_compare(const void *a, const void *b)
+{
+    long int ia = sg_bucket_gen_index((SGBucket*)a);
+    long int ib = sg_bucket_gen_index((SGBucket*)b);
+
+    if(ia != ib)
+        return ia < ib ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Follows the aircraft.
+ *
+ * The buckets within range are only listed again when the aircraft
+ * goes into another bucket or the range changes. self->added and
+ * self->removed then tell what has changed, they are empty otherwise.
+ *
+ * @param self a TileArea
+ * @param location Where the aircraft is
+ * @param range Distance, in meters, up to which buckets are needed
+ * @return true if the set of buckets has changed, false otherwise
+ * (including when out of memory, leaving the previous set)
+ */
+bool tile_area_update(TileArea *self, GeoLocation *location, double range)
+{
+    SGBucket center;
+    TileList tmp;
+    size_t i, j;
+    int cmp;
+
+    self->added.n = 0;
+    self->removed.n = 0;
+
+    sg_bucket_set(&center, location->longitude, location->latitude);
+    if(self->valid && range == self->range && sg_bucket_equals(&center, &self->center))
+        return false;
+
+    if(!tile_area_around(&center, range, &self->next))
+        return false;
+    qsort(self->next.buckets, self->next.n, sizeof(SGBucket), tile_area_compare);
+
+    /*Both sorted: a merge tells what has come and gone*/
+    for(i = 0, j = 0; i < self->current.n || j < self->next.n;){
+        if(i == self->current.n)
+            cmp = 1;
+        else if(j == self->next.n)
+            cmp = -1;
+        else
+            cmp = tile_area_compare(&self->current.buckets[i], &self->next.buckets[j]);
+
+        if(cmp < 0){
+            if(!tile_list_append(&self->removed, &self->current.buckets[i]))
+                goto fail;
+            i++;
+        }else if(cmp > 0){
+            if(!tile_list_append(&self->added, &self->next.buckets[j]))
+                goto fail;
+            j++;
+        }else{
+            i++;
+            j++;
+        }
+    }
+
+    tmp = self->current;
+    self->current = self->next;
+    self->next = tmp;
+    self->center = center;
+    self->range = range;
+    self->valid = true;
+    return self->added.n || self->removed.n;
+
+fail:
+    self->added.n = 0;
+    self->removed.n = 0;
+    return false;
+}
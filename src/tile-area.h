@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef TILE_AREA_H
+#define TILE_AREA_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bucket.h"
+#include "geo-location.h"
+
+/*Growable array of buckets, coordinates only*/
+typedef struct{
+    SGBucket *buckets;
+    size_t n;
+    size_t allocated;
+}TileList;
+
+typedef struct{
+    /*Buckets within range of the aircraft's bucket, by index*/
+    TileList current;
+    /*Changes made by the last tile_area_update*/
+    TileList added;
+    TileList removed;
+
+    SGBucket center; /*Where the aircraft was*/
+    double range; /*meters*/
+    bool valid;
+
+    TileList next; /*Scratch*/
+}TileArea;
+
+TileArea *tile_area_new(void);
+TileArea *tile_area_init(TileArea *self);
+TileArea *tile_area_dispose(TileArea *self);
+TileArea *tile_area_free(TileArea *self);
+
+bool tile_area_update(TileArea *self, GeoLocation *location, double range);
+
+bool tile_area_circle(GeoLocation *center, double radius, TileList *list);
+bool tile_area_around(SGBucket *bucket, double range, TileList *list);
+void tile_list_dispose(TileList *self);
+#endif /* TILE_AREA_H */
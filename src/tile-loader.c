@@ -0,0 +1,420 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile-loader.h"
+#include "fg-scenery.h"
+#include "http-download.h"
+#include "tile-store.h"
+
+static TileLoader *instance = NULL;
+
+static int tile_loader_worker(void *data);
+static TileLoader *tile_loader_init(TileLoader *self);
+static void tile_loader_dispose(TileLoader *self);
+
+/**
+ * TileLoader: Loads tile meshes (STG parsing, BTG reading, vertex
+ * deduplication and flattening) on background threads.
+ *
+ * The GL thread asks for a tile with tile_loader_request() and later picks
+ * the results up with tile_loader_collect(). Meshes handed over that way are
+ * finished (mesh_finish has been called) but not prepared: GL resources
+ * are still allocated lazily by the render loop.
+ *
+ * Pending jobs are picked up by priority: tiles needed right now come
+ * first, prefetched ones by the time left before they are needed.
+ */
+
+TileLoader *tile_loader_get_instance(void)
+{
+    if(!instance){
+        instance = calloc(1, sizeof(TileLoader));
+        if(instance && !tile_loader_init(instance)){
+            tile_loader_dispose(instance);
+            free(instance);
+            instance = NULL;
+        }
+    }
+    return instance;
+}
+
+/**
+ * @brief Stops the workers and releases all jobs, loaded or not.
+ *
+ * Must be called from the GL thread as meshes that have been loaded
+ * but never collected will be freed.
+ */
+void tile_loader_shutdown(void)
+{
+    if(instance){
+        tile_loader_dispose(instance);
+        free(instance);
+        instance = NULL;
+    }
+}
+
+static TileLoader *tile_loader_init(TileLoader *self)
+{
+    self->lock = SDL_CreateMutex();
+    self->wakeup = SDL_CreateCond();
+    if(!self->lock || !self->wakeup){
+        printf("Couldn't create tile loader sync primitives: %s\n", SDL_GetError());
+        return NULL;
+    }
+    /*Workers may download missing tiles*/
+    if(!http_download_init())
+        printf("Couldn't set up downloads, missing tiles won't be fetched\n");
+
+    for(int i = 0; i < TILE_LOADER_NTHREADS; i++){
+        self->workers[i] = SDL_CreateThread(tile_loader_worker, "tile-loader", self);
+        if(!self->workers[i]){
+            printf("Couldn't create tile loader thread: %s\n", SDL_GetError());
+            return NULL;
+        }
+    }
+    return self;
+}
+
+static void tile_loader_dispose(TileLoader *self)
+{
+    TileLoaderJob *job, *next;
+
+    if(self->lock){
+        SDL_LockMutex(self->lock);
+        self->quit = true;
+        if(self->wakeup)
+            SDL_CondBroadcast(self->wakeup);
+        SDL_UnlockMutex(self->lock);
+    }
+
+    /*Jobs being worked on will be finished before the workers exit*/
+    for(int i = 0; i < TILE_LOADER_NTHREADS; i++){
+        if(self->workers[i])
+            SDL_WaitThread(self->workers[i], NULL);
+    }
+
+    for(job = self->pending; job != NULL; job = next){
+        next = job->next;
+        tile_loader_job_free(job);
+    }
+    for(job = self->done; job != NULL; job = next){
+        next = job->next;
+        tile_loader_job_free(job);
+    }
+
+    if(self->wakeup)
+        SDL_DestroyCond(self->wakeup);
+    if(self->lock)
+        SDL_DestroyMutex(self->lock);
+}
+
+void tile_loader_job_free(TileLoaderJob *self)
+{
+    if(self->mesh)
+        mesh_free(self->mesh);
+    if(self->data)
+        free(self->data);
+    if(self->path)
+        free(self->path);
+    free(self);
+}
+
+/* Inserts @p job in the pending list, after the jobs of same or lower
+ * priority value. Must be called with the lock held.*/
+static void tile_loader_insert(TileLoader *self, TileLoaderJob *job)
+{
+    TileLoaderJob **iter;
+
+    if(self->pending_tail && self->pending_tail->priority <= job->priority){
+        self->pending_tail->next = job;
+        self->pending_tail = job;
+        return;
+    }
+    for(iter = &self->pending; *iter && (*iter)->priority <= job->priority; iter = &(*iter)->next)
+        ;
+    job->next = *iter;
+    *iter = job;
+    if(!job->next)
+        self->pending_tail = job;
+}
+
+/**
+ * @brief Queues the loading of @p bucket mesh. Returns immediately.
+ *
+ * The job is identified by the bucket index rather than by the bucket
+ * itself: the bucket can be evicted from the TileManager before the
+ * load completes.
+ *
+ * @param self a TileLoader
+ * @param bucket The bucket that needs its mesh
+ * @param priority Seconds before the mesh is needed,
+ * TILE_LOADER_PRIORITY_NOW if it is needed right now. Lowest values are
+ * loaded first.
+ * @return true if the job has been queued, false otherwise.
+ *
+ * @see tile_loader_collect
+ */
+bool tile_loader_request(TileLoader *self, SGBucket *bucket, float priority)
+{
+    TileLoaderJob *job;
+
+    job = calloc(1, sizeof(TileLoaderJob));
+    if(!job)
+        return false;
+    job->index = sg_bucket_gen_index(bucket);
+    job->priority = priority;
+    /*sg_bucket_getfilename uses a static buffer: only call it from here*/
+    job->path = strdup(sg_bucket_getfilename(bucket));
+    if(!job->path){
+        free(job);
+        return false;
+    }
+
+    SDL_LockMutex(self->lock);
+    tile_loader_insert(self, job);
+    SDL_CondSignal(self->wakeup);
+    SDL_UnlockMutex(self->lock);
+
+    return true;
+}
+
+/**
+ * @brief Queues the compression of an evicted tile for the TileStore.
+ * Returns immediately.
+ *
+ * The compressed tile comes back through tile_loader_collect, in a job
+ * flagged as pack, to be given to tile_store_add on the GL thread.
+ *
+ * @param self a TileLoader
+ * @param index sg_bucket_gen_index() of the evicted bucket
+ * @param mesh The bucket mesh, taken over. Its GL objects must have
+ * been released, see mesh_release_gl: the worker frees it.
+ * @return true if the job has been queued, false otherwise (@p mesh is
+ * then left to the caller).
+ */
+bool tile_loader_pack(TileLoader *self, long int index, Mesh *mesh)
+{
+    TileLoaderJob *job;
+
+    job = calloc(1, sizeof(TileLoaderJob));
+    if(!job)
+        return false;
+    job->index = index;
+    job->priority = TILE_LOADER_PRIORITY_PACK;
+    job->pack = true;
+    job->mesh = mesh;
+
+    SDL_LockMutex(self->lock);
+    tile_loader_insert(self, job);
+    SDL_CondSignal(self->wakeup);
+    SDL_UnlockMutex(self->lock);
+
+    return true;
+}
+
+/**
+ * @brief Moves a job that hasn't been picked up yet ahead in the queue.
+ *
+ * Does nothing if the job is already more urgent than @p priority, or
+ * if it is being loaded or done.
+ *
+ * @param self a TileLoader
+ * @param index sg_bucket_gen_index() of the bucket that requested the job
+ * @param priority The new priority, see tile_loader_request
+ * @return true if the job is still pending, false otherwise.
+ *
+ * @see tile_loader_promote_all
+ */
+bool tile_loader_promote(TileLoader *self, long int index, float priority)
+{
+    TileLoaderPromotion promotion = {index, priority};
+
+    return tile_loader_promote_all(self, &promotion, 1) == 1;
+}
+
+static int tile_loader_promotion_cmp(const void *a, const void *b)
+{
+    long int ia = ((const TileLoaderPromotion *)a)->index;
+    long int ib = ((const TileLoaderPromotion *)b)->index;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/*Sorts a job list by priority, keeping the order of equal ones*/
+static TileLoaderJob *tile_loader_sort(TileLoaderJob *list)
+{
+    TileLoaderJob *a, *b, **iter, *slow, *fast;
+
+    if(!list || !list->next)
+        return list;
+    for(slow = list, fast = list->next; fast && fast->next; fast = fast->next->next)
+        slow = slow->next;
+    b = slow->next;
+    slow->next = NULL;
+    a = tile_loader_sort(list);
+    b = tile_loader_sort(b);
+
+    for(iter = &list; a && b; iter = &(*iter)->next){
+        if(a->priority <= b->priority){
+            *iter = a;
+            a = a->next;
+        }else{
+            *iter = b;
+            b = b->next;
+        }
+    }
+    *iter = a ? a : b;
+    return list;
+}
+
+/**
+ * @brief Moves jobs that haven't been picked up yet ahead in the queue,
+ * all at once.
+ *
+ * Same as calling tile_loader_promote for each of @p promotions, but
+ * the queue is locked and walked only once.
+ *
+ * @param self a TileLoader
+ * @param promotions Bucket indexes and their new priority. Sorted by
+ * index on return.
+ * @param n Number of @p promotions
+ * @return The number of @p promotions whose job is still pending.
+ */
+size_t tile_loader_promote_all(TileLoader *self, TileLoaderPromotion *promotions, size_t n)
+{
+    TileLoaderJob **iter, *job, *moved, **moved_tail, *kept;
+    TileLoaderPromotion key, *promotion;
+    size_t rv;
+
+    if(!n)
+        return 0;
+    qsort(promotions, n, sizeof(TileLoaderPromotion), tile_loader_promotion_cmp);
+
+    rv = 0;
+    moved = NULL;
+    moved_tail = &moved;
+    kept = NULL;
+    SDL_LockMutex(self->lock);
+    for(iter = &self->pending; *iter;){
+        job = *iter;
+        promotion = NULL;
+        if(!job->pack){
+            key.index = job->index;
+            promotion = bsearch(&key, promotions, n, sizeof(TileLoaderPromotion), tile_loader_promotion_cmp);
+        }
+        if(promotion)
+            rv++;
+        if(!promotion || job->priority <= promotion->priority){
+            kept = job;
+            iter = &job->next;
+            continue;
+        }
+        *iter = job->next;
+        job->next = NULL;
+        job->priority = promotion->priority;
+        *moved_tail = job;
+        moved_tail = &job->next;
+    }
+    self->pending_tail = kept;
+
+    /*Merge back, after the pending jobs of same priority*/
+    moved = tile_loader_sort(moved);
+    for(iter = &self->pending; moved; iter = &(*iter)->next){
+        if(!*iter || moved->priority < (*iter)->priority){
+            job = moved;
+            moved = moved->next;
+            job->next = *iter;
+            *iter = job;
+            if(!job->next)
+                self->pending_tail = job;
+        }
+    }
+    SDL_UnlockMutex(self->lock);
+
+    return rv;
+}
+
+/**
+ * @brief Takes ownership of all the jobs that have completed since the last
+ * call.
+ *
+ * Must be called from the GL thread. The caller is responsible for
+ * releasing the jobs with tile_loader_job_free() once it has taken
+ * the meshes it is interested in (setting job->mesh to NULL).
+ *
+ * @param self a TileLoader
+ * @return A linked list of finished jobs, NULL if there is none. Jobs
+ * whose loading failed have a NULL mesh.
+ */
+TileLoaderJob *tile_loader_collect(TileLoader *self)
+{
+    TileLoaderJob *rv;
+
+    /*Don't stall the frame if a worker is pushing a result right now*/
+    if(SDL_TryLockMutex(self->lock) != 0)
+        return NULL;
+    rv = self->done;
+    self->done = NULL;
+    SDL_UnlockMutex(self->lock);
+
+    return rv;
+}
+
+static int tile_loader_worker(void *data)
+{
+    TileLoader *self = (TileLoader *)data;
+    TileLoaderJob *job;
+    char *filename;
+    Uint32 start;
+
+    SDL_LockMutex(self->lock);
+    while(!self->quit){
+        if(!self->pending){
+            SDL_CondWait(self->wakeup, self->lock);
+            continue;
+        }
+        job = self->pending;
+        self->pending = job->next;
+        if(!self->pending)
+            self->pending_tail = NULL;
+        job->next = NULL;
+        SDL_UnlockMutex(self->lock);
+
+        if(job->pack){
+            job->data = tile_store_compress(job->mesh, &job->size, &job->raw_size);
+            mesh_free(job->mesh);
+            job->mesh = NULL;
+            SDL_LockMutex(self->lock);
+            job->next = self->done;
+            self->done = job;
+            continue;
+        }
+
+        start = SDL_GetTicks();
+        filename = fg_scenery_get_file(job->path);
+        if(filename){
+            printf("Loading tile %ld in the background: path=%s\n",
+                job->index, filename
+            );
+            job->mesh = mesh_new_from_file(filename);
+            free(filename);
+        }
+        job->duration = SDL_GetTicks() - start;
+        printf("Tile %ld loaded from disk in %d ms\n", job->index, job->duration);
+
+        SDL_LockMutex(self->lock);
+        job->next = self->done;
+        self->done = job;
+    }
+    SDL_UnlockMutex(self->lock);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef TILE_LOADER_H
+#define TILE_LOADER_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+#include "bucket.h"
+#include "mesh.h"
+
+/* Each load uses its own SGBinReader, workers don't share any
+ * state besides the job lists. One core is left to the GL thread
+ * on quad-core boards.
+ * */
+#ifndef TILE_LOADER_NTHREADS
+#define TILE_LOADER_NTHREADS 3
+#endif
+
+/*Priority of the tiles needed right now, see tile_loader_request*/
+#define TILE_LOADER_PRIORITY_NOW 0.0f
+/* Priority of compressing evicted tiles, see tile_loader_pack: after
+ * what is needed now, ahead of most prefetches. That frees memory.*/
+#define TILE_LOADER_PRIORITY_PACK 1.0f
+
+typedef struct _TileLoaderJob{
+    long int index; /*sg_bucket_gen_index() of the requesting bucket*/
+    char *path; /*STG path, relative to TERRAIN_DIR*/
+
+    Mesh *mesh; /*Result: NULL until loaded, or on failure*/
+    /*Pack jobs: mesh to compress, released by the worker*/
+    bool pack;
+    uint8_t *data; /*Result, see tile_store_compress*/
+    size_t size;
+    size_t raw_size;
+    Uint32 duration; /*ms spent loading*/
+    float priority; /*Lowest first: seconds before the tile is needed*/
+
+    struct _TileLoaderJob *next;
+}TileLoaderJob;
+
+typedef struct{
+    long int index; /*sg_bucket_gen_index()*/
+    float priority;
+}TileLoaderPromotion;
+
+typedef struct{
+    SDL_Thread *workers[TILE_LOADER_NTHREADS];
+
+    SDL_mutex *lock;
+    SDL_cond *wakeup;
+
+    /*Protected by lock*/
+    TileLoaderJob *pending; /*Requested, not yet picked up by a worker. By priority*/
+    TileLoaderJob *pending_tail;
+    TileLoaderJob *done; /*Loaded, waiting to be collected by the GL thread*/
+    bool quit;
+}TileLoader;
+
+TileLoader *tile_loader_get_instance(void);
+void tile_loader_shutdown(void);
+
+bool tile_loader_request(TileLoader *self, SGBucket *bucket, float priority);
+bool tile_loader_promote(TileLoader *self, long int index, float priority);
+size_t tile_loader_promote_all(TileLoader *self, TileLoaderPromotion *promotions, size_t n);
+bool tile_loader_pack(TileLoader *self, long int index, Mesh *mesh);
+TileLoaderJob *tile_loader_collect(TileLoader *self);
+
+void tile_loader_job_free(TileLoaderJob *self);
+#endif /* TILE_LOADER_H */
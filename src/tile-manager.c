@@ -8,27 +8,66 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "tile-manager.h"
+#include "tile-loader.h"
 #include "geodesy.h"
 
 static TileManager *instance = NULL;
 
+/**
+ * TileManager: keeps the buckets around the aircraft and their meshes.
+ *
+ * Buckets are found by index in a hash table. What they use, RAM and
+ * GL buffers, is accounted against a byte budget rather than a number
+ * of slots: tiles vary a lot in size. When over budget, the least
+ * recently used buckets are evicted until usage gets down to
+ * TILE_MANAGER_LOW_WATER of the budget, which leaves room for the
+ * next tiles instead of evicting one at each load. Buckets used by the
+ * current frame are never evicted.
+ *
+ * Meshes of evicted buckets go to a TileStore, compressed by the
+ * TileLoader workers. Buckets found there when needed again get their
+ * mesh back from it instead of being loaded. A bucket needed again
+ * before its compression is done is loaded as usual.
+ */
+
 static TileManager *tile_manager_new(void)
 {
     TileManager *rv;
 
     rv = calloc(1, sizeof(TileManager));
+    if(rv){
+        rv->nslots = 64;
+        rv->slots = calloc(rv->nslots, sizeof(TileSlot));
+        rv->atiles = 16;
+        rv->tiles = calloc(rv->atiles, sizeof(SGBucket*));
+        if(!rv->slots || !rv->tiles){
+            free(rv->slots);
+            free(rv->tiles);
+            free(rv);
+            return NULL;
+        }
+        rv->budget = TILE_MANAGER_BUDGET * 1024 * 1024;
+        tile_area_init(&rv->area);
+        tile_store_init(&rv->store, (size_t)TILE_STORE_BUDGET * 1024 * 1024);
+    }
 
     return rv;
 }
 
 static void tile_manager_free(TileManager *self)
 {
-    for(int i = 0; i < MAX_BUCKETS; i++){
-        if(self->buckets[i])
-            sg_bucket_free(self->buckets[i]);
+    tile_area_dispose(&self->area);
+    tile_store_dispose(&self->store);
+    free(self->tiles);
+    free(self->promotions);
+    for(size_t i = 0; i < self->nslots; i++){
+        if(self->slots[i].bucket)
+            sg_bucket_free(self->slots[i].bucket);
     }
+    free(self->slots);
     free(self);
 }
 
@@ -42,34 +81,108 @@ TileManager *tile_manager_get_instance(void)
 
 void tile_manager_shutdown(void)
 {
+    /*Stop loading before the buckets go away*/
+    tile_loader_shutdown();
     if(instance){
        tile_manager_free(instance);
        instance = NULL;
     }
 }
 
-bool tile_manager_add_tile(TileManager *self, SGBucket *bucket)
+/**
+ * @brief Sets how much memory the resident tiles can use.
+ *
+ * Takes effect at the next tile_manager_get_tiles.
+ *
+ * @param self a TileManager
+ * @param budget Bytes of RAM and GL buffers, together
+ */
+void tile_manager_set_budget(TileManager *self, size_t budget)
 {
-    size_t add_idx;
-
-    if(self->nbuckets == MAX_BUCKETS){
-        /* If we get here, we already have all buckets slots used:
-         * remove the older
-         */
-        Uint32 oldest_stamp = SDL_GetTicks(); /*start at now() and look for the smallest value*/
-        for(int i = 0; i < self->nbuckets; i++){
-            if(oldest_stamp > self->buckets[i]->last_used){
-                oldest_stamp = self->buckets[i]->last_used;
-                add_idx = i;
-            }
-        }
-        sg_bucket_free(self->buckets[add_idx]);
-    }else{
-        add_idx = self->nbuckets;
-        self->nbuckets++;
+    self->budget = budget;
+}
+
+static inline size_t tile_manager_hash(TileManager *self, long int index)
+{
+    uint64_t h;
+
+    h = (uint64_t)index * 0x9E3779B97F4A7C15ULL;
+    return (h >> 32) & (self->nslots - 1);
+}
+
+/*Slot holding @p index, or the free one where it would go*/
+static TileSlot *tile_manager_lookup(TileManager *self, long int index)
+{
+    size_t i;
+
+    for(i = tile_manager_hash(self, index);
+        self->slots[i].bucket && self->slots[i].index != index;
+        i = (i + 1) & (self->nslots - 1))
+        ;
+    return &self->slots[i];
+}
+
+static bool tile_manager_grow(TileManager *self)
+{
+    TileSlot *old;
+    size_t nold;
+
+    old = self->slots;
+    nold = self->nslots;
+    self->slots = calloc(nold * 2, sizeof(TileSlot));
+    if(!self->slots){
+        self->slots = old;
+        return false;
     }
+    self->nslots = nold * 2;
+    for(size_t i = 0; i < nold; i++){
+        if(old[i].bucket)
+            *tile_manager_lookup(self, old[i].index) = old[i];
+    }
+    free(old);
+    return true;
+}
+
+/*Removes @p slot from the table, without freeing its bucket*/
+static void tile_manager_remove(TileManager *self, TileSlot *slot)
+{
+    size_t i, j, home;
 
-    self->buckets[add_idx] = bucket;
+    /* Linear probing: move back the entries that would no longer be
+     * reachable past the hole*/
+    i = slot - self->slots;
+    j = i;
+    for(;;){
+        self->slots[i].bucket = NULL;
+        do{
+            j = (j + 1) & (self->nslots - 1);
+            if(!self->slots[j].bucket)
+                goto done;
+            home = tile_manager_hash(self, self->slots[j].index);
+        }while(i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        self->slots[i] = self->slots[j];
+        i = j;
+    }
+done:
+    self->nbuckets--;
+}
+
+bool tile_manager_add_tile(TileManager *self, SGBucket *bucket)
+{
+    TileSlot *slot;
+    long int index;
+
+    /*Keeps the table at most half full*/
+    if(2 * (self->nbuckets + 1) > self->nslots && !tile_manager_grow(self))
+        return false;
+
+    index = sg_bucket_gen_index(bucket);
+    slot = tile_manager_lookup(self, index);
+    if(slot->bucket)
+        return false; /*Already there*/
+    slot->index = index;
+    slot->bucket = bucket;
+    self->nbuckets++;
     return true;
 }
 
@@ -85,94 +198,320 @@ SGBucket *tile_manager_add_tile_copy(TileManager *self, SGBucket *bucket)
     return copy;
 }
 
-SGBucket *tile_manager_get_tile(TileManager *self, double lat, double lon)
+/*Gives @p mesh, loaded or taken back from the store, to @p bucket*/
+static void tile_manager_attach(TileManager *self, SGBucket *bucket, Mesh *mesh)
+{
+    bucket->mesh = mesh;
+    bucket->size = 0;
+    for(Mesh *iter = bucket->mesh; iter; iter = iter->next)
+        bucket->size += mesh_get_size(iter, false);
+    self->loaded_bytes += bucket->size;
+    self->loaded_tiles++;
+}
+
+/*Gets the mesh of a bucket just added back from the store, if there*/
+static bool tile_manager_promote(TileManager *self, SGBucket *bucket)
+{
+    Mesh *mesh;
+
+    mesh = tile_store_take(&self->store, sg_bucket_gen_index(bucket));
+    if(!mesh)
+        return false;
+    tile_manager_attach(self, bucket, mesh);
+    return true;
+}
+
+/*Resident bucket at the same place as @p bucket, added if needed*/
+static SGBucket *tile_manager_get_bucket(TileManager *self, SGBucket *bucket)
 {
     SGBucket *rv;
-    SGBucket tmp;
 
-    sg_bucket_set(&tmp, lon, lat);
-    /*TODO: Use a hash-like structure?*/
-    for(int i = 0; i < self->nbuckets; i++){
-        if(!self->buckets[i]) continue;
-        if(sg_bucket_equals(&tmp, self->buckets[i])){
-            self->buckets[i]->last_used = SDL_GetTicks();
-            return self->buckets[i];
-        }
+    rv = tile_manager_lookup(self, sg_bucket_gen_index(bucket))->bucket;
+    if(rv){
+        self->stats.hits++;
+        rv->last_used = SDL_GetTicks();
+        return rv;
     }
 
-    rv = tile_manager_add_tile_copy(self, &tmp);
+    rv = tile_manager_add_tile_copy(self, bucket);
     if(!rv){
         printf("Couldn't add tile, bailing out\n");
         exit(EXIT_FAILURE);
     }
+    self->stats.misses++;
+    tile_manager_promote(self, rv);
     rv->last_used = SDL_GetTicks();
     return rv;
 }
 
-/*return next index*/
-static size_t add_bucket(size_t nbuckets, size_t abuckets, SGBucket **buckets, SGBucket *candidate)
+SGBucket *tile_manager_get_tile(TileManager *self, double lat, double lon)
+{
+    SGBucket tmp;
+
+    sg_bucket_set(&tmp, lon, lat);
+    return tile_manager_get_bucket(self, &tmp);
+}
+
+static SGBucket *tile_manager_find_tile(TileManager *self, long int index)
+{
+    return tile_manager_lookup(self, index)->bucket;
+}
+
+/*RAM and GL buffers used by @p bucket, estimated while it is loading*/
+static size_t tile_manager_get_bucket_size(TileManager *self, SGBucket *bucket)
+{
+    if(bucket->mesh)
+        return bucket->size + bucket->mesh->gpu_size;
+    if(bucket->loading && self->loaded_tiles)
+        return 2 * self->loaded_bytes / self->loaded_tiles; /*RAM + GL*/
+    return 0;
+}
+
+/* Hands the mesh of @p bucket, being evicted, to a TileLoader worker
+ * for the TileStore. Only the GL objects are released here: compressing
+ * takes several ms per tile. Tiles the store still holds are just
+ * freed.*/
+static void tile_manager_stash(TileManager *self, SGBucket *bucket)
+{
+    TileLoader *loader;
+
+    if(!bucket->mesh || !self->store.budget)
+        return;
+    if(tile_store_touch(&self->store, sg_bucket_gen_index(bucket))){
+        mesh_release_gl(bucket->mesh);
+        mesh_free(bucket->mesh);
+        bucket->mesh = NULL;
+        return;
+    }
+    loader = tile_loader_get_instance();
+    if(!loader)
+        return;
+    mesh_release_gl(bucket->mesh);
+    if(tile_loader_pack(loader, sg_bucket_gen_index(bucket), bucket->mesh))
+        bucket->mesh = NULL;
+}
+
+static int tile_manager_compare_lru(const void *a, const void *b)
+{
+    const SGBucket *ba = *(const SGBucket **)a;
+    const SGBucket *bb = *(const SGBucket **)b;
+
+    if(ba->last_used != bb->last_used)
+        return ba->last_used < bb->last_used ? -1 : 1;
+    return 0;
+}
+
+/* Accounts for the memory used by all buckets and, when over budget,
+ * evicts the least recently used ones that the current frame doesn't
+ * use*/
+static void tile_manager_trim(TileManager *self)
 {
-    for(int i = 0; i < nbuckets; i++){
-        if(buckets[i] == candidate)
-            return nbuckets;
+    SGBucket **candidates;
+    SGBucket *bucket;
+    size_t ncandidates;
+    size_t low_water;
+
+    self->used = 0;
+    for(size_t i = 0; i < self->nslots; i++){
+        if(self->slots[i].bucket)
+            self->used += tile_manager_get_bucket_size(self, self->slots[i].bucket);
     }
+    if(self->used <= self->budget)
+        return;
 
-    //printf("Adding tile %p as bucket #%d\n", candidate, nbuckets);
-    buckets[nbuckets++] = candidate;
-    return nbuckets;
+    candidates = malloc(sizeof(SGBucket*) * self->nbuckets);
+    if(!candidates)
+        return;
+    ncandidates = 0;
+    for(size_t i = 0; i < self->nslots; i++){
+        bucket = self->slots[i].bucket;
+        if(bucket && bucket->last_used < self->stamp)
+            candidates[ncandidates++] = bucket;
+    }
+    qsort(candidates, ncandidates, sizeof(SGBucket*), tile_manager_compare_lru);
+
+    low_water = self->budget * TILE_MANAGER_LOW_WATER;
+    for(size_t i = 0; i < ncandidates && self->used > low_water; i++){
+        self->used -= tile_manager_get_bucket_size(self, candidates[i]);
+        tile_manager_remove(self, tile_manager_lookup(self, sg_bucket_gen_index(candidates[i])));
+        tile_manager_stash(self, candidates[i]);
+        sg_bucket_free(candidates[i]);
+        self->stats.evictions++;
+    }
+    free(candidates);
 }
+
 /**
+ * @brief Hands meshes loaded in the background over to the buckets that
+ * requested them, and evicted meshes compressed in the background over
+ * to the TileStore.
+ *
+ * Meshes of buckets that have been evicted in the meantime are
+ * released. Must be called from the GL thread.
+ *
+ * @param self a TileManager
+ */
+void tile_manager_collect(TileManager *self)
+{
+    TileLoader *loader;
+    TileLoaderJob *job, *next;
+    SGBucket *bucket;
+
+    loader = tile_loader_get_instance();
+    if(!loader)
+        return;
+
+    for(job = tile_loader_collect(loader); job != NULL; job = next){
+        next = job->next;
+        if(job->pack){
+            if(job->data)
+                tile_store_add(&self->store, job->index, job->data, job->size, job->raw_size);
+            job->data = NULL;
+            tile_loader_job_free(job);
+            continue;
+        }
+        bucket = tile_manager_find_tile(self, job->index);
+        /* A failed load leaves the bucket flagged as loading: it won't be
+         * retried every frame, only once evicted and requested again*/
+        if(bucket && job->mesh){
+            if(!bucket->mesh){
+                tile_manager_attach(self, bucket, job->mesh);
+                job->mesh = NULL;
+            }
+            bucket->loading = false;
+        }
+        tile_loader_job_free(job);
+    }
+}
+
+/*Queues a promotion for tile_loader_promote_all, dropped if out of memory*/
+static void tile_manager_add_promotion(TileManager *self, long int index, float priority, size_t *n)
+{
+    TileLoaderPromotion *tmp;
+
+    if(*n == self->apromotions){
+        size_t apromotions = self->apromotions ? self->apromotions * 2 : 16;
+        tmp = realloc(self->promotions, sizeof(TileLoaderPromotion) * apromotions);
+        if(!tmp)
+            return;
+        self->promotions = tmp;
+        self->apromotions = apromotions;
+    }
+    self->promotions[(*n)++] = (TileLoaderPromotion){index, priority};
+}
+
+/**
+ * @brief Loads ahead of need the buckets queued by @p prefetcher.
+ *
+ * Buckets are taken by priority, as long as the budget isn't used up:
+ * prefetching never evicts anything. Loads already queued are moved
+ * ahead if the bucket has become more urgent, all in one go.
+ *
+ * Must be called after tile_manager_get_tiles, from the GL thread.
+ *
+ * @param self a TileManager
+ * @param prefetcher a TilePrefetcher, see tile_prefetcher_predict
+ * @return The number of loads requested
+ */
+size_t tile_manager_prefetch(TileManager *self, TilePrefetcher *prefetcher)
+{
+    TileLoader *loader;
+    TilePrefetch prefetch;
+    SGBucket *bucket;
+    size_t rv, npromotions;
+
+    loader = tile_loader_get_instance();
+    if(!loader)
+        return 0;
+
+    rv = 0;
+    npromotions = 0;
+    while(tile_prefetcher_pop(prefetcher, &prefetch)){
+        bucket = tile_manager_find_tile(self, sg_bucket_gen_index(&prefetch.bucket));
+        if(bucket){
+            bucket->last_used = SDL_GetTicks();
+            if(!bucket->mesh && bucket->loading)
+                tile_manager_add_promotion(self, sg_bucket_gen_index(bucket), prefetch.eta, &npromotions);
+        }else{
+            if(self->used >= self->budget)
+                break;
+            bucket = tile_manager_add_tile_copy(self, &prefetch.bucket);
+            if(!bucket)
+                break;
+            bucket->last_used = SDL_GetTicks();
+            if(tile_manager_promote(self, bucket))
+                self->used += tile_manager_get_bucket_size(self, bucket);
+        }
+        if(!bucket->mesh && !bucket->loading){
+            bucket->loading = tile_loader_request(loader, bucket, prefetch.eta);
+            if(bucket->loading){
+                self->used += tile_manager_get_bucket_size(self, bucket);
+                rv++;
+            }
+        }
+    }
+    tile_loader_promote_all(loader, self->promotions, npromotions);
+    return rv;
+}
+
+/**
+ * @brief Gives the buckets within @p vis of @p location.
+ *
+ * The set is only computed again when the aircraft goes into another
+ * bucket or @p vis changes, see TileArea. Buckets coming in are then
+ * requested from the TileLoader, those going out are left to be
+ * evicted when memory is needed. What has changed is in self->area.
  *
  * vis in m
+ *
+ * @param self a TileManager
+ * @param location Where the aircraft is
+ * @param vis Distance, in meters, up to which tiles are needed
+ * @return The buckets, NULL-terminated. Owned by @p self, valid until
+ * the next call.
  */
 SGBucket **tile_manager_get_tiles(TileManager *self, GeoLocation *location, float vis)
 {
-    static SGBucket *rv[6];
-    SGBucket *tmp;
-    bool found;
-    GeoLocation nbox[2];
-    int nbuckets;
-
-    geo_location_bounding_coordinates(location, vis, nbox);
-
-    nbuckets = 0;
-    //center
-    tmp = tile_manager_get_tile(self, location->latitude, location->longitude);
-    nbuckets = add_bucket(nbuckets, 4, rv, tmp);
-#if !defined (NO_PRELOAD) || NO_PRELOAD == 0
-    //up left
-    tmp = tile_manager_get_tile(self, nbox[1].latitude, nbox[0].longitude); //lat lon, Y X
-    nbuckets = add_bucket(nbuckets, 4, rv, tmp);
-    //buckets[0]->active = true;
-    //down left
-    tmp = tile_manager_get_tile(self, nbox[0].latitude, nbox[0].longitude);
-    nbuckets = add_bucket(nbuckets, 4, rv, tmp);
-
-    //down right
-    tmp = tile_manager_get_tile(self, nbox[0].latitude, nbox[1].longitude);
-    nbuckets = add_bucket(nbuckets, 4, rv, tmp);
-
-    //up right
-    tmp = tile_manager_get_tile(self, nbox[1].latitude, nbox[1].longitude);
-    nbuckets = add_bucket(nbuckets, 4, rv, tmp);
+    SGBucket *bucket;
+    SGBucket **tmp;
+    size_t atiles;
+
+    tile_manager_collect(self);
+    self->stamp = SDL_GetTicks();
+#if defined (NO_PRELOAD) && NO_PRELOAD != 0
+    vis = 0.0f; /*Only the bucket under the aircraft*/
 #endif
-    rv[nbuckets] = NULL;
-
-/*    printf("Bounding locations for region %f m around lat: %f, lon: %f:\n"*/
-            /*"\tTile 0: lat:%d lon:%d x:%d y:%d\n"*/
-            /*"\tTile 1: lat:%d lon:%d x:%d y:%d\n"*/
-            /*"\tTile 2: lat:%d lon:%d x:%d y:%d\n"*/
-            /*"\tTile 3: lat:%d lon:%d x:%d y:%d\n",*/
-        /*vis,*/
-        /*location->latitude, location->longitude,*/
-        /*rv[0]->lat, rv[0]->lon, rv[0]->x, rv[0]->y,*/
-        /*rv[1]->lat, rv[1]->lon, rv[1]->x, rv[1]->y,*/
-        /*rv[2]->lat, rv[2]->lon, rv[2]->x, rv[2]->y,*/
-        /*rv[3]->lat, rv[3]->lon, rv[3]->x, rv[3]->y*/
-    /*);*/
-//    fflush(stdout);
 
+    if(tile_area_update(&self->area, location, vis)){
+        for(size_t i = 0; i < self->area.removed.n; i++){
+            bucket = tile_manager_find_tile(self, sg_bucket_gen_index(&self->area.removed.buckets[i]));
+            for(size_t j = 0; j < self->ntiles; j++){
+                if(self->tiles[j] == bucket){
+                    self->tiles[j] = self->tiles[--self->ntiles];
+                    break;
+                }
+            }
+        }
 
-    return rv;
-}
+        if(self->ntiles + self->area.added.n + 1 > self->atiles){
+            atiles = self->ntiles + self->area.added.n + 1;
+            tmp = realloc(self->tiles, sizeof(SGBucket*) * atiles);
+            if(!tmp){
+                printf("Couldn't add tile, bailing out\n");
+                exit(EXIT_FAILURE);
+            }
+            self->tiles = tmp;
+            self->atiles = atiles;
+        }
+        for(size_t i = 0; i < self->area.added.n; i++)
+            self->tiles[self->ntiles++] = tile_manager_get_bucket(self, &self->area.added.buckets[i]);
+        self->tiles[self->ntiles] = NULL;
+    }
+
+    /*Keeps them out of eviction*/
+    for(size_t i = 0; i < self->ntiles; i++)
+        self->tiles[i]->last_used = self->stamp;
+    tile_manager_trim(self);
 
+    return self->tiles;
+}
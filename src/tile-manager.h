@@ -10,12 +10,58 @@
 
 #include "bucket.h"
 #include "geo-location.h"
-#define MAX_BUCKETS 8
+#include "tile-area.h"
+#include "tile-loader.h"
+#include "tile-prefetcher.h"
+#include "tile-store.h"
+
+/* Memory (MB) the resident tiles can use, RAM and GL buffers together.
+ * Once over, the least recently used tiles are evicted down to
+ * TILE_MANAGER_LOW_WATER of the budget.*/
+#ifndef TILE_MANAGER_BUDGET
+#define TILE_MANAGER_BUDGET 128
+#endif
+#define TILE_MANAGER_LOW_WATER 0.75
+
+/*Hash table slot*/
+typedef struct{
+    long int index; /*sg_bucket_gen_index()*/
+    SGBucket *bucket; /*NULL for free slots*/
+}TileSlot;
+
+typedef struct{
+    size_t hits; /*Tiles asked for that were resident*/
+    size_t misses; /*Tiles asked for that had to be loaded*/
+    size_t evictions;
+}TileManagerStats;
 
 typedef struct{
-    SGBucket *buckets[MAX_BUCKETS];
+    /*Resident buckets, open addressing (linear probing) on their index*/
+    TileSlot *slots;
+    size_t nslots; /*power of two*/
     size_t nbuckets;
 
+    size_t budget; /*bytes*/
+    size_t used; /*bytes, as of the last tile_manager_get_tiles*/
+    /*Loaded so far, gives the size of tiles still loading*/
+    size_t loaded_bytes;
+    size_t loaded_tiles;
+
+    /*Buckets within range, NULL-terminated*/
+    TileArea area;
+    SGBucket **tiles;
+    size_t ntiles;
+    size_t atiles;
+
+    Uint32 stamp; /*Ticks at the last tile_manager_get_tiles*/
+    TileManagerStats stats;
+
+    /*Compressed copies of evicted buckets' meshes*/
+    TileStore store;
+
+    /*Scratch, see tile_manager_prefetch*/
+    TileLoaderPromotion *promotions;
+    size_t apromotions;
 }TileManager;
 
 
@@ -27,4 +73,7 @@ SGBucket **tile_manager_get_tiles(TileManager *self, GeoLocation *location, floa
 SGBucket *tile_manager_get_tile(TileManager *self, double lat, double lon);
 bool tile_manager_add_tile(TileManager *self, SGBucket *bucket);
 SGBucket *tile_manager_add_tile_copy(TileManager *self, SGBucket *bucket);
+void tile_manager_set_budget(TileManager *self, size_t budget);
+void tile_manager_collect(TileManager *self);
+size_t tile_manager_prefetch(TileManager *self, TilePrefetcher *prefetcher);
 #endif
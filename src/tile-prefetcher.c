@@ -0,0 +1,353 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "tile-prefetcher.h"
+
+/**
+ * TilePrefetcher: guesses which buckets the aircraft will need in the
+ * next minutes, so that they can be loaded before they are.
+ *
+ * Ground speed, track and turn rate are estimated from the last
+ * positions. The path is extrapolated from them as a turn of constant
+ * rate (or a straight line), and each point of the path asks for the
+ * buckets TileManager would ask for there: those within visibility of
+ * the bucket under the point (see tile_area_around). That covers what
+ * lies beside the path.
+ *
+ * Buckets come out of the queue by the time left before the aircraft
+ * needs them, the ones needed right now first.
+ *
+ * The path is only extrapolated again when a position is kept in the
+ * history (every TILE_PREFETCHER_FIX_INTERVAL) or the visibility
+ * changes. In between, the queue keeps what hasn't been taken out yet.
+ */
+
+TilePrefetcher *tile_prefetcher_new(void)
+{
+    TilePrefetcher *rv;
+
+    rv = calloc(1, sizeof(TilePrefetcher));
+    if(rv){
+        if(!tile_prefetcher_init(rv))
+            return tile_prefetcher_free(rv);
+    }
+    return rv;
+}
+
+TilePrefetcher *tile_prefetcher_init(TilePrefetcher *self)
+{
+    self->a_queue = 32;
+    self->queue = malloc(sizeof(TilePrefetch) * self->a_queue);
+    self->a_queued = 64;
+    self->queued = malloc(sizeof(long int) * self->a_queued);
+    if(!self->queue || !self->queued)
+        return NULL;
+    self->stale = true;
+    return self;
+}
+
+TilePrefetcher *tile_prefetcher_dispose(TilePrefetcher *self)
+{
+    if(self->queue)
+        free(self->queue);
+    if(self->queued)
+        free(self->queued);
+    tile_list_dispose(&self->area);
+    return self;
+}
+
+TilePrefetcher *tile_prefetcher_free(TilePrefetcher *self)
+{
+    tile_prefetcher_dispose(self);
+    free(self);
+    return NULL;
+}
+
+/*Same as geo_location_distance_to, but 0 instead of NaN for close points*/
+static double tile_prefetcher_distance(GeoLocation *a, GeoLocation *b)
+{
+    double rv;
+
+    rv = geo_location_distance_to(a, b);
+    return isnan(rv) ? 0.0 : rv;
+}
+
+/*Angle from @p a to @p b, in [-180,180]*/
+static double tile_prefetcher_angle(double a, double b)
+{
+    double rv;
+
+    rv = fmod(b - a, 360.0);
+    if(rv > 180.0)
+        rv -= 360.0;
+    else if(rv < -180.0)
+        rv += 360.0;
+    return rv;
+}
+
+static void tile_prefetcher_estimate(TilePrefetcher *self)
+{
+    TilePrefetcherFix *oldest, *middle, *last;
+    double dt, t1, t2, b1, b2;
+
+    self->speed = 0.0;
+    self->track = self->heading;
+    self->turn_rate = 0.0;
+    if(self->n_history < 2)
+        return;
+
+    oldest = &self->history[self->head];
+    last = &self->last;
+    dt = last->time - oldest->time;
+    if(dt <= 0.0)
+        return;
+    self->speed = tile_prefetcher_distance(&oldest->location, &last->location) / dt;
+    if(self->speed < TILE_PREFETCHER_MIN_SPEED)
+        return;
+
+    if(self->n_history < 3){
+        self->track = geo_location_bearing(&oldest->location, &last->location);
+        return;
+    }
+    /* Each chord gives the track at its middle, the change between
+     * the two the turn rate*/
+    middle = &self->history[(self->head + self->n_history / 2) % TILE_PREFETCHER_HISTORY];
+    b1 = geo_location_bearing(&oldest->location, &middle->location);
+    b2 = geo_location_bearing(&middle->location, &last->location);
+    t1 = (oldest->time + middle->time) / 2.0;
+    t2 = (middle->time + last->time) / 2.0;
+    if(t2 > t1){
+        self->turn_rate = tile_prefetcher_angle(b1, b2) / (t2 - t1);
+        self->turn_rate = fmax(-TILE_PREFETCHER_MAX_TURN_RATE,
+            fmin(self->turn_rate, TILE_PREFETCHER_MAX_TURN_RATE)
+        );
+    }
+    self->track = fmod(b2 + self->turn_rate * (last->time - t2) + 360.0, 360.0);
+}
+
+/**
+ * @brief Feeds the prefetcher with the current position of the aircraft.
+ *
+ * Should be called every frame, or at least every
+ * TILE_PREFETCHER_FIX_INTERVAL. Going back in time (e.g. rewinding a
+ * replay) forgets the previous positions.
+ *
+ * @param self a TilePrefetcher
+ * @param location Where the aircraft is
+ * @param heading Where its nose points, in degrees. Used as the track
+ * until it has moved enough to tell the track.
+ * @param time Time of the fix, in seconds
+ */
+void tile_prefetcher_add_fix(TilePrefetcher *self, GeoLocation *location, double heading, double time)
+{
+    TilePrefetcherFix *newest;
+    size_t idx;
+
+    newest = NULL;
+    if(self->n_history){
+        idx = (self->head + self->n_history - 1) % TILE_PREFETCHER_HISTORY;
+        newest = &self->history[idx];
+        if(time < newest->time){
+            self->n_history = 0;
+            self->head = 0;
+            newest = NULL;
+            self->stale = true;
+        }
+    }
+
+    self->last.location = *location;
+    self->last.time = time;
+    self->heading = heading;
+
+    if(!newest || time - newest->time >= TILE_PREFETCHER_FIX_INTERVAL){
+        if(self->n_history == TILE_PREFETCHER_HISTORY){
+            idx = self->head;
+            self->head = (self->head + 1) % TILE_PREFETCHER_HISTORY;
+        }else{
+            idx = (self->head + self->n_history) % TILE_PREFETCHER_HISTORY;
+            self->n_history++;
+        }
+        self->history[idx] = self->last;
+        self->stale = true;
+    }
+
+    tile_prefetcher_estimate(self);
+}
+
+static inline size_t tile_prefetcher_hash(TilePrefetcher *self, long int index)
+{
+    uint64_t h;
+
+    h = (uint64_t)index * 0x9E3779B97F4A7C15ULL;
+    return (h >> 32) & (self->a_queued - 1);
+}
+
+/*Adds @p index to the set of queued buckets, false if already there*/
+static bool tile_prefetcher_mark(TilePrefetcher *self, long int index)
+{
+    long int *old, *tmp;
+    size_t nold, i;
+
+    if(2 * (self->n_queued + 1) > self->a_queued){
+        tmp = malloc(sizeof(long int) * self->a_queued * 2);
+        if(!tmp)
+            return false;
+        old = self->queued;
+        nold = self->a_queued;
+        self->queued = tmp;
+        self->a_queued *= 2;
+        memset(self->queued, 0xff, sizeof(long int) * self->a_queued);
+        for(size_t j = 0; j < nold; j++){
+            if(old[j] < 0)
+                continue;
+            for(i = tile_prefetcher_hash(self, old[j]); self->queued[i] >= 0; i = (i + 1) & (self->a_queued - 1))
+                ;
+            self->queued[i] = old[j];
+        }
+        free(old);
+    }
+
+    for(i = tile_prefetcher_hash(self, index); self->queued[i] >= 0; i = (i + 1) & (self->a_queued - 1)){
+        if(self->queued[i] == index)
+            return false;
+    }
+    self->queued[i] = index;
+    self->n_queued++;
+    return true;
+}
+
+static void tile_prefetcher_push(TilePrefetcher *self, SGBucket *bucket, float eta)
+{
+    TilePrefetch *tmp;
+    size_t i, parent;
+
+    /*Points are pushed by increasing eta: the first one is the earliest*/
+    if(!tile_prefetcher_mark(self, sg_bucket_gen_index(bucket)))
+        return;
+
+    if(self->n_queue == self->a_queue){
+        tmp = realloc(self->queue, sizeof(TilePrefetch) * self->a_queue * 2);
+        if(!tmp)
+            return;
+        self->queue = tmp;
+        self->a_queue *= 2;
+    }
+
+    for(i = self->n_queue++; i > 0; i = parent){
+        parent = (i - 1) / 2;
+        if(self->queue[parent].eta <= eta)
+            break;
+        self->queue[i] = self->queue[parent];
+    }
+    self->queue[i].bucket = *bucket;
+    self->queue[i].eta = eta;
+}
+
+/* Buckets tile_manager_get_tiles asks for at @p location, unless they
+ * are those of the previous point (in @p last)*/
+static void tile_prefetcher_push_area(TilePrefetcher *self, GeoLocation *location, float vis, float eta, SGBucket *last)
+{
+    SGBucket bucket;
+
+    sg_bucket_set(&bucket, location->longitude, location->latitude);
+    if(sg_bucket_equals(&bucket, last))
+        return;
+    *last = bucket;
+
+    if(!tile_area_around(&bucket, vis, &self->area))
+        return;
+    for(size_t i = 0; i < self->area.n; i++)
+        tile_prefetcher_push(self, &self->area.buckets[i], eta);
+}
+
+/**
+ * @brief Extrapolates the path of the aircraft and queues the buckets
+ * it will need, by priority.
+ *
+ * Replaces what has been queued by the previous call, unless no fix
+ * has been kept since and @p vis hasn't changed: the queue then keeps
+ * what is left of it. Cheap enough to be called every frame.
+ *
+ * @param self a TilePrefetcher
+ * @param vis The visibility distance, in meters
+ * @return The number of buckets queued
+ *
+ * @see tile_prefetcher_pop
+ */
+size_t tile_prefetcher_predict(TilePrefetcher *self, float vis)
+{
+    GeoLocation location;
+    SGBucket last;
+    double track, turned, dturn, dt;
+    double distance;
+
+    if(!self->stale && vis == self->vis)
+        return self->n_queue;
+    self->stale = false;
+    self->vis = vis;
+
+    self->n_queue = 0;
+    self->n_queued = 0;
+    memset(self->queued, 0xff, sizeof(long int) * self->a_queued);
+    if(!self->n_history)
+        return 0;
+
+    location = self->last.location;
+    memset(&last, 0xff, sizeof(SGBucket)); /*Matches no bucket*/
+    tile_prefetcher_push_area(self, &location, vis, 0.0f, &last);
+    if(self->speed < TILE_PREFETCHER_MIN_SPEED)
+        return self->n_queue;
+
+    distance = fmin(self->speed * TILE_PREFETCHER_LOOKAHEAD, TILE_PREFETCHER_MAX_DISTANCE);
+    dt = TILE_PREFETCHER_STEP / self->speed;
+    track = self->track;
+    turned = 0.0;
+    for(double d = TILE_PREFETCHER_STEP; d <= distance; d += TILE_PREFETCHER_STEP){
+        dturn = fmax(-TILE_PREFETCHER_MAX_TURN - turned,
+            fmin(self->turn_rate * dt, TILE_PREFETCHER_MAX_TURN - turned)
+        );
+        geo_location_destination(&location, track + dturn / 2.0, TILE_PREFETCHER_STEP, &location);
+        track += dturn;
+        turned += dturn;
+        tile_prefetcher_push_area(self, &location, vis, d / self->speed, &last);
+    }
+    return self->n_queue;
+}
+
+/**
+ * @brief Takes the most urgent bucket out of the queue.
+ *
+ * @param self a TilePrefetcher
+ * @param prefetch Where to store the bucket and its eta
+ * @return true if a bucket has been taken, false if the queue is empty
+ */
+bool tile_prefetcher_pop(TilePrefetcher *self, TilePrefetch *prefetch)
+{
+    TilePrefetch last;
+    size_t i, child;
+
+    if(!self->n_queue)
+        return false;
+    *prefetch = self->queue[0];
+
+    last = self->queue[--self->n_queue];
+    for(i = 0; (child = 2 * i + 1) < self->n_queue; i = child){
+        if(child + 1 < self->n_queue && self->queue[child + 1].eta < self->queue[child].eta)
+            child++;
+        if(last.eta <= self->queue[child].eta)
+            break;
+        self->queue[i] = self->queue[child];
+    }
+    self->queue[i] = last;
+    return true;
+}
@@ -0,0 +1,80 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef TILE_PREFETCHER_H
+#define TILE_PREFETCHER_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bucket.h"
+#include "geo-location.h"
+#include "tile-area.h"
+
+/*Positions kept to estimate the motion, one per interval*/
+#define TILE_PREFETCHER_HISTORY 8
+#define TILE_PREFETCHER_FIX_INTERVAL 1.0 /*s*/
+/*How far ahead the path is extrapolated*/
+#define TILE_PREFETCHER_LOOKAHEAD 120.0 /*s*/
+#define TILE_PREFETCHER_MAX_DISTANCE 50000.0 /*m*/
+#define TILE_PREFETCHER_STEP 1000.0 /*m between two points of the path*/
+/*Below that ground speed (m/s), the aircraft is considered still*/
+#define TILE_PREFETCHER_MIN_SPEED 2.0
+/*Turns are extrapolated up to that rate and that much heading change*/
+#define TILE_PREFETCHER_MAX_TURN_RATE 6.0 /*deg/s, twice a standard rate turn*/
+#define TILE_PREFETCHER_MAX_TURN 90.0 /*deg*/
+
+typedef struct{
+    GeoLocation location;
+    double time; /*s*/
+}TilePrefetcherFix;
+
+typedef struct{
+    SGBucket bucket; /*Only the coordinates are set*/
+    float eta; /*s before the aircraft needs the bucket*/
+}TilePrefetch;
+
+typedef struct{
+    /*Ring buffer, oldest first from history[head]*/
+    TilePrefetcherFix history[TILE_PREFETCHER_HISTORY];
+    size_t n_history;
+    size_t head;
+
+    /*Latest fix, kept or not*/
+    TilePrefetcherFix last;
+    double heading; /*degrees*/
+
+    /*Estimated motion*/
+    double speed; /*m/s over the ground*/
+    double track; /*degrees*/
+    double turn_rate; /*degrees/s, positive to the right*/
+
+    /*Binary min-heap on eta*/
+    TilePrefetch *queue;
+    size_t n_queue;
+    size_t a_queue;
+
+    /*The path is only extrapolated again on a new fix or visibility*/
+    bool stale;
+    float vis;
+
+    /*Indexes of the buckets queued by the last prediction, open addressing*/
+    long int *queued;
+    size_t n_queued;
+    size_t a_queued; /*power of two*/
+
+    TileList area; /*Scratch*/
+}TilePrefetcher;
+
+TilePrefetcher *tile_prefetcher_new(void);
+TilePrefetcher *tile_prefetcher_init(TilePrefetcher *self);
+TilePrefetcher *tile_prefetcher_dispose(TilePrefetcher *self);
+TilePrefetcher *tile_prefetcher_free(TilePrefetcher *self);
+
+void tile_prefetcher_add_fix(TilePrefetcher *self, GeoLocation *location, double heading, double time);
+size_t tile_prefetcher_predict(TilePrefetcher *self, float vis);
+bool tile_prefetcher_pop(TilePrefetcher *self, TilePrefetch *prefetch);
+#endif /* TILE_PREFETCHER_H */
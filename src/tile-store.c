@@ -0,0 +1,304 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile-store.h"
+#include "mesh-cache.h"
+#include "lz.h"
+
+/**
+ * TileStore: second level of the tile cache, compressed, in RAM.
+ *
+ * Tiles evicted by the TileManager are kept here as the image of their
+ * cache file (see mesh_cache_pack), compressed with LZ. Getting one back
+ * is a decompression and a parse of that image: the groups point into
+ * it, their arrays are ready to be uploaded. It doesn't go through the
+ * disk, gzip, btg-io nor the VertexSet.
+ *
+ * Images are mostly floats, whose bytes differ the most in the low
+ * order ones. They are transposed in 4 planes (all first bytes, then
+ * all second bytes...) before compression, which makes a tile around
+ * 10% smaller.
+ *
+ * Entries are kept when taken back: if the tile is evicted again, it
+ * doesn't need to be compressed again, see tile_store_touch. The store has its own byte
+ * budget and drops the least recently used entries to stay within it.
+ *
+ * Compression doesn't need the store: it is done by TileLoader workers,
+ * off the GL thread, see tile_loader_pack.
+ */
+
+TileStore *tile_store_new(size_t budget)
+{
+    TileStore *rv;
+
+    rv = calloc(1, sizeof(TileStore));
+    if(rv){
+        if(!tile_store_init(rv, budget))
+            return tile_store_free(rv);
+    }
+    return rv;
+}
+
+/**
+ * @brief Inits a TileStore.
+ *
+ * @param self a TileStore
+ * @param budget Bytes the compressed tiles can use, 0 to store nothing
+ * @return @p self
+ */
+TileStore *tile_store_init(TileStore *self, size_t budget)
+{
+    memset(self, 0, sizeof(TileStore));
+    self->budget = budget;
+    return self;
+}
+
+TileStore *tile_store_dispose(TileStore *self)
+{
+    for(size_t i = 0; i < self->n; i++)
+        free(self->entries[i].data);
+    if(self->entries)
+        free(self->entries);
+    self->entries = NULL;
+    self->n = self->allocated = 0;
+    self->used = 0;
+    return self;
+}
+
+TileStore *tile_store_free(TileStore *self)
+{
+    tile_store_dispose(self);
+    free(self);
+    return NULL;
+}
+
+static TileStoreEntry *tile_store_find(TileStore *self, long int index)
+{
+    for(size_t i = 0; i < self->n; i++){
+        if(self->entries[i].index == index)
+            return &self->entries[i];
+    }
+    return NULL;
+}
+
+static void tile_store_drop(TileStore *self, TileStoreEntry *entry)
+{
+    self->used -= entry->size;
+    free(entry->data);
+    *entry = self->entries[--self->n];
+    self->stats.dropped++;
+}
+
+static TileStoreEntry *tile_store_get_lru(TileStore *self)
+{
+    TileStoreEntry *rv;
+
+    rv = NULL;
+    for(size_t i = 0; i < self->n; i++){
+        if(!rv || self->entries[i].last_used < rv->last_used)
+            rv = &self->entries[i];
+    }
+    return rv;
+}
+
+/*4 bytes elements to byte planes, the trailing bytes are left as is*/
+static void tile_store_shuffle(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    size_t q;
+
+    q = n / 4;
+    for(size_t i = 0; i < q; i++){
+        dst[i] = src[i * 4];
+        dst[q + i] = src[i * 4 + 1];
+        dst[2 * q + i] = src[i * 4 + 2];
+        dst[3 * q + i] = src[i * 4 + 3];
+    }
+    memcpy(dst + q * 4, src + q * 4, n - q * 4);
+}
+
+static void tile_store_unshuffle(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    size_t q;
+
+    q = n / 4;
+    for(size_t i = 0; i < q; i++){
+        dst[i * 4] = src[i];
+        dst[i * 4 + 1] = src[q + i];
+        dst[i * 4 + 2] = src[2 * q + i];
+        dst[i * 4 + 3] = src[3 * q + i];
+    }
+    memcpy(dst + q * 4, src + q * 4, n - q * 4);
+}
+
+/**
+ * @brief Compresses the image of a tile.
+ *
+ * Doesn't touch the TileStore: it can run on any thread, see
+ * tile_loader_pack. The result is then given to tile_store_add.
+ *
+ * @param mesh The tile, whose groups must have been finished. Left
+ * untouched.
+ * @param size Set to the size of the compressed image
+ * @param raw_size Set to the size of the image
+ * @return The compressed image, NULL on failure.
+ */
+uint8_t *tile_store_compress(Mesh *mesh, size_t *size, size_t *raw_size)
+{
+    uint8_t *image, *shuffled, *rv, *tmp;
+    size_t capacity;
+
+    image = mesh_cache_pack(mesh, raw_size);
+    if(!image)
+        return NULL;
+
+    capacity = lz_compress_bound(*raw_size);
+    shuffled = malloc(*raw_size);
+    rv = malloc(capacity);
+    *size = 0;
+    if(shuffled && rv){
+        tile_store_shuffle(image, shuffled, *raw_size);
+        *size = lz_compress(shuffled, *raw_size, rv, capacity);
+    }
+    free(image);
+    free(shuffled);
+    if(!*size){
+        free(rv);
+        return NULL;
+    }
+
+    tmp = realloc(rv, *size);
+    return tmp ? tmp : rv;
+}
+
+/**
+ * @brief Marks a stored tile as used.
+ *
+ * Tiles taken back keep their entry: when evicted again, this tells
+ * that they don't need to be compressed again.
+ *
+ * @param self a TileStore
+ * @param index Index of the tile's bucket, see sg_bucket_gen_index
+ * @return true if the tile is stored, false otherwise.
+ */
+bool tile_store_touch(TileStore *self, long int index)
+{
+    TileStoreEntry *entry;
+
+    entry = tile_store_find(self, index);
+    if(!entry)
+        return false;
+    entry->last_used = ++self->clock;
+    return true;
+}
+
+/**
+ * @brief Stores a tile compressed by tile_store_compress.
+ *
+ * Least recently used tiles are dropped if needed to make room. If the
+ * tile is already stored, it is only marked as used.
+ *
+ * @param self a TileStore
+ * @param index Index of the tile's bucket, see sg_bucket_gen_index
+ * @param data The compressed image, taken over even on failure
+ * @param size Size of @p data
+ * @param raw_size Size of the image once decompressed
+ * @return true if the tile is stored, false otherwise.
+ */
+bool tile_store_add(TileStore *self, long int index, uint8_t *data, size_t size, size_t raw_size)
+{
+    if(tile_store_touch(self, index)){
+        free(data);
+        return true;
+    }
+    if(!self->budget || size > self->budget){
+        free(data);
+        return false;
+    }
+
+    if(self->n == self->allocated){
+        size_t allocated = self->allocated ? self->allocated * 2 : 32;
+        TileStoreEntry *tmp = realloc(self->entries, sizeof(TileStoreEntry) * allocated);
+        if(!tmp){
+            free(data);
+            return false;
+        }
+        self->entries = tmp;
+        self->allocated = allocated;
+    }
+    while(self->used + size > self->budget)
+        tile_store_drop(self, tile_store_get_lru(self));
+
+    self->entries[self->n++] = (TileStoreEntry){
+        .index = index,
+        .data = data,
+        .size = size,
+        .raw_size = raw_size,
+        .last_used = ++self->clock
+    };
+    self->used += size;
+    self->stats.stored++;
+    self->stats.raw_bytes += raw_size;
+    self->stats.packed_bytes += size;
+    return true;
+}
+
+/**
+ * @brief Gets a tile back.
+ *
+ * The tile stays in the store.
+ *
+ * @param self a TileStore
+ * @param index Index of the tile's bucket, see sg_bucket_gen_index
+ * @return A newly created Mesh chain, as it was when stored, NULL if
+ * the tile isn't stored. Not prepared: it will be uploaded when first
+ * drawn.
+ */
+Mesh *tile_store_take(TileStore *self, long int index)
+{
+    TileStoreEntry *entry;
+    uint8_t *shuffled, *image;
+    Mesh *rv;
+
+    if(!self->budget)
+        return NULL;
+
+    entry = tile_store_find(self, index);
+    if(!entry){
+        self->stats.misses++;
+        return NULL;
+    }
+
+    shuffled = malloc(entry->raw_size);
+    image = malloc(entry->raw_size);
+    if(!shuffled || !image){
+        free(shuffled);
+        free(image);
+        return NULL;
+    }
+    if(!lz_decompress(entry->data, entry->size, shuffled, entry->raw_size)){
+        printf("TileStore: corrupted tile %ld, dropping\n", index);
+        free(shuffled);
+        free(image);
+        tile_store_drop(self, entry);
+        return NULL;
+    }
+    tile_store_unshuffle(shuffled, image, entry->raw_size);
+    free(shuffled);
+
+    rv = mesh_cache_unpack(image, entry->raw_size);
+    if(!rv){
+        tile_store_drop(self, entry);
+        return NULL;
+    }
+    entry->last_used = ++self->clock;
+    self->stats.hits++;
+    return rv;
+}
@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2021 Samuel Cuella <samuel.cuella@gmail.com>
+ *
+ * This file is part of SoFIS - an open source EFIS
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#ifndef TILE_STORE_H
+#define TILE_STORE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mesh.h"
+
+/* Memory (MB) the compressed images of evicted tiles can use, on top
+ * of TILE_MANAGER_BUDGET. 0 disables the store.*/
+#ifndef TILE_STORE_BUDGET
+#define TILE_STORE_BUDGET 64
+#endif
+
+typedef struct{
+    long int index; /*sg_bucket_gen_index()*/
+    uint8_t *data; /*Compressed cache image, see mesh_cache_pack*/
+    size_t size;
+    size_t raw_size;
+    size_t last_used; /*TileStore clock*/
+}TileStoreEntry;
+
+typedef struct{
+    size_t hits; /*Tiles asked for that were stored*/
+    size_t misses;
+    size_t stored;
+    size_t dropped; /*Entries evicted to make room*/
+    size_t raw_bytes; /*Of all stored images, before and after compression*/
+    size_t packed_bytes;
+}TileStoreStats;
+
+typedef struct{
+    TileStoreEntry *entries;
+    size_t n;
+    size_t allocated;
+
+    size_t budget; /*bytes*/
+    size_t used; /*bytes*/
+    size_t clock;
+    TileStoreStats stats;
+}TileStore;
+
+TileStore *tile_store_new(size_t budget);
+TileStore *tile_store_init(TileStore *self, size_t budget);
+TileStore *tile_store_dispose(TileStore *self);
+TileStore *tile_store_free(TileStore *self);
+
+bool tile_store_touch(TileStore *self, long int index);
+uint8_t *tile_store_compress(Mesh *mesh, size_t *size, size_t *raw_size);
+bool tile_store_add(TileStore *self, long int index, uint8_t *data, size_t size, size_t raw_size);
+Mesh *tile_store_take(TileStore *self, long int index);
+#endif /* TILE_STORE_H */
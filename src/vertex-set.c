@@ -7,6 +7,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "vertex-set.h"
@@ -14,14 +15,26 @@
 #define position_equals(p1, p2) (((p1)->x == (p2)->x) && ((p1)->y == (p2)->y) && ((p1)->z == (p2)->z))
 #define texcoords_equals(t1, t2) ((t1)->x == (t2)->x) && ((t1)->y == (t2)->y)
 
-static uint32_t indexed_vertex_hashcode(SGVec3d *position, SGVec2f *texcoords);
-static inline bool indexed_vertex_equals(IndexedVertex *self, SGVec3d *position, SGVec2f *texcoords);
+/*Grow the table once it is 70% full*/
+#define VERTEX_SET_MAX_LOAD(nslots) ((nslots) / 10 * 7)
+
+static uint64_t vertex_hashcode(SGVec3f *position, SGVec2f *texcoords);
+static bool vertex_set_rehash(VertexSet *self, size_t nslots);
 
 /**
  * VertexSet: A set of vertices that only stores a given vertex
  * (distinct set of position, texture coordinates, etc.) once.
  *
+ * Vertex attributes are stored flattened, in index order, ready to
+ * be handed over to a VGroup. Lookups go through an open addressing
+ * table whose slots only hold a 64 bits key and the vertex index.
  *
+ * The set works in one of two modes, that must not be mixed:
+ *  - value mode (vertex_set_add_vertex): vertices are compared on
+ *  their properties. Keys are hashes of these properties.
+ *  - index mode (vertex_set_add_indexed): vertices are identified by
+ *  the indices of their position and texture coordinates in the BTG
+ *  lists. Keys are these index pairs, properties are never compared.
  */
 
 /**
@@ -30,7 +43,7 @@ static inline bool indexed_vertex_equals(IndexedVertex *self, SGVec3d *position,
  * Caller must free the VertexSet using vertex_set_free when done.
  *
  * @param size A hint on the amount of vertex the set is going to hold.
- * The VertexSet will be able to store more but less efficiently.
+ * The VertexSet will grow as needed.
  * @return a newly allocated VertexSet or NULL
  * on failure.
  *
@@ -54,7 +67,7 @@ VertexSet *vertex_set_new(size_t size)
  * Caller must dispose the VertexSet using vertex_set_dispose when done.
  *
  * @param size A hint on the amount of vertex the set is going to hold.
- * The VertexSet will be able to store more but less efficiently.
+ * The VertexSet will grow as needed.
  * @return @p self on success or NULL
  * on failure.
  *
@@ -62,34 +75,28 @@ VertexSet *vertex_set_new(size_t size)
  */
 VertexSet *vertex_set_init(VertexSet *self, size_t size)
 {
-    self->size = size;
-    self->vertices = calloc(self->size, sizeof(IndexedVertex));
-    if(!self->vertices)
-        return NULL;
-    for(int i = 0; i < self->size; i++)
-        self->vertices[i].position.x = NAN;
+    size_t nslots;
 
-    return self;
+    if(size < 16)
+        size = 16;
+    for(nslots = 16; VERTEX_SET_MAX_LOAD(nslots) < size; nslots *= 2);
+
+    self->allocated = size;
+    self->positions = malloc(self->allocated * sizeof(SGVec3f));
+    self->texcoords = malloc(self->allocated * sizeof(SGVec2f));
+    if(!self->positions || !self->texcoords)
+        return NULL;
+    return vertex_set_rehash(self, nslots) ? self : NULL;
 }
 
 VertexSet *vertex_set_dispose(VertexSet *self)
 {
-    IndexedVertex *current, *next;
-
-    for(int i = 0; i < self->size; i++){
-        if(isnan(self->vertices[i].position.x)) continue;
-        /* All 'next' IndexedVertex have been allocated,
-         * only self->vertices[x] is part of the array */
-        current = self->vertices[i].next;
-        while(current){
-            next = current->next;
-            free(current);
-            current = next;
-        }
-    }
-    if(self->vertices)
-        free(self->vertices);
-
+    if(self->positions)
+        free(self->positions);
+    if(self->texcoords)
+        free(self->texcoords);
+    if(self->slots)
+        free(self->slots);
     return NULL;
 }
 
@@ -100,149 +107,270 @@ VertexSet *vertex_set_free(VertexSet *self)
     return NULL;
 }
 
+static inline uint64_t vertex_set_mix64(uint64_t k)
+{
+    /*MurmurHash3 finalizer*/
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/*
+ * Moves all slots to a new table of @p nslots slots. Keys are
+ * kept in the slots, vertex properties don't need to be hashed again.
+ */
+static bool vertex_set_rehash(VertexSet *self, size_t nslots)
+{
+    VertexSlot *slots;
+    size_t mask, idx;
+
+    slots = calloc(nslots, sizeof(VertexSlot));
+    if(!slots)
+        return false;
+    mask = nslots - 1;
+    for(size_t i = 0; i < self->nslots; i++){
+        if(!self->slots[i].vertex)
+            continue;
+        for(idx = vertex_set_mix64(self->slots[i].key) & mask; slots[idx].vertex; idx = (idx + 1) & mask);
+        slots[idx] = self->slots[i];
+    }
+    if(self->slots)
+        free(self->slots);
+    self->slots = slots;
+    self->nslots = nslots;
+    return true;
+}
+
+/*
+ * Returns the slot holding the vertex, or the free slot where it
+ * would go. In value mode (@p position set) slots whose key match
+ * are compared on vertex properties, in index mode the key is the
+ * vertex identity.
+ */
+static inline VertexSlot *vertex_set_lookup(VertexSet *self, uint64_t key,
+                                            SGVec3f *position,
+                                            SGVec2f *texcoords)
+{
+    size_t mask = self->nslots - 1;
+    VertexSlot *slot;
+
+    for(size_t idx = vertex_set_mix64(key) & mask; ; idx = (idx + 1) & mask){
+        slot = &self->slots[idx];
+        if(!slot->vertex)
+            return slot;
+        if(slot->key == key
+           && (!position
+               || (position_equals(&self->positions[slot->vertex - 1], position)
+                   && texcoords_equals(&self->texcoords[slot->vertex - 1], texcoords))))
+            return slot;
+    }
+}
+
+/*
+ * Appends a vertex whose key wasn't found. @p slot is the one returned
+ * by vertex_set_lookup for that key.
+ */
+static long vertex_set_insert(VertexSet *self, VertexSlot *slot, uint64_t key,
+                              SGVec3f *position, SGVec2f *texcoords)
+{
+    if(self->nelements + 1 > VERTEX_SET_MAX_LOAD(self->nslots)){
+        if(!vertex_set_rehash(self, self->nslots * 2))
+            return -1;
+        slot = vertex_set_lookup(self, key, position, texcoords);
+    }
+    if(self->nelements == self->allocated){
+        size_t nsize = self->allocated * 2;
+        SGVec3f *p = realloc(self->positions, nsize * sizeof(SGVec3f));
+        if(p)
+            self->positions = p;
+        SGVec2f *t = p ? realloc(self->texcoords, nsize * sizeof(SGVec2f)) : NULL;
+        if(!t)
+            return -1;
+        self->texcoords = t;
+        self->allocated = nsize;
+    }
+
+    self->positions[self->nelements] = *position;
+    self->texcoords[self->nelements] = *texcoords;
+    *slot = (VertexSlot){
+        .key = key,
+        .vertex = ++self->nelements
+    };
+    return self->nelements - 1;
+}
+
 /**
  * @brief Ensures that a vertex with given properties is present in the set.
  *
- * This function will either return an existing vertex with matching properties
- * or a newly added vertex either case the indice can be used. If it fails it will
- * return NULL.
+ * This function will either return the index of an existing vertex with
+ * matching properties or the index of a newly added vertex. Positions are
+ * stored (and compared) in single precision.
  *
  * @param self a VertexSet
  * @param position pointer to a SGVec3d which represents the vertex's position
  * @param texcoords pointer to a SGVec2f which represents the vertex's u/v
  * texture coordinates
- * @return a IndexedVertex on success, NULL on failure (memory).
+ * @return the vertex index on success, -1 on failure (memory).
  */
-IndexedVertex *vertex_set_add_vertex(VertexSet *self,
-                                     SGVec3d *position,
-                                     SGVec2f *texcoords)
+long vertex_set_add_vertex(VertexSet *self,
+                           SGVec3d *position,
+                           SGVec2f *texcoords)
 {
-    IndexedVertex *iv, *prev;
-    size_t idx;
-
-    idx = indexed_vertex_hashcode(position, texcoords);
-    idx = idx % self->size;
-
-    if(!isnan(self->vertices[idx].position.x)){/*There is already something for this idx*/
-        /*Going to the last element. */
-        for(iv = &self->vertices[idx]; iv != NULL; iv = iv->next){
-            if(indexed_vertex_equals(iv, position, texcoords)){
-                return iv;
-            }
-            prev = iv;
-        }
-        /* If we get here, we had at least an existing vertex for that hash
-         * but for a different vertex. We need to chain up
-         * next to it
-         * */
-        prev->next = calloc(1, sizeof(IndexedVertex));
-        if(!prev->next)
-            return NULL;
-        iv = prev->next;
-    }else{/*Slot is free*/
-        iv = &self->vertices[idx];
-    }
-    *iv = (IndexedVertex){
-        .index = self->nelements++,
-        .position = *position,
-        .texcoords = *texcoords
-    };
+    VertexSlot *slot;
+    SGVec3f p;
+    uint64_t key;
 
-    return iv;
+    p = (SGVec3f){position->x, position->y, position->z};
+    key = vertex_hashcode(&p, texcoords);
+    slot = vertex_set_lookup(self, key, &p, texcoords);
+    if(slot->vertex)
+        return slot->vertex - 1;
+    return vertex_set_insert(self, slot, key, &p, texcoords);
 }
 
-IndexedVertex *vertex_set_get_vertex(VertexSet *self,
-                                     SGVec3d *position,
-                                     SGVec2f *texcoords)
+/**
+ * @brief Gives the index of a vertex previously added with
+ * vertex_set_add_vertex.
+ *
+ * @return the vertex index, -1 if not in the set.
+ */
+long vertex_set_get_vertex(VertexSet *self,
+                           SGVec3d *position,
+                           SGVec2f *texcoords)
 {
-    IndexedVertex *iv;
-    size_t idx;
-
-    idx = indexed_vertex_hashcode(position, texcoords);
-    idx = idx % self->size;
-
-    if(!isnan(self->vertices[idx].position.x)){/*There is already something for this idx*/
-        /*Going to the last element. */
-        for(iv = &self->vertices[idx]; iv != NULL; iv = iv->next){
-            if(indexed_vertex_equals(iv, position, texcoords)){
-                return iv;
-            }
-        }
-    }
-    return NULL;
+    VertexSlot *slot;
+    SGVec3f p;
+
+    p = (SGVec3f){position->x, position->y, position->z};
+    slot = vertex_set_lookup(self, vertex_hashcode(&p, texcoords), &p, texcoords);
+    return slot->vertex ? (long)slot->vertex - 1 : -1;
+}
+
+/**
+ * @brief Index mode counterpart of vertex_set_add_vertex: ensures that
+ * the vertex made of the @p position_idx th position and @p texcoords_idx
+ * th texture coordinates is present in the set.
+ *
+ * Only the indices are looked at. Vertex properties are read from
+ * @p positions and @p texcoords when the vertex is seen for the first time.
+ *
+ * @param self a VertexSet
+ * @param position_idx Index of the vertex position in @p positions
+ * @param texcoords_idx Index of the vertex texture coordinates in @p texcoords
+ * @param positions BTG vertex list
+ * @param texcoords BTG texture coordinates list
+ * @return the vertex index on success, -1 on failure (memory).
+ */
+long vertex_set_add_indexed(VertexSet *self,
+                            uint32_t position_idx,
+                            uint32_t texcoords_idx,
+                            const SGVec3d *positions,
+                            const SGVec2f *texcoords)
+{
+    VertexSlot *slot;
+    uint64_t key;
+    SGVec3f p;
+    SGVec2f t;
+
+    key = (uint64_t)position_idx << 32 | texcoords_idx;
+    slot = vertex_set_lookup(self, key, NULL, NULL);
+    if(slot->vertex)
+        return slot->vertex - 1;
+
+    p = (SGVec3f){
+        positions[position_idx].x,
+        positions[position_idx].y,
+        positions[position_idx].z
+    };
+    t = texcoords[texcoords_idx];
+    return vertex_set_insert(self, slot, key, &p, &t);
 }
 
 /**
- * @brief Flatten stored vertex data into arrays while preserving
- * indices.
+ * @brief Hands the flattened vertex attributes over to the caller.
  *
- * Allocates needed memory for each vertex attribute (currently
- * position and texture coordinates). Calling code becomes responsible
- * for freeing the memory by calling free(3) on it.
+ * Arrays are shrunk to fit and the caller becomes responsible for freeing
+ * them by calling free(3). The set is left empty and can't be used anymore
+ * besides being disposed.
  *
  * @param self a VertexSet
  * @param nvertices a place to store the number of vertices in the arrays.
- * @param positions a place to store the adress of the newly allocated array.
- * @param textcoords a place to store the adress of the newly allocated array.
+ * @param positions a place to store the adress of the positions array.
+ * @param textcoords a place to store the adress of the texture coordinates
+ * array.
  * @return true on success, false on failure.
  *
  * @note: If the function fails the caller doesn't need to free
  * any of pointers. Ownership is only transfered on success
  */
-bool vertex_set_flatten(VertexSet *self, indice_t *nvertices,
-                        SGVec3f **positions, SGVec2f **texcoords)
+bool vertex_set_release_arrays(VertexSet *self, indice_t *nvertices,
+                               SGVec3f **positions, SGVec2f **texcoords)
 {
-    IndexedVertex *iv;
+    SGVec3f *p;
+    SGVec2f *t;
 
-    *positions = malloc(sizeof(SGVec3f)*self->nelements);
-    *texcoords = malloc(sizeof(SGVec2f)*self->nelements);
-    if(!*positions || !*texcoords)
-        goto bail;
+    if(!self->positions || !self->texcoords)
+        return false;
+    p = realloc(self->positions, sizeof(SGVec3f) * (self->nelements ? self->nelements : 1));
+    t = realloc(self->texcoords, sizeof(SGVec2f) * (self->nelements ? self->nelements : 1));
+    *positions = p ? p : self->positions;
+    *texcoords = t ? t : self->texcoords;
     *nvertices = self->nelements;
-    for(int i = 0; i < self->size; i++){
-        if(isnan(self->vertices[i].position.x)) continue;
-        for(iv = &self->vertices[i]; iv != NULL; iv = iv->next){
-            (*positions)[iv->index] = (SGVec3f){
-                .x = iv->position.x,
-                .y = iv->position.y,
-                .z = iv->position.z
-            };
-            (*texcoords)[iv->index] = iv->texcoords;
-        }
-    }
-    return true;
 
-bail:
-    if(*positions)
-        free(*positions);
-    if(*texcoords)
-        free(*texcoords);
-    return false;
+    self->positions = NULL;
+    self->texcoords = NULL;
+    self->nelements = self->allocated = 0;
+    return true;
 }
 
-static uint32_t indexed_vertex_hashcode(SGVec3d *position, SGVec2f *texcoords)
+/**
+ * @brief Gives the distance between the slots where vertices
+ * landed and their home slot.
+ *
+ * A vertex found in its home slot has a probe length of 1.
+ *
+ * @param self a VertexSet
+ * @param mean a place to store the mean probe length
+ * @param max a place to store the longest probe length
+ */
+void vertex_set_get_probe_lengths(VertexSet *self, double *mean, size_t *max)
 {
-    int rv = 23; /*any prime will do*/
-
-    /*same for 31*/
-    rv = rv * 31 + position->x;
-    rv = rv * 31 + position->y;
-    rv = rv * 31 + position->z;
+    size_t mask = self->nslots - 1;
+    size_t total = 0;
+    size_t len, home;
 
-    rv = rv * 31 + texcoords->x;
-    rv = rv * 31 + texcoords->y;
-
-    return rv;
+    *max = 0;
+    for(size_t i = 0; i < self->nslots; i++){
+        if(!self->slots[i].vertex)
+            continue;
+        home = vertex_set_mix64(self->slots[i].key) & mask;
+        len = ((i - home) & mask) + 1;
+        total += len;
+        if(len > *max)
+            *max = len;
+    }
+    *mean = self->nelements ? (double)total / self->nelements : 0.0;
 }
 
-static inline bool indexed_vertex_equals(IndexedVertex *self,
-                                         SGVec3d *position,
-                                         SGVec2f *texcoords)
+/*
+ * Hashes the raw bits of the coordinates. -0.0 is folded into 0.0 to
+ * stay consistent with the == comparison done on lookups. The result
+ * is mixed again by vertex_set_lookup, as index mode keys are.
+ */
+static uint64_t vertex_hashcode(SGVec3f *position, SGVec2f *texcoords)
 {
-    if(position_equals(&self->position, position)
-       && texcoords_equals(&self->texcoords, texcoords)){
-        return true;
-    }
+    float f[5] = {
+        position->x + 0.0f, position->y + 0.0f, position->z + 0.0f,
+        texcoords->x + 0.0f, texcoords->y + 0.0f
+    };
+    uint32_t w[5];
+    uint64_t rv;
 
-    return false;
+    memcpy(w, f, sizeof(f));
+    rv = vertex_set_mix64((uint64_t)w[0] << 32 | w[1]);
+    rv = vertex_set_mix64(rv ^ ((uint64_t)w[2] << 32 | w[3]));
+    return rv ^ w[4];
 }
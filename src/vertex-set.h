@@ -15,26 +15,24 @@
 #include "indice.h"
 #include "sg-vec.h"
 
-typedef struct _IndexedVertex{
-    /* 'virtual' index of the vertex presented to outside
-     * as if all vertices where together side by side
-     */
-    indice_t index;
-
-    /*vertex properties*/
-    SGVec3d position;
-    SGVec2f texcoords;
-
-    struct _IndexedVertex *next;
-}IndexedVertex;
-
+/* Hash table slot, the vertex itself is stored in VertexSet arrays*/
 typedef struct{
-    /*too big?*/
-    indice_t size; /*can hold up to size first-level elements*/
-    /* number of elements, not necessarily consecutive*/
-    indice_t nelements;
+    /* Value mode: hash of the vertex properties
+     * Index mode: BTG position index << 32 | BTG texcoords index*/
+    uint64_t key;
+    uint32_t vertex; /*index in VertexSet arrays + 1, 0 for free slots*/
+}VertexSlot;
 
-    IndexedVertex *vertices;
+typedef struct{
+    /* Vertex attributes, flattened in index (first seen) order*/
+    SGVec3f *positions;
+    SGVec2f *texcoords;
+    size_t nelements;
+    size_t allocated;
+
+    /* Open addressing (linear probing) table*/
+    VertexSlot *slots;
+    size_t nslots; /*power of two*/
 }VertexSet;
 
 
@@ -44,14 +42,21 @@ VertexSet *vertex_set_init(VertexSet *self, size_t size);
 VertexSet *vertex_set_dispose(VertexSet *self);
 VertexSet *vertex_set_free(VertexSet *self);
 
-IndexedVertex *vertex_set_add_vertex(VertexSet *self,
-                                     SGVec3d *position,
-                                     SGVec2f *texcoords);
+long vertex_set_add_vertex(VertexSet *self,
+                           SGVec3d *position,
+                           SGVec2f *texcoords);
+long vertex_set_get_vertex(VertexSet *self,
+                           SGVec3d *position,
+                           SGVec2f *texcoords);
+
+long vertex_set_add_indexed(VertexSet *self,
+                            uint32_t position_idx,
+                            uint32_t texcoords_idx,
+                            const SGVec3d *positions,
+                            const SGVec2f *texcoords);
 
-IndexedVertex *vertex_set_get_vertex(VertexSet *self,
-                                     SGVec3d *position,
-                                     SGVec2f *texcoords);
+bool vertex_set_release_arrays(VertexSet *self, indice_t *nvertices,
+                               SGVec3f **positions, SGVec2f **texcoords);
 
-bool vertex_set_flatten(VertexSet *self, indice_t *nvertices,
-                        SGVec3f **positions, SGVec2f **texcoords);
+void vertex_set_get_probe_lengths(VertexSet *self, double *mean, size_t *max);
 #endif /* VERTEX_SET_H */
@@ -237,8 +237,11 @@ int main(int argc, char **argv)
     Uint32 nframes = 0;
 
     Uint32 tframe_acc = 0;
-    Uint32 tframe_start;
+    Uint32 tframe_start, tframe;
     Uint32 ntframes = 0;
+    size_t triangles_acc = 0;
+    size_t draws_acc = 0, tbinds_acc = 0, bbinds_acc = 0;
+    size_t glcalls_acc = 0, glskipped_acc = 0;
 
     startms = SDL_GetTicks();
     while(!done){
@@ -275,7 +278,16 @@ int main(int argc, char **argv)
 
         tframe_start = SDL_GetTicks();
         terrain_viewer_frame(viewer);
-        tframe_acc += (SDL_GetTicks() - tframe_start);
+        tframe = SDL_GetTicks() - tframe_start;
+        tframe_acc += tframe;
+        /*Not the wall time: it would include the wait for vsync in the swap*/
+        range_controller_add_frame(viewer->range_controller, tframe);
+        triangles_acc += viewer->stats.triangles;
+        draws_acc += viewer->stats.draw_calls;
+        tbinds_acc += viewer->stats.texture_binds;
+        bbinds_acc += viewer->stats.buffer_binds;
+        glcalls_acc += viewer->stats.gl_calls;
+        glskipped_acc += viewer->stats.gl_skipped;
         ntframes++;
 
         SDL_GL_SwapWindow(window);
@@ -293,7 +305,7 @@ int main(int argc, char **argv)
             dtms -= 60000 * m;
             s = dtms / 1000;
 
-            printf("%02d:%02d:%02d Current FPS: %05d\r",h,m,s, (1000*nframes)/elapsed);
+            printf("%02d:%02d:%02d Current FPS: %05d, triangles: %07zu\r",h,m,s, (1000*nframes)/elapsed, viewer->stats.triangles);
             fflush(stdout);
             nframes = 0;
             acc = 0;
@@ -301,6 +313,22 @@ int main(int argc, char **argv)
         last_ticks = ticks;
     }
     printf("Average terrain_viewer_frame duration: %f ms (%d calls)\n",(tframe_acc*1.0)/ntframes,ntframes);
+    printf("Average triangles submitted per frame: %f\n",(triangles_acc*1.0)/ntframes);
+    printf("Average per frame: %f draw calls, %f texture binds, %f buffer binds\n",
+        (draws_acc*1.0)/ntframes, (tbinds_acc*1.0)/ntframes, (bbinds_acc*1.0)/ntframes
+    );
+    printf("Average per frame: %f GL calls, %f redundant ones dropped\n",
+        (glcalls_acc*1.0)/ntframes, (glskipped_acc*1.0)/ntframes
+    );
+    TileManagerStats *tstats = &tile_manager_get_instance()->stats;
+    printf("Tile cache: %zu hits, %zu misses, %zu evictions\n",
+        tstats->hits, tstats->misses, tstats->evictions
+    );
+    TileStoreStats *sstats = &tile_manager_get_instance()->store.stats;
+    printf("Tile store: %zu hits, %zu misses, %zu stored, %zu dropped, ratio %.2f\n",
+        sstats->hits, sstats->misses, sstats->stored, sstats->dropped,
+        sstats->packed_bytes ? (sstats->raw_bytes * 1.0) / sstats->packed_bytes : 0.0
+    );
     terrain_viewer_free(viewer);
     texture_store_shutdown();
     fg_tape_free(tape);
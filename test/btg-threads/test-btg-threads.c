@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "btg-io.h"
+
+#define NTHREADS 8
+#define NITERATIONS 6
+
+typedef struct{
+    const char *btg;
+    char *obj; /*Single-threaded OBJ dump, without its date line*/
+    size_t obj_len;
+    uint32_t checksum; /*Single-threaded sg_bin_object_stream result*/
+}Reference;
+
+typedef struct{
+    int id;
+    pthread_t thread;
+    SGBinReader reader;
+    int failures;
+}Worker;
+
+static Reference refs[] = {
+    {.btg = "../btg/2990336.btg"},
+    {.btg = "../btg/3039642.btg.gz"},
+};
+#define NREFS (sizeof(refs)/sizeof(refs[0]))
+
+/* Reads back an OBJ dump, dropping the "# Created <date>" line */
+static char *obj_slurp(const char *filename, size_t *len)
+{
+    FILE *fp;
+    char *rv, *created, *eol;
+    long size;
+
+    fp = fopen(filename, "rb");
+    if(!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    rv = malloc(size + 1);
+    if(rv && fread(rv, 1, size, fp) != size){
+        free(rv);
+        rv = NULL;
+    }
+    fclose(fp);
+    if(!rv)
+        return NULL;
+    rv[size] = '\0';
+
+    created = strstr(rv, "# Created ");
+    if(created && (eol = strchr(created, '\n'))){
+        memmove(created, eol + 1, rv + size - eol);
+        size -= eol + 1 - created;
+    }
+    *len = size;
+    return rv;
+}
+
+static void fnv_update(uint32_t *hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for(size_t i = 0; i < len; i++){
+        *hash ^= p[i];
+        *hash *= 16777619u;
+    }
+}
+
+static void checksum_bounding_sphere(void *data, SGVec3d *center, float radius)
+{
+    fnv_update(data, center, sizeof(SGVec3d));
+    fnv_update(data, &radius, sizeof(float));
+}
+
+static bool checksum_begin_triangles(void *data, const char *material, unsigned int nelements)
+{
+    fnv_update(data, material, strlen(material));
+    return true;
+}
+
+static bool checksum_triangle(void *data, SGVec3d *v1, SGVec2f *t1, SGVec3d *v2, SGVec2f *t2, SGVec3d *v3, SGVec2f *t3)
+{
+    fnv_update(data, v1, sizeof(SGVec3d)); fnv_update(data, t1, sizeof(SGVec2f));
+    fnv_update(data, v2, sizeof(SGVec3d)); fnv_update(data, t2, sizeof(SGVec2f));
+    fnv_update(data, v3, sizeof(SGVec3d)); fnv_update(data, t3, sizeof(SGVec2f));
+    return true;
+}
+
+static SGBinStreamHandlers checksum_handlers = {
+    .bounding_sphere = checksum_bounding_sphere,
+    .begin_triangles = checksum_begin_triangles,
+    .triangle = checksum_triangle
+};
+
+/* Loads @p btg with @p reader, dumps it to @p obj and returns the dump */
+static char *load_and_dump(SGBinReader *reader, const char *btg, const char *obj, size_t *len)
+{
+    SGBinObject *bo;
+    char *rv = NULL;
+
+    bo = sg_bin_object_new();
+    if(sg_bin_object_read(bo, reader, btg) && sg_bin_object_write_obj(bo, obj))
+        rv = obj_slurp(obj, len);
+    sg_bin_object_free(bo);
+    return rv;
+}
+
+static void *worker_run(void *data)
+{
+    Worker *self = (Worker *)data;
+    char obj[64];
+    char *dump;
+    size_t len;
+    uint32_t checksum;
+
+    snprintf(obj, sizeof(obj), "thread-%d.obj", self->id);
+    for(int i = 0; i < NITERATIONS; i++){
+        /*Threads walk the corpus in different orders*/
+        Reference *ref = &refs[(self->id + i) % NREFS];
+
+        dump = load_and_dump(&self->reader, ref->btg, obj, &len);
+        if(!dump || len != ref->obj_len || memcmp(dump, ref->obj, len)){
+            printf("Thread %d: %s OBJ dump differs from the single-threaded one\n", self->id, ref->btg);
+            self->failures++;
+        }
+        free(dump);
+
+        checksum = 2166136261u;
+        if(!sg_bin_reader_stream(&self->reader, ref->btg, &checksum_handlers, &checksum)
+           || checksum != ref->checksum){
+            printf("Thread %d: %s streamed checksum %08x, expected %08x\n",
+                self->id, ref->btg, checksum, ref->checksum);
+            self->failures++;
+        }
+    }
+    return NULL;
+}
+
+/* Parses the test corpus from NTHREADS threads at once, each one with
+ * its own reader, and checks that the results are the same as when
+ * parsed from a single thread.
+ */
+int main(int argc, char *argv[])
+{
+    Worker workers[NTHREADS] = {0};
+    SGBinReader reader;
+    int failures = 0;
+
+    sg_bin_reader_init(&reader);
+    for(int i = 0; i < NREFS; i++){
+        refs[i].obj = load_and_dump(&reader, refs[i].btg, "reference.obj", &refs[i].obj_len);
+        refs[i].checksum = 2166136261u;
+        if(!refs[i].obj
+           || !sg_bin_reader_stream(&reader, refs[i].btg, &checksum_handlers, &refs[i].checksum)){
+            printf("Couldn't read %s\n", refs[i].btg);
+            exit(EXIT_FAILURE);
+        }
+    }
+    sg_bin_reader_dispose(&reader);
+
+    for(int i = 0; i < NTHREADS; i++){
+        workers[i].id = i;
+        sg_bin_reader_init(&workers[i].reader);
+        if(pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0){
+            printf("Couldn't create thread %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for(int i = 0; i < NTHREADS; i++){
+        SGBinReaderStats *stats = &workers[i].reader.stats;
+
+        pthread_join(workers[i].thread, NULL);
+        printf("Thread %d: %zu files, %zu failures, %zu bytes, %zu objects, %zu elements\n",
+            i, stats->files, stats->failures, stats->bytes, stats->objects, stats->elements
+        );
+        if(stats->files != 2 * NITERATIONS)
+            workers[i].failures++;
+        failures += workers[i].failures;
+        sg_bin_reader_dispose(&workers[i].reader);
+    }
+
+    for(int i = 0; i < NREFS; i++)
+        free(refs[i].obj);
+
+    printf("%d failures\n", failures);
+    exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
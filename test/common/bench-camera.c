@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-camera.h"
+
+#define GPS_RECORD_SIZE 28 /*32 bits time, then lat, lon and alt as doubles*/
+
+/* View projection matrix of a camera at @p eye looking along @p fwd,
+ * both unit vectors*/
+void bench_camera_vp(SGVec3d *eye, SGVec3d *fwd, SGVec3d *up, mat4d vp)
+{
+    mat4d proj, view = {{0}};
+    SGVec3d s;
+
+    glm_perspectived(BENCH_FOV_Y, BENCH_ASPECT, BENCH_NEAR_PLANE, BENCH_FAR_PLANE, proj);
+
+    s = (SGVec3d){
+        fwd->y*up->z - fwd->z*up->y,
+        fwd->z*up->x - fwd->x*up->z,
+        fwd->x*up->y - fwd->y*up->x
+    };
+    view[0][0] = s.x;  view[1][0] = s.y;  view[2][0] = s.z;
+    view[0][1] = up->x; view[1][1] = up->y; view[2][1] = up->z;
+    view[0][2] = -fwd->x; view[1][2] = -fwd->y; view[2][2] = -fwd->z;
+    view[3][0] = -(s.x*eye->x + s.y*eye->y + s.z*eye->z);
+    view[3][1] = -(up->x*eye->x + up->y*eye->y + up->z*eye->z);
+    view[3][2] = fwd->x*eye->x + fwd->y*eye->y + fwd->z*eye->z;
+    view[3][3] = 1.0;
+
+    glm_mat4d_mul(proj, view, vp);
+}
+
+/*Positions recorded by the GPS feed, NULL if @p filename can't be read*/
+TracePoint *bench_trace_load(const char *filename, size_t *n)
+{
+    unsigned char record[GPS_RECORD_SIZE];
+    TracePoint *rv, *tmp;
+    size_t allocated;
+    FILE *fp;
+
+    fp = fopen(filename, "rb");
+    if(!fp)
+        return NULL;
+    *n = 0;
+    allocated = 1024;
+    rv = malloc(sizeof(TracePoint) * allocated);
+    while(rv && fread(record, GPS_RECORD_SIZE, 1, fp) == 1){
+        if(*n == allocated){
+            allocated *= 2;
+            tmp = realloc(rv, sizeof(TracePoint) * allocated);
+            if(!tmp){
+                free(rv);
+                rv = NULL;
+                break;
+            }
+            rv = tmp;
+        }
+        memcpy(&rv[*n].lat, record + 4, sizeof(double));
+        memcpy(&rv[*n].lon, record + 12, sizeof(double));
+        memcpy(&rv[*n].alt, record + 20, sizeof(double));
+        (*n)++;
+    }
+    fclose(fp);
+    return rv;
+}
@@ -0,0 +1,25 @@
+#ifndef BENCH_CAMERA_H
+#define BENCH_CAMERA_H
+#include <stddef.h>
+#include <math.h>
+
+#include <cglm/cglm.h>
+
+#include "sg-vec.h"
+
+/*Same as TerrainViewer*/
+#define BENCH_FOV_Y (60.0 * M_PI / 180.0)
+#define BENCH_ASPECT (800.0 / 600.0)
+#define BENCH_NEAR_PLANE 1.0
+#define BENCH_FAR_PLANE 10000.0
+
+/*Recorded positions, as in test/gpsfeed/test.gps*/
+typedef struct{
+    double lat;
+    double lon;
+    double alt;
+}TracePoint;
+
+void bench_camera_vp(SGVec3d *eye, SGVec3d *fwd, SGVec3d *up, mat4d vp);
+TracePoint *bench_trace_load(const char *filename, size_t *n);
+#endif /* BENCH_CAMERA_H */
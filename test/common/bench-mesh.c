@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-mesh.h"
+#include "mesh-optimizer.h"
+
+/*A render-ready Mesh straight from a BTG file, as mesh_new_from_file*/
+Mesh *bench_load_btg(const char *filename)
+{
+    Mesh *rv;
+
+    rv = mesh_new_from_btg(filename);
+    if(!rv)
+        return NULL;
+    mesh_finish(rv);
+    mesh_optimize(rv, mesh_optimizer_get_flags());
+    return rv;
+}
+
+static bool bench_vgroup_equals(VGroup *a, VGroup *b)
+{
+    if(strcmp(a->material, b->material)
+       || a->n_vertices != b->n_vertices
+       || a->n_indices != b->n_indices
+       || memcmp(&a->bs, &b->bs, sizeof(SGSphered))
+       || memcmp(a->positions, b->positions, a->n_vertices * sizeof(SGVec3f))
+       || memcmp(a->texcoords, b->texcoords, a->n_vertices * sizeof(SGVec2f))
+       || memcmp(a->indices, b->indices, a->n_indices * sizeof(indice_t))
+       || a->n_lods != b->n_lods
+       || a->n_lod_indices != b->n_lod_indices
+       || memcmp(a->lod_indices, b->lod_indices, a->n_lod_indices * sizeof(indice_t)))
+        return false;
+    for(size_t l = 0; l < a->n_lods; l++){
+        if(a->lods[l].offset != b->lods[l].offset
+           || a->lods[l].n_indices != b->lods[l].n_indices
+           || a->lods[l].error != b->lods[l].error)
+            return false;
+    }
+    return true;
+}
+
+/*Whether two Mesh chains hold the same render-ready arrays*/
+bool bench_mesh_equals(Mesh *a, Mesh *b)
+{
+    for(; a && b; a = a->next, b = b->next){
+        if(a->n_groups != b->n_groups || a->n_cells != b->n_cells)
+            return false;
+        if(memcmp(a->transformation, b->transformation, sizeof(mat4d)))
+            return false;
+        if(a->n_cells && memcmp(a->cells, b->cells, a->n_cells * sizeof(MeshCell)))
+            return false;
+        for(size_t i = 0; i < a->n_groups; i++){
+            if(!bench_vgroup_equals(&a->groups[i], &b->groups[i]))
+                return false;
+        }
+    }
+    return !a && !b;
+}
@@ -0,0 +1,9 @@
+#ifndef BENCH_MESH_H
+#define BENCH_MESH_H
+#include <stdbool.h>
+
+#include "mesh.h"
+
+Mesh *bench_load_btg(const char *filename);
+bool bench_mesh_equals(Mesh *a, Mesh *b);
+#endif /* BENCH_MESH_H */
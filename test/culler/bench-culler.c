@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "culler.h"
+#include "bench-camera.h"
+
+#define NRUNS 200
+#define SPREAD 20000.0 /*Spheres are spread over a cube this wide (meters)*/
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double frand(double min, double max)
+{
+    return min + (max - min) * (rand() / (double)RAND_MAX);
+}
+
+/*Same as culler_spheres_test without SIMD, for checking*/
+static size_t reference_test(CullerSpheres *self, float planes[6][4], uint32_t *visible)
+{
+    size_t rv = 0;
+
+    for(size_t i = 0; i < self->n; i++){
+        bool in = true;
+        for(int p = 0; p < 6; p++){
+            float d = (self->x[i]*planes[p][0] + self->y[i]*planes[p][1])
+                    + (self->z[i]*planes[p][2] + planes[p][3]);
+            in = in && d >= -self->r[i];
+        }
+        if(in)
+            visible[rv++] = i;
+    }
+    return rv;
+}
+
+/*What mesh_render_buffer does: fat VGroups, world float planes*/
+static size_t vgroup_test(VGroup *groups, size_t n, float planes[6][4])
+{
+    size_t rv = 0;
+
+    for(size_t i = 0; i < n; i++){
+        bool in = true;
+        for(int p = 0; p < 6 && in; p++){
+            float side = groups[i].bs.center.x*planes[p][0]
+                       + groups[i].bs.center.y*planes[p][1]
+                       + groups[i].bs.center.z*planes[p][2] + planes[p][3];
+            in = side >= -groups[i].bs.radius;
+        }
+        rv += in;
+    }
+    return rv;
+}
+
+/* Tests 10k to 100k random spheres spread around a camera close to the
+ * Earth surface with the culler, and compares with a per-VGroup test.
+ */
+int main(int argc, char *argv[])
+{
+    size_t sizes[] = {10000, 30000, 100000};
+    CullerSpheres spheres;
+    VGroup *groups;
+    uint32_t *visible, *expected;
+    SGVec3d eye = {4207000.0, 177000.0, 4778000.0}; /*Somewhere in France*/
+    SGVec3d up, fwd, world = {0};
+    SGSphered bs;
+    float planes[6][4], wplanes[6][4];
+    mat4d vp;
+    double start, t_soa, t_aos;
+    size_t n_visible, n_expected, n_aos;
+    int rv = EXIT_SUCCESS;
+
+#if defined(__AVX__)
+    printf("Culler built with AVX\n");
+#elif defined(__SSE2__)
+    printf("Culler built with SSE2\n");
+#elif defined(__ARM_NEON)
+    printf("Culler built with NEON\n");
+#else
+    printf("Culler built without SIMD\n");
+#endif
+    double l = sqrt(eye.x*eye.x + eye.y*eye.y + eye.z*eye.z);
+    up = (SGVec3d){eye.x/l, eye.y/l, eye.z/l};
+    /*Looking north-ish, along the horizon*/
+    fwd = (SGVec3d){-up.z*up.x, -up.z*up.y, up.x*up.x + up.y*up.y};
+    l = sqrt(fwd.x*fwd.x + fwd.y*fwd.y + fwd.z*fwd.z);
+    fwd = (SGVec3d){fwd.x/l, fwd.y/l, fwd.z/l};
+    bench_camera_vp(&eye, &fwd, &up, vp);
+
+    srand(42);
+    for(int s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+        size_t n = sizes[s];
+
+        memset(&spheres, 0, sizeof(CullerSpheres));
+        groups = calloc(n, sizeof(VGroup));
+        visible = malloc(n * sizeof(uint32_t));
+        expected = malloc(n * sizeof(uint32_t));
+        for(size_t i = 0; i < n; i++){
+            bs.center = (SGVec3d){
+                eye.x + frand(-SPREAD/2, SPREAD/2),
+                eye.y + frand(-SPREAD/2, SPREAD/2),
+                eye.z + frand(-SPREAD/2, SPREAD/2)
+            };
+            bs.radius = frand(50.0, 1000.0);
+            culler_spheres_add(&spheres, &bs, &eye);
+            groups[i].bs = bs;
+        }
+        culler_get_planes(vp, &eye, planes);
+        culler_get_planes(vp, &world, wplanes);
+
+        n_visible = 0;
+        start = now_ms();
+        for(int j = 0; j < NRUNS; j++)
+            n_visible = culler_spheres_test(&spheres, planes, 0, spheres.n, visible);
+        t_soa = (now_ms() - start) / NRUNS;
+
+        n_aos = 0;
+        start = now_ms();
+        for(int j = 0; j < NRUNS; j++)
+            n_aos = vgroup_test(groups, n, wplanes);
+        t_aos = (now_ms() - start) / NRUNS;
+
+        n_expected = reference_test(&spheres, planes, expected);
+        if(n_visible != n_expected || memcmp(visible, expected, n_visible * sizeof(uint32_t))){
+            printf("%zu spheres: SIMD and scalar results differ (%zu vs %zu)\n", n, n_visible, n_expected);
+            rv = EXIT_FAILURE;
+        }
+        printf("%zu spheres, %zu visible: culler %.3f ms (%.2f ns/sphere), "
+            "per VGroup %.3f ms (%zu visible), x%.1f\n",
+            n, n_visible, t_soa, t_soa * 1e6 / n, t_aos, n_aos, t_aos / t_soa
+        );
+
+        culler_spheres_dispose(&spheres);
+        free(groups);
+        free(visible);
+        free(expected);
+    }
+    exit(rv);
+}
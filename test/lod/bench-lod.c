@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+#include "mesh.h"
+#include "mesh-optimizer.h"
+#include "mesh-lod.h"
+#include "culler.h"
+#include "bench-camera.h"
+
+#define HEIGHT 600
+#define PITCH (-10.0 * M_PI / 180.0)
+#define ALTITUDE 300.0 /*Of the first record, above the tile center*/
+#define EARTH_RADIUS 6371000.0
+
+typedef struct{
+    size_t frames;
+    size_t triangles;
+    size_t max_triangles;
+    size_t levels[VGROUP_LOD_LEVELS];
+    float max_error; /*Pixels*/
+}LodCount;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static SGVec3d vadd(SGVec3d a, SGVec3d b, double s)
+{
+    return (SGVec3d){a.x + b.x*s, a.y + b.y*s, a.z + b.z*s};
+}
+
+static SGVec3d vnorm(SGVec3d a)
+{
+    double l = sqrt(a.x*a.x + a.y*a.y + a.z*a.z);
+    return (SGVec3d){a.x/l, a.y/l, a.z/l};
+}
+
+typedef struct{
+    float x, y, z;
+    uint32_t id;
+}SortVertex;
+
+static int sort_vertex_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, 3 * sizeof(float));
+}
+
+static int edge_cmp(const void *a, const void *b)
+{
+    uint64_t ea = *(const uint64_t *)a;
+    uint64_t eb = *(const uint64_t *)b;
+
+    return (ea > eb) - (ea < eb);
+}
+
+/*Indices of @p group at @p level, falling back as vgroup_get_lod_range*/
+static indice_t *get_lod_indices(VGroup *group, int level, size_t *n_indices)
+{
+    if(level > (int)group->n_lods)
+        level = group->n_lods;
+    if(!level){
+        *n_indices = group->n_indices;
+        return group->indices;
+    }
+    *n_indices = group->lods[level - 1].n_indices;
+    return group->lod_indices + group->lods[level - 1].offset;
+}
+
+/* Sorted edges, by vertex position, that aren't shared by exactly two
+ * triangles of the groups at level @p level*/
+static size_t get_borders(VGroup *groups, size_t n_groups, int level, uint64_t **borders)
+{
+    SortVertex *sorted;
+    uint32_t *welded, *base, n;
+    uint64_t *edges;
+    size_t n_vertices, n_indices, count, i, j, rv;
+    indice_t *indices;
+
+    base = malloc(sizeof(uint32_t) * n_groups);
+    n_vertices = n_indices = 0;
+    for(size_t g = 0; g < n_groups; g++){
+        base[g] = n_vertices;
+        n_vertices += groups[g].n_vertices;
+        n_indices += groups[g].n_indices;
+    }
+    sorted = malloc(sizeof(SortVertex) * (n_vertices + 1));
+    welded = malloc(sizeof(uint32_t) * (n_vertices + 1));
+    for(size_t g = 0; g < n_groups; g++){
+        for(size_t v = 0; v < groups[g].n_vertices; v++){
+            sorted[base[g] + v] = (SortVertex){
+                groups[g].positions[v].x, groups[g].positions[v].y,
+                groups[g].positions[v].z, base[g] + v
+            };
+        }
+    }
+    qsort(sorted, n_vertices, sizeof(SortVertex), sort_vertex_cmp);
+    for(i = 0, n = 0; i < n_vertices; i++){
+        if(i > 0 && sort_vertex_cmp(&sorted[i], &sorted[i-1]))
+            n++;
+        welded[sorted[i].id] = n;
+    }
+
+    edges = malloc(sizeof(uint64_t) * (n_indices + 1));
+    count = 0;
+    for(size_t g = 0; g < n_groups; g++){
+        indices = get_lod_indices(&groups[g], level, &n_indices);
+        for(i = 0; i < n_indices; i += 3){
+            uint64_t v[3];
+            for(int k = 0; k < 3; k++)
+                v[k] = welded[base[g] + indices[i + k]];
+            /*Levels drop triangles with two vertices at the same place*/
+            if(v[0] == v[1] || v[1] == v[2] || v[0] == v[2])
+                continue;
+            for(int k = 0; k < 3; k++){
+                uint64_t a = v[k], b = v[(k + 1) % 3];
+                edges[count++] = a < b ? (a << 32) | b : (b << 32) | a;
+            }
+        }
+    }
+    qsort(edges, count, sizeof(uint64_t), edge_cmp);
+    *borders = malloc(sizeof(uint64_t) * (count + 1));
+    rv = 0;
+    for(i = 0; i < count; i = j){
+        for(j = i + 1; j < count && edges[j] == edges[i]; j++)
+            ;
+        if(j - i != 2)
+            (*borders)[rv++] = edges[i];
+    }
+    free(edges);
+    free(welded);
+    free(sorted);
+    free(base);
+    return rv;
+}
+
+/* Cells drawn at different levels must not crack: levels must keep the
+ * borders of the cell, and nothing else may become a border*/
+static bool check_borders(VGroup *groups, size_t n_groups)
+{
+    uint64_t *expected, *got;
+    size_t n_expected, n_got;
+    bool rv = true;
+
+    n_expected = get_borders(groups, n_groups, 0, &expected);
+    for(int l = 1; l < VGROUP_LOD_LEVELS && rv; l++){
+        n_got = get_borders(groups, n_groups, l, &got);
+        rv = n_got == n_expected && !memcmp(got, expected, n_got * sizeof(uint64_t));
+        free(got);
+    }
+    free(expected);
+    return rv;
+}
+
+/* Flies the trace, centered over the tile, and counts the triangles
+ * that get submitted at full resolution and with levels of detail
+ * picked for @p max_error pixels*/
+static void replay(Culler *culler, Mesh *mesh, TracePoint *trace, size_t n_points, float max_error, size_t *full, LodCount *count)
+{
+    SGVec3d up, east, north, horiz, eye, fwd, cam_up;
+    double lat, lon, min_lat, max_lat, min_lon, max_lon, clat, clon, hdg;
+    double de, dn, pe, pn;
+    float pixel_scale, err;
+    VGroup *group;
+    mat4d vp;
+    size_t tris, full_tris, first_index, n_indices;
+    int lod;
+
+    up = vnorm(mesh->bs.center);
+    lon = atan2(up.y, up.x);
+    lat = asin(up.z);
+    east = (SGVec3d){-sin(lon), cos(lon), 0.0};
+    north = (SGVec3d){-sin(lat)*cos(lon), -sin(lat)*sin(lon), cos(lat)};
+
+    min_lat = max_lat = trace[0].lat;
+    min_lon = max_lon = trace[0].lon;
+    for(size_t i = 1; i < n_points; i++){
+        min_lat = fmin(min_lat, trace[i].lat); max_lat = fmax(max_lat, trace[i].lat);
+        min_lon = fmin(min_lon, trace[i].lon); max_lon = fmax(max_lon, trace[i].lon);
+    }
+    clat = (min_lat + max_lat) / 2.0;
+    clon = (min_lon + max_lon) / 2.0;
+
+    pixel_scale = HEIGHT / (2.0 * tan(BENCH_FOV_Y / 2.0));
+    memset(count, 0, sizeof(LodCount));
+    *full = 0;
+    hdg = 0.0;
+    pe = pn = 0.0;
+    for(size_t i = 0; i < n_points; i++){
+        dn = (trace[i].lat - clat) * M_PI / 180.0 * EARTH_RADIUS;
+        de = (trace[i].lon - clon) * M_PI / 180.0 * EARTH_RADIUS * cos(clat * M_PI / 180.0);
+        if(i > 0 && (de != pe || dn != pn))
+            hdg = atan2(de - pe, dn - pn);
+        pe = de;
+        pn = dn;
+
+        eye = vadd(vadd(vadd(mesh->bs.center, east, de), north, dn),
+            up, trace[i].alt - trace[0].alt + ALTITUDE
+        );
+        horiz = vadd(vadd((SGVec3d){0}, north, cos(hdg)), east, sin(hdg));
+        fwd = vadd(vadd((SGVec3d){0}, horiz, cos(PITCH)), up, sin(PITCH));
+        cam_up = vadd(vadd((SGVec3d){0}, up, cos(PITCH)), horiz, -sin(PITCH));
+        bench_camera_vp(&eye, &fwd, &cam_up, vp);
+
+        culler_cull(culler, vp, &eye);
+        if(!culler->n_visible)
+            continue;
+        tris = full_tris = 0;
+        for(size_t j = 0; j < culler->n_visible; j++){
+            group = culler->items[culler->visible[j]].group;
+            lod = vgroup_select_lod(group, culler->distances[j], pixel_scale, max_error);
+            vgroup_get_lod_range(group, lod, &first_index, &n_indices);
+            full_tris += group->n_indices / 3;
+            tris += n_indices / 3;
+            count->levels[lod]++;
+            if(lod > 0 && culler->distances[j] > 0.0f){
+                err = group->lods[lod - 1].error * pixel_scale / culler->distances[j];
+                if(err > count->max_error)
+                    count->max_error = err;
+            }
+        }
+        count->frames++;
+        count->triangles += tris;
+        if(tris > count->max_triangles)
+            count->max_triangles = tris;
+        *full += full_tris;
+    }
+}
+
+/* Builds the levels of detail of each tile given on the command line,
+ * checks that they keep group borders, then flies the GPS trace given
+ * as first argument over each tile (translated so that it stays around
+ * the tile) and reports how many triangles get submitted per frame with
+ * and without levels of detail.
+ */
+int main(int argc, char *argv[])
+{
+    float errors[] = {0.5f, 1.0f, 2.0f};
+    Mesh *mesh;
+    Culler *culler;
+    TracePoint *trace;
+    LodCount count;
+    size_t n_points, total, lod_total, lod_indices, full;
+    size_t levels[VGROUP_LOD_LEVELS];
+    float max_error;
+    double start, elapsed;
+    int rv = EXIT_SUCCESS;
+
+    if(argc < 3){
+        printf("Usage: %s trace.gps tile.btg.gz [tile.btg.gz...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    trace = bench_trace_load(argv[1], &n_points);
+    if(!trace || !n_points){
+        printf("%s: loading failed\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 2; i < argc; i++){
+        mesh = mesh_new_from_btg(argv[i]);
+        if(!mesh || !mesh_finish(mesh)
+           || !mesh_optimize(mesh, MESH_OPTIMIZE_VERTEX_CACHE | MESH_OPTIMIZE_VERTEX_FETCH)){
+            printf("%s: loading failed\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        start = now_ms();
+        if(!mesh_optimize(mesh, MESH_OPTIMIZE_LOD)){
+            printf("%s: building levels of detail failed\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        elapsed = now_ms() - start;
+
+        total = lod_indices = 0;
+        max_error = 0.0f;
+        memset(levels, 0, sizeof(levels));
+        for(size_t j = 0; j < mesh->n_groups; j++){
+            VGroup *group = &mesh->groups[j];
+            total += group->n_indices;
+            lod_indices += group->n_lod_indices;
+            levels[0] += group->n_indices / 3;
+            for(size_t l = 0; l < VGROUP_LOD_LEVELS - 1; l++){
+                /*Groups without a level are drawn with their coarsest one*/
+                lod_total = l < group->n_lods ? group->lods[l].n_indices
+                          : group->n_lods ? group->lods[group->n_lods - 1].n_indices
+                          : group->n_indices;
+                levels[l + 1] += lod_total / 3;
+            }
+            if(group->n_lods && group->lods[group->n_lods - 1].error > max_error)
+                max_error = group->lods[group->n_lods - 1].error;
+        }
+        for(size_t c = 0; c < mesh->n_cells; c++){
+            if(!check_borders(&mesh->groups[mesh->cells[c].first_group], mesh->cells[c].n_groups)){
+                printf("%s: cell %zu: levels of detail moved cell borders\n", argv[i], c);
+                rv = EXIT_FAILURE;
+            }
+        }
+        printf("%s: levels built in %.2f ms, triangles per level:", argv[i], elapsed);
+        for(int l = 0; l < VGROUP_LOD_LEVELS; l++)
+            printf(" %zu", levels[l]);
+        printf(", worst error %.2f m, +%.1f%% indices\n",
+            max_error, 100.0 * lod_indices / total
+        );
+
+        culler = culler_new();
+        if(!culler || !culler_add_mesh(culler, mesh)){
+            printf("Couldn't create culler\n");
+            exit(EXIT_FAILURE);
+        }
+        for(int e = 0; e < sizeof(errors)/sizeof(errors[0]); e++){
+            replay(culler, mesh, trace, n_points, errors[e], &full, &count);
+            if(!count.frames)
+                continue;
+            printf("  %.1f px, %zu frames: %.0f triangles per frame (max %zu), "
+                "full resolution %.0f (%.1f%%), levels",
+                errors[e], count.frames, count.triangles / (double)count.frames,
+                count.max_triangles, full / (double)count.frames,
+                100.0 * count.triangles / full
+            );
+            for(int l = 0; l < VGROUP_LOD_LEVELS; l++)
+                printf(" %zu", count.levels[l]);
+            printf(", worst %.2f px\n", count.max_error);
+        }
+        culler_free(culler);
+        mesh_free(mesh);
+    }
+    free(trace);
+    exit(rv);
+}
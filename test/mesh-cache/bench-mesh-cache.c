@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mesh.h"
+#include "mesh-cache.h"
+#include "bench-mesh.h"
+
+#define NRUNS 10
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Compares the time it takes to get a render-ready Mesh from a BTG
+ * file (parsing, deduplication, flattening) and from its cache file.
+ */
+int main(int argc, char *argv[])
+{
+    Mesh *ref, *mesh;
+    char cache[256];
+    double start, t_btg, t_cache;
+    int rv = EXIT_SUCCESS;
+
+    for(int i = 1; i < argc; i++){
+        snprintf(cache, sizeof(cache), "bench-%d.fgrc", i);
+
+        ref = bench_load_btg(argv[i]);
+        if(!ref || !mesh_cache_save(ref, cache)){
+            printf("%s: couldn't build cache\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+        start = now_ms();
+        for(int j = 0; j < NRUNS; j++)
+            mesh_free(bench_load_btg(argv[i]));
+        t_btg = (now_ms() - start) / NRUNS;
+
+        start = now_ms();
+        for(int j = 0; j < NRUNS; j++)
+            mesh_free(mesh_cache_load(cache));
+        t_cache = (now_ms() - start) / NRUNS;
+
+        mesh = mesh_cache_load(cache);
+        if(!mesh || !bench_mesh_equals(ref, mesh)){
+            printf("%s: cached mesh differs from BTG mesh\n", argv[i]);
+            rv = EXIT_FAILURE;
+        }
+        printf("%s: %zu groups, %zu bytes: btg %.3f ms, cache %.3f ms (x%.1f)\n",
+            argv[i], ref->n_groups, mesh_get_size(ref, true),
+            t_btg, t_cache, t_btg / t_cache
+        );
+        mesh_free(ref);
+        if(mesh)
+            mesh_free(mesh);
+    }
+
+    exit(rv);
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mesh.h"
+
+#define FOV_Y (60.0 * M_PI / 180.0) /*Same as TerrainViewer*/
+#define ASPECT (800.0 / 600.0)
+#define NEAR_PLANE 1.0
+#define FAR_PLANE 10000.0
+#define ALTITUDE 300.0 /*Above the tile center*/
+#define PITCH (-10.0 * M_PI / 180.0)
+#define NHEADINGS 8
+
+typedef struct{
+    SGVec3d n;
+    double d;
+}Plane;
+
+typedef struct{
+    size_t groups;
+    size_t triangles;
+}CullCount;
+
+static SGVec3d vadd(SGVec3d a, SGVec3d b, double s)
+{
+    return (SGVec3d){a.x + b.x*s, a.y + b.y*s, a.z + b.z*s};
+}
+
+static double vdot(SGVec3d a, SGVec3d b)
+{
+    return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+static SGVec3d vnorm(SGVec3d a)
+{
+    double l = sqrt(vdot(a, a));
+    return (SGVec3d){a.x/l, a.y/l, a.z/l};
+}
+
+/*Same test as glm_frustum_cgsphered, in double*/
+static bool visible(Plane frustum[6], SGSphered *bs)
+{
+    for(int i = 0; i < 6; i++){
+        if(vdot(bs->center, frustum[i].n) + frustum[i].d < -bs->radius)
+            return false;
+    }
+    return true;
+}
+
+static void make_plane(Plane *p, SGVec3d n, SGVec3d at)
+{
+    p->n = vnorm(n);
+    p->d = -vdot(p->n, at);
+}
+
+/* Frustum of a camera at @p pos looking at @p fwd with @p up up,
+ * planes normals point inwards*/
+static void make_frustum(Plane frustum[6], SGVec3d pos, SGVec3d fwd, SGVec3d up)
+{
+    SGVec3d right;
+    double v = FOV_Y / 2.0;
+    double h = atan(tan(v) * ASPECT);
+
+    right = (SGVec3d){
+        fwd.y*up.z - fwd.z*up.y,
+        fwd.z*up.x - fwd.x*up.z,
+        fwd.x*up.y - fwd.y*up.x
+    };
+    make_plane(&frustum[0], fwd, vadd(pos, fwd, NEAR_PLANE));
+    make_plane(&frustum[1], vadd((SGVec3d){0}, fwd, -1.0), vadd(pos, fwd, FAR_PLANE));
+    make_plane(&frustum[2], vadd(vadd((SGVec3d){0}, right, cos(h)), fwd, sin(h)), pos);
+    make_plane(&frustum[3], vadd(vadd((SGVec3d){0}, right, -cos(h)), fwd, sin(h)), pos);
+    make_plane(&frustum[4], vadd(vadd((SGVec3d){0}, up, cos(v)), fwd, sin(v)), pos);
+    make_plane(&frustum[5], vadd(vadd((SGVec3d){0}, up, -cos(v)), fwd, sin(v)), pos);
+}
+
+/*What mesh_render_buffer submits: mesh, then cells, then groups*/
+static void cull_cells(Mesh *mesh, Plane frustum[6], CullCount *count)
+{
+    if(!visible(frustum, &mesh->bs))
+        return;
+    for(size_t c = 0; c < mesh->n_cells; c++){
+        MeshCell *cell = &mesh->cells[c];
+        if(!visible(frustum, &cell->bs))
+            continue;
+        for(size_t i = cell->first_group; i < cell->first_group + cell->n_groups; i++){
+            if(!visible(frustum, &mesh->groups[i].bs))
+                continue;
+            count->groups++;
+            count->triangles += mesh->groups[i].n_indices / 3;
+        }
+    }
+}
+
+/* What was submitted when groups spanned the whole tile: one group per
+ * material, bounded by the union of the material groups*/
+static void cull_materials(Mesh *mesh, Plane frustum[6], CullCount *count)
+{
+    SGSphered bs;
+    size_t triangles;
+    bool seen;
+
+    if(!visible(frustum, &mesh->bs))
+        return;
+    for(size_t i = 0; i < mesh->n_groups; i++){
+        seen = false;
+        for(size_t j = 0; j < i && !seen; j++)
+            seen = !strcmp(mesh->groups[i].material, mesh->groups[j].material);
+        if(seen)
+            continue;
+
+        bs.radius = -1.0;
+        triangles = 0;
+        for(size_t j = i; j < mesh->n_groups; j++){
+            if(strcmp(mesh->groups[i].material, mesh->groups[j].material))
+                continue;
+            sg_sphered_expand_by_sphere(&bs, &mesh->groups[j].bs);
+            triangles += mesh->groups[j].n_indices / 3;
+        }
+        if(!visible(frustum, &bs))
+            continue;
+        count->groups++;
+        count->triangles += triangles;
+    }
+}
+
+/* Counts the triangles that would be submitted from cameras placed
+ * over each tile given on the command line, at ALTITUDE meters and
+ * looking slightly down in NHEADINGS directions, with and without the
+ * cell hierarchy.
+ */
+int main(int argc, char *argv[])
+{
+    Mesh *mesh;
+    Plane frustum[6];
+    SGVec3d up, east, north, horiz, pos, fwd, cam_up;
+    CullCount before, after;
+    size_t total;
+    double lat, lon, hdg;
+
+    for(int i = 1; i < argc; i++){
+        mesh = mesh_new_from_btg(argv[i]);
+        if(!mesh || !mesh_finish(mesh)){
+            printf("%s: loading failed\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        total = 0;
+        for(size_t j = 0; j < mesh->n_groups; j++)
+            total += mesh->groups[j].n_indices / 3;
+
+        up = vnorm(mesh->bs.center);
+        lon = atan2(up.y, up.x);
+        lat = asin(up.z);
+        east = (SGVec3d){-sin(lon), cos(lon), 0.0};
+        north = (SGVec3d){-sin(lat)*cos(lon), -sin(lat)*sin(lon), cos(lat)};
+        pos = vadd(mesh->bs.center, up, ALTITUDE);
+
+        memset(&before, 0, sizeof(CullCount));
+        memset(&after, 0, sizeof(CullCount));
+        for(int h = 0; h < NHEADINGS; h++){
+            hdg = h * 2.0 * M_PI / NHEADINGS;
+            horiz = vadd(vadd((SGVec3d){0}, north, cos(hdg)), east, sin(hdg));
+            fwd = vadd(vadd((SGVec3d){0}, horiz, cos(PITCH)), up, sin(PITCH));
+            cam_up = vadd(vadd((SGVec3d){0}, up, cos(PITCH)), horiz, -sin(PITCH));
+            make_frustum(frustum, pos, fwd, cam_up);
+
+            cull_materials(mesh, frustum, &before);
+            cull_cells(mesh, frustum, &after);
+        }
+        printf("%s: %zu triangles, %zu cells, %zu groups. Per frame: "
+            "material groups %zu draws %zu triangles, cells %zu draws %zu triangles (%.1f%%)\n",
+            argv[i], total, mesh->n_cells, mesh->n_groups,
+            before.groups / NHEADINGS, before.triangles / NHEADINGS,
+            after.groups / NHEADINGS, after.triangles / NHEADINGS,
+            100.0 * after.triangles / before.triangles
+        );
+        mesh_free(mesh);
+    }
+    exit(EXIT_SUCCESS);
+}
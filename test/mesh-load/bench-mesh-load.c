@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "mesh.h"
+
+#define NRUNS 10
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for(size_t i = 0; i < len; i++){
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Loads each BTG file given on the command line into a render-ready
+ * Mesh, reporting the best time out of NRUNS loads and the peak RSS of
+ * the process.
+ * The checksum covers the flattened arrays and can be used to check
+ * that different loaders produce the same meshes.
+ */
+int main(int argc, char *argv[])
+{
+    Mesh *mesh;
+    struct rusage usage;
+    double start, elapsed, best;
+    size_t n_vertices, n_indices;
+    uint32_t sum;
+
+    for(int i = 1; i < argc; i++){
+        best = -1.0;
+        for(int j = 0; j < NRUNS; j++){
+            start = now_ms();
+            mesh = mesh_new_from_btg(argv[i]);
+            if(!mesh){
+                printf("%s: loading failed\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            mesh_finish(mesh);
+            elapsed = now_ms() - start;
+            if(best < 0.0 || elapsed < best)
+                best = elapsed;
+            if(j < NRUNS - 1)
+                mesh_free(mesh);
+        }
+
+        n_vertices = n_indices = 0;
+        sum = 2166136261u;
+        for(size_t j = 0; j < mesh->n_groups; j++){
+            VGroup *group = &mesh->groups[j];
+
+            n_vertices += group->n_vertices;
+            n_indices += group->n_indices;
+            sum = fnv1a(sum, group->positions, group->n_vertices * sizeof(SGVec3f));
+            sum = fnv1a(sum, group->texcoords, group->n_vertices * sizeof(SGVec2f));
+            sum = fnv1a(sum, group->indices, group->n_indices * sizeof(indice_t));
+        }
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%s: %zu groups, %zu vertices, %zu indices, checksum %08x: %.3f ms, peak RSS %ld KB\n",
+            argv[i], mesh->n_groups, n_vertices, n_indices, sum,
+            best, usage.ru_maxrss
+        );
+        mesh_free(mesh);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mesh.h"
+#include "mesh-optimizer.h"
+
+#define FIFO_SIZE 16 /*Post-transform cache entries of the modeled GPU*/
+
+typedef struct{
+    float v[3][5];
+}Triangle;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int triangle_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(Triangle));
+}
+
+/* Triangles of @p group by vertex values, rotated to start on their
+ * smallest vertex to keep their winding, and sorted*/
+static Triangle *get_triangles(VGroup *group)
+{
+    Triangle *rv, t;
+    int first;
+
+    rv = malloc(sizeof(Triangle) * (group->n_indices / 3 + 1));
+    for(size_t i = 0; i < group->n_indices / 3; i++){
+        for(int j = 0; j < 3; j++){
+            indice_t idx = group->indices[i*3 + j];
+            memset(t.v[j], 0, sizeof(t.v[j]));
+            t.v[j][0] = group->positions[idx].x;
+            t.v[j][1] = group->positions[idx].y;
+            t.v[j][2] = group->positions[idx].z;
+            t.v[j][3] = group->texcoords[idx].x;
+            t.v[j][4] = group->texcoords[idx].y;
+        }
+        first = 0;
+        for(int j = 1; j < 3; j++){
+            if(memcmp(t.v[j], t.v[first], sizeof(t.v[j])) < 0)
+                first = j;
+        }
+        for(int j = 0; j < 3; j++)
+            memcpy(rv[i].v[j], t.v[(first + j) % 3], sizeof(t.v[j]));
+    }
+    qsort(rv, group->n_indices / 3, sizeof(Triangle), triangle_cmp);
+    return rv;
+}
+
+/* Reorders the groups of each tile given on the command line and
+ * counts vertex shader invocations with a FIFO_SIZE entries FIFO cache
+ * before and after, per group and overall. Also checks that
+ * the groups still have the same triangles.
+ */
+int main(int argc, char *argv[])
+{
+    Mesh *mesh;
+    VGroup *group;
+    VGroupCacheStats before, after;
+    size_t tris, verts, t_before, t_after;
+    Triangle *expected, *got;
+    double start, elapsed;
+    int rv = EXIT_SUCCESS;
+
+    for(int i = 1; i < argc; i++){
+        mesh = mesh_new_from_btg(argv[i]);
+        if(!mesh || !mesh_finish(mesh)){
+            printf("%s: loading failed\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        tris = verts = t_before = t_after = 0;
+        elapsed = 0;
+        for(size_t j = 0; j < mesh->n_groups; j++){
+            group = &mesh->groups[j];
+            expected = get_triangles(group);
+            vgroup_get_cache_stats(group, FIFO_SIZE, &before);
+
+            start = now_ms();
+            if(!vgroup_optimize_vertex_cache(group) || !vgroup_optimize_vertex_fetch(group)){
+                printf("%s: group #%zu: optimization failed\n", argv[i], j);
+                rv = EXIT_FAILURE;
+            }
+            elapsed += now_ms() - start;
+            vgroup_get_cache_stats(group, FIFO_SIZE, &after);
+
+            got = get_triangles(group);
+            if(after.triangles != before.triangles
+               || memcmp(expected, got, sizeof(Triangle) * after.triangles)){
+                printf("%s: group #%zu: triangles differ after optimization\n", argv[i], j);
+                rv = EXIT_FAILURE;
+            }
+            free(expected);
+            free(got);
+
+            printf("  group #%zu %s: %zu triangles, %zu vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+                j, group->material, after.triangles, after.vertices,
+                before.acmr, after.acmr, before.atvr, after.atvr
+            );
+            tris += after.triangles;
+            verts += after.vertices;
+            t_before += before.transforms;
+            t_after += after.transforms;
+        }
+        printf("%s: %zu groups, %zu triangles, %zu vertices, %d entries FIFO. "
+            "Vertex shader invocations %zu -> %zu (%.1f%%), "
+            "ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, optimized in %.1f ms\n",
+            argv[i], mesh->n_groups, tris, verts, FIFO_SIZE,
+            t_before, t_after, 100.0 * t_after / t_before,
+            t_before / (double)tris, t_after / (double)tris,
+            t_before / (double)verts, t_after / (double)verts,
+            elapsed
+        );
+        mesh_free(mesh);
+    }
+    exit(rv);
+}
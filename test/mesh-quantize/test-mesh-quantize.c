@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mesh.h"
+
+#define BTG_FILE "../btg/3039642.btg.gz"
+#define OBJ_FILE "../btg/expected-v7.obj" /*Dump of the same file*/
+#define EPSILON 1e-3 /*Rounding of the dump and float positions*/
+
+typedef struct{
+    double v[3];
+}ObjVertex;
+
+static int obj_vertex_cmp(const void *a, const void *b)
+{
+    double d = ((ObjVertex *)a)->v[0] - ((ObjVertex *)b)->v[0];
+    return d < 0 ? -1 : (d > 0 ? 1 : 0);
+}
+
+/* Reads the "v" (vertices, relative to the gbs) or "vt" lines of
+ * @p filename, sorted along their first component*/
+static ObjVertex *obj_load(const char *filename, const char *tag, size_t *n)
+{
+    ObjVertex *rv, *tmp;
+    size_t allocated;
+    char line[256];
+    double gbs[3] = {0};
+    FILE *fp;
+    int ncomps;
+
+    fp = fopen(filename, "r");
+    if(!fp)
+        return NULL;
+    ncomps = strcmp(tag, "vt") ? 3 : 2;
+    allocated = 1024;
+    rv = malloc(allocated * sizeof(ObjVertex));
+    *n = 0;
+    while(fgets(line, sizeof(line), fp)){
+        if(!strncmp(line, "# gbs ", 6)){
+            sscanf(line + 6, "%lf %lf %lf", &gbs[0], &gbs[1], &gbs[2]);
+            continue;
+        }
+        if(strncmp(line, tag, strlen(tag)) || line[strlen(tag)] != ' ')
+            continue;
+        if(*n == allocated){
+            allocated *= 2;
+            tmp = realloc(rv, allocated * sizeof(ObjVertex));
+            if(!tmp) break;
+            rv = tmp;
+        }
+        memset(&rv[*n], 0, sizeof(ObjVertex));
+        sscanf(line + strlen(tag), "%lf %lf %lf", &rv[*n].v[0], &rv[*n].v[1], &rv[*n].v[2]);
+        if(ncomps == 3){ /*The dump is relative to the gbs, of nodes already relative to it*/
+            for(int i = 0; i < 3; i++)
+                rv[*n].v[i] += gbs[i];
+        }
+        (*n)++;
+    }
+    fclose(fp);
+    qsort(rv, *n, sizeof(ObjVertex), obj_vertex_cmp);
+    return rv;
+}
+
+/*Distance from @p v to the closest of @p vertices*/
+static double obj_closest(ObjVertex *vertices, size_t n, double v[3], double max)
+{
+    size_t lo, hi, mid;
+    double d, rv;
+
+    lo = 0; hi = n;
+    while(lo < hi){
+        mid = (lo + hi) / 2;
+        if(vertices[mid].v[0] < v[0] - max) lo = mid + 1;
+        else hi = mid;
+    }
+    rv = INFINITY;
+    for(size_t i = lo; i < n && vertices[i].v[0] <= v[0] + max; i++){
+        d = 0;
+        for(int j = 0; j < 3; j++)
+            d = fmax(d, fabs(vertices[i].v[j] - v[j]));
+        rv = fmin(rv, d);
+    }
+    return rv;
+}
+
+/* Quantizes a tile and checks that dequantized vertices, as computed by
+ * the vertex shader, are within half a quantization step of both the
+ * float vertices and the vertices of the expected.obj dump.
+ */
+int main(int argc, char *argv[])
+{
+    Mesh *mesh;
+    VGroup *group;
+    MeshBatch *batch;
+    MeshVertex *vertices, *vertex;
+    indice_t *indices;
+    size_t n_vertices, n_indices;
+    ObjVertex *obj_v, *obj_vt;
+    size_t n_obj_v, n_obj_vt;
+    double p[3], t[3], f[3], tol[3];
+    double perr, terr, pmax, tmax, step;
+    int rv = EXIT_SUCCESS;
+
+    mesh = mesh_new_from_btg(BTG_FILE);
+    if(!mesh || !mesh_finish(mesh)){
+        printf("%s: loading failed\n", BTG_FILE);
+        exit(EXIT_FAILURE);
+    }
+    obj_v = obj_load(OBJ_FILE, "v", &n_obj_v);
+    obj_vt = obj_load(OBJ_FILE, "vt", &n_obj_vt);
+    if(!obj_v || !obj_vt || !mesh_pack(mesh, &vertices, &n_vertices, &indices, &n_indices)){
+        printf("Couldn't load %s or pack the mesh\n", OBJ_FILE);
+        exit(EXIT_FAILURE);
+    }
+
+    pmax = tmax = step = 0;
+    vertex = vertices;
+    for(size_t i = 0; i < mesh->n_groups; i++){
+        group = &mesh->groups[i];
+        batch = group->batch;
+        tol[0] = batch->position_scale.x / 2.0 + EPSILON;
+        tol[1] = batch->position_scale.y / 2.0 + EPSILON;
+        tol[2] = batch->position_scale.z / 2.0 + EPSILON;
+        step = fmax(step, fmax(batch->position_scale.x, fmax(batch->position_scale.y, batch->position_scale.z)));
+        for(size_t j = 0; j < group->n_vertices; j++, vertex++){
+            /*What the vertex shader does, in float*/
+            p[0] = (float)(vertex->position[0] * batch->position_scale.x + batch->position_offset.x);
+            p[1] = (float)(vertex->position[1] * batch->position_scale.y + batch->position_offset.y);
+            p[2] = (float)(vertex->position[2] * batch->position_scale.z + batch->position_offset.z);
+            t[0] = (float)(vertex->texcoord[0] * batch->texcoord_scale.x + batch->texcoord_offset.x);
+            t[1] = (float)(vertex->texcoord[1] * batch->texcoord_scale.y + batch->texcoord_offset.y);
+            t[2] = 0.0;
+
+            f[0] = group->positions[j].x;
+            f[1] = group->positions[j].y;
+            f[2] = group->positions[j].z;
+            for(int k = 0; k < 3; k++){
+                if(fabs(p[k] - f[k]) > tol[k]){
+                    printf("Group #%zu vertex %zu: %f off on axis %d\n", i, j, fabs(p[k] - f[k]), k);
+                    rv = EXIT_FAILURE;
+                }
+            }
+            if(fabs(t[0] - group->texcoords[j].x) > batch->texcoord_scale.x / 2.0 + EPSILON
+               || fabs(t[1] - group->texcoords[j].y) > batch->texcoord_scale.y / 2.0 + EPSILON){
+                printf("Group #%zu vertex %zu: texcoord off\n", i, j);
+                rv = EXIT_FAILURE;
+            }
+
+            f[0] = fmax(tol[0], fmax(tol[1], tol[2]));
+            perr = obj_closest(obj_v, n_obj_v, p, f[0]);
+            terr = obj_closest(obj_vt, n_obj_vt, t, 1.0);
+            if(perr > f[0] || terr > fmax(batch->texcoord_scale.x, batch->texcoord_scale.y) / 2.0 + EPSILON){
+                printf("Group #%zu vertex %zu: not in %s (%f, %f)\n", i, j, OBJ_FILE, perr, terr);
+                rv = EXIT_FAILURE;
+            }
+            pmax = fmax(pmax, perr);
+            tmax = fmax(tmax, terr);
+        }
+    }
+    printf("%zu vertices in %zu batches, %zu bytes per vertex (%zu as floats)\n",
+        n_vertices, mesh->n_batches, sizeof(MeshVertex), 5 * sizeof(float)
+    );
+    printf("Max quantization step %.4f m, max error %.4f m, max texcoord error %.6f\n",
+        step, pmax, tmax
+    );
+
+    free(vertices);
+    free(indices);
+    free(obj_v);
+    free(obj_vt);
+    mesh_free(mesh);
+    exit(rv);
+}
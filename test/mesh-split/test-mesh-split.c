@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "mesh.h"
+
+/*Grid cells per side: 301x301 = 90601 vertices, 180000 triangles*/
+#define GRID_SIZE 300
+#define GRID_STEP 1.0 /*Keeps the grid within a single cell*/
+
+static SGVec3d grid_pos(int x, int y)
+{
+    return (SGVec3d){x * GRID_STEP, y * GRID_STEP, sin(x * 0.1) * cos(y * 0.1) * 50.0};
+}
+
+static SGVec2f grid_tex(int x, int y)
+{
+    return (SGVec2f){x / (float)GRID_SIZE, y / (float)GRID_SIZE};
+}
+
+/* Builds a single group mesh with more vertices than what
+ * indice_t can index and checks that mesh_split_groups() cuts it
+ * into groups that can be indexed, without losing any triangle,
+ * that each group bounding sphere encloses its vertices and that
+ * cells cover all groups.
+ */
+int main(int argc, char *argv[])
+{
+    Mesh *mesh;
+    VGroup *group;
+    SGVec3d p[4];
+    SGVec2f t[4];
+    SGVec3d gbs_center = {1000.0, 2000.0, 3000.0};
+    MeshCell *cell;
+    size_t n_indices, n_groups;
+    double d;
+    int rv = EXIT_SUCCESS;
+
+    mesh = mesh_new_empty();
+    mesh->bs.center = gbs_center;
+    if(!mesh_set_size(mesh, 1) || !(group = vgroup_init(&mesh->groups[0], "Grass", GRID_SIZE*GRID_SIZE*2))){
+        printf("Couldn't create mesh\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int y = 0; y < GRID_SIZE; y++){
+        for(int x = 0; x < GRID_SIZE; x++){
+            p[0] = grid_pos(x, y);     t[0] = grid_tex(x, y);
+            p[1] = grid_pos(x+1, y);   t[1] = grid_tex(x+1, y);
+            p[2] = grid_pos(x+1, y+1); t[2] = grid_tex(x+1, y+1);
+            p[3] = grid_pos(x, y+1);   t[3] = grid_tex(x, y+1);
+            vgroup_add_triangle(group, &p[0], &t[0], &p[1], &t[1], &p[2], &t[2]);
+            vgroup_add_triangle(group, &p[0], &t[0], &p[2], &t[2], &p[3], &t[3]);
+        }
+    }
+    printf("Built a group with %zu vertices, %zu indices\n",
+        group->vset->nelements, group->n_indices
+    );
+
+    if(!mesh_split_groups(mesh)){
+        printf("mesh_split_groups failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if(mesh->n_groups < 2){
+        printf("Group hasn't been split\n");
+        rv = EXIT_FAILURE;
+    }
+    if(!mesh_finish(mesh)){
+        printf("Couldn't finish mesh\n");
+        rv = EXIT_FAILURE;
+    }
+
+    n_indices = 0;
+    for(size_t i = 0; i < mesh->n_groups; i++){
+        group = &mesh->groups[i];
+        printf("Group #%zu: %u vertices, %zu indices, radius %0.2f\n",
+            i, group->n_vertices, group->n_indices, group->bs.radius
+        );
+        n_indices += group->n_indices;
+
+        for(size_t j = 0; j < group->n_indices; j++){
+            if(group->indices[j] >= group->n_vertices){
+                printf("Group #%zu: index %zu out of range\n", i, j);
+                rv = EXIT_FAILURE;
+                break;
+            }
+        }
+        for(size_t j = 0; j < group->n_vertices; j++){
+            d = sqrt(
+                pow(group->positions[j].x + gbs_center.x - group->bs.center.x, 2)
+              + pow(group->positions[j].y + gbs_center.y - group->bs.center.y, 2)
+              + pow(group->positions[j].z + gbs_center.z - group->bs.center.z, 2)
+            );
+            if(d > group->bs.radius + 0.01){
+                printf("Group #%zu: vertex %zu outside of the bounding sphere\n", i, j);
+                rv = EXIT_FAILURE;
+                break;
+            }
+        }
+    }
+    n_groups = 0;
+    for(size_t i = 0; i < mesh->n_cells; i++){
+        cell = &mesh->cells[i];
+        printf("Cell #%zu: groups %zu-%zu, radius %0.2f\n",
+            i, cell->first_group, cell->first_group + cell->n_groups - 1, cell->bs.radius
+        );
+        if(cell->first_group != n_groups){
+            printf("Cell #%zu: groups are not contiguous\n", i);
+            rv = EXIT_FAILURE;
+        }
+        n_groups += cell->n_groups;
+        for(size_t j = cell->first_group; j < cell->first_group + cell->n_groups; j++){
+            group = &mesh->groups[j];
+            d = sqrt(
+                pow(group->bs.center.x - cell->bs.center.x, 2)
+              + pow(group->bs.center.y - cell->bs.center.y, 2)
+              + pow(group->bs.center.z - cell->bs.center.z, 2)
+            );
+            if(d + group->bs.radius > cell->bs.radius + 0.01){
+                printf("Cell #%zu: group %zu outside of the bounding sphere\n", i, j);
+                rv = EXIT_FAILURE;
+            }
+        }
+    }
+    if(n_groups != mesh->n_groups){
+        printf("Cells cover %zu groups out of %zu\n", n_groups, mesh->n_groups);
+        rv = EXIT_FAILURE;
+    }
+    if(n_indices != GRID_SIZE * GRID_SIZE * 6){
+        printf("Lost triangles: %zu indices, expected %d\n", n_indices, GRID_SIZE * GRID_SIZE * 6);
+        rv = EXIT_FAILURE;
+    }
+
+    mesh_free(mesh);
+    exit(rv);
+}
@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <time.h>
+#include <math.h>
+
+#include "mesh.h"
+#include "mesh-optimizer.h"
+#include "mesh-lod.h"
+#include "culler.h"
+#include "bench-camera.h"
+
+#define WIDTH 800
+#define HEIGHT 600
+#define PITCH (-5.0 * M_PI / 180.0)
+#define LOD_ERROR 1.0 /*Same as TerrainViewer*/
+#define EARTH_RADIUS 6371000.0
+#define CHECK_STEP 10 /*Frames between two checks against a full rendering*/
+
+typedef struct{
+    size_t frames;
+    size_t cells; /*In the frustum*/
+    size_t horizon_cells;
+    size_t occluded_cells;
+    size_t groups; /*Frustum and horizon*/
+    size_t occluded_groups;
+    size_t triangles; /*Frustum and horizon, with levels of detail*/
+    size_t occluded_triangles;
+    size_t occluder_triangles;
+    double cull_ms; /*Frustum and horizon*/
+    double occlusion_ms; /*Frustum, horizon and occlusion*/
+    double max_occlusion_ms;
+    /*Frames checked against a full rendering*/
+    size_t checked;
+    size_t checked_groups;
+    size_t hidden_groups; /*Not seen at all in the full rendering*/
+    size_t wrongly_culled; /*Seen, but occluded*/
+}OcclusionCount;
+
+/*Full resolution rendering telling which group is seen at each pixel*/
+typedef struct{
+    float depth[WIDTH * HEIGHT];
+    uint32_t ids[WIDTH * HEIGHT];
+}RefBuffer;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static SGVec3d vadd(SGVec3d a, SGVec3d b, double s)
+{
+    return (SGVec3d){a.x + b.x*s, a.y + b.y*s, a.z + b.z*s};
+}
+
+static SGVec3d vnorm(SGVec3d a)
+{
+    double l = sqrt(a.x*a.x + a.y*a.y + a.z*a.z);
+    return (SGVec3d){a.x/l, a.y/l, a.z/l};
+}
+
+static double vdot(SGVec3d a, SGVec3d b)
+{
+    return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+static SGVec3d vcross(SGVec3d a, SGVec3d b)
+{
+    return (SGVec3d){a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x};
+}
+
+/* Height above @p p, along @p up, of the highest terrain triangle
+ * (Möller-Trumbore), false if there is no terrain under @p p*/
+static bool ground_height(Mesh *mesh, SGVec3d *p, SGVec3d *up, double *height)
+{
+    SGVec3d origin, dir, v[3], e1, e2, pv, tv, qv;
+    double det, u, w, t;
+    bool found = false;
+
+    origin = vadd(*p, *up, 10000.0);
+    dir = (SGVec3d){-up->x, -up->y, -up->z};
+    for(size_t g = 0; g < mesh->n_groups; g++){
+        VGroup *group = &mesh->groups[g];
+
+        for(size_t i = 0; i < group->n_indices; i += 3){
+            for(int k = 0; k < 3; k++){
+                SGVec3f *q = &group->positions[group->indices[i + k]];
+                v[k] = (SGVec3d){
+                    q->x + mesh->transformation[3][0],
+                    q->y + mesh->transformation[3][1],
+                    q->z + mesh->transformation[3][2]
+                };
+            }
+            e1 = vadd(v[1], v[0], -1.0);
+            e2 = vadd(v[2], v[0], -1.0);
+            pv = vcross(dir, e2);
+            det = vdot(e1, pv);
+            if(fabs(det) < 1e-12)
+                continue;
+            tv = vadd(origin, v[0], -1.0);
+            u = vdot(tv, pv) / det;
+            if(u < 0.0 || u > 1.0)
+                continue;
+            qv = vcross(tv, e1);
+            w = vdot(dir, qv) / det;
+            if(w < 0.0 || u + w > 1.0)
+                continue;
+            t = vdot(e2, qv) / det;
+            if(!found || 10000.0 - t > *height){
+                *height = 10000.0 - t;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+/*Draws a group at full resolution, tagging its pixels with @p id*/
+static void ref_add_group(RefBuffer *self, mat4d vp, Mesh *mesh, VGroup *group, uint32_t id)
+{
+    mat4d mvp;
+    double sx[3], sy[3], iw[3];
+    double area, b[3], wi, d;
+    int x0, x1, y0, y1;
+    bool skip;
+
+    glm_mat4d_mul(vp, mesh->transformation, mvp);
+    for(size_t i = 0; i < group->n_indices; i += 3){
+        skip = false;
+        for(int k = 0; k < 3; k++){
+            SGVec3f *p = &group->positions[group->indices[i + k]];
+            double x = mvp[0][0]*p->x + mvp[1][0]*p->y + mvp[2][0]*p->z + mvp[3][0];
+            double y = mvp[0][1]*p->x + mvp[1][1]*p->y + mvp[2][1]*p->z + mvp[3][1];
+            double w = mvp[0][3]*p->x + mvp[1][3]*p->y + mvp[2][3]*p->z + mvp[3][3];
+
+            skip = skip || w < BENCH_NEAR_PLANE;
+            iw[k] = 1.0 / w;
+            sx[k] = (x * iw[k] * 0.5 + 0.5) * WIDTH;
+            sy[k] = (y * iw[k] * 0.5 + 0.5) * HEIGHT;
+        }
+        area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+        if(skip || fabs(area) < 1e-9)
+            continue;
+        x0 = fmax(floor(fmin(sx[0], fmin(sx[1], sx[2]))), 0);
+        x1 = fmin(ceil(fmax(sx[0], fmax(sx[1], sx[2]))), WIDTH - 1);
+        y0 = fmax(floor(fmin(sy[0], fmin(sy[1], sy[2]))), 0);
+        y1 = fmin(ceil(fmax(sy[0], fmax(sy[1], sy[2]))), HEIGHT - 1);
+        for(int y = y0; y <= y1; y++){
+            for(int x = x0; x <= x1; x++){
+                double px = x + 0.5, py = y + 0.5;
+                bool in = true;
+
+                for(int k = 0; k < 3 && in; k++){
+                    int m = (k + 1) % 3, n = (k + 2) % 3;
+                    b[k] = ((sx[n] - sx[m]) * (py - sy[m]) - (sy[n] - sy[m]) * (px - sx[m])) / area;
+                    in = b[k] >= 0.0;
+                }
+                if(!in)
+                    continue;
+                wi = b[0]*iw[0] + b[1]*iw[1] + b[2]*iw[2];
+                d = 1.0 / wi;
+                if(d < self->depth[y * WIDTH + x]){
+                    self->depth[y * WIDTH + x] = d;
+                    self->ids[y * WIDTH + x] = id;
+                }
+            }
+        }
+    }
+}
+
+/* Renders the groups @p plain sees and counts those that end up with
+ * no pixel, and those that have pixels but @p occ culled*/
+static void check_frame(RefBuffer *ref, mat4d vp, Culler *plain, Culler *occ, OcclusionCount *count)
+{
+    static bool *seen = NULL, *kept = NULL;
+    static size_t allocated = 0;
+    CullerItem *item;
+
+    if(allocated < plain->group_bounds.n + 1){
+        allocated = plain->group_bounds.n + 1;
+        seen = realloc(seen, allocated * sizeof(bool));
+        kept = realloc(kept, allocated * sizeof(bool));
+    }
+    memset(seen, 0, allocated * sizeof(bool));
+    memset(kept, 0, allocated * sizeof(bool));
+    for(size_t i = 0; i < WIDTH * HEIGHT; i++){
+        ref->depth[i] = FLT_MAX;
+        ref->ids[i] = 0;
+    }
+    for(size_t i = 0; i < plain->n_visible; i++){
+        item = &plain->items[plain->visible[i]];
+        ref_add_group(ref, vp, item->mesh, item->group, plain->visible[i] + 1);
+    }
+    for(size_t i = 0; i < WIDTH * HEIGHT; i++){
+        if(ref->ids[i])
+            seen[ref->ids[i] - 1] = true;
+    }
+    /*Both cullers track the same meshes, in the same order*/
+    for(size_t i = 0; i < occ->n_visible; i++)
+        kept[occ->visible[i]] = true;
+
+    count->checked++;
+    for(size_t i = 0; i < plain->n_visible; i++){
+        uint32_t g = plain->visible[i];
+        count->checked_groups++;
+        if(!seen[g])
+            count->hidden_groups++;
+        else if(!kept[g])
+            count->wrongly_culled++;
+    }
+}
+
+static size_t count_triangles(Culler *culler)
+{
+    size_t rv = 0;
+    size_t first_index, n_indices;
+    VGroup *group;
+    float pixel_scale = HEIGHT / (2.0 * tan(BENCH_FOV_Y / 2.0));
+
+    for(size_t i = 0; i < culler->n_visible; i++){
+        group = culler->items[culler->visible[i]].group;
+        vgroup_get_lod_range(group,
+            vgroup_select_lod(group, culler->distances[i], pixel_scale, LOD_ERROR),
+            &first_index, &n_indices
+        );
+        rv += n_indices / 3;
+    }
+    return rv;
+}
+
+/* Flies the trace, centered over the tile, @p agl meters above the
+ * terrain, culling each frame with and without occlusion culling*/
+static void replay(Culler *plain, Culler *occ, Mesh *mesh, TracePoint *trace, double *ground, size_t n_points, double agl, RefBuffer *ref, OcclusionCount *count)
+{
+    SGVec3d up, east, north, horiz, eye, fwd, cam_up, pos;
+    double lat, lon, min_lat, max_lat, min_lon, max_lon, clat, clon, hdg;
+    double de, dn, pe, pn;
+    double start, elapsed;
+    mat4d vp;
+
+    up = vnorm(mesh->bs.center);
+    lon = atan2(up.y, up.x);
+    lat = asin(up.z);
+    east = (SGVec3d){-sin(lon), cos(lon), 0.0};
+    north = (SGVec3d){-sin(lat)*cos(lon), -sin(lat)*sin(lon), cos(lat)};
+
+    min_lat = max_lat = trace[0].lat;
+    min_lon = max_lon = trace[0].lon;
+    for(size_t i = 1; i < n_points; i++){
+        min_lat = fmin(min_lat, trace[i].lat); max_lat = fmax(max_lat, trace[i].lat);
+        min_lon = fmin(min_lon, trace[i].lon); max_lon = fmax(max_lon, trace[i].lon);
+    }
+    clat = (min_lat + max_lat) / 2.0;
+    clon = (min_lon + max_lon) / 2.0;
+
+    memset(count, 0, sizeof(OcclusionCount));
+    hdg = 0.0;
+    pe = pn = 0.0;
+    for(size_t i = 0; i < n_points; i++){
+        dn = (trace[i].lat - clat) * M_PI / 180.0 * EARTH_RADIUS;
+        de = (trace[i].lon - clon) * M_PI / 180.0 * EARTH_RADIUS * cos(clat * M_PI / 180.0);
+        if(i > 0 && (de != pe || dn != pn))
+            hdg = atan2(de - pe, dn - pn);
+        pe = de;
+        pn = dn;
+        if(isnan(ground[i]))
+            continue;
+
+        pos = vadd(vadd(mesh->bs.center, east, de), north, dn);
+        eye = vadd(pos, up, ground[i] + agl);
+        horiz = vadd(vadd((SGVec3d){0}, north, cos(hdg)), east, sin(hdg));
+        fwd = vadd(vadd((SGVec3d){0}, horiz, cos(PITCH)), up, sin(PITCH));
+        cam_up = vadd(vadd((SGVec3d){0}, up, cos(PITCH)), horiz, -sin(PITCH));
+        bench_camera_vp(&eye, &fwd, &cam_up, vp);
+
+        start = now_ms();
+        culler_cull(plain, vp, &eye);
+        count->cull_ms += now_ms() - start;
+
+        start = now_ms();
+        culler_cull(occ, vp, &eye);
+        elapsed = now_ms() - start;
+        count->occlusion_ms += elapsed;
+        if(elapsed > count->max_occlusion_ms)
+            count->max_occlusion_ms = elapsed;
+
+        count->frames++;
+        count->cells += plain->n_visible_cells + plain->n_horizon_cells;
+        count->horizon_cells += plain->n_horizon_cells;
+        count->occluded_cells += occ->n_occluded_cells;
+        count->groups += plain->n_visible;
+        count->occluded_groups += plain->n_visible - occ->n_visible;
+        count->triangles += count_triangles(plain);
+        count->occluded_triangles += count_triangles(occ);
+        count->occluder_triangles += occ->occlusion->n_triangles;
+
+        if(i % CHECK_STEP == 0)
+            check_frame(ref, vp, plain, occ, count);
+    }
+}
+
+/* Flies the GPS trace given as first argument over each tile given on
+ * the command line (translated so that it stays around the tile), at
+ * several heights above the terrain. Reports what horizon and
+ * occlusion culling remove, what they cost, and checks every few
+ * frames against a full resolution rendering that no group that has
+ * pixels on screen gets culled.
+ */
+int main(int argc, char *argv[])
+{
+    double heights[] = {2.0, 20.0, 100.0, 300.0};
+    Mesh *mesh;
+    Culler *plain, *occ;
+    TracePoint *trace;
+    RefBuffer *ref;
+    OcclusionCount c;
+    SGVec3d up, east, north, pos;
+    double *ground;
+    double lat, lon, min_lat, max_lat, min_lon, max_lon, clat, clon;
+    size_t n_points;
+    int rv = EXIT_SUCCESS;
+
+    if(argc < 3){
+        printf("Usage: %s trace.gps tile.btg.gz [tile.btg.gz...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    trace = bench_trace_load(argv[1], &n_points);
+    if(!trace || !n_points){
+        printf("%s: loading failed\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    ground = malloc(sizeof(double) * n_points);
+    ref = malloc(sizeof(RefBuffer));
+    if(!ground || !ref){
+        printf("Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 2; i < argc; i++){
+        mesh = mesh_new_from_btg(argv[i]);
+        if(!mesh || !mesh_finish(mesh) || !mesh_optimize(mesh, MESH_OPTIMIZE_ALL)){
+            printf("%s: loading failed\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        plain = culler_new();
+        occ = culler_new();
+        if(!plain || !occ || !culler_add_mesh(plain, mesh) || !culler_add_mesh(occ, mesh)
+           || !culler_set_occlusion(occ, true, BENCH_FOV_Y)){
+            printf("Couldn't create cullers\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /*Same placement as replay*/
+        up = vnorm(mesh->bs.center);
+        lon = atan2(up.y, up.x);
+        lat = asin(up.z);
+        east = (SGVec3d){-sin(lon), cos(lon), 0.0};
+        north = (SGVec3d){-sin(lat)*cos(lon), -sin(lat)*sin(lon), cos(lat)};
+        min_lat = max_lat = trace[0].lat;
+        min_lon = max_lon = trace[0].lon;
+        for(size_t j = 1; j < n_points; j++){
+            min_lat = fmin(min_lat, trace[j].lat); max_lat = fmax(max_lat, trace[j].lat);
+            min_lon = fmin(min_lon, trace[j].lon); max_lon = fmax(max_lon, trace[j].lon);
+        }
+        clat = (min_lat + max_lat) / 2.0;
+        clon = (min_lon + max_lon) / 2.0;
+        for(size_t j = 0; j < n_points; j++){
+            pos = vadd(vadd(mesh->bs.center, east,
+                (trace[j].lon - clon) * M_PI / 180.0 * EARTH_RADIUS * cos(clat * M_PI / 180.0)),
+                north, (trace[j].lat - clat) * M_PI / 180.0 * EARTH_RADIUS
+            );
+            if(!ground_height(mesh, &pos, &up, &ground[j]))
+                ground[j] = NAN;
+        }
+
+        printf("%s: %zu cells, %zu groups\n", argv[i], plain->cell_bounds.n, plain->group_bounds.n);
+        for(int h = 0; h < sizeof(heights)/sizeof(heights[0]); h++){
+            replay(plain, occ, mesh, trace, ground, n_points, heights[h], ref, &c);
+            if(!c.frames)
+                continue;
+            printf("  %4.0f m AGL, %zu frames: %.1f cells in frustum, %.1f below horizon, %.1f occluded\n",
+                heights[h], c.frames, c.cells / (double)c.frames,
+                c.horizon_cells / (double)c.frames, c.occluded_cells / (double)c.frames
+            );
+            printf("    groups %.1f -> %.1f (-%.1f%%), triangles %.0f -> %.0f (-%.1f%%), %.0f occluder triangles\n",
+                c.groups / (double)c.frames, (c.groups - c.occluded_groups) / (double)c.frames,
+                100.0 * c.occluded_groups / c.groups,
+                c.triangles / (double)c.frames,
+                c.occluded_triangles / (double)c.frames,
+                100.0 * (c.triangles - c.occluded_triangles) / c.triangles,
+                c.occluder_triangles / (double)c.frames
+            );
+            printf("    culling %.3f ms -> %.3f ms per frame (max %.3f ms)\n",
+                c.cull_ms / c.frames, c.occlusion_ms / c.frames, c.max_occlusion_ms
+            );
+            printf("    %zu frames checked: %.1f%% of groups have no pixel, %zu seen but culled\n",
+                c.checked, 100.0 * c.hidden_groups / c.checked_groups, c.wrongly_culled
+            );
+            if(c.wrongly_culled)
+                rv = EXIT_FAILURE;
+        }
+        culler_free(plain);
+        culler_free(occ);
+        mesh_free(mesh);
+    }
+    free(ground);
+    free(ref);
+    free(trace);
+    exit(rv);
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "bucket.h"
+#include "geo-location.h"
+#include "tile-loader.h"
+#include "tile-area.h"
+#include "tile-manager.h"
+#include "tile-prefetcher.h"
+
+#include "fg-tape.h"
+
+#define FRAME_RATE 25.0 /*Hz, the tape is replayed at that rate*/
+#define VISIBILITY 10000.0 /*RangeController range at 400 m AGL*/
+#define START_POS 120.0 /*s, same as view-gl*/
+#define MAX_DURATION 7200.0 /*s*/
+#define NLOAD_TIMES 3
+/*RAM and GL buffers of a tile, about the average of the scenery around LFLG*/
+#define TILE_SIZE (4 * 1024 * 1024)
+#define MAX_TILES (TILE_MANAGER_BUDGET * 1024 * 1024 / TILE_SIZE)
+#define MAX_SLOTS (MAX_TILES + 256) /*Tiles in range are never evicted*/
+
+typedef struct __attribute__((__packed__))  {
+    double latitude;
+    double longitude;
+    double altitude;
+    float roll;
+    float pitch;
+    float heading;
+}TpBuffer;
+
+typedef struct{
+    GeoLocation location;
+    double heading;
+}TracePoint;
+
+/* Replays the policy of TileManager and the queue of TileLoader, with
+ * loads of a fixed duration instead of threads reading the scenery*/
+typedef struct{
+    SGBucket bucket; /*Coordinates only*/
+    bool loaded;
+    bool loading;
+    bool blocked; /*Already counted as blocking*/
+    bool prefetched; /*Loaded by the prefetcher...*/
+    bool used; /*...and since then needed by a frame*/
+    size_t last_used; /*Frame*/
+}SimSlot;
+
+typedef struct{
+    long int index;
+    float priority;
+    size_t seq; /*Requests of same priority are served in order*/
+    double done_at; /*Negative until picked up by a worker*/
+}SimJob;
+
+typedef struct{
+    SimSlot slots[MAX_SLOTS];
+    size_t nslots;
+    size_t frame;
+
+    SimJob *jobs; /*Pending or being loaded*/
+    size_t njobs;
+    size_t ajobs;
+    size_t seq;
+    double workers[TILE_LOADER_NTHREADS]; /*Time at which each is free*/
+    double load_time;
+    TileList area; /*Buckets in range*/
+
+    /*Results*/
+    size_t loads; /*Requested*/
+    size_t prefetched; /*Requested by the prefetcher*/
+    size_t blocking; /*Loads not done when the tile was first needed*/
+    size_t missing; /*Tiles missing, summed over frames*/
+    size_t missing_frames; /*Frames with at least a tile missing*/
+    size_t unused; /*Prefetched, but evicted before being needed*/
+}Sim;
+
+static SimSlot *sim_find(Sim *self, long int index)
+{
+    for(size_t i = 0; i < self->nslots; i++){
+        if(sg_bucket_gen_index(&self->slots[i].bucket) == index)
+            return &self->slots[i];
+    }
+    return NULL;
+}
+
+static SimJob *sim_find_job(Sim *self, long int index)
+{
+    for(size_t i = 0; i < self->njobs; i++){
+        if(self->jobs[i].index == index)
+            return &self->jobs[i];
+    }
+    return NULL;
+}
+
+static void sim_request(Sim *self, SimSlot *slot, float priority)
+{
+    if(self->njobs == self->ajobs){
+        self->ajobs = self->ajobs ? self->ajobs * 2 : 16;
+        self->jobs = realloc(self->jobs, sizeof(SimJob) * self->ajobs);
+        if(!self->jobs){
+            printf("Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    self->jobs[self->njobs++] = (SimJob){
+        .index = sg_bucket_gen_index(&slot->bucket),
+        .priority = priority,
+        .seq = self->seq++,
+        .done_at = -1.0
+    };
+    slot->loading = true;
+    self->loads++;
+}
+
+static SimSlot *sim_add(Sim *self, SGBucket *bucket)
+{
+    SimSlot *rv;
+
+    if(self->nslots == MAX_SLOTS){
+        printf("Out of slots\n");
+        exit(EXIT_FAILURE);
+    }
+    rv = &self->slots[self->nslots++];
+    memset(rv, 0, sizeof(SimSlot));
+    rv->bucket = *bucket;
+    return rv;
+}
+
+/*Same as tile_manager_trim, all tiles being TILE_SIZE*/
+static void sim_trim(Sim *self)
+{
+    SimSlot *oldest;
+
+    if(self->nslots <= MAX_TILES)
+        return;
+    while(self->nslots > MAX_TILES * TILE_MANAGER_LOW_WATER){
+        oldest = NULL;
+        for(size_t i = 0; i < self->nslots; i++){
+            if(self->slots[i].last_used >= self->frame)
+                continue;
+            if(!oldest || self->slots[i].last_used < oldest->last_used)
+                oldest = &self->slots[i];
+        }
+        if(!oldest)
+            break;
+        if(oldest->prefetched && !oldest->used)
+            self->unused++;
+        *oldest = self->slots[--self->nslots];
+    }
+}
+
+/*tile_manager_collect, and workers picking up pending jobs*/
+static void sim_advance(Sim *self, double now)
+{
+    SimSlot *slot;
+    SimJob *next;
+
+    for(size_t i = 0; i < self->njobs; i++){
+        if(self->jobs[i].done_at < 0.0 || self->jobs[i].done_at > now)
+            continue;
+        /*Meshes of evicted buckets are dropped*/
+        slot = sim_find(self, self->jobs[i].index);
+        if(slot){
+            slot->loaded = true;
+            slot->loading = false;
+        }
+        self->jobs[i--] = self->jobs[--self->njobs];
+    }
+
+    for(int w = 0; w < TILE_LOADER_NTHREADS; w++){
+        if(self->workers[w] > now)
+            continue;
+        next = NULL;
+        for(size_t i = 0; i < self->njobs; i++){
+            if(self->jobs[i].done_at >= 0.0)
+                continue;
+            if(!next || self->jobs[i].priority < next->priority
+               || (self->jobs[i].priority == next->priority && self->jobs[i].seq < next->seq))
+                next = &self->jobs[i];
+        }
+        if(!next)
+            break;
+        next->done_at = now + self->load_time;
+        self->workers[w] = next->done_at;
+    }
+}
+
+/*tile_manager_get_tiles*/
+static void sim_get_tiles(Sim *self, GeoLocation *location)
+{
+    SGBucket center;
+    SimSlot *slot;
+    size_t missing;
+
+    sg_bucket_set(&center, location->longitude, location->latitude);
+    if(!tile_area_around(&center, VISIBILITY, &self->area)){
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    missing = 0;
+    for(size_t i = 0; i < self->area.n; i++){
+        slot = sim_find(self, sg_bucket_gen_index(&self->area.buckets[i]));
+        if(!slot)
+            slot = sim_add(self, &self->area.buckets[i]);
+        slot->last_used = self->frame;
+        slot->used = true;
+        if(!slot->loaded && !slot->loading)
+            sim_request(self, slot, TILE_LOADER_PRIORITY_NOW);
+        if(!slot->loaded){
+            missing++;
+            if(!slot->blocked){
+                slot->blocked = true;
+                self->blocking++;
+            }
+        }
+    }
+    self->missing += missing;
+    if(missing)
+        self->missing_frames++;
+    sim_trim(self);
+}
+
+/*tile_manager_prefetch, with frames instead of ticks*/
+static void sim_prefetch(Sim *self, TilePrefetcher *prefetcher)
+{
+    TilePrefetch prefetch;
+    SimSlot *slot;
+    SimJob *job;
+
+    while(tile_prefetcher_pop(prefetcher, &prefetch)){
+        slot = sim_find(self, sg_bucket_gen_index(&prefetch.bucket));
+        if(slot){
+            slot->last_used = self->frame;
+            job = sim_find_job(self, sg_bucket_gen_index(&slot->bucket));
+            if(job && job->done_at < 0.0 && job->priority > prefetch.eta)
+                job->priority = prefetch.eta;
+        }else{
+            if(self->nslots >= MAX_TILES)
+                break;
+            slot = sim_add(self, &prefetch.bucket);
+            slot->last_used = self->frame;
+        }
+        if(!slot->loaded && !slot->loading){
+            sim_request(self, slot, prefetch.eta);
+            slot->prefetched = true;
+            self->prefetched++;
+        }
+    }
+}
+
+static void sim_run(Sim *self, TracePoint *trace, size_t npoints, double load_time, bool prefetch)
+{
+    TilePrefetcher *prefetcher;
+    double now;
+
+    memset(self, 0, sizeof(Sim));
+    self->load_time = load_time;
+    /*Frame 0 means never used*/
+    self->frame = 1;
+
+    prefetcher = prefetch ? tile_prefetcher_new() : NULL;
+    if(prefetch && !prefetcher){
+        printf("Couldn't create prefetcher\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < npoints; i++, self->frame++){
+        now = i / FRAME_RATE;
+        sim_advance(self, now);
+        sim_get_tiles(self, &trace[i].location);
+        if(prefetcher){
+            tile_prefetcher_add_fix(prefetcher, &trace[i].location, trace[i].heading, now);
+            tile_prefetcher_predict(prefetcher, VISIBILITY);
+            sim_prefetch(self, prefetcher);
+        }
+        sim_advance(self, now);
+    }
+
+    if(prefetcher)
+        tile_prefetcher_free(prefetcher);
+    free(self->jobs);
+    tile_list_dispose(&self->area);
+}
+
+static TracePoint *load_tape(const char *filename, double start, double end, size_t *n)
+{
+    FGTape *tape;
+    FGTapeSignal signals[6];
+    TpBuffer buffer;
+    TracePoint *rv;
+    size_t allocated;
+
+    tape = fg_tape_new_from_file(filename);
+    if(!tape)
+        return NULL;
+    fg_tape_get_signals(tape, signals,
+        "/position[0]/latitude-deg[0]",
+        "/position[0]/longitude-deg[0]",
+        "/position[0]/altitude-ft[0]",
+        "/orientation[0]/roll-deg[0]",
+        "/orientation[0]/pitch-deg[0]",
+        "/orientation[0]/heading-deg[0]",
+        NULL
+    );
+
+    *n = 0;
+    allocated = 1024;
+    rv = malloc(sizeof(TracePoint) * allocated);
+    for(double t = start; rv && t < end; t += 1.0 / FRAME_RATE){
+        if(!fg_tape_get_data_at(tape, t, 6, signals, &buffer))
+            break; /*End of the tape*/
+        if(*n == allocated){
+            allocated *= 2;
+            rv = realloc(rv, sizeof(TracePoint) * allocated);
+            if(!rv)
+                break;
+        }
+        rv[*n].location.latitude = buffer.latitude;
+        rv[*n].location.longitude = fmod(buffer.longitude + 180.0, 360.0) - 180.0;
+        rv[*n].heading = buffer.heading;
+        (*n)++;
+    }
+    fg_tape_free(tape);
+    return rv;
+}
+
+int main(int argc, char *argv[])
+{
+    TracePoint *trace;
+    size_t npoints;
+    Sim off, on;
+    double load_times[NLOAD_TIMES] = {0.5, 2.0, 5.0}; /*s, desktop to Pi*/
+    double start, end;
+
+    if(argc < 2){
+        printf("Usage: %s tape.fgtape [start_s [end_s]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    start = argc > 2 ? atof(argv[2]) : START_POS;
+    end = argc > 3 ? atof(argv[3]) : start + MAX_DURATION;
+
+    trace = load_tape(argv[1], start, end, &npoints);
+    if(!trace || !npoints){
+        printf("Couldn't read %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    printf("Replaying %.0f s of %s at %.0f frames/s, %d MB for tiles (%d tiles), %d loaders\n",
+        npoints / FRAME_RATE, argv[1], FRAME_RATE, TILE_MANAGER_BUDGET, MAX_TILES, TILE_LOADER_NTHREADS
+    );
+
+    printf("%-8s %-9s %8s %8s %8s %9s %14s %14s\n",
+        "load(s)", "prefetch", "loads", "ahead", "unused", "blocking",
+        "missing tiles", "missing frames"
+    );
+    for(int i = 0; i < NLOAD_TIMES; i++){
+        sim_run(&off, trace, npoints, load_times[i], false);
+        sim_run(&on, trace, npoints, load_times[i], true);
+        for(int j = 0; j < 2; j++){
+            Sim *s = j ? &on : &off;
+
+            printf("%-8.1f %-9s %8zu %8zu %8zu %9zu %14zu %14zu\n",
+                load_times[i], j ? "on" : "off",
+                s->loads, s->prefetched, s->unused, s->blocking,
+                s->missing, s->missing_frames
+            );
+        }
+    }
+
+    free(trace);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,216 @@
+#define GL_GLEXT_PROTOTYPES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <SDL2/SDL.h>
+#if USE_GLES
+#include <SDL2/SDL_opengles2.h>
+#else
+#include <SDL2/SDL_opengl.h>
+#endif
+
+#include "mesh.h"
+#include "basic-shader.h"
+#include "culler.h"
+#include "render-queue.h"
+#include "mesh-lod.h"
+#include "texture.h"
+#include "gl-state.h"
+#include "bench-camera.h"
+
+#define WIDTH 800
+#define HEIGHT 600
+#define ALTITUDE 300.0 /*Above the first tile center*/
+#define PITCH (-10.0 * M_PI / 180.0)
+#define NHEADINGS 8
+#define NFRAMES 25 /*Per heading*/
+#define MAX_TILES 8
+#define LOD_ERROR 1.0 /*Pixels, same as TerrainViewer*/
+
+static SGVec3d vadd(SGVec3d a, SGVec3d b, double s)
+{
+    return (SGVec3d){a.x + b.x*s, a.y + b.y*s, a.z + b.z*s};
+}
+
+static SGVec3d vnorm(SGVec3d a)
+{
+    double l = sqrt(a.x*a.x + a.y*a.y + a.z*a.z);
+    return (SGVec3d){a.x/l, a.y/l, a.z/l};
+}
+
+/*What TerrainViewer does each frame*/
+static void render(Culler *culler, RenderQueue *queue, BasicShader *shader, mat4d vp, SGVec3d *eye, MeshRenderStats *stats)
+{
+    CullerItem *item;
+
+    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    culler_cull(culler, vp, eye);
+    render_queue_clear(queue);
+    for(size_t i = 0; i < culler->n_visible; i++){
+        item = &culler->items[culler->visible[i]];
+        render_queue_push(queue, shader, item->mesh, item->group,
+            vgroup_select_lod(item->group, culler->distances[i],
+                HEIGHT / (2.0 * tan(BENCH_FOV_Y / 2.0)), LOD_ERROR
+            )
+        );
+    }
+    render_queue_flush(queue, vp, stats);
+}
+
+/* Renders the tiles given on the command line from a camera placed
+ * ALTITUDE meters over the first one, looking slightly down in
+ * NHEADINGS directions, and reports what has been submitted per frame
+ * along with the frame time.
+ *
+ * Build with -DUSE_TEXTURE_ATLAS=1 (bench-render-atlas) to compare with
+ * a single texture atlas.
+ */
+int main(int argc, char *argv[])
+{
+    SDL_Window *window;
+    SDL_GLContext gl_context;
+    BasicShader *shader;
+    Culler *culler;
+    RenderQueue *queue;
+    Mesh *meshes[MAX_TILES];
+    size_t n_meshes;
+    SGVec3d up, east, north, horiz, eye, fwd, cam_up;
+    MeshRenderStats stats, warmup, upload;
+    GLStateStats gl_stats;
+    mat4d vp[NHEADINGS];
+    double lat, lon, hdg;
+    Uint64 start, elapsed;
+
+    if(argc < 2){
+        printf("Usage: %s tile.btg.gz [tile.btg.gz...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(SDL_Init(SDL_INIT_VIDEO) < 0){
+        printf("SDL_Init error: %s\n",SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+#if USE_GLES
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+#else
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+#endif
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    window = SDL_CreateWindow("bench-render", SDL_WINDOWPOS_CENTERED,
+        SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT,
+        SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL
+    );
+    if(!window || !(gl_context = SDL_GL_CreateContext(window))){
+        printf("Couldn't create GL context: %s\n", SDL_GetError());
+        SDL_Quit();
+        exit(EXIT_FAILURE);
+    }
+    SDL_GL_SetSwapInterval(0);
+    printf("Renderer: %s, %s, %s\n", glGetString(GL_RENDERER),
+        USE_TEXTURE_ATLAS ? "texture atlas" : "one texture per material",
+        gl_state_init() ? "vertex array objects" : "no vertex array objects"
+    );
+
+    shader = basic_shader_new();
+    culler = culler_new();
+    queue = render_queue_new();
+    if(!shader || !culler || !queue){
+        printf("Couldn't create renderer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    n_meshes = 0;
+    for(int i = 1; i < argc && n_meshes < MAX_TILES; i++){
+        meshes[n_meshes] = mesh_new_from_btg(argv[i]);
+        if(!meshes[n_meshes] || !mesh_finish(meshes[n_meshes])){
+            printf("%s: loading failed\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        n_meshes++;
+    }
+    memset(&upload, 0, sizeof(MeshRenderStats));
+    start = SDL_GetPerformanceCounter();
+    for(size_t i = 0; i < n_meshes; i++)
+        mesh_prepare(meshes[i], &upload);
+    glFinish();
+    elapsed = SDL_GetPerformanceCounter() - start;
+    printf("Upload: %zu bytes, %zu GL calls, %.2f ms\n",
+        upload.upload_bytes, upload.upload_calls,
+        elapsed * 1000.0 / SDL_GetPerformanceFrequency()
+    );
+    culler_set_meshes(culler, meshes, n_meshes);
+
+    up = vnorm(meshes[0]->bs.center);
+    lon = atan2(up.y, up.x);
+    lat = asin(up.z);
+    east = (SGVec3d){-sin(lon), cos(lon), 0.0};
+    north = (SGVec3d){-sin(lat)*cos(lon), -sin(lat)*sin(lon), cos(lat)};
+    eye = vadd(meshes[0]->bs.center, up, ALTITUDE);
+    for(int h = 0; h < NHEADINGS; h++){
+        hdg = h * 2.0 * M_PI / NHEADINGS;
+        horiz = vadd(vadd((SGVec3d){0}, north, cos(hdg)), east, sin(hdg));
+        fwd = vadd(vadd((SGVec3d){0}, horiz, cos(PITCH)), up, sin(PITCH));
+        cam_up = vadd(vadd((SGVec3d){0}, up, cos(PITCH)), horiz, -sin(PITCH));
+        bench_camera_vp(&eye, &fwd, &cam_up, vp[h]);
+    }
+
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glClearColor(1.0, 1.0, 1.0, 0.0);
+    glEnable(GL_DEPTH_TEST);
+
+    /*First frames load textures*/
+    memset(&warmup, 0, sizeof(MeshRenderStats));
+    start = SDL_GetPerformanceCounter();
+    for(int h = 0; h < NHEADINGS; h++)
+        render(culler, queue, shader, vp[h], &eye, &warmup);
+    glFinish();
+    elapsed = SDL_GetPerformanceCounter() - start;
+    printf("Warm-up: %.2f ms\n", elapsed * 1000.0 / SDL_GetPerformanceFrequency());
+
+    memset(&stats, 0, sizeof(MeshRenderStats));
+    gl_state_reset_stats();
+    start = SDL_GetPerformanceCounter();
+    for(int h = 0; h < NHEADINGS; h++){
+        for(int f = 0; f < NFRAMES; f++){
+            render(culler, queue, shader, vp[h], &eye, &stats);
+            SDL_GL_SwapWindow(window);
+        }
+    }
+    glFinish();
+    elapsed = SDL_GetPerformanceCounter() - start;
+    gl_state_get_stats(&gl_stats);
+
+    printf("Per frame: %.1f groups, %.1f draw calls, %.1f texture binds, %.1f buffer binds, "
+        "%.1f transforms, %.0f triangles, %.3f ms\n",
+        stats.groups / (double)(NHEADINGS*NFRAMES),
+        stats.draw_calls / (double)(NHEADINGS*NFRAMES),
+        stats.texture_binds / (double)(NHEADINGS*NFRAMES),
+        stats.buffer_binds / (double)(NHEADINGS*NFRAMES),
+        stats.meshes / (double)(NHEADINGS*NFRAMES),
+        stats.triangles / (double)(NHEADINGS*NFRAMES),
+        elapsed * 1000.0 / SDL_GetPerformanceFrequency() / (NHEADINGS*NFRAMES)
+    );
+    printf("Per frame: %.1f GL calls, %.1f redundant ones dropped\n",
+        gl_stats.calls / (double)(NHEADINGS*NFRAMES),
+        gl_stats.skipped / (double)(NHEADINGS*NFRAMES)
+    );
+    if(glGetError() != GL_NO_ERROR)
+        printf("GL error(s) raised\n");
+
+    for(size_t i = 0; i < n_meshes; i++)
+        mesh_free(meshes[i]);
+    render_queue_free(queue);
+    culler_free(culler);
+    basic_shader_free(shader);
+    texture_store_shutdown();
+    SDL_GL_DeleteContext(gl_context);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    exit(EXIT_SUCCESS);
+}
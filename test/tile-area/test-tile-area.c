@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bucket.h"
+#include "geo-location.h"
+#include "tile-area.h"
+
+#define NCIRCLES 300
+#define NSAMPLES 2000
+#define MAX_RANGE 60000.0 /*m*/
+
+static double random_between(double min, double max)
+{
+    return min + (max - min) * (rand() / (double)RAND_MAX);
+}
+
+static bool tile_list_contains(TileList *list, SGBucket *bucket)
+{
+    for(size_t i = 0; i < list->n; i++){
+        if(sg_bucket_equals(&list->buckets[i], bucket))
+            return true;
+    }
+    return false;
+}
+
+/*Closest any point of @p bucket gets to @p location, sampled*/
+static double bucket_distance(SGBucket *bucket, GeoLocation *location)
+{
+    GeoLocation point;
+    double lat, west, width;
+    double rv, d;
+
+    lat = bucket->lat + bucket->y * SG_BUCKET_SPAN;
+    width = sg_bucket_get_width(bucket);
+    west = sg_bucket_get_center_lon(bucket) - width / 2.0;
+    rv = INFINITY;
+    for(int i = 0; i <= 32; i++){
+        for(int j = 0; j <= 32; j++){
+            point.latitude = fmin(lat + SG_BUCKET_SPAN * i / 32.0, 90.0);
+            point.longitude = west + width * j / 32.0;
+            d = geo_location_distance_to(location, &point);
+            rv = fmin(rv, isnan(d) ? 0.0 : d);
+        }
+    }
+    return rv;
+}
+
+/*Every point of the circle is in a listed bucket, and no listed bucket is away from it*/
+static bool check_circle(GeoLocation *center, double radius, TileList *list)
+{
+    GeoLocation point;
+    SGBucket bucket;
+
+    if(!tile_area_circle(center, radius, list))
+        return false;
+
+    for(int i = 0; i < NSAMPLES; i++){
+        geo_location_destination(center, random_between(0.0, 360.0),
+            radius * sqrt(random_between(0.0, 0.999)), &point
+        );
+        sg_bucket_set(&bucket, point.longitude, point.latitude);
+        if(!tile_list_contains(list, &bucket)){
+            printf("Error: circle of %f m around %f,%f misses %f,%f\n",
+                radius, center->latitude, center->longitude,
+                point.latitude, point.longitude
+            );
+            return false;
+        }
+    }
+
+    for(size_t i = 0; i < list->n; i++){
+        /*Sampling is a few hundred meters off at worst*/
+        if(bucket_distance(&list->buckets[i], center) > radius + 500.0){
+            printf("Error: circle of %f m around %f,%f has bucket %s out of it\n",
+                radius, center->latitude, center->longitude,
+                sg_bucket_gen_index_str(&list->buckets[i])
+            );
+            return false;
+        }
+    }
+    return true;
+}
+
+/*The area around a bucket has the circles around all its points*/
+static bool check_around(GeoLocation *location, double range, TileList *around, TileList *circle)
+{
+    GeoLocation point;
+    SGBucket bucket;
+    double lat, west, width;
+
+    sg_bucket_set(&bucket, location->longitude, location->latitude);
+    if(!tile_area_around(&bucket, range, around))
+        return false;
+
+    lat = bucket.lat + bucket.y * SG_BUCKET_SPAN;
+    width = sg_bucket_get_width(&bucket);
+    west = sg_bucket_get_center_lon(&bucket) - width / 2.0;
+    for(int i = 0; i < 20; i++){
+        point.latitude = random_between(lat, lat + SG_BUCKET_SPAN);
+        point.longitude = random_between(west, west + width);
+        if(!tile_area_circle(&point, range, circle))
+            return false;
+        for(size_t j = 0; j < circle->n; j++){
+            if(!tile_list_contains(around, &circle->buckets[j])){
+                printf("Error: area of %f m around bucket %s misses %s\n",
+                    range, sg_bucket_gen_index_str(&bucket),
+                    sg_bucket_gen_index_str(&circle->buckets[j])
+                );
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*Deltas add up to the set, which only changes across buckets*/
+static bool check_updates(void)
+{
+    TileArea *area;
+    GeoLocation location;
+    SGBucket last, bucket;
+    size_t n;
+    bool changed;
+
+    area = tile_area_new();
+    if(!area)
+        return false;
+
+    n = 0;
+    geo_location_set(&location, 45.215487, 5.844851);
+    for(int i = 0; i < 5000; i++){
+        location.latitude += 0.001;
+        location.longitude += 0.002;
+        sg_bucket_set(&bucket, location.longitude, location.latitude);
+        changed = tile_area_update(area, &location, 10000.0);
+        if(i && changed == sg_bucket_equals(&bucket, &last)){
+            printf("Error: set %s at step %d\n", changed ? "changed" : "didn't change", i);
+            return false;
+        }
+        n += area->added.n;
+        n -= area->removed.n;
+        if(n != area->current.n){
+            printf("Error: %zu buckets after deltas, %zu in the set\n", n, area->current.n);
+            return false;
+        }
+        last = bucket;
+    }
+    /*Range changes alone are enough*/
+    if(!tile_area_update(area, &location, 20000.0) || !area->added.n){
+        printf("Error: range change not taken into account\n");
+        return false;
+    }
+    if(!tile_area_update(area, &location, 10000.0) || !area->removed.n){
+        printf("Error: range change not taken into account\n");
+        return false;
+    }
+    tile_area_free(area);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    TileList list = {0};
+    TileList other = {0};
+    GeoLocation center;
+    double radius;
+
+    srand(42);
+    for(int i = 0; i < NCIRCLES; i++){
+        /*Mostly where spans change, some right at the poles*/
+        if(i < NCIRCLES / 3)
+            center.latitude = random_between(50.0, 90.0);
+        else if(i < NCIRCLES - 20)
+            center.latitude = random_between(-90.0, 90.0);
+        else
+            center.latitude = (i % 2 ? 1 : -1) * random_between(89.5, 90.0);
+        center.longitude = random_between(-180.0, 180.0);
+        radius = random_between(100.0, MAX_RANGE);
+
+        if(!check_circle(&center, radius, &list))
+            exit(EXIT_FAILURE);
+        if(i % 10 == 0 && !check_around(&center, radius, &list, &other))
+            exit(EXIT_FAILURE);
+    }
+    printf("%d circles up to %.0f m checked\n", NCIRCLES, MAX_RANGE);
+
+    if(!check_updates())
+        exit(EXIT_FAILURE);
+    printf("Incremental updates checked\n");
+
+    tile_list_dispose(&list);
+    tile_list_dispose(&other);
+    exit(EXIT_SUCCESS);
+}
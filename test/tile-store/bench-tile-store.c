@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bucket.h"
+#include "geo-location.h"
+#include "mesh.h"
+#include "mesh-cache.h"
+#include "tile-area.h"
+#include "tile-store.h"
+#include "bench-mesh.h"
+
+#define NRUNS 10
+
+/*Flight: back and forth along a parallel, NPASSES times*/
+#define LATITUDE 45.2
+#define WEST 5.0
+#define EAST 7.0
+#define STEP 0.005 /*degrees*/
+#define NPASSES 6
+#define RANGE 10000.0 /*m*/
+
+/*Resident tiles (MB), with the size of the stand-in meshes*/
+#define RESIDENT_BUDGET 32
+#define STORE_BUDGET 64
+
+typedef struct{
+    long int index;
+    size_t size;
+    size_t last_used;
+}Resident;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Replays a flight going back and forth over the same tiles. Residents
+ * are evicted to a TileStore as tile_manager_stash and
+ * tile_manager_collect do: tiles still stored are only touched, others
+ * are compressed then added. The viewer compresses on a TileLoader
+ * worker, here it is done inline and timed apart. Tiles coming back in
+ * range are taken from the store when there. Real tiles stand in for
+ * every bucket on the way.
+ *
+ * Reports how often tiles are found in the store and what it takes to
+ * get one back, against a cold load (BTG parsing and optimization).
+ */
+int main(int argc, char *argv[])
+{
+    Mesh **refs;
+    size_t *sizes;
+    double *t_cold;
+    int nrefs;
+    TileStore *store;
+    TileArea *area;
+    GeoLocation location;
+    Resident *residents;
+    size_t nresidents, resident_bytes;
+    size_t clock, hits, promoted, loaded, steps, evicted, touched;
+    double start, t, t_promote, t_compress, t_loads, t_without;
+    uint8_t *data;
+    size_t size, raw_size;
+    long int index;
+    Mesh *mesh;
+    int rv = EXIT_SUCCESS;
+
+    if(argc < 2){
+        printf("Usage: %s file.btg.gz...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    nrefs = argc - 1;
+    refs = calloc(nrefs, sizeof(Mesh*));
+    sizes = calloc(nrefs, sizeof(size_t));
+    t_cold = calloc(nrefs, sizeof(double));
+    for(int i = 0; i < nrefs; i++){
+        refs[i] = bench_load_btg(argv[i + 1]);
+        if(!refs[i]){
+            printf("%s: couldn't load\n", argv[i + 1]);
+            exit(EXIT_FAILURE);
+        }
+        free(mesh_cache_pack(refs[i], &sizes[i]));
+
+        start = now_ms();
+        for(int j = 0; j < NRUNS; j++)
+            mesh_free(bench_load_btg(argv[i + 1]));
+        t_cold[i] = (now_ms() - start) / NRUNS;
+    }
+
+    store = tile_store_new(STORE_BUDGET * 1024 * 1024);
+    area = tile_area_new();
+    residents = NULL;
+    nresidents = resident_bytes = 0;
+    clock = hits = promoted = loaded = steps = evicted = touched = 0;
+    t_promote = t_compress = t_loads = t_without = 0.0;
+
+    geo_location_set(&location, LATITUDE, WEST);
+    for(int pass = 0; pass < NPASSES; pass++){
+        double dir = pass % 2 ? -STEP : STEP;
+        for(location.longitude = pass % 2 ? EAST : WEST;
+            location.longitude >= WEST && location.longitude <= EAST;
+            location.longitude += dir, steps++){
+            clock++;
+            if(!tile_area_update(area, &location, RANGE))
+                goto touch;
+
+            for(size_t i = 0; i < area->added.n; i++){
+                long int index = sg_bucket_gen_index(&area->added.buckets[i]);
+                int ref = index % nrefs;
+                size_t j;
+
+                for(j = 0; j < nresidents && residents[j].index != index; j++)
+                    ;
+                if(j < nresidents){
+                    hits++;
+                    continue;
+                }
+
+                t_without += t_cold[ref];
+                t = now_ms();
+                mesh = tile_store_take(store, index);
+                if(mesh){
+                    t_promote += now_ms() - t;
+                    promoted++;
+                    if(!bench_mesh_equals(refs[ref], mesh)){
+                        printf("Tile %ld differs once taken back from the store\n", index);
+                        rv = EXIT_FAILURE;
+                    }
+                    mesh_free(mesh);
+                }else{
+                    t_loads += t_cold[ref];
+                    loaded++;
+                }
+                residents = realloc(residents, sizeof(Resident) * (nresidents + 1));
+                residents[nresidents++] = (Resident){index, sizes[ref], clock};
+                resident_bytes += sizes[ref];
+            }
+touch:
+            /*In range: not evictable*/
+            for(size_t i = 0; i < area->current.n; i++){
+                long int index = sg_bucket_gen_index(&area->current.buckets[i]);
+                for(size_t j = 0; j < nresidents; j++){
+                    if(residents[j].index == index)
+                        residents[j].last_used = clock;
+                }
+            }
+            while(resident_bytes > RESIDENT_BUDGET * 1024 * 1024){
+                size_t lru = nresidents;
+                for(size_t j = 0; j < nresidents; j++){
+                    if(residents[j].last_used < clock
+                       && (lru == nresidents || residents[j].last_used < residents[lru].last_used))
+                        lru = j;
+                }
+                if(lru == nresidents)
+                    break;
+                evicted++;
+                index = residents[lru].index;
+                if(tile_store_touch(store, index)){
+                    touched++;
+                }else{
+                    t = now_ms();
+                    data = tile_store_compress(refs[index % nrefs], &size, &raw_size);
+                    t_compress += now_ms() - t;
+                    if(data)
+                        tile_store_add(store, index, data, size, raw_size);
+                }
+                resident_bytes -= residents[lru].size;
+                residents[lru] = residents[--nresidents];
+            }
+        }
+    }
+
+    double cold = 0.0;
+    for(int i = 0; i < nrefs; i++){
+        printf("%s: %zu bytes, cold load %.3f ms\n", argv[i + 1], sizes[i], t_cold[i]);
+        cold += t_cold[i] / nrefs;
+    }
+    printf("%zu steps, %d passes: %zu resident hits, %zu taken from the store, %zu loaded\n",
+        steps, NPASSES, hits, promoted, loaded
+    );
+    printf("Store: %.1f%% hit rate, %zu stored, %zu dropped, ratio %.2f, %zu/%zu KB used\n",
+        100.0 * promoted / (promoted + loaded),
+        store->stats.stored, store->stats.dropped,
+        (store->stats.raw_bytes * 1.0) / store->stats.packed_bytes,
+        store->used / 1024, store->budget / 1024
+    );
+    printf("Re-promotion %.3f ms vs cold load %.3f ms (x%.1f)\n",
+        promoted ? t_promote / promoted : 0.0, cold,
+        promoted ? cold / (t_promote / promoted) : 0.0
+    );
+    printf("%zu evictions: %zu already stored, %zu compressed, %.3f ms each (loader worker)\n",
+        evicted, touched, evicted - touched,
+        evicted > touched ? t_compress / (evicted - touched) : 0.0
+    );
+    printf("Getting tiles: %.1f ms with the store, %.1f ms without\n",
+        t_promote + t_loads, t_without
+    );
+
+    free(residents);
+    tile_area_free(area);
+    tile_store_free(store);
+    for(int i = 0; i < nrefs; i++)
+        mesh_free(refs[i]);
+    free(refs);
+    free(sizes);
+    free(t_cold);
+    exit(rv);
+}
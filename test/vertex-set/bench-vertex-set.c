@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btg-io.h"
+#include "vertex-set.h"
+
+#define NRUNS 10
+
+/* Triangle corners of a VGroup-to-be, grouped the same way
+ * mesh_new_from_btg does: consecutive objects with the same
+ * material go into the same group.
+ */
+typedef struct{
+    char *material;
+    size_t n_triangles; /*hint given by the first object, as vgroup_init gets*/
+    SGVec3d *positions;
+    SGVec2f *texcoords;
+    uint32_t *keys; /*position index, texcoords index pairs*/
+    size_t n_corners;
+    size_t allocated;
+}Group;
+
+typedef struct{
+    Group *groups;
+    size_t n_groups;
+    const char *material; /*of the object being read*/
+    unsigned int nelements;
+    bool new_group;
+    const SGVec3d *nodes;
+    const SGVec2f *tcs;
+}Collector;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void collect_bounding_sphere(void *data, SGVec3d *center, float radius)
+{
+}
+
+static bool collect_begin_triangles(void *data, const char *material, unsigned int nelements)
+{
+    Collector *self = (Collector *)data;
+
+    self->new_group = !self->n_groups || strcmp(self->groups[self->n_groups-1].material, material);
+    self->material = material;
+    self->nelements = nelements;
+    return true;
+}
+
+static bool collect_triangle(void *data, const SGVec3d *nodes, const SGVec2f *texcoords,
+                             const uint32_t v[3], const uint32_t t[3])
+{
+    Collector *self = (Collector *)data;
+    Group *group;
+
+    if(self->new_group){
+        Group *tmp = realloc(self->groups, sizeof(Group) * (self->n_groups + 1));
+        if(!tmp)
+            return false;
+        self->groups = tmp;
+        self->groups[self->n_groups++] = (Group){
+            .material = strdup(self->material),
+            .n_triangles = self->nelements
+        };
+        self->new_group = false;
+    }
+    group = &self->groups[self->n_groups-1];
+    if(group->n_corners + 3 > group->allocated){
+        size_t nsize = group->allocated ? group->allocated * 2 : 3 * 1024;
+        SGVec3d *p = realloc(group->positions, sizeof(SGVec3d) * nsize);
+        SGVec2f *t = p ? realloc(group->texcoords, sizeof(SGVec2f) * nsize) : NULL;
+        uint32_t *k = t ? realloc(group->keys, sizeof(uint32_t) * 2 * nsize) : NULL;
+        if(p) group->positions = p;
+        if(t) group->texcoords = t;
+        if(k) group->keys = k;
+        if(!p || !t || !k)
+            return false;
+        group->allocated = nsize;
+    }
+    for(int i = 0; i < 3; i++){
+        group->positions[group->n_corners] = nodes[v[i]];
+        group->texcoords[group->n_corners] = texcoords[t[i]];
+        group->keys[group->n_corners * 2] = v[i];
+        group->keys[group->n_corners * 2 + 1] = t[i];
+        group->n_corners++;
+    }
+    /*Keep the BTG lists around for index mode*/
+    self->nodes = nodes;
+    self->tcs = texcoords;
+    return true;
+}
+
+/* Builds the VertexSet in value mode (vertex properties are compared)
+ * or in index mode (BTG index pairs are compared)*/
+static VertexSet *group_build(Group *self, bool indexed, const SGVec3d *nodes, const SGVec2f *tcs)
+{
+    VertexSet *rv;
+    long idx;
+
+    rv = vertex_set_new(self->n_triangles);
+    for(size_t i = 0; rv && i < self->n_corners; i++){
+        if(indexed)
+            idx = vertex_set_add_indexed(rv, self->keys[i*2], self->keys[i*2+1], nodes, tcs);
+        else
+            idx = vertex_set_add_vertex(rv, &self->positions[i], &self->texcoords[i]);
+        if(idx < 0)
+            rv = vertex_set_free(rv);
+    }
+    return rv;
+}
+
+/* Best of NRUNS builds. Returns the last VertexSet for inspection*/
+static VertexSet *group_time(Group *self, bool indexed, const SGVec3d *nodes, const SGVec2f *tcs, double *best)
+{
+    VertexSet *rv = NULL;
+    double start;
+
+    *best = -1.0;
+    for(int k = 0; k < NRUNS; k++){
+        if(rv)
+            vertex_set_free(rv);
+        start = now_ms();
+        rv = group_build(self, indexed, nodes, tcs);
+        start = now_ms() - start;
+        if(!rv)
+            return NULL;
+        if(*best < 0 || start < *best)
+            *best = start;
+    }
+    return rv;
+}
+
+/* Times the deduplication of each group of the tiles given on the command
+ * line, comparing vertices either on their values or on their BTG indices,
+ * and reports how well vertices spread over the hash table.
+ */
+int main(int argc, char *argv[])
+{
+    SGBinStreamHandlers handlers = {
+        .bounding_sphere = collect_bounding_sphere,
+        .begin_triangles = collect_begin_triangles,
+        .indexed_triangle = collect_triangle
+    };
+
+    for(int i = 1; i < argc; i++){
+        Collector collector = {0};
+        SGBinReader reader;
+        double total[2] = {0.0, 0.0};
+
+        /*nodes and texcoords live in the reader scratch buffers:
+         * keep it around until the groups are done*/
+        sg_bin_reader_init(&reader);
+        if(!sg_bin_reader_stream(&reader, argv[i], &handlers, &collector)){
+            printf("%s: couldn't read file\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        printf("%s:\n", argv[i]);
+        printf("%-18s %7s | %8s %6s %9s %6s %5s | %8s %6s %9s %6s %5s\n",
+            "", "", "values", "", "", "", "", "indices", "", "", "", ""
+        );
+        printf("%-18s %7s | %8s %6s %9s %6s %5s | %8s %6s %9s %6s %5s\n",
+            "material", "corners",
+            "vertices", "slots", "build(ms)", "probe", "max",
+            "vertices", "slots", "build(ms)", "probe", "max"
+        );
+        for(size_t j = 0; j < collector.n_groups; j++){
+            Group *group = &collector.groups[j];
+
+            printf("%-18s %7zu", group->material, group->n_corners);
+            for(int mode = 0; mode < 2; mode++){
+                VertexSet *vset;
+                double best, mean;
+                size_t max;
+
+                vset = group_time(group, mode, collector.nodes, collector.tcs, &best);
+                if(!vset){
+                    printf("%s: couldn't build VertexSet\n", group->material);
+                    exit(EXIT_FAILURE);
+                }
+                total[mode] += best;
+                vertex_set_get_probe_lengths(vset, &mean, &max);
+                printf(" | %8zu %6zu %9.3f %6.2f %5zu",
+                    vset->nelements, vset->nslots, best, mean, max
+                );
+                vertex_set_free(vset);
+            }
+            printf("\n");
+            free(group->material);
+            free(group->positions);
+            free(group->texcoords);
+            free(group->keys);
+        }
+        printf("%zu groups, values %.3f ms, indices %.3f ms\n\n",
+            collector.n_groups, total[0], total[1]
+        );
+        free(collector.groups);
+        sg_bin_reader_dispose(&reader);
+    }
+    exit(EXIT_SUCCESS);
+}